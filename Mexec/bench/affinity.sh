@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# Stage placement benchmark. Prints CSV on stdout.
+#
+# A pipeline of
+#     head -c SIZE /dev/zero | cat | ... | cat | wc -c
+# with DEPTH stages is run by mexec with:
+#     none        no placement, the scheduler decides
+#     auto-pin    --auto-pin, neighbouring stages on neighbouring CPUs
+#     scattered   @cpu annotations putting neighbouring stages half the
+#                 machine apart, usually on another cache or socket
+#     one-cpu     every stage on CPU 0
+# On a machine with one CPU all modes but none place the same.
+#
+# Environment:
+#     BENCH_DEPTHS    stage counts (default "4 8 16")
+#     BENCH_SIZES     bytes through the pipeline, K/M/G suffixes (default "1G")
+#     BENCH_REPS      runs of each case (default 3)
+
+MEXEC=${MEXEC:-./mexec}
+MEASURE=${MEASURE:-bench/measure}
+DEPTHS=${BENCH_DEPTHS:-4 8 16}
+SIZES=${BENCH_SIZES:-1G}
+REPS=${BENCH_REPS:-3}
+CPUS=$(nproc)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Writes a spec of DEPTH stages to stdout. Stage i gets "@cpu $(place i)"
+# unless place is empty.
+spec() {
+    local size=$1 depth=$2 place=$3 prefix=""
+    for ((i = 0; i < depth; i++)); do
+        [ -n "$place" ] && prefix="@cpu $($place $i) "
+        if ((i == 0)); then
+            echo "${prefix}head -c $size /dev/zero"
+        elif ((i == depth - 1)); then
+            echo "${prefix}wc -c"
+        else
+            echo "${prefix}cat"
+        fi
+    done
+}
+
+scattered() {
+    echo $(( ($1 * (CPUS / 2 > 0 ? CPUS / 2 : 1) + $1 / 2) % CPUS ))
+}
+
+one_cpu() {
+    echo 0
+}
+
+echo "mode,depth,size,bytes,rep,status,wall_s,parent_user_s,parent_sys_s,children_user_s,children_sys_s,mb_per_s"
+for size in $SIZES; do
+    n=$(numfmt --from=iec "$size")
+    for depth in $DEPTHS; do
+        spec "$n" "$depth" "" > "$TMP/plain.txt"
+        spec "$n" "$depth" scattered > "$TMP/scattered.txt"
+        spec "$n" "$depth" one_cpu > "$TMP/one-cpu.txt"
+        for ((rep = 1; rep <= REPS; rep++)); do
+            for mode in none auto-pin scattered one-cpu; do
+                case $mode in
+                    none)       row=$("$MEASURE" "$MEXEC" "$TMP/plain.txt" 2>/dev/null) ;;
+                    auto-pin)   row=$("$MEASURE" "$MEXEC" --auto-pin "$TMP/plain.txt" 2>/dev/null) ;;
+                    *)          row=$("$MEASURE" "$MEXEC" "$TMP/$mode.txt" 2>/dev/null) ;;
+                esac
+                wall=$(cut -d, -f2 <<< "$row")
+                rate=$(awk -v n="$n" -v t="$wall" 'BEGIN { printf "%.1f", (t > 0 ? n / t / 1048576 : 0) }')
+                echo "$mode,$depth,$size,$n,$rep,$row,$rate"
+            done
+        done
+    done
+done
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# Compares mexec builtin stages against the coreutils they replace. Prints
+# CSV on stdout.
+# usage: bench/builtins.sh [MB of input]   (run from Mexec/, after make)
+#
+# Each filter chain is run three ways: builtins inside mexec, the coreutils
+# commands under mexec and the coreutils commands under bash.
+
+MEXEC=${MEXEC:-./mexec}
+SIZE=${1:-256}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Generate a CSV file of roughly SIZE MB.
+awk -v n=$((SIZE * 1024 * 1024 / 24)) 'BEGIN { for (i = 0; i < n; i++) printf "%d,%d,key%d\n", i, i * 7, i % 97 }' > "$TMP/in.csv"
+
+# name|builtin chain|coreutils chain
+CASES=(
+    "wc|:wc-l|wc -l"
+    "grep|:grep-F key42\n:wc-l|grep -F key42\nwc -l"
+    "cut|:cut -d , -f 3\n:grep-F key1\n:wc-l|cut -d , -f 3\ngrep -F key1\nwc -l"
+    "head|:head 1000000\n:cut -d , -f 1\n:wc-l|head -n 1000000\ncut -d , -f 1\nwc -l"
+)
+
+TIMEFORMAT=%R
+echo "case,builtin_s,coreutils_s,bash_s"
+for c in "${CASES[@]}"; do
+    IFS='|' read -r name builtins coreutils <<< "$c"
+    printf "cat $TMP/in.csv\n$builtins\n" > "$TMP/builtin.txt"
+    printf "cat $TMP/in.csv\n$coreutils\n" > "$TMP/coreutils.txt"
+    shell="cat $TMP/in.csv | $(printf "$coreutils" | paste -sd '|')"
+
+    b=$( { time "$MEXEC" "$TMP/builtin.txt" > /dev/null; } 2>&1 )
+    e=$( { time "$MEXEC" "$TMP/coreutils.txt" > /dev/null; } 2>&1 )
+    s=$( { time bash -c "$shell" > /dev/null; } 2>&1 )
+    echo "$name,$b,$e,$s"
+done
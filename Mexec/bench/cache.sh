@@ -0,0 +1,58 @@
+#!/bin/bash
+#
+# Size limit of the output cache in batch mode. Prints CSV on stdout.
+#
+# One mexec -b run holds BENCH_PIPELINES pipelines
+#     @pure cat fI
+#     wc -c
+# where each fI is BENCH_ENTRY KiB of its own random bytes, so every
+# pipeline stores one entry of that size. The cache is limited to BENCH_CAP
+# KiB, which every store after the first few crosses. The entries left and
+# the KiB they take on disk are checked after the run, and the script exits
+# 1 after a run that left more than the limit or nothing at all.
+#
+# Environment:
+#     BENCH_PIPELINES pipelines in the batch (default 6)
+#     BENCH_ENTRY     KiB each pipeline stores (default 100)
+#     BENCH_CAP       --cache-size in KiB (default 250)
+#     BENCH_REPS      runs (default 3)
+
+MEXEC=$(realpath "${MEXEC:-./mexec}")
+PIPELINES=${BENCH_PIPELINES:-6}
+ENTRY=${BENCH_ENTRY:-100}
+CAP=${BENCH_CAP:-250}
+REPS=${BENCH_REPS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+now() {
+    date +%s.%N
+}
+
+for ((i = 1; i <= PIPELINES; i++)); do
+    printf '@pure cat %s/f%d\nwc -c\n\n' "$TMP" $i >> spec.txt
+done
+failed=0
+echo "rep,pipelines,entry_kib,cap_kib,entries,kib,wall_s,ok"
+for ((rep = 1; rep <= REPS; rep++)); do
+    rm -rf cache
+    for ((i = 1; i <= PIPELINES; i++)); do
+        head -c $((ENTRY << 10)) /dev/urandom > f$i
+    done
+    start=$(now)
+    # A prefix reading a pipe or terminal on stdin isn't cached.
+    "$MEXEC" -b --cache cache --cache-size ${CAP}K spec.txt < /dev/null > /dev/null 2>&1 || exit 1
+    end=$(now)
+    entries=$(ls cache | wc -l)
+    kib=$(du -sk cache | cut -f1)
+    ok=1
+    ((entries > 0)) || ok=0
+    # du counts the directory itself too.
+    ((kib - $(stat -c %b cache) / 2 <= CAP)) || ok=0
+    ((ok)) || failed=1
+    awk -v r="$rep" -v p="$PIPELINES" -v e="$ENTRY" -v c="$CAP" -v n="$entries" -v k="$kib" \
+        -v a="$start" -v b="$end" -v ok="$ok" \
+        'BEGIN { printf "%d,%d,%d,%d,%d,%d,%.4f,%d\n", r, p, e, c, n, k, b - a, ok }'
+done
+exit $failed
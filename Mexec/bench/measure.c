@@ -0,0 +1,94 @@
+/*
+  Author: c19elm, Edvin Lindholm
+
+  Description: Benchmark helper. Runs a command with its output discarded and prints one CSV row:
+               status,wall_s,parent_user_s,parent_sys_s,children_user_s,children_sys_s
+               The parent times are for the command's own process (all its threads), the
+               children times for everything it forked and reaped. Both are read from
+               /proc while the command is a zombie, before it is reaped.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Fuction declaration
+void readTimes(pid_t pid, double times[4]);
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    siginfo_t info;
+    int status;
+    double times[4];
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s command [args...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if(pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if(pid == 0) {
+        // Only the measurements go to stdout.
+        if(freopen("/dev/null", "w", stdout) == NULL) {
+            perror("/dev/null");
+            exit(EXIT_FAILURE);
+        }
+        execvp(argv[1], argv + 1);
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Wait for exit, but leave the zombie so /proc still has its times.
+    if(waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1) {
+        perror("waitid");
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    readTimes(pid, times);
+    if(waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%d,%.6f,%.3f,%.3f,%.3f,%.3f\n", WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+           times[0], times[1], times[2], times[3]);
+    return 0;
+}
+
+/*  Function: readTimes
+ *  Input:
+            pid_t pid       :Process to read.
+            double times    :Set to user, system, children user and children system seconds.
+ *
+ *  Output: Reads utime, stime, cutime and cstime from /proc/pid/stat.
+ */
+void readTimes(pid_t pid, double times[4]) {
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL || fgets(buf, sizeof(buf), fp) == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+
+    // The command name may contain spaces, fields are counted from after it.
+    char *p = strrchr(buf, ')') + 2;
+    long ticks = sysconf(_SC_CLK_TCK);
+    for(int field = 3; field < 14; field++) {
+        p = strchr(p, ' ') + 1;
+    }
+    for(int i = 0; i < 4; i++) {
+        times[i] = strtod(p, &p) / ticks;
+    }
+}
@@ -0,0 +1,58 @@
+#!/bin/bash
+#
+# Pipeline throughput benchmark, run by "make bench". Prints CSV on stdout.
+#
+# For every depth and data volume, a pipeline of
+#     head -c SIZE /dev/zero | cat | ... | cat | wc -c
+# with DEPTH stages is run by bash, by mexec, and by mexec with :cat builtins
+# in the middle. SIZE 0 measures launch and teardown latency only.
+#
+# Environment:
+#     BENCH_DEPTHS    stage counts (default "2 4 8 16 32 64")
+#     BENCH_SIZES     bytes through the pipeline, K/M/G suffixes
+#                     (default "0 1K 1M 100M 1G", add e.g. 10G 20G for long runs)
+#     BENCH_REPS      runs of each case (default 3)
+
+MEXEC=${MEXEC:-./mexec}
+MEASURE=${MEASURE:-bench/measure}
+DEPTHS=${BENCH_DEPTHS:-2 4 8 16 32 64}
+SIZES=${BENCH_SIZES:-0 1K 1M 100M 1G}
+REPS=${BENCH_REPS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Writes a spec of DEPTH stages to stdout, the middle stages are $3.
+spec() {
+    local size=$1 depth=$2 middle=$3
+    echo "head -c $size /dev/zero"
+    for ((i = 2; i < depth; i++)); do
+        echo "$middle"
+    done
+    echo "wc -c"
+}
+
+bytes() {
+    numfmt --from=iec "$1"
+}
+
+echo "mode,depth,size,bytes,rep,status,wall_s,parent_user_s,parent_sys_s,children_user_s,children_sys_s,mb_per_s"
+for size in $SIZES; do
+    n=$(bytes "$size")
+    for depth in $DEPTHS; do
+        spec "$n" "$depth" cat > "$TMP/mexec.txt"
+        spec "$n" "$depth" :cat > "$TMP/builtin.txt"
+        shell=$(paste -sd '|' "$TMP/mexec.txt")
+        for ((rep = 1; rep <= REPS; rep++)); do
+            for mode in bash mexec mexec-builtin; do
+                case $mode in
+                    bash)           row=$("$MEASURE" bash -c "$shell" 2>/dev/null) ;;
+                    mexec)          row=$("$MEASURE" "$MEXEC" "$TMP/mexec.txt" 2>/dev/null) ;;
+                    mexec-builtin)  row=$("$MEASURE" "$MEXEC" "$TMP/builtin.txt" 2>/dev/null) ;;
+                esac
+                wall=$(cut -d, -f2 <<< "$row")
+                rate=$(awk -v n="$n" -v t="$wall" 'BEGIN { printf "%.1f", (t > 0 ? n / t / 1048576 : 0) }')
+                echo "$mode,$depth,$size,$n,$rep,$row,$rate"
+            done
+        done
+    done
+done
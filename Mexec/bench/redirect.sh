@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Shows the copy saved by redirecting files directly instead of adding cat
+# and tee stages. Prints CSV on stdout.
+# usage: bench/redirect.sh [GB of input]   (run from Mexec/, after make)
+
+MEXEC=${MEXEC:-./mexec}
+SIZE=${1:-2}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Generate SIZE GB of short lines.
+yes "the quick brown fox jumps over the lazy dog" | head -c $((SIZE * 1024 * 1024 * 1024)) > "$TMP/in.txt"
+
+# name|spec
+CASES=(
+    "cat-in|cat $TMP/in.txt\nwc -l"
+    "redir-in|wc -l < $TMP/in.txt"
+    "cat-in-builtin|cat $TMP/in.txt\n:wc-l"
+    "redir-in-builtin|:wc-l < $TMP/in.txt"
+    "tee-out|cat $TMP/in.txt\ntr a-z A-Z\ntee $TMP/out.txt"
+    "redir-out|tr a-z A-Z < $TMP/in.txt > $TMP/out.txt"
+)
+
+TIMEFORMAT="%R %U %S"
+echo "case,real_s,user_s,sys_s"
+for c in "${CASES[@]}"; do
+    IFS='|' read -r name spec <<< "$c"
+    printf "$spec\n" > "$TMP/spec.txt"
+    t=$( { time "$MEXEC" "$TMP/spec.txt" > /dev/null; } 2>&1 )
+    echo "$name,${t// /,}"
+done
@@ -0,0 +1,53 @@
+#!/bin/bash
+#
+# Per-invocation latency of mexec with and without a server. Prints CSV on
+# stdout.
+#
+# Every run starts mexec on a one stage pipeline, "true", or on the spec in
+# BENCH_SPEC. Modes:
+#     direct      ./mexec spec
+#     client      ./mexec --client SOCKET spec, against a running server
+#
+# Environment:
+#     BENCH_RUNS      invocations per measurement (default 1000)
+#     BENCH_REPS      measurements of each mode (default 3)
+#     BENCH_HELPERS   helpers of the server (default 4)
+#     BENCH_SPEC      spec file to run instead of "true"
+
+MEXEC=${MEXEC:-./mexec}
+RUNS=${BENCH_RUNS:-1000}
+REPS=${BENCH_REPS:-3}
+HELPERS=${BENCH_HELPERS:-4}
+TMP=$(mktemp -d)
+SOCKET=$TMP/mexec.sock
+trap 'kill $SERVER 2>/dev/null; wait; rm -rf "$TMP"' EXIT
+
+SPEC=${BENCH_SPEC:-$TMP/spec.txt}
+[ -n "$BENCH_SPEC" ] || echo true > "$SPEC"
+
+"$MEXEC" --server "$SOCKET" "$HELPERS" &
+SERVER=$!
+while [ ! -S "$SOCKET" ]; do
+    sleep 0.01
+done
+
+now() {
+    date +%s.%N
+}
+
+echo "mode,runs,rep,total_s,per_run_ms"
+for ((rep = 1; rep <= REPS; rep++)); do
+    for mode in direct client; do
+        case $mode in
+            direct) args=() ;;
+            client) args=(--client "$SOCKET") ;;
+        esac
+        start=$(now)
+        for ((i = 0; i < RUNS; i++)); do
+            "$MEXEC" "${args[@]}" "$SPEC" > /dev/null
+        done
+        end=$(now)
+        awk -v m="$mode" -v n="$RUNS" -v r="$rep" -v s="$start" -v e="$end" \
+            'BEGIN { printf "%s,%d,%d,%.3f,%.3f\n", m, n, r, e - s, (e - s) * 1000 / n }'
+    done
+done
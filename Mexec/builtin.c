@@ -0,0 +1,1086 @@
+/*
+Builtin pipeline stages
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+
+The builtins mirror the coreutils they replace:
+    :cat                    cat
+    :grep-F PATTERN         grep -F PATTERN
+    :wc-l                   wc -l
+    :head [-n] N            head -n N
+    :cut -d D -f LIST       cut -d D -f LIST
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "builtin.h"
+
+#define CHUNKSIZE 65536
+#define CHANNEL_DEPTH 8
+
+struct chunk {
+    char *data;
+    size_t len;
+};
+
+struct channel {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // Ring of filled buffers, waiting for the reader.
+    struct chunk queue[CHANNEL_DEPTH];
+    int head;
+    int count;
+    // Buffers handed back by the reader, reused by the writer.
+    char *spare[CHANNEL_DEPTH];
+    int nspare;
+    bool writeClosed;
+    bool readClosed;
+};
+
+// Where a builtin reads from.
+struct source {
+    int fd;
+    channel *chan;
+    char *own;
+    char *chunk;
+    size_t clen;
+    size_t cpos;
+    // Start of a line that continues in the next chunk.
+    char *carry;
+    size_t carryLen;
+    size_t carryCap;
+    bool error;
+    const bool *cancelled;
+    // Readable once the stage is cancelled.
+    int wake;
+    // The fd can block, like a pipe or terminal, so reads wait in poll with wake.
+    bool wait;
+};
+
+// Where a builtin writes to.
+struct sink {
+    int fd;
+    channel *chan;
+    char *buf;
+    size_t len;
+    bool closed;
+    bool error;
+    const bool *cancelled;
+    int wake;
+    bool wait;
+};
+
+struct range {
+    long from;
+    long to;
+};
+
+struct builtin {
+    pthread_t thread;
+    char **argv;
+    int (*run)(builtin *b);
+    int notifyfd;
+    // Set by builtin_cancel from the supervisor.
+    bool cancelled;
+    // Eventfd signalled by builtin_cancel, wakes a stage blocked on its fds.
+    int wake;
+    // CPUs to run on, if pinned.
+    cpu_set_t cpus;
+    bool pinned;
+    struct source in;
+    struct sink out;
+    int status;
+    // :head
+    long lines;
+    // :grep-F
+    const char *pattern;
+    size_t patternLen;
+    // :cut
+    char delim;
+    struct range *fields;
+    int nfields;
+};
+
+// Function declaration
+static bool parseNone(builtin *b);
+static bool parseGrep(builtin *b);
+static bool parseHead(builtin *b);
+static bool parseCut(builtin *b);
+static int runCat(builtin *b);
+static int runGrep(builtin *b);
+static int runWc(builtin *b);
+static int runHead(builtin *b);
+static int runCut(builtin *b);
+
+static const struct {
+    const char *name;
+    bool (*parse)(builtin *b);
+    int (*run)(builtin *b);
+    const char *usage;
+} builtins[] = {
+    {":cat",    parseNone, runCat,  ":cat"},
+    {":grep-F", parseGrep, runGrep, ":grep-F PATTERN"},
+    {":wc-l",   parseNone, runWc,   ":wc-l"},
+    {":head",   parseHead, runHead, ":head [-n] N"},
+    {":cut",    parseCut,  runCut,  ":cut -d DELIM -f LIST"},
+};
+
+#define NBUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+/*  Function: channel_create
+ *  Input:
+ *          void
+ *
+ *  Output: A new channel with no queued buffers.
+ */
+channel *channel_create(void) {
+    channel *c = calloc(1, sizeof(channel));
+    if(c == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    return c;
+}
+
+/*  Function: channel_kill
+ *  Input:
+ *          channel *c      :Channel to free.
+ *
+ *  Output: Frees the channel and all buffers it still holds.
+ */
+void channel_kill(channel *c) {
+    for(int i = 0; i < c->count; i++) {
+        free(c->queue[(c->head + i) % CHANNEL_DEPTH].data);
+    }
+    for(int i = 0; i < c->nspare; i++) {
+        free(c->spare[i]);
+    }
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c);
+}
+
+/*  Function: channelBuffer
+ *  Input:
+ *          channel *c      :Channel the buffer will be sent on.
+ *
+ *  Output: An empty buffer of CHUNKSIZE bytes, reused from the reader if possible.
+ */
+static char *channelBuffer(channel *c) {
+    char *buf = NULL;
+    pthread_mutex_lock(&c->lock);
+    if(c->nspare > 0) {
+        buf = c->spare[--c->nspare];
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    if(buf == NULL && (buf = malloc(CHUNKSIZE)) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    return buf;
+}
+
+/*  Function: channelRelease
+ *  Input:
+ *          channel *c      :Channel the buffer came from.
+ *          char *buf       :Buffer the reader is done with.
+ *
+ *  Output: Hands the buffer back to the writer, or frees it if enough are spare.
+ */
+static void channelRelease(channel *c, char *buf) {
+    pthread_mutex_lock(&c->lock);
+    if(c->nspare < CHANNEL_DEPTH) {
+        c->spare[c->nspare++] = buf;
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&c->lock);
+    free(buf);
+}
+
+/*  Function: channelSend
+ *  Input:
+ *          channel *c      :Channel to send on.
+ *          char *buf       :Buffer to send, the channel takes ownership.
+ *          size_t len      :Bytes used in buffer.
+ *
+ *  Output: Queues the buffer, blocking while the channel is full. Returns false if
+ *          the reader has stopped reading.
+ */
+static bool channelSend(channel *c, char *buf, size_t len) {
+    pthread_mutex_lock(&c->lock);
+    while(c->count == CHANNEL_DEPTH && !c->readClosed) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if(c->readClosed) {
+        pthread_mutex_unlock(&c->lock);
+        free(buf);
+        return false;
+    }
+    c->queue[(c->head + c->count) % CHANNEL_DEPTH] = (struct chunk){buf, len};
+    c->count++;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    return true;
+}
+
+/*  Function: channelRecv
+ *  Input:
+ *          channel *c      :Channel to receive from.
+ *          char **buf      :Set to the received buffer.
+ *          size_t *len     :Set to the bytes used in buffer.
+ *
+ *  Output: Blocks until a buffer is available. Returns false at end of input.
+ */
+static bool channelRecv(channel *c, char **buf, size_t *len) {
+    pthread_mutex_lock(&c->lock);
+    while(c->count == 0 && !c->writeClosed) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if(c->count == 0) {
+        pthread_mutex_unlock(&c->lock);
+        return false;
+    }
+    *buf = c->queue[c->head].data;
+    *len = c->queue[c->head].len;
+    c->head = (c->head + 1) % CHANNEL_DEPTH;
+    c->count--;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    return true;
+}
+
+/*  Function: channelClose
+ *  Input:
+ *          channel *c      :Channel to close.
+ *          bool reader     :True if the reader closes, false if the writer closes.
+ *
+ *  Output: Wakes up the other side. A closing reader drops everything still queued.
+ */
+static void channelClose(channel *c, bool reader) {
+    pthread_mutex_lock(&c->lock);
+    if(reader) {
+        c->readClosed = true;
+        for(; c->count > 0; c->count--) {
+            free(c->queue[c->head].data);
+            c->head = (c->head + 1) % CHANNEL_DEPTH;
+        }
+    }
+    else {
+        c->writeClosed = true;
+    }
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*  Function: countLines
+ *  Input:
+ *          const char *p   :Bytes to scan.
+ *          size_t n        :Amount of bytes.
+ *
+ *  Output: Number of newlines in p. Compares 16 bytes at a time and sums the
+ *          matches in byte lanes, which are flushed before they can overflow.
+ */
+static size_t countLines(const char *p, size_t n) {
+    size_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    while(i + 16 <= n) {
+        __m128i acc = zero;
+        for(int k = 0; k < 255 && i + 16 <= n; k++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_extract_epi16(sums, 4);
+    }
+#endif
+    for(; i < n; i++) {
+        count += (p[i] == '\n');
+    }
+    return count;
+}
+
+/*  Function: findBytes
+ *  Input:
+ *          const char *hay     :Bytes to search.
+ *          size_t n            :Amount of bytes in hay.
+ *          const char *needle  :Bytes to search for.
+ *          size_t m            :Amount of bytes in needle.
+ *
+ *  Output: Pointer to the first occurrence of needle in hay, or NULL. Candidates
+ *          are found 16 at a time by matching the first and last needle byte.
+ */
+static const char *findBytes(const char *hay, size_t n, const char *needle, size_t m) {
+    if(m == 0) {
+        return hay;
+    }
+    if(m > n) {
+        return NULL;
+    }
+    if(m == 1) {
+        return memchr(hay, needle[0], n);
+    }
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    for(; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                        _mm_cmpeq_epi8(b, last)));
+        while(mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if(memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return memmem(hay + i, n - i, needle, m);
+}
+
+/*  Function: mayBlock
+ *  Input:
+ *          int fd          :Descriptor a stage reads or writes.
+ *
+ *  Output: True if reading or writing fd can block for as long as another process
+ *          wants, like for a pipe, socket or terminal. False for files and disks.
+ */
+static bool mayBlock(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == -1 || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+}
+
+/*  Function: waitFd
+ *  Input:
+ *          int fd          :Descriptor to wait for.
+ *          short events    :POLLIN or POLLOUT.
+ *          int wake        :Eventfd of the stage.
+ *
+ *  Output: Waits until fd is ready or the stage is cancelled. Returns false if it was
+ *          cancelled.
+ */
+static bool waitFd(int fd, short events, int wake) {
+    struct pollfd fds[2] = {{fd, events, 0}, {wake, POLLIN, 0}};
+    while(poll(fds, 2, -1) == -1) {
+        if(errno != EINTR) {
+            // Let the read or write report it.
+            return true;
+        }
+    }
+    return fds[1].revents == 0;
+}
+
+/*  Function: sourceFill
+ *  Input:
+ *          struct source *s    :Source to read into.
+ *
+ *  Output: Replaces the current chunk with the next one. Returns false at end of input.
+ */
+static bool sourceFill(struct source *s) {
+    if(__atomic_load_n(s->cancelled, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    if(s->chan != NULL) {
+        if(s->chunk != NULL) {
+            channelRelease(s->chan, s->chunk);
+            s->chunk = NULL;
+        }
+        s->cpos = 0;
+        s->clen = 0;
+        return channelRecv(s->chan, &s->chunk, &s->clen);
+    }
+    if(s->own == NULL && (s->own = malloc(CHUNKSIZE)) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    if(s->wait && !waitFd(s->fd, POLLIN, s->wake)) {
+        return false;
+    }
+    ssize_t n;
+    while((n = read(s->fd, s->own, CHUNKSIZE)) == -1 && errno == EINTR);
+    if(n == -1) {
+        perror("read");
+        s->error = true;
+    }
+    s->chunk = s->own;
+    s->cpos = 0;
+    s->clen = n > 0 ? (size_t)n : 0;
+    return n > 0;
+}
+
+/*  Function: sourceRaw
+ *  Input:
+ *          struct source *s    :Source to read from.
+ *          const char **p      :Set to the next block of input.
+ *          size_t *n           :Set to the size of the block.
+ *
+ *  Output: The next block of input, as it arrived. Returns false at end of input.
+ */
+static bool sourceRaw(struct source *s, const char **p, size_t *n) {
+    if(s->cpos == s->clen && !sourceFill(s)) {
+        return false;
+    }
+    *p = s->chunk + s->cpos;
+    *n = s->clen - s->cpos;
+    s->cpos = s->clen;
+    return true;
+}
+
+/*  Function: carryAppend
+ *  Input:
+ *          struct source *s    :Source whose carry buffer to grow.
+ *          const char *p       :Bytes to append.
+ *          size_t n            :Amount of bytes.
+ *
+ *  Output: Appends to the partial line kept between chunks.
+ */
+static void carryAppend(struct source *s, const char *p, size_t n) {
+    if(s->carryLen + n > s->carryCap) {
+        size_t cap = s->carryCap == 0 ? 256 : s->carryCap;
+        while(cap < s->carryLen + n) {
+            cap *= 2;
+        }
+        if((s->carry = realloc(s->carry, cap)) == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        s->carryCap = cap;
+    }
+    memcpy(s->carry + s->carryLen, p, n);
+    s->carryLen += n;
+}
+
+/*  Function: sourceLines
+ *  Input:
+ *          struct source *s    :Source to read from.
+ *          const char **p      :Set to the next block of input.
+ *          size_t *n           :Set to the size of the block.
+ *
+ *  Output: The next block of whole lines. Blocks point straight into the received
+ *          chunk, only a line split between two chunks is copied. The last line of
+ *          the input may lack its newline. Returns false at end of input.
+ */
+static bool sourceLines(struct source *s, const char **p, size_t *n) {
+    while(true) {
+        if(s->cpos == s->clen && !sourceFill(s)) {
+            if(s->carryLen == 0) {
+                return false;
+            }
+            *p = s->carry;
+            *n = s->carryLen;
+            s->carryLen = 0;
+            return true;
+        }
+        char *b = s->chunk + s->cpos;
+        size_t len = s->clen - s->cpos;
+
+        // Finish the line started in an earlier chunk.
+        if(s->carryLen > 0) {
+            char *nl = memchr(b, '\n', len);
+            size_t take = nl != NULL ? (size_t)(nl - b) + 1 : len;
+            carryAppend(s, b, take);
+            s->cpos += take;
+            if(nl != NULL) {
+                *p = s->carry;
+                *n = s->carryLen;
+                s->carryLen = 0;
+                return true;
+            }
+            continue;
+        }
+
+        // Hand out everything up to the last newline, keep the rest.
+        char *last = memrchr(b, '\n', len);
+        s->cpos = s->clen;
+        if(last == NULL) {
+            carryAppend(s, b, len);
+            continue;
+        }
+        size_t take = (size_t)(last - b) + 1;
+        if(take < len) {
+            carryAppend(s, last + 1, len - take);
+        }
+        *p = b;
+        *n = take;
+        return true;
+    }
+}
+
+/*  Function: sourceClose
+ *  Input:
+ *          struct source *s    :Source to close.
+ *
+ *  Output: Tells the upstream stage that no more input will be read.
+ */
+static void sourceClose(struct source *s) {
+    if(s->chan != NULL) {
+        if(s->chunk != NULL) {
+            channelRelease(s->chan, s->chunk);
+        }
+        channelClose(s->chan, true);
+    }
+    else if(s->fd != STDIN_FILENO) {
+        close(s->fd);
+    }
+    free(s->own);
+    free(s->carry);
+}
+
+/*  Function: sinkFlush
+ *  Input:
+ *          struct sink *s      :Sink to flush.
+ *
+ *  Output: Passes buffered output on. Returns false if downstream has stopped reading.
+ */
+static bool sinkFlush(struct sink *s) {
+    if(s->len == 0 || s->closed) {
+        return !s->closed;
+    }
+    if(s->chan != NULL) {
+        s->closed = !channelSend(s->chan, s->buf, s->len);
+        s->buf = NULL;
+        s->len = 0;
+        return !s->closed;
+    }
+    size_t done = 0;
+    while(done < s->len) {
+        if(s->wait && !waitFd(s->fd, POLLOUT, s->wake)) {
+            s->closed = true;
+            break;
+        }
+        ssize_t n = write(s->fd, s->buf + done, s->len - done);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            // Reader is gone, same as a SIGPIPE for an external command.
+            if(errno != EPIPE) {
+                perror("write");
+                s->error = true;
+            }
+            s->closed = true;
+            break;
+        }
+        done += n;
+    }
+    s->len = 0;
+    return !s->closed;
+}
+
+/*  Function: sinkWrite
+ *  Input:
+ *          struct sink *s      :Sink to write to.
+ *          const char *p       :Bytes to write.
+ *          size_t n            :Amount of bytes.
+ *
+ *  Output: Buffers output. Returns false if downstream has stopped reading.
+ */
+static bool sinkWrite(struct sink *s, const char *p, size_t n) {
+    if(__atomic_load_n(s->cancelled, __ATOMIC_RELAXED)) {
+        s->closed = true;
+    }
+    while(n > 0) {
+        if(s->closed) {
+            return false;
+        }
+        if(s->buf == NULL) {
+            if(s->chan != NULL) {
+                s->buf = channelBuffer(s->chan);
+            }
+            else if((s->buf = malloc(CHUNKSIZE)) == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        size_t room = CHUNKSIZE - s->len;
+        size_t take = n < room ? n : room;
+        memcpy(s->buf + s->len, p, take);
+        s->len += take;
+        p += take;
+        n -= take;
+        if(s->len == CHUNKSIZE) {
+            sinkFlush(s);
+        }
+    }
+    return !s->closed;
+}
+
+/*  Function: sinkClose
+ *  Input:
+ *          struct sink *s      :Sink to close.
+ *
+ *  Output: Flushes the sink and signals end of output downstream.
+ */
+static void sinkClose(struct sink *s) {
+    sinkFlush(s);
+    if(s->chan != NULL) {
+        channelClose(s->chan, false);
+        if(s->buf != NULL) {
+            channelRelease(s->chan, s->buf);
+        }
+    }
+    else {
+        if(s->fd != STDOUT_FILENO) {
+            close(s->fd);
+        }
+        free(s->buf);
+    }
+}
+
+/*  Function: builtin_is
+ *  Input:
+ *          const char *name    :First word of a command.
+ *
+ *  Output: True if the command is run as a builtin.
+ */
+bool builtin_is(const char *name) {
+    return name != NULL && name[0] == ':';
+}
+
+/*  Function: builtin_create
+ *  Input:
+ *          char **argv     :Arguments of the stage.
+ *
+ *  Output: A stage ready to be started, or NULL if the arguments are wrong.
+ */
+builtin *builtin_create(char **argv) {
+    for(size_t i = 0; i < NBUILTINS; i++) {
+        if(strcmp(argv[0], builtins[i].name) != 0) {
+            continue;
+        }
+        builtin *b = calloc(1, sizeof(builtin));
+        if(b == NULL) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        b->argv = argv;
+        b->run = builtins[i].run;
+        if(!builtins[i].parse(b)) {
+            fprintf(stderr, "usage: %s\n", builtins[i].usage);
+            free(b->fields);
+            free(b);
+            return NULL;
+        }
+        if((b->wake = eventfd(0, EFD_CLOEXEC)) == -1) {
+            perror("eventfd");
+            exit(EXIT_FAILURE);
+        }
+        return b;
+    }
+    fprintf(stderr, "%s: Unknown builtin\n", argv[0]);
+    return NULL;
+}
+
+/*  Function: worker
+ *  Input:
+ *          void *arg       :The stage to run.
+ *
+ *  Output: Thread function, runs a builtin, closes its ends of the pipeline and
+ *          reports that it is done.
+ */
+static void *worker(void *arg) {
+    builtin *b = arg;
+    b->status = b->run(b);
+    sourceClose(&b->in);
+    sinkClose(&b->out);
+    if(b->in.error || b->out.error) {
+        b->status = 1;
+    }
+    // A pointer is less than PIPE_BUF, so the write is atomic.
+    while(write(b->notifyfd, &b, sizeof(b)) == -1 && errno == EINTR);
+    return NULL;
+}
+
+/*  Function: builtin_start
+ *  Input:
+ *          builtin *b      :Stage to start.
+ *          int infd        :File descriptor to read from, or -1.
+ *          channel *in     :Channel to read from, or NULL.
+ *          int outfd       :File descriptor to write to, or -1.
+ *          channel *out    :Channel to write to, or NULL.
+ *          int notifyfd    :File descriptor to report completion on.
+ *
+ *  Output: Runs the stage in a new thread.
+ */
+void builtin_start(builtin *b, int infd, channel *in, int outfd, channel *out, int notifyfd) {
+    b->notifyfd = notifyfd;
+    b->in.cancelled = &b->cancelled;
+    b->out.cancelled = &b->cancelled;
+    b->in.wake = b->wake;
+    b->out.wake = b->wake;
+    b->in.fd = infd;
+    b->in.chan = in;
+    b->in.wait = in == NULL && mayBlock(infd);
+    b->out.fd = outfd;
+    b->out.chan = out;
+    b->out.wait = out == NULL && mayBlock(outfd);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(b->pinned && pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &b->cpus) != 0) {
+        fprintf(stderr, "mexec: %s: can't set CPU affinity\n", b->argv[0]);
+    }
+    if(pthread_create(&b->thread, &attr, worker, b) != 0) {
+        fprintf(stderr, "Error creating thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*  Function: builtin_pin
+ *  Input:
+ *          builtin *b              :Stage not yet started.
+ *          const cpu_set_t *cpus   :CPUs to run on.
+ *
+ *  Output: The stage's thread will be started on the given CPUs.
+ */
+void builtin_pin(builtin *b, const cpu_set_t *cpus) {
+    b->cpus = *cpus;
+    b->pinned = true;
+}
+
+/*  Function: builtin_cancel
+ *  Input:
+ *          builtin *b      :Running stage.
+ *
+ *  Output: Makes the stage stop at its next read or write, or the one it is blocked in.
+ */
+void builtin_cancel(builtin *b) {
+    __atomic_store_n(&b->cancelled, true, __ATOMIC_RELAXED);
+    uint64_t one = 1;
+    while(write(b->wake, &one, sizeof(one)) == -1 && errno == EINTR);
+}
+
+/*  Function: builtin_kill
+ *  Input:
+ *          builtin *b      :Stage that was never started.
+ *
+ *  Output: Frees the stage.
+ */
+void builtin_kill(builtin *b) {
+    close(b->wake);
+    free(b->fields);
+    free(b);
+}
+
+/*  Function: builtin_join
+ *  Input:
+ *          builtin *b      :Stage to wait for.
+ *
+ *  Output: Exit status of the stage. The stage is freed.
+ */
+int builtin_join(builtin *b) {
+    if(pthread_join(b->thread, NULL) != 0) {
+        fprintf(stderr, "Error joining thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    int status = b->status;
+    builtin_kill(b);
+    return status;
+}
+
+/*  Function: parseNone
+ *  Input:
+ *          builtin *b      :Stage taking no arguments.
+ *
+ *  Output: True if no arguments were given.
+ */
+static bool parseNone(builtin *b) {
+    return b->argv[1] == NULL;
+}
+
+/*  Function: parseGrep
+ *  Input:
+ *          builtin *b      ::grep-F stage.
+ *
+ *  Output: True if exactly one pattern was given.
+ */
+static bool parseGrep(builtin *b) {
+    if(b->argv[1] == NULL || b->argv[2] != NULL) {
+        return false;
+    }
+    b->pattern = b->argv[1];
+    b->patternLen = strlen(b->pattern);
+    return true;
+}
+
+/*  Function: parseHead
+ *  Input:
+ *          builtin *b      ::head stage.
+ *
+ *  Output: True if a valid line count was given.
+ */
+static bool parseHead(builtin *b) {
+    char **arg = b->argv + 1;
+    char *endp;
+    if(*arg != NULL && strcmp(*arg, "-n") == 0) {
+        arg++;
+    }
+    if(*arg == NULL || arg[1] != NULL) {
+        return false;
+    }
+    b->lines = strtol(*arg, &endp, 10);
+    return *endp == '\0' && endp != *arg && b->lines >= 0;
+}
+
+/*  Function: parseFields
+ *  Input:
+ *          builtin *b      ::cut stage.
+ *          char *list      :Field list, e.g. "1,3-4,6-".
+ *
+ *  Output: True if the list was valid, fields are stored in b.
+ */
+static bool parseFields(builtin *b, char *list) {
+    char *p = list;
+    while(true) {
+        struct range r;
+        char *endp;
+        r.from = strtol(p, &endp, 10);
+        if(endp == p || r.from < 1) {
+            return false;
+        }
+        r.to = r.from;
+        if(*endp == '-') {
+            p = endp + 1;
+            r.to = strtol(p, &endp, 10);
+            if(endp == p) {
+                r.to = -1;
+            }
+            else if(r.to < r.from) {
+                return false;
+            }
+        }
+        b->fields = realloc(b->fields, sizeof(struct range) * (b->nfields + 1));
+        if(b->fields == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        b->fields[b->nfields++] = r;
+        if(*endp == '\0') {
+            return true;
+        }
+        if(*endp != ',') {
+            return false;
+        }
+        p = endp + 1;
+    }
+}
+
+/*  Function: parseCut
+ *  Input:
+ *          builtin *b      ::cut stage.
+ *
+ *  Output: True if a one byte delimiter and a field list were given.
+ */
+static bool parseCut(builtin *b) {
+    char *delim = NULL;
+    char *list = NULL;
+    for(char **arg = b->argv + 1; *arg != NULL; arg++) {
+        char **dest;
+        if(strncmp(*arg, "-d", 2) == 0) {
+            dest = &delim;
+        }
+        else if(strncmp(*arg, "-f", 2) == 0) {
+            dest = &list;
+        }
+        else {
+            return false;
+        }
+        // Value either follows directly (-d,) or is the next argument (-d ,).
+        if((*arg)[2] != '\0') {
+            *dest = *arg + 2;
+        }
+        else if(arg[1] != NULL) {
+            *dest = *++arg;
+        }
+        else {
+            return false;
+        }
+    }
+    if(delim == NULL || list == NULL || strlen(delim) != 1) {
+        return false;
+    }
+    b->delim = delim[0];
+    return parseFields(b, list);
+}
+
+/*  Function: runCat
+ *  Input:
+ *          builtin *b      ::cat stage.
+ *
+ *  Output: Copies input to output.
+ */
+static int runCat(builtin *b) {
+    const char *p;
+    size_t n;
+    while(sourceRaw(&b->in, &p, &n) && sinkWrite(&b->out, p, n));
+    return 0;
+}
+
+/*  Function: runWc
+ *  Input:
+ *          builtin *b      ::wc-l stage.
+ *
+ *  Output: Writes the number of lines in input.
+ */
+static int runWc(builtin *b) {
+    const char *p;
+    size_t n;
+    size_t lines = 0;
+    while(sourceRaw(&b->in, &p, &n)) {
+        lines += countLines(p, n);
+    }
+    char out[32];
+    int len = snprintf(out, sizeof(out), "%zu\n", lines);
+    sinkWrite(&b->out, out, len);
+    return 0;
+}
+
+/*  Function: runHead
+ *  Input:
+ *          builtin *b      ::head stage.
+ *
+ *  Output: Copies the first lines of input to output, then stops reading.
+ */
+static int runHead(builtin *b) {
+    const char *p;
+    size_t n;
+    long left = b->lines;
+    while(left > 0 && sourceRaw(&b->in, &p, &n)) {
+        size_t lines = countLines(p, n);
+        const char *end = p + n;
+        // Whole block fits, otherwise find where the last wanted line ends.
+        if(lines < (size_t)left) {
+            left -= lines;
+        }
+        else {
+            end = p;
+            for(; left > 0; left--) {
+                end = (const char *)memchr(end, '\n', p + n - end) + 1;
+            }
+        }
+        if(!sinkWrite(&b->out, p, end - p)) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*  Function: runGrep
+ *  Input:
+ *          builtin *b      ::grep-F stage.
+ *
+ *  Output: Writes the lines of input containing the pattern. Returns 1 if no line
+ *          matched, like grep.
+ */
+static int runGrep(builtin *b) {
+    const char *p;
+    size_t n;
+    bool matched = false;
+    while(sourceLines(&b->in, &p, &n)) {
+        const char *cur = p;
+        const char *end = p + n;
+        while(cur < end) {
+            const char *hit = findBytes(cur, end - cur, b->pattern, b->patternLen);
+            if(hit == NULL) {
+                break;
+            }
+            const char *start = memrchr(cur, '\n', hit - cur);
+            start = start != NULL ? start + 1 : cur;
+            const char *nl = memchr(hit, '\n', end - hit);
+            cur = nl != NULL ? nl + 1 : end;
+            matched = true;
+            if(!sinkWrite(&b->out, start, cur - start)
+               || (nl == NULL && !sinkWrite(&b->out, "\n", 1))) {
+                return 0;
+            }
+        }
+    }
+    return matched ? 0 : 1;
+}
+
+/*  Function: fieldSelected
+ *  Input:
+ *          builtin *b      ::cut stage.
+ *          long field      :Field number, counted from 1.
+ *
+ *  Output: True if the field is in the field list.
+ */
+static bool fieldSelected(builtin *b, long field) {
+    for(int i = 0; i < b->nfields; i++) {
+        if(field >= b->fields[i].from && (b->fields[i].to == -1 || field <= b->fields[i].to)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*  Function: runCut
+ *  Input:
+ *          builtin *b      ::cut stage.
+ *
+ *  Output: Writes the selected fields of each line. Lines without the delimiter
+ *          are written whole, like cut.
+ */
+static int runCut(builtin *b) {
+    const char *p;
+    size_t n;
+    while(sourceLines(&b->in, &p, &n)) {
+        const char *end = p + n;
+        for(const char *line = p; line < end;) {
+            const char *nl = memchr(line, '\n', end - line);
+            const char *lineEnd = nl != NULL ? nl : end;
+            bool ok = true;
+
+            if(memchr(line, b->delim, lineEnd - line) == NULL) {
+                ok = sinkWrite(&b->out, line, lineEnd - line);
+            }
+            else {
+                bool first = true;
+                const char *field = line;
+                for(long num = 1; ok; num++) {
+                    const char *fieldEnd = memchr(field, b->delim, lineEnd - field);
+                    if(fieldEnd == NULL) {
+                        fieldEnd = lineEnd;
+                    }
+                    if(fieldSelected(b, num)) {
+                        if(!first) {
+                            ok = sinkWrite(&b->out, &b->delim, 1);
+                        }
+                        ok = ok && sinkWrite(&b->out, field, fieldEnd - field);
+                        first = false;
+                    }
+                    if(fieldEnd == lineEnd) {
+                        break;
+                    }
+                    field = fieldEnd + 1;
+                }
+            }
+            if(!ok || !sinkWrite(&b->out, "\n", 1)) {
+                return 0;
+            }
+            line = lineEnd + 1;
+        }
+    }
+    return 0;
+}
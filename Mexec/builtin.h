@@ -0,0 +1,100 @@
+/*
+Builtin pipeline stages header file
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+
+Stages whose name starts with ':' are run as threads inside mexec instead of
+being exec'd. Two adjacent builtins pass buffers through a channel, a builtin
+next to an external command uses an ordinary pipe.
+*/
+
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <stdbool.h>
+#include <sched.h>
+#include <stddef.h>
+
+typedef struct channel channel;
+typedef struct builtin builtin;
+
+/**
+ * Creates an empty channel between two builtin stages.
+ *
+ * @return			Pointer to the channel.
+ */
+channel *channel_create(void);
+
+/**
+ * Frees a channel and any buffers still queued in it.
+ *
+ * @param c			Pointer to the channel.
+ */
+void channel_kill(channel *c);
+
+/**
+ * Checks if a command names a builtin stage.
+ *
+ * @param name		First word of the command.
+ * @return			True if the stage should run in-process.
+ */
+bool builtin_is(const char *name);
+
+/**
+ * Creates a builtin stage from its arguments. Prints a usage message if the
+ * arguments are invalid.
+ *
+ * @param argv		NULL terminated argument array, argv[0] is the stage name.
+ * @return			Pointer to the stage, or NULL on bad usage.
+ */
+builtin *builtin_create(char **argv);
+
+/**
+ * Starts a builtin stage in a new thread. Exactly one of infd/in and one of
+ * outfd/out should be used, the unused one is -1 or NULL. File descriptors
+ * other than stdin/stdout are closed by the stage when it is done, after
+ * which the stage writes its own pointer to notifyfd.
+ *
+ * @param b			Pointer to the stage.
+ * @param infd		File descriptor to read from, or -1.
+ * @param in		Channel to read from, or NULL.
+ * @param outfd		File descriptor to write to, or -1.
+ * @param out		Channel to write to, or NULL.
+ * @param notifyfd	File descriptor to report completion on.
+ */
+void builtin_start(builtin *b, int infd, channel *in, int outfd, channel *out, int notifyfd);
+
+/**
+ * Restricts the thread of a builtin stage to some CPUs. Must be called before
+ * builtin_start.
+ *
+ * @param b			Pointer to the stage.
+ * @param cpus		CPUs the stage may run on.
+ */
+void builtin_pin(builtin *b, const cpu_set_t *cpus);
+
+/**
+ * Asks a running builtin stage to stop. The stage stops reading and writing,
+ * also if it is blocked on a pipe or terminal, and finishes with status 0.
+ *
+ * @param b			Pointer to the stage.
+ */
+void builtin_cancel(builtin *b);
+
+/**
+ * Frees a builtin stage that was never started.
+ *
+ * @param b			Pointer to the stage.
+ */
+void builtin_kill(builtin *b);
+
+/**
+ * Waits for a builtin stage to finish and frees it.
+ *
+ * @param b			Pointer to the stage.
+ * @return			Exit status of the stage, 0 on success.
+ */
+int builtin_join(builtin *b);
+
+#endif
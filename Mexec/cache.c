@@ -0,0 +1,365 @@
+/*
+Output cache
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+#define KEY_HEX 64
+
+struct cache {
+    char *dir;
+    int dirfd;
+    long long maxBytes;
+    // Numbers temporary files, together with the pid.
+    unsigned tmpCount;
+};
+
+struct entry {
+    char name[KEY_HEX + 1];
+    long long size;
+    struct timespec used;
+};
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Function declaration
+static void hashBlock(cache_hasher *h, const unsigned char *block);
+static void keyName(const cache_key *key, char name[KEY_HEX + 1]);
+static bool isEntry(const char *name);
+static int compareUsed(const void *a, const void *b);
+static void evict(cache *c);
+
+/*  Function: cache_open
+ *  Input:
+ *          const char *dir     :Cache directory.
+ *          long long maxBytes  :Size limit of the entries.
+ *
+ *  Output: The opened cache, or NULL with an error printed.
+ */
+cache *cache_open(const char *dir, long long maxBytes) {
+    if(mkdir(dir, 0777) == -1 && errno != EEXIST) {
+        perror(dir);
+        return NULL;
+    }
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirfd == -1) {
+        perror(dir);
+        return NULL;
+    }
+    cache *c = calloc(1, sizeof(cache));
+    if(c == NULL || (c->dir = strdup(dir)) == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    c->dirfd = dirfd;
+    c->maxBytes = maxBytes;
+    return c;
+}
+
+/*  Function: cache_close
+ *  Input:
+ *          cache *c    :Cache to free.
+ *
+ *  Output: Frees the cache.
+ */
+void cache_close(cache *c) {
+    close(c->dirfd);
+    free(c->dir);
+    free(c);
+}
+
+/*  Function: cache_hash_init
+ *  Input:
+ *          cache_hasher *h     :Hasher to initialize.
+ *
+ *  Output: An empty SHA-256.
+ */
+void cache_hash_init(cache_hasher *h) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(h->state, initial, sizeof(initial));
+    h->blockLen = 0;
+    h->total = 0;
+}
+
+/*  Function: cache_hash_update
+ *  Input:
+ *          cache_hasher *h     :Hasher.
+ *          const void *data    :Bytes to add.
+ *          size_t len          :Amount of bytes.
+ *
+ *  Output: Hashes every full block, the rest waits for more data.
+ */
+void cache_hash_update(cache_hasher *h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    h->total += len;
+    while(len > 0) {
+        size_t n = 64 - h->blockLen < len ? 64 - h->blockLen : len;
+        memcpy(h->block + h->blockLen, p, n);
+        h->blockLen += n;
+        p += n;
+        len -= n;
+        if(h->blockLen == 64) {
+            hashBlock(h, h->block);
+            h->blockLen = 0;
+        }
+    }
+}
+
+/*  Function: cache_hash_final
+ *  Input:
+ *          cache_hasher *h     :Hasher.
+ *          cache_key *key      :Set to the hash.
+ *
+ *  Output: Pads the last block with the bit length and writes the hash big endian.
+ */
+void cache_hash_final(cache_hasher *h, cache_key *key) {
+    uint64_t bits = h->total * 8;
+    unsigned char pad[72] = {0x80};
+    size_t padLen = (h->blockLen < 56 ? 56 : 120) - h->blockLen;
+    for(int i = 0; i < 8; i++) {
+        pad[padLen + i] = bits >> (56 - 8 * i);
+    }
+    cache_hash_update(h, pad, padLen + 8);
+    for(int i = 0; i < 8; i++) {
+        key->bytes[4*i] = h->state[i] >> 24;
+        key->bytes[4*i + 1] = h->state[i] >> 16;
+        key->bytes[4*i + 2] = h->state[i] >> 8;
+        key->bytes[4*i + 3] = h->state[i];
+    }
+}
+
+/*  Function: cache_lookup
+ *  Input:
+ *          cache *c                :Cache.
+ *          const cache_key *key    :Key to look up.
+ *
+ *  Output: Descriptor of the entry, -1 if there is none. The modification time of an
+ *          entry is when it was last used, that is what eviction goes by.
+ */
+int cache_lookup(cache *c, const cache_key *key) {
+    char name[KEY_HEX + 1];
+    keyName(key, name);
+    int fd = openat(c->dirfd, name, O_RDONLY | O_CLOEXEC);
+    if(fd != -1) {
+        futimens(fd, NULL);
+    }
+    return fd;
+}
+
+/*  Function: cache_create
+ *  Input:
+ *          cache *c        :Cache.
+ *          char **tmpPath  :Set to the path of the temporary file.
+ *
+ *  Output: Descriptor of a new temporary file in the cache directory, -1 on failure.
+ */
+int cache_create(cache *c, char **tmpPath) {
+    size_t size = strlen(c->dir) + 64;
+    if((*tmpPath = malloc(size)) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(*tmpPath, size, "%s/tmp.%d.%u", c->dir, (int)getpid(), c->tmpCount++);
+    int fd = open(*tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd == -1) {
+        perror(*tmpPath);
+        free(*tmpPath);
+        *tmpPath = NULL;
+    }
+    return fd;
+}
+
+/*  Function: cache_commit
+ *  Input:
+ *          cache *c                :Cache.
+ *          const cache_key *key    :Key of the entry.
+ *          char *tmpPath           :Written temporary file.
+ *
+ *  Output: Renames the file to its key, replacing any entry written meanwhile by another
+ *          mexec, and evicts old entries.
+ */
+void cache_commit(cache *c, const cache_key *key, char *tmpPath) {
+    char name[KEY_HEX + 1];
+    keyName(key, name);
+    const char *base = strrchr(tmpPath, '/') + 1;
+    if(renameat(c->dirfd, base, c->dirfd, name) == -1) {
+        perror(tmpPath);
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+    evict(c);
+}
+
+/*  Function: cache_abort
+ *  Input:
+ *          char *tmpPath   :Temporary file.
+ *
+ *  Output: Removes the file.
+ */
+void cache_abort(char *tmpPath) {
+    unlink(tmpPath);
+    free(tmpPath);
+}
+
+/*  Function: hashBlock
+ *  Input:
+ *          cache_hasher *h             :Hasher.
+ *          const unsigned char *block  :64 bytes.
+ *
+ *  Output: The SHA-256 compression function applied to the state.
+ */
+static void hashBlock(cache_hasher *h, const unsigned char *block) {
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+    uint32_t w[64];
+    for(int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[4*i] << 24 | (uint32_t)block[4*i + 1] << 16
+               | (uint32_t)block[4*i + 2] << 8 | block[4*i + 3];
+    }
+    for(int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    uint32_t a = h->state[0], b = h->state[1], c = h->state[2], d = h->state[3];
+    uint32_t e = h->state[4], f = h->state[5], g = h->state[6], k = h->state[7];
+    for(int i = 0; i < 64; i++) {
+        uint32_t t1 = k + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h->state[0] += a;
+    h->state[1] += b;
+    h->state[2] += c;
+    h->state[3] += d;
+    h->state[4] += e;
+    h->state[5] += f;
+    h->state[6] += g;
+    h->state[7] += k;
+#undef ROTR
+}
+
+/*  Function: keyName
+ *  Input:
+ *          const cache_key *key    :Key.
+ *          char name               :Set to the key in hex.
+ *
+ *  Output: File name of the entry of a key.
+ */
+static void keyName(const cache_key *key, char name[KEY_HEX + 1]) {
+    static const char hex[] = "0123456789abcdef";
+    for(int i = 0; i < 32; i++) {
+        name[2*i] = hex[key->bytes[i] >> 4];
+        name[2*i + 1] = hex[key->bytes[i] & 0xf];
+    }
+    name[KEY_HEX] = '\0';
+}
+
+/*  Function: isEntry
+ *  Input:
+ *          const char *name    :File name in the cache directory.
+ *
+ *  Output: True if the name is a key, not a temporary file or something else.
+ */
+static bool isEntry(const char *name) {
+    return strlen(name) == KEY_HEX && strspn(name, "0123456789abcdef") == KEY_HEX;
+}
+
+/*  Function: compareUsed
+ *  Input:
+ *          const void *a   :Entry.
+ *          const void *b   :Entry.
+ *
+ *  Output: qsort comparison, least recently used first.
+ */
+static int compareUsed(const void *a, const void *b) {
+    const struct timespec *x = &((const struct entry *)a)->used;
+    const struct timespec *y = &((const struct entry *)b)->used;
+    if(x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+/*  Function: evict
+ *  Input:
+ *          cache *c    :Cache.
+ *
+ *  Output: Removes the least recently used entries until the rest fit the size limit.
+ */
+static void evict(cache *c) {
+    // A dup of dirfd would share its offset, left at the end by the last scan.
+    int fd = openat(c->dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+    if(dir == NULL) {
+        perror(c->dir);
+        if(fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    struct entry *entries = NULL;
+    size_t amount = 0;
+    size_t cap = 0;
+    long long total = 0;
+    struct dirent *d;
+    while((d = readdir(dir)) != NULL) {
+        struct stat st;
+        if(!isEntry(d->d_name) || fstatat(c->dirfd, d->d_name, &st, 0) == -1) {
+            continue;
+        }
+        if(amount == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            if((entries = realloc(entries, cap * sizeof(struct entry))) == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(entries[amount].name, d->d_name, KEY_HEX + 1);
+        entries[amount].size = st.st_blocks * 512LL;
+        entries[amount].used = st.st_mtim;
+        total += entries[amount].size;
+        amount++;
+    }
+    closedir(dir);
+
+    if(total > c->maxBytes) {
+        qsort(entries, amount, sizeof(struct entry), compareUsed);
+        for(size_t i = 0; i < amount && total > c->maxBytes; i++) {
+            if(unlinkat(c->dirfd, entries[i].name, 0) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    free(entries);
+}
@@ -0,0 +1,108 @@
+/*
+Output cache header file
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+
+A content-addressed store for the output of @pure pipeline prefixes. Every
+entry is one file in the cache directory, named by the hex SHA-256 key of
+what produced it. Entries are written to a temporary file and renamed into
+place, so readers never see a partial entry. The least recently used entries
+are removed when the directory grows past its size limit.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct cache cache;
+
+typedef struct cache_key {
+    unsigned char bytes[32];
+} cache_key;
+
+typedef struct cache_hasher {
+    uint32_t state[8];
+    unsigned char block[64];
+    size_t blockLen;
+    uint64_t total;
+} cache_hasher;
+
+/**
+ * Opens a cache directory, creating it if it doesn't exist.
+ *
+ * @param dir		Cache directory.
+ * @param maxBytes	Size the entries may use together.
+ * @return			Pointer to the cache, or NULL if the directory can't be used.
+ */
+cache *cache_open(const char *dir, long long maxBytes);
+
+/**
+ * Frees a cache. The entries stay on disk.
+ *
+ * @param c			Pointer to the cache.
+ */
+void cache_close(cache *c);
+
+/**
+ * Starts a new key.
+ *
+ * @param h			Hasher to initialize.
+ */
+void cache_hash_init(cache_hasher *h);
+
+/**
+ * Adds bytes to a key.
+ *
+ * @param h			Hasher.
+ * @param data		Bytes to add.
+ * @param len		Amount of bytes.
+ */
+void cache_hash_update(cache_hasher *h, const void *data, size_t len);
+
+/**
+ * Finishes a key.
+ *
+ * @param h			Hasher, must be initialized again before reuse.
+ * @param key		Set to the key.
+ */
+void cache_hash_final(cache_hasher *h, cache_key *key);
+
+/**
+ * Opens the entry of a key and marks it as recently used.
+ *
+ * @param c			Pointer to the cache.
+ * @param key		Key to look up.
+ * @return			Read-only close on exec descriptor of the entry, or -1 on a miss.
+ */
+int cache_lookup(cache *c, const cache_key *key);
+
+/**
+ * Creates a temporary file for a new entry.
+ *
+ * @param c			Pointer to the cache.
+ * @param tmpPath	Set to the path of the file, freed by cache_commit or cache_abort.
+ * @return			Close on exec descriptor to write the entry to, or -1 on failure.
+ */
+int cache_create(cache *c, char **tmpPath);
+
+/**
+ * Makes a completely written temporary file the entry of a key, then removes
+ * old entries until the cache fits its size limit.
+ *
+ * @param c			Pointer to the cache.
+ * @param key		Key of the entry.
+ * @param tmpPath	Path from cache_create, freed.
+ */
+void cache_commit(cache *c, const cache_key *key, char *tmpPath);
+
+/**
+ * Removes a temporary file that won't become an entry.
+ *
+ * @param tmpPath	Path from cache_create, freed.
+ */
+void cache_abort(char *tmpPath);
+
+#endif
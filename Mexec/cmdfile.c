@@ -0,0 +1,199 @@
+/*
+Command file reader
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cmdfile.h"
+
+#define CHUNKSIZE 65536
+
+struct cmdfile {
+    // All command text, '\n' replaced by '\0'.
+    char *arena;
+    size_t len;
+    size_t cap;
+    // Length of the mapping if arena is mmapped, otherwise 0.
+    size_t mapLen;
+    // Offset of the start of each line in arena.
+    size_t *off;
+    int lineAmt;
+    int offCap;
+    // Next byte starts a new line.
+    bool lineStart;
+    char **lines;
+};
+
+// Function declaration
+static bool mapFile(cmdfile *c, int fd);
+static void streamFile(cmdfile *c, int fd);
+static void splitLines(cmdfile *c, size_t from, size_t to);
+
+/*  Function: cmdfile_read
+ *  Input:
+ *          int fd          :File descriptor to read from.
+ *
+ *  Output: All lines of the file, split in place.
+ */
+cmdfile *cmdfile_read(int fd) {
+    cmdfile *c = calloc(1, sizeof(cmdfile));
+    if(c == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    c->lineStart = true;
+    if(!mapFile(c, fd)) {
+        streamFile(c, fd);
+    }
+    return c;
+}
+
+/*  Function: cmdfile_lines
+ *  Input:
+ *          cmdfile *c      :Command file.
+ *          int *lineAmt    :Set to the amount of lines.
+ *
+ *  Output: NULL terminated array of the lines. The offsets become pointers once the
+ *          arena has stopped growing.
+ */
+char **cmdfile_lines(cmdfile *c, int *lineAmt) {
+    if(c->lines == NULL) {
+        if((c->lines = malloc((c->lineAmt + 1) * sizeof(char *))) == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        for(int i = 0; i < c->lineAmt; i++) {
+            c->lines[i] = c->arena + c->off[i];
+        }
+        c->lines[c->lineAmt] = NULL;
+    }
+    *lineAmt = c->lineAmt;
+    return c->lines;
+}
+
+/*  Function: cmdfile_kill
+ *  Input:
+ *          cmdfile *c      :Command file to free.
+ *
+ *  Output: Frees or unmaps all memory of the command file.
+ */
+void cmdfile_kill(cmdfile *c) {
+    if(c->mapLen > 0) {
+        munmap(c->arena, c->mapLen);
+    }
+    else {
+        free(c->arena);
+    }
+    free(c->off);
+    free(c->lines);
+    free(c);
+}
+
+/*  Function: mapFile
+ *  Input:
+ *          cmdfile *c      :Command file to fill.
+ *          int fd          :File descriptor to read from.
+ *
+ *  Output: Maps a regular file copy-on-write and splits it in place. Returns false if
+ *          fd can't be mapped and has to be streamed.
+ */
+static bool mapFile(cmdfile *c, int fd) {
+    struct stat st;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0
+       || lseek(fd, 0, SEEK_CUR) != 0) {
+        return false;
+    }
+    size_t size = st.st_size;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    // An unterminated last line is ended by the zero filled rest of its page,
+    // unless the file fills the page exactly.
+    if(map[size - 1] != '\n' && size % sysconf(_SC_PAGESIZE) == 0) {
+        munmap(map, size);
+        return false;
+    }
+    c->arena = map;
+    c->mapLen = size;
+    c->len = size;
+    splitLines(c, 0, size);
+    lseek(fd, 0, SEEK_END);
+    return true;
+}
+
+/*  Function: streamFile
+ *  Input:
+ *          cmdfile *c      :Command file to fill.
+ *          int fd          :File descriptor to read from.
+ *
+ *  Output: Reads fd until end of file into the arena, splitting lines as they arrive.
+ */
+static void streamFile(cmdfile *c, int fd) {
+    while(true) {
+        // Keep one byte free for the terminator of an unterminated last line.
+        if(c->cap - c->len < CHUNKSIZE) {
+            c->cap = c->cap * 2 > c->len + CHUNKSIZE ? c->cap * 2 : c->len + CHUNKSIZE;
+            if((c->arena = realloc(c->arena, c->cap)) == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t n = read(fd, c->arena + c->len, c->cap - c->len - 1);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            exit(EXIT_FAILURE);
+        }
+        if(n == 0) {
+            break;
+        }
+        splitLines(c, c->len, c->len + n);
+        c->len += n;
+    }
+    c->arena[c->len] = '\0';
+}
+
+/*  Function: splitLines
+ *  Input:
+ *          cmdfile *c      :Command file.
+ *          size_t from     :Start of new bytes in arena.
+ *          size_t to       :End of new bytes in arena.
+ *
+ *  Output: Terminates every line in the range and records where the next one starts.
+ */
+static void splitLines(cmdfile *c, size_t from, size_t to) {
+    size_t pos = from;
+    while(pos < to) {
+        if(c->lineStart) {
+            if(c->lineAmt == c->offCap) {
+                c->offCap = c->offCap == 0 ? 64 : c->offCap * 2;
+                if((c->off = realloc(c->off, c->offCap * sizeof(size_t))) == NULL) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            c->off[c->lineAmt++] = pos;
+            c->lineStart = false;
+        }
+        char *nl = memchr(c->arena + pos, '\n', to - pos);
+        if(nl == NULL) {
+            break;
+        }
+        *nl = '\0';
+        pos = nl - c->arena + 1;
+        c->lineStart = true;
+    }
+}
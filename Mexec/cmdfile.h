@@ -0,0 +1,43 @@
+/*
+Command file header file
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+
+Reads the command lines given to mexec. A regular file is mmapped and split
+in place, anything else is streamed into one growable arena. Lines have no
+length limit.
+*/
+
+#ifndef CMDFILE_H
+#define CMDFILE_H
+
+typedef struct cmdfile cmdfile;
+
+/**
+ * Reads all lines from a file descriptor. The descriptor is left at end of
+ * file, so children inheriting it don't see the commands.
+ *
+ * @param fd		File descriptor to read from.
+ * @return			Pointer to the read lines.
+ */
+cmdfile *cmdfile_read(int fd);
+
+/**
+ * Gets the lines of a command file, without their newlines.
+ *
+ * @param c			Pointer to the command file.
+ * @param lineAmt	Set to the amount of lines.
+ * @return			Array of lines, terminated with NULL. The lines may be
+ *					modified, and are valid until cmdfile_kill.
+ */
+char **cmdfile_lines(cmdfile *c, int *lineAmt);
+
+/**
+ * Frees a command file and its lines.
+ *
+ * @param c			Pointer to the command file.
+ */
+void cmdfile_kill(cmdfile *c);
+
+#endif
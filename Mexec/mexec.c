@@ -5,317 +5,458 @@
 
 
   Description: Program that functions as a shell pipeline.
+               Each line is one command. Words can be quoted with '' or "", and a word starting
+               with <, >, >>, 2> or 2>> redirects that command to or from a file, and
+               >&2 or 2>&1 makes stdout or stderr a copy of the other.
+               Commands starting with ':' (:cat, :grep-F, :wc-l, :head, :cut) are builtins that run
+               as threads in mexec, see builtin.c.
+               -b flag: Batch mode, the input holds many pipelines separated by blank lines.
+               -d flag: Also separate pipelines by lines equal to the given delimiter.
+               -j flag: Run up to the given amount of pipelines at once.
+               -o flag: Write stdout/stderr of pipeline N to DIR/N.out and DIR/N.err instead of
+                        printing them prefixed with [N].
+               -g flag: Milliseconds a stage gets to exit after SIGTERM before SIGKILL (default 1000).
+                        Stages are stopped when a later stage is done.
+               -p/--auto-pin flag: Pin each stage to a CPU, adjacent stages on neighbouring CPUs
+                        sharing a last level cache.
+               A command can start with annotations placing its stage, see place.h:
+               @cpu LIST, @mem SIZE and @weight N.
+               --cache flag: Keep the output of the leading stages annotated @pure in the given
+                        directory, and use it instead of running them when the commands and their
+                        input files are unchanged. --cache-size limits the directory (default 1G).
+               --server SOCKET [HELPERS]: Serve clients from a pool of forked helpers (default 4).
+               --client SOCKET [options] [file]: Run through a server, see server.h.
+               Exit status is that of the first stage to fail, like pipefail in bash.
 */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <sys/wait.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include "pipeline.h"
+#include "cmdfile.h"
+#include "cache.h"
+#include "server.h"
 
-#define WRITE_END 1
-#define READ_END 0
-#define BUFSIZE 1024
+typedef struct {
+    // Values for flags
+    bool batch;
+    int jobs;
+    const char *outDir;
+    const char *delim;
+    int graceMs;
+    bool autopin;
+    const char *cacheDir;
+    long long cacheSize;
+    // Opened cacheDir, NULL if not caching.
+    cache *cache;
+} optVariable;
+
+struct job {
+    int id;
+    // Lines of the pipeline in the commands array.
+    int first;
+    int lineAmt;
+    pipeline *p;
+    int outfd;
+    int errfd;
+    int status;
+    // First stage to fail, -1 if none.
+    int failedStage;
+    const char *failedCommand;
+    double seconds;
+};
 
 // Fuction declaration
-void pipeline(char **array, int lineAmt);
-void createPipes(int lineAmt, int file_desc[lineAmt -1][2]);
-pid_t createFork(void);
-void directPipes(int iteration, int lineAmt, int file_desc[lineAmt-1][2]);
-void execute(char *command);
+int runMexec(int argc, char *argv[]);
+int getArgs(int argc, char *argv[], optVariable *varp);
+int runPipeline(char **commands, int lineAmt, optVariable var);
+int runBatch(char **commands, int lineAmt, optVariable var);
+bool isSeparator(const char *line, optVariable var);
+int openOutput(optVariable var, int id, const char *suffix);
+void finishJob(struct job *job, optVariable var);
+void emitOutput(int fd, FILE *to, int id);
 
 
 int main(int argc, char *argv[]) {
-    FILE *inputfile;
-    int lineAmt = 0;
-    char buf[BUFSIZE];
-    char *temp = NULL;
-    // Array of commands.
-    char **commands = malloc(sizeof(char *));
-    if(commands == NULL) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+    // Server and client modes, the client passes the rest of the arguments on.
+    if(argc >= 3 && strcmp(argv[1], "--server") == 0) {
+        int helpers = argc > 3 ? atoi(argv[3]) : 4;
+        if(argc > 4 || helpers < 1) {
+            fprintf(stderr, "usage: %s --server socket [helpers]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        return server_run(argv[2], helpers, runMexec);
     }
+    if(argc >= 3 && strcmp(argv[1], "--client") == 0) {
+        const char *path = argv[2];
+        argv[2] = argv[0];
+        return client_run(path, argc - 2, argv + 2);
+    }
+    return runMexec(argc, argv);
+}
+
+/*  Function: runMexec
+ *  Input:
+            int argc            :Argument count.
+            char *argv[]        :Arguments, options and an optional command file.
+ *
+ *  Output: Runs the commands as mexec was asked to, and returns the exit status. Called
+ *          by main, or by a server helper for a client.
+ */
+int runMexec(int argc, char *argv[]) {
+    int inputfile = STDIN_FILENO;
+    int lineAmt = 0;
+    int status;
+    // Default option values.
+    optVariable var = {false, 1, NULL, NULL, 1000, false, NULL, 1LL << 30, NULL};
+
+    int fileIndex = getArgs(argc, argv, &var);
 
     // No inputfile, read from stdin.
-    if(argc == 1) {
-        inputfile = stdin;
+    if(fileIndex == argc) {
+        inputfile = STDIN_FILENO;
     }
     // Read from inputfile.
-    else if(argc == 2) {
-        if ((inputfile = fopen(argv[1], "r")) == NULL) {
-            perror(argv[1]);
+    else if(fileIndex == argc - 1) {
+        if ((inputfile = open(argv[fileIndex], O_RDONLY | O_CLOEXEC)) == -1) {
+            perror(argv[fileIndex]);
             exit(EXIT_FAILURE);
         }
     }
     // Too many arguments, exit with error.
     else {
         fprintf(stderr, "Wrong number of arguments.\n");
-        fprintf(stderr, "usage: %s file\n", argv[0]);
+        fprintf(stderr, "usage: %s [-b] [-p] [-j jobs] [-o dir] [-d delim] [-g ms] [--cache dir [--cache-size size]] [file]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
-    // Read file line by line.
-    while(fgets(buf,BUFSIZE, inputfile) != NULL) {
-        // Allocate a new space in array for each line input.
-        commands = realloc(commands, (lineAmt + 1) * sizeof(char *));
-        if(commands == NULL) {
-            perror("realloc");
-            exit(EXIT_FAILURE);
-        }
-        // Allocate space for line variable.
-        temp =  malloc(strlen(buf) * sizeof(char));
-        if(temp == NULL) {
-            perror("malloc");
-            exit(EXIT_FAILURE);
-        }
-        // Remove trailing \n and replace with \0.
-        buf[strcspn(buf,"\n")] = '\0';
-        strcpy(temp, buf);
+    // Without a usable cache directory everything still runs, just uncached.
+    if(var.cacheDir != NULL) {
+        var.cache = cache_open(var.cacheDir, var.cacheSize);
+    }
 
-        // Store in array.
-        commands[lineAmt] = temp;
-        // Count the amount of entries so far.
-        ++lineAmt;
+    // Read every line, without any limit on line length.
+    cmdfile *input = cmdfile_read(inputfile);
+    // Array of commands.
+    char **commands = cmdfile_lines(input, &lineAmt);
+
+    // Pipe and execute commands.
+    if(var.batch) {
+        status = runBatch(commands, lineAmt, var);
     }
-    commands = realloc(commands, (lineAmt + 1) * sizeof(char *));
-    if(commands == NULL) {
-        perror("realloc");
-        exit(EXIT_FAILURE);
+    else {
+        status = runPipeline(commands, lineAmt, var);
     }
-    commands[lineAmt] = 0;
-    // Pipe and execute commands.
-    pipeline(commands, lineAmt);
 
     // Free commands.
-    for(int i = 0; i < lineAmt; i++) {
-        free(commands[i]);
+    cmdfile_kill(input);
+    if(var.cache != NULL) {
+        cache_close(var.cache);
     }
-    free(commands);
 
-    fclose(inputfile);
-    return 0;
+    if(inputfile != STDIN_FILENO) {
+        close(inputfile);
+    }
+    return status;
 }
 
-/*  Function: pipeline
+/*  Function: getArgs
  *  Input:
-            char **array    :Array to store commands.
-            int lineAmt     :Amount of lines in file.
-
- *  Output: Executes the every command in array, by piping cmd1 -> cmd2 -> cmd3..., and so on, until last command
- *          is reached, in which output goes to terminal.
+            int argc            :Argument count from main.
+            char *argv[]        :Argument values from main.
+            optVariable *varp   :Options to update.
+ *
+ *  Output: Index of the first argument that isn't an option.
  */
-void pipeline(char **array, int lineAmt) {
-
-    // Create 2 file descriptors for each pipe. We will need one pipe for each line except the last.
-    int file_desc[lineAmt - 1][2];
-    pid_t pid;
-    int status;
-    int j;
-
-    // Create pipes.
-    createPipes(lineAmt, file_desc);
-
-
-    // Create a process for each line, and pipe according to position of line.
-    for(j = 0; j < lineAmt; j++) {
-        pid = createFork();
-        // Child processes:
-        if(pid == 0) {
-            directPipes(j, lineAmt, file_desc);
-            // Leave loop after dup and close.
+int getArgs(int argc, char *argv[], optVariable *varp) {
+    int option;
+    char *endp;
+    static const struct option longOptions[] = {
+        {"auto-pin", no_argument, NULL, 'p'},
+        {"cache", required_argument, NULL, 'C'},
+        {"cache-size", required_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0}
+    };
+    while((option = getopt_long(argc, argv, "bpj:o:d:g:", longOptions, NULL)) != -1) {
+        switch(option) {
+            case 'b':
+            varp->batch = true;
             break;
-        }
-    }
-
-    // Parent process.
-    if(pid > 0) {
-        // Close all fd's.
-        for(int i = 0; i < lineAmt-1; i++) {
-            close(file_desc[i][READ_END]);
-            close(file_desc[i][WRITE_END]);
-        }
-    }
-
-    // Split commands in arguments and execute file.
-    if(pid == 0) {
-        execute(array[j]);
-
-    }
-
-    // Wait in children.
-    if(pid > 0) {
-        for(int i = 0; i < lineAmt; i++) {
-            if (wait(&status) == -1) {
-                perror("wait");
+            // Every option but -b only makes sense in batch mode, so they imply it.
+            case 'j':
+            varp->jobs = (int) strtol(optarg, &endp, 10);
+            if(*endp != '\0' || varp->jobs < 1) {
+                fprintf(stderr, "%s: -j needs a positive number\n", argv[0]);
                 exit(EXIT_FAILURE);
             }
-            else if(WEXITSTATUS(status) != 0) {
+            varp->batch = true;
+            break;
+            case 'o':
+            varp->outDir = optarg;
+            varp->batch = true;
+            break;
+            case 'd':
+            varp->delim = optarg;
+            varp->batch = true;
+            break;
+            case 'g':
+            varp->graceMs = (int) strtol(optarg, &endp, 10);
+            if(*endp != '\0' || varp->graceMs < 0) {
+                fprintf(stderr, "%s: -g needs a number of milliseconds\n", argv[0]);
                 exit(EXIT_FAILURE);
             }
+            break;
+            case 'p':
+            varp->autopin = true;
+            break;
+            case 'C':
+            varp->cacheDir = optarg;
+            break;
+            case 'S':
+            varp->cacheSize = strtoll(optarg, &endp, 10);
+            // K, M and G are powers of 1024.
+            if(*endp != '\0' && strchr("KMG", *endp) != NULL) {
+                varp->cacheSize <<= 10 * (strchr("KMG", *endp) - "KMG" + 1);
+                endp++;
+            }
+            if(*endp != '\0' || varp->cacheSize <= 0) {
+                fprintf(stderr, "%s: --cache-size needs a size like 512M or 2G\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+            default:
+            fprintf(stderr, "usage: %s [-b] [-p] [-j jobs] [-o dir] [-d delim] [-g ms] [--cache dir [--cache-size size]] [file]\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
     }
-    return;
+    return optind;
 }
 
-/*  Function: directPipes
+/*  Function: runPipeline
  *  Input:
-            int lineAmt     :Amount of lines in file.
-            int file_desc   :The filedescriptors for the pipe, in a 2D array.
+            char **commands     :Array of commands.
+            int lineAmt         :Amount of commands.
+            optVariable var     :Current flag statuses.
  *
- *  Output: Create pipes.
+ *  Output: Runs all commands as one pipeline with output to the terminal. Returns the exit
+ *          status of the first stage to fail, and says which stage it was.
  */
-void createPipes(int lineAmt, int file_desc[lineAmt -1][2]) {
-    int ret;
-    for(int i = 0; i < lineAmt-1; i++) {
-        if((ret = pipe(file_desc[i])) == -1){
-            perror("pipe");
-            exit(EXIT_FAILURE);
-        }
+int runPipeline(char **commands, int lineAmt, optVariable var) {
+    if(lineAmt == 0) {
+        return 0;
     }
-    return;
-}
-/*  Function: createFork
- *  Input:
-             void
- *
- *  Output: returns pid of child.
- */
-pid_t createFork(void) {
-    pid_t pid;
-    if((pid = fork()) == -1) {
-        perror("fork");
+    pipeline *p = pipeline_create(commands, lineAmt);
+    if(p == NULL) {
         exit(EXIT_FAILURE);
     }
-    return pid;
+    supervisor *s = supervisor_create(var.graceMs);
+    supervisor_set_autopin(s, var.autopin);
+    supervisor_set_cache(s, var.cache);
+    pipeline_start(p, s, -1, -1);
+    supervisor_wait(s);
+
+    int status = pipeline_status(p);
+    if(status != 0) {
+        fprintf(stderr, "mexec: stage %d (%s) failed with exit status %d\n", pipeline_failed(p) + 1,
+                pipeline_command(p, pipeline_failed(p)), status);
+    }
+    pipeline_kill(p);
+    supervisor_kill(s);
+    return status;
 }
 
-/*  Function: directPipes
+/*  Function: runBatch
  *  Input:
-            int iteration   :Current iteration loop.
-            int lineAmt     :Amount of lines in file.
-            int file_desc   :The filedescriptors for the pipe, in a 2D array.
+            char **commands     :Array of commands.
+            int lineAmt         :Amount of commands.
+            optVariable var     :Current flag statuses.
  *
- *  Output: Uses dup2 and close to direct pipes.
+ *  Output: Splits the commands into pipelines and runs up to var.jobs of them at once.
+ *          Prints a summary of failures and timings to stderr, and returns the exit
+ *          status for mexec.
  */
-void directPipes(int iteration, int lineAmt, int file_desc[lineAmt-1][2]) {
+int runBatch(char **commands, int lineAmt, optVariable var) {
+    struct job *jobs = NULL;
+    int jobAmt = 0;
+    struct timespec start, end;
 
-    // First process:
-    if(iteration == 0) {
-        // Change output from STDOUT to pipe.
-        if((dup2(file_desc[0][WRITE_END], STDOUT_FILENO))  == -1) {
-            perror("dup2");
-            exit(EXIT_FAILURE);
+    // Find the lines of each pipeline.
+    for(int i = 0; i < lineAmt; i++) {
+        if(isSeparator(commands[i], var)) {
+            continue;
         }
-
-        // Close all other pipe endings.
-        for(int i = 0; i < lineAmt-1; i++) {
-            if( i == 0) {
-                close(file_desc[0][READ_END]);
+        if(i == 0 || isSeparator(commands[i-1], var)) {
+            jobs = realloc(jobs, (jobAmt + 1) * sizeof(struct job));
+            if(jobs == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
             }
-            close(file_desc[i][READ_END]);
-            close(file_desc[i][WRITE_END]);
+            jobs[jobAmt] = (struct job){jobAmt + 1, i, 0, NULL, -1, -1, 0, -1, NULL, 0};
+            jobAmt++;
         }
+        jobs[jobAmt-1].lineAmt++;
     }
-    // Last process:
-    else if(iteration == lineAmt-1) {
-        // Change input to come from previous pipes write end.
-        if((dup2(file_desc[iteration-1][READ_END], STDIN_FILENO))  == -1) {
-            perror("dup2");
-            exit(EXIT_FAILURE);
-        }
 
-        // Close pipe endings.
-        for(int i = 0; i < iteration; i++) {
-            // Since we use read end of file descriptor iteration-1 we dont want to close it.
-            if(i != iteration-1){
-                close(file_desc[i][READ_END]);
-                close(file_desc[i][WRITE_END]);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    supervisor *s = supervisor_create(var.graceMs);
+    supervisor_set_autopin(s, var.autopin);
+    supervisor_set_cache(s, var.cache);
+    int next = 0;
+    int running = 0;
+    while(next < jobAmt || running > 0) {
+        // Fill free job slots.
+        while(running < var.jobs && next < jobAmt) {
+            struct job *job = &jobs[next++];
+            if((job->p = pipeline_create(commands + job->first, job->lineAmt)) == NULL) {
+                job->status = EXIT_FAILURE;
+                continue;
             }
-            else {
-                close(file_desc[iteration-1][WRITE_END]);
+            job->outfd = openOutput(var, job->id, "out");
+            job->errfd = openOutput(var, job->id, "err");
+            pipeline_start(job->p, s, job->outfd, job->errfd);
+            running++;
+        }
+        if(running == 0) {
+            continue;
+        }
+
+        // Wait for any pipeline to finish.
+        pipeline *p = supervisor_wait(s);
+        for(int i = 0; i < next; i++) {
+            if(jobs[i].p == p) {
+                finishJob(&jobs[i], var);
             }
         }
+        running--;
     }
-    // Middle processes:
-    else {
-        // Change input to come from previous pipes write end.
-        if(dup2(file_desc[iteration-1][READ_END], STDIN_FILENO) == -1) {
-            perror("dup2");
-            exit(EXIT_FAILURE);
-        }
-        // Change output to go to pipe.
-        if(dup2(file_desc[iteration][WRITE_END], STDOUT_FILENO) == -1) {
-            perror("dup2");
-            exit(EXIT_FAILURE);
+    supervisor_kill(s);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Summary.
+    int failed = 0;
+    double total = 0;
+    for(int i = 0; i < jobAmt; i++) {
+        total += jobs[i].seconds;
+        if(jobs[i].status == 0) {
+            continue;
         }
-        // Close pipe endings.
-        for(int i = 0; i < iteration; i++) {
-            // Since we use read end of file descriptor iteration-1 we dont want to close it.
-            if(  i != iteration-1) {
-                close(file_desc[i][READ_END]);
-                close(file_desc[i][WRITE_END]);
-            }
-            else {
-                close(file_desc[iteration-1][WRITE_END]);
-            }
+        if(jobs[i].failedStage != -1) {
+            fprintf(stderr, "mexec: [%d] stage %d (%s) failed with exit status %d after %.3fs\n",
+                    jobs[i].id, jobs[i].failedStage + 1, jobs[i].failedCommand, jobs[i].status,
+                    jobs[i].seconds);
         }
-        for(int i = iteration; i < lineAmt-1; i++) {
-            // Since we use write end of file descriptor iteration we dont want to close it.
-            if(i != iteration){
-                close(file_desc[i][READ_END]);
-                close(file_desc[i][WRITE_END]);
-            }
-            else {
-                close(file_desc[iteration][READ_END]);
-            }
+        else {
+            fprintf(stderr, "mexec: [%d] invalid pipeline\n", jobs[i].id);
         }
+        failed++;
     }
+    fprintf(stderr, "mexec: %d pipelines, %d failed, %.3fs wall, %.3fs total\n", jobAmt, failed,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, total);
+    free(jobs);
+    return failed == 0 ? 0 : EXIT_FAILURE;
 }
 
-/*  Function: execute
+/*  Function: isSeparator
  *  Input:
-            char *command   :Command to split into arguments and execute.
+            const char *line    :Line of input.
+            optVariable var     :Current flag statuses.
  *
- *  Output: Executes command and outputs it into pipe or if last line of file, to terminal.
+ *  Output: True if the line is blank or the delimiter, which ends a pipeline in batch mode.
  */
-void execute(char *command) {
-    int i = 0;
-     // Array to store arguments in.
-    char **argv = NULL;
-    char *c;
-
-    // Token c contains line without " ". (??)
-    c = strtok(command, " ");
-    if(c == NULL) {
-         perror("strtok");
-         exit(EXIT_FAILURE);
+bool isSeparator(const char *line, optVariable var) {
+    if(var.delim != NULL && strcmp(line, var.delim) == 0) {
+        return true;
     }
-    while (c) {
-        // Allocate space for each argument.
-        argv = realloc(argv, sizeof(char *) * (i + 1));
-        if(argv == NULL) {
-            perror("realloc");
+    return line[strspn(line, " \t\r")] == '\0';
+}
+
+/*  Function: openOutput
+ *  Input:
+            optVariable var     :Current flag statuses.
+            int id              :Number of the pipeline.
+            const char *suffix  :"out" or "err".
+ *
+ *  Output: File descriptor for output of a pipeline. Either DIR/id.suffix or, without -o,
+ *          an in-memory file that is printed when the pipeline is done.
+ */
+int openOutput(optVariable var, int id, const char *suffix) {
+    int fd;
+    if(var.outDir == NULL) {
+        if((fd = memfd_create(suffix, MFD_CLOEXEC)) == -1) {
+            perror("memfd_create");
             exit(EXIT_FAILURE);
         }
-        // Store argument in array and continue until token is NULL.
-        argv[i] = c;
-        i++;
-        c = strtok(NULL, " ");
+        return fd;
     }
-    // Allocate space for NULL.
-    argv = realloc(argv, sizeof(char*) * (i + 1));
-    if(argv == NULL) {
-        perror("realloc");
+    char path[strlen(var.outDir) + 32];
+    snprintf(path, sizeof(path), "%s/%d.%s", var.outDir, id, suffix);
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        perror(path);
         exit(EXIT_FAILURE);
     }
-    // Add a NULL in the last position of the array.
-    argv[i] = 0;
-
-    // Execute programs.
-    execvp(argv[0],argv);
-    // Child shouldn't reach these lines.
-    perror(argv[0]);
-    exit(EXIT_FAILURE);
+    return fd;
+}
 
+/*  Function: finishJob
+ *  Input:
+            struct job *job     :Job whose pipeline has finished.
+            optVariable var     :Current flag statuses.
+ *
+ *  Output: Records the result of the job, prints its buffered output and frees the pipeline.
+ */
+void finishJob(struct job *job, optVariable var) {
+    job->status = pipeline_status(job->p);
+    // The command names point into the command lines, which outlive the pipeline.
+    if((job->failedStage = pipeline_failed(job->p)) != -1) {
+        job->failedCommand = pipeline_command(job->p, job->failedStage);
+    }
+    job->seconds = pipeline_seconds(job->p);
+    if(var.outDir == NULL) {
+        emitOutput(job->outfd, stdout, job->id);
+        emitOutput(job->errfd, stderr, job->id);
+    }
+    close(job->outfd);
+    close(job->errfd);
+    pipeline_kill(job->p);
+    job->p = NULL;
+}
 
+/*  Function: emitOutput
+ *  Input:
+            int fd      :In-memory file with the output of a pipeline.
+            FILE *to    :Stream to print to.
+            int id      :Number of the pipeline.
+ *
+ *  Output: Prints every line of the output, prefixed with the pipeline number.
+ */
+void emitOutput(int fd, FILE *to, int id) {
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        perror("fstat");
+        exit(EXIT_FAILURE);
+    }
+    if(st.st_size == 0) {
+        return;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    char *end = data + st.st_size;
+    for(char *line = data; line < end;) {
+        char *nl = memchr(line, '\n', end - line);
+        char *lineEnd = nl != NULL ? nl : end;
+        fprintf(to, "[%d] %.*s\n", id, (int)(lineEnd - line), line);
+        line = lineEnd + 1;
+    }
+    fflush(to);
+    munmap(data, st.st_size);
 }
@@ -0,0 +1,1291 @@
+/*
+Pipeline execution and supervision
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include "builtin.h"
+#include "place.h"
+#include "cache.h"
+#include "pipeline.h"
+
+#define WRITE_END 1
+#define READ_END 0
+
+struct stage {
+    char **argv;
+    // NULL for external commands.
+    builtin *builtin;
+    pid_t pid;
+    int pidfd;
+    int status;
+    bool done;
+    // Stopped by mexec because the stages after it are done.
+    bool killed;
+    // When to send SIGKILL after SIGTERM, in ms, 0 if not pending.
+    long long killAt;
+    // Redirected stdin, stdout and stderr, NULL if not redirected.
+    char *inPath;
+    char *outPath;
+    char *errPath;
+    bool outAppend;
+    bool errAppend;
+    // Opened redirections, indexed by the fd they replace. -1 if not redirected.
+    int redir[3];
+    // Descriptor stdout and stderr are made copies of by >&N, -1 if none.
+    int dup[3];
+    // Position among the redirections of the command of the last one of each fd, 0 if none.
+    int order[3];
+    // CPUs and cgroup limits from @ annotations.
+    placement place;
+    // Annotated @pure: the output only depends on the command and its input files.
+    bool pure;
+    // Cached output the stage writes instead of running its command, -1 if none.
+    int cacheFd;
+    // Cache entry the stage copies its input to while passing it on, -1 if none.
+    int teeFd;
+};
+
+struct pipeline {
+    int lineAmt;
+    struct stage *stages;
+    // One pipe or channel between each pair of stages.
+    int (*file_desc)[2];
+    channel **channels;
+    // Stages not yet finished.
+    int running;
+    // Index of the first stage that failed, -1 if none.
+    int failed;
+    struct timespec start;
+    struct timespec end;
+    pipeline *next;
+    // Stage inserted after a pure prefix to fill the cache, -1 if none.
+    int teeAt;
+    // The inserted stage copied everything to tmpPath, which becomes the entry of key.
+    bool teeOk;
+    cache_key key;
+    char *tmpPath;
+};
+
+struct supervisor {
+    // Time between SIGTERM and SIGKILL when tearing down stages.
+    int graceMs;
+    // Builtin threads write their handle here when they finish.
+    int notify[2];
+    pipeline *running;
+    struct pollfd *fds;
+    struct stage **fdStages;
+    size_t cap;
+    // Pin stages without @cpu to neighbouring CPUs, counting on from nextSlot.
+    bool autopin;
+    int nextSlot;
+    // Store for the output of pure prefixes, NULL if not caching.
+    cache *cache;
+};
+
+// Fuction declaration
+static void createPipes(int lineAmt, int file_desc[lineAmt -1][2], struct stage *stages, channel **channels);
+static pid_t createFork(void);
+static void directPipes(int iteration, int lineAmt, int file_desc[lineAmt-1][2], int outfd, int errfd, const struct stage *stage);
+static char **tokenize(char *command, struct stage *stage);
+static int openRedirects(pipeline *p);
+static void execute(char **argv);
+static void stageDone(supervisor *s, pipeline *p, struct stage *stage, int status);
+static void teardown(supervisor *s, pipeline *p, int upto);
+static long long nowMs(void);
+static void cachePrefix(supervisor *s, pipeline *p);
+static bool hashInput(cache_hasher *h, const struct stat *st, off_t offset);
+static bool statProgram(const char *name, struct stat *st);
+static void cacheFinish(supervisor *s, pipeline *p);
+static void copyStage(struct stage *stage);
+static bool writeAll(int fd, const char *buf, size_t len);
+
+/*  Function: supervisor_create
+ *  Input:
+ *          int graceMs     :Time stages get to exit after SIGTERM before SIGKILL.
+ *
+ *  Output: A supervisor with no running pipelines.
+ */
+supervisor *supervisor_create(int graceMs) {
+    supervisor *s = calloc(1, sizeof(supervisor));
+    if(s == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    s->graceMs = graceMs;
+    if(pipe2(s->notify, O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    // A builtin that writes an error to stderr gets EPIPE instead of being killed.
+    // Children restore the default.
+    signal(SIGPIPE, SIG_IGN);
+    return s;
+}
+
+/*  Function: supervisor_kill
+ *  Input:
+ *          supervisor *s   :Supervisor to free.
+ *
+ *  Output: Frees the supervisor.
+ */
+void supervisor_kill(supervisor *s) {
+    close(s->notify[READ_END]);
+    close(s->notify[WRITE_END]);
+    free(s->fds);
+    free(s->fdStages);
+    free(s);
+    placement_cleanup();
+}
+
+/*  Function: supervisor_set_autopin
+ *  Input:
+ *          supervisor *s   :Supervisor.
+ *          bool autopin    :Whether to pin stages.
+ *
+ *  Output: Stages of pipelines started from now on without a @cpu annotation are pinned
+ *          to a CPU each, adjacent stages on neighbouring CPUs of the same last level cache.
+ */
+void supervisor_set_autopin(supervisor *s, bool autopin) {
+    s->autopin = autopin;
+}
+
+/*  Function: supervisor_set_cache
+ *  Input:
+ *          supervisor *s   :Supervisor.
+ *          cache *c        :Cache to use, NULL to not cache.
+ *
+ *  Output: Pipelines started from now on take the output of their @pure prefix from the
+ *          cache if it's there, and put it there otherwise.
+ */
+void supervisor_set_cache(supervisor *s, cache *c) {
+    s->cache = c;
+}
+
+/*  Function: supervisor_wait
+ *  Input:
+ *          supervisor *s   :Supervisor of the running pipelines.
+ *
+ *  Output: Polls the pidfd of every running child and the builtin notify pipe until
+ *          some pipeline has no running stages left, and returns that pipeline. Stages
+ *          that ignore SIGTERM get SIGKILL when their grace period is over.
+ */
+pipeline *supervisor_wait(supervisor *s) {
+    while(true) {
+        // Return a finished pipeline if there is one.
+        size_t n = 1;
+        for(pipeline **pp = &s->running; *pp != NULL; pp = &(*pp)->next) {
+            pipeline *p = *pp;
+            if(p->running == 0) {
+                *pp = p->next;
+                p->next = NULL;
+                return p;
+            }
+            n += p->lineAmt;
+        }
+        if(s->running == NULL) {
+            return NULL;
+        }
+
+        if(n > s->cap) {
+            s->fds = realloc(s->fds, n * sizeof(struct pollfd));
+            s->fdStages = realloc(s->fdStages, n * sizeof(struct stage *));
+            if(s->fds == NULL || s->fdStages == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+            s->cap = n;
+        }
+        // Slot 0 is the notify pipe, the rest are pidfds of running children.
+        s->fds[0] = (struct pollfd){s->notify[READ_END], POLLIN, 0};
+        n = 1;
+        long long deadline = -1;
+        for(pipeline *p = s->running; p != NULL; p = p->next) {
+            for(int j = 0; j < p->lineAmt; j++) {
+                struct stage *stage = &p->stages[j];
+                if(stage->builtin == NULL && !stage->done) {
+                    s->fds[n] = (struct pollfd){stage->pidfd, POLLIN, 0};
+                    s->fdStages[n] = stage;
+                    n++;
+                    if(stage->killAt != 0 && (deadline == -1 || stage->killAt < deadline)) {
+                        deadline = stage->killAt;
+                    }
+                }
+            }
+        }
+
+        // Wake up for the first pending SIGKILL.
+        int timeout = -1;
+        if(deadline != -1) {
+            long long left = deadline - nowMs();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        if(poll(s->fds, n, timeout) == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        // Kill children whose grace period is over.
+        long long now = nowMs();
+        for(size_t i = 1; i < n; i++) {
+            struct stage *stage = s->fdStages[i];
+            if(s->fds[i].revents == 0 && stage->killAt != 0 && stage->killAt <= now) {
+                syscall(SYS_pidfd_send_signal, stage->pidfd, SIGKILL, NULL, 0);
+                stage->killAt = 0;
+            }
+        }
+
+        // Reap children that have exited.
+        for(size_t i = 1; i < n; i++) {
+            if(s->fds[i].revents == 0) {
+                continue;
+            }
+            struct stage *stage = s->fdStages[i];
+            int status;
+            if(waitpid(stage->pid, &status, 0) == -1) {
+                perror("waitpid");
+                exit(EXIT_FAILURE);
+            }
+            close(stage->pidfd);
+            // Like a shell: death by signal is 128 + signal, except SIGPIPE which only
+            // means the reader was done.
+            int code = 0;
+            if(WIFEXITED(status)) {
+                code = WEXITSTATUS(status);
+            }
+            else if(WIFSIGNALED(status) && WTERMSIG(status) != SIGPIPE) {
+                code = 128 + WTERMSIG(status);
+            }
+            for(pipeline *p = s->running; p != NULL; p = p->next) {
+                if(stage >= p->stages && stage < p->stages + p->lineAmt) {
+                    stageDone(s, p, stage, code);
+                }
+            }
+        }
+
+        // Join builtins that have finished.
+        if(s->fds[0].revents != 0) {
+            builtin *done[64];
+            ssize_t len = read(s->notify[READ_END], done, sizeof(done));
+            if(len == -1 && errno != EINTR) {
+                perror("read");
+                exit(EXIT_FAILURE);
+            }
+            for(ssize_t k = 0; k < len / (ssize_t)sizeof(builtin *); k++) {
+                for(pipeline *p = s->running; p != NULL; p = p->next) {
+                    for(int j = 0; j < p->lineAmt; j++) {
+                        if(p->stages[j].builtin == done[k]) {
+                            p->stages[j].builtin = NULL;
+                            stageDone(s, p, &p->stages[j], builtin_join(done[k]));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*  Function: stageDone
+ *  Input:
+ *          supervisor *s       :Supervisor of the pipeline.
+ *          pipeline *p         :Pipeline of the stage.
+ *          struct stage *stage :Stage that finished.
+ *          int status          :Exit status of the stage.
+ *
+ *  Output: Records the result, and the end time when it was the last stage. Whatever
+ *          the stages before it still produce has no reader anymore, so they are torn down.
+ */
+static void stageDone(supervisor *s, pipeline *p, struct stage *stage, int status) {
+    int index = stage - p->stages;
+    // The cache copy never fails the pipeline, it only decides if the entry is kept. It
+    // exits 0 only after copying everything, even if it was told to stop meanwhile.
+    if(index == p->teeAt) {
+        p->teeOk = status == 0;
+        status = 0;
+    }
+    // A stage mexec stopped didn't fail by itself.
+    stage->status = stage->killed ? 0 : status;
+    stage->done = true;
+    placement_release(&stage->place);
+    if(stage->status != 0 && p->failed == -1) {
+        p->failed = index;
+    }
+    teardown(s, p, index);
+    if(--p->running == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &p->end);
+        cacheFinish(s, p);
+    }
+}
+
+/*  Function: teardown
+ *  Input:
+ *          supervisor *s   :Supervisor of the pipeline.
+ *          pipeline *p     :Pipeline to tear down.
+ *          int upto        :Stop the stages before this one.
+ *
+ *  Output: Sends SIGTERM to running children and schedules SIGKILL after the grace
+ *          period. Running builtins are cancelled.
+ */
+static void teardown(supervisor *s, pipeline *p, int upto) {
+    for(int j = 0; j < upto; j++) {
+        struct stage *stage = &p->stages[j];
+        if(stage->done || stage->killed) {
+            continue;
+        }
+        stage->killed = true;
+        if(stage->builtin != NULL) {
+            builtin_cancel(stage->builtin);
+        }
+        // The pidfd can't signal a reused pid, and fails quietly if the child has exited.
+        else if(syscall(SYS_pidfd_send_signal, stage->pidfd, SIGTERM, NULL, 0) == 0) {
+            stage->killAt = nowMs() + s->graceMs;
+        }
+    }
+}
+
+/*  Function: nowMs
+ *  Input:
+ *          void
+ *
+ *  Output: Monotonic time in milliseconds.
+ */
+static long long nowMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/*  Function: pipeline_create
+ *  Input:
+ *          char **commands     :Array of command lines.
+ *          int lineAmt         :Amount of lines.
+ *
+ *  Output: A pipeline with every line split into arguments and redirections and the
+ *          builtins set up, or NULL if a line is invalid.
+ */
+pipeline *pipeline_create(char **commands, int lineAmt) {
+    pipeline *p = calloc(1, sizeof(pipeline));
+    if(p == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    p->lineAmt = lineAmt;
+    p->failed = -1;
+    p->teeAt = -1;
+    // Room for a stage filling the cache.
+    p->stages = calloc(lineAmt + 1, sizeof(struct stage));
+    p->file_desc = calloc(lineAmt + 1, sizeof(int[2]));
+    p->channels = calloc(lineAmt + 1, sizeof(channel *));
+    if(p->stages == NULL || p->file_desc == NULL || p->channels == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int j = 0; j < lineAmt; j++) {
+        struct stage *stage = &p->stages[j];
+        placement_init(&stage->place);
+        stage->pidfd = -1;
+        stage->cacheFd = -1;
+        stage->teeFd = -1;
+        stage->redir[0] = stage->redir[1] = stage->redir[2] = -1;
+        stage->dup[0] = stage->dup[1] = stage->dup[2] = -1;
+        stage->argv = tokenize(commands[j], stage);
+        if(stage->argv == NULL) {
+            pipeline_kill(p);
+            return NULL;
+        }
+        if(builtin_is(stage->argv[0]) && (stage->builtin = builtin_create(stage->argv)) == NULL) {
+            pipeline_kill(p);
+            return NULL;
+        }
+        // Builtins are threads of mexec, only their CPUs can be set.
+        if(stage->builtin != NULL && (stage->place.memMax != -1 || stage->place.weight != 0)) {
+            fprintf(stderr, "mexec: %s: @mem and @weight don't apply to builtins\n", stage->argv[0]);
+        }
+    }
+    return p;
+}
+
+/*  Function: pipeline_start
+ *  Input:
+ *          pipeline *p     :Pipeline to start.
+ *          supervisor *s   :Supervisor to reap the stages.
+ *          int outfd       :Output of the last stage, -1 for stdout.
+ *          int errfd       :Error output of the stages, -1 for stderr.
+ *
+ *  Output: Forks a process for each external command and starts a thread for each
+ *          builtin. All forks happen before any builtin of the pipeline is started.
+ */
+void pipeline_start(pipeline *p, supervisor *s, int outfd, int errfd) {
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    p->next = s->running;
+    s->running = p;
+
+    // Replace the pure prefix by its cached output, or add a stage that caches it.
+    if(s->cache != NULL) {
+        cachePrefix(s, p);
+    }
+    int lineAmt = p->lineAmt;
+    p->running = 0;
+    for(int j = 0; j < lineAmt; j++) {
+        p->running += !p->stages[j].done;
+    }
+
+    // Open all redirections first, a missing file fails the pipeline before anything runs.
+    int failed = openRedirects(p);
+    if(failed != -1) {
+        for(int j = 0; j < lineAmt; j++) {
+            p->stages[j].done = true;
+        }
+        p->stages[failed].status = EXIT_FAILURE;
+        p->failed = failed;
+        p->running = 0;
+        p->end = p->start;
+        return;
+    }
+
+    // Place the stages. Cgroups are created here so the children only have to join them.
+    for(int j = 0; j < lineAmt; j++) {
+        struct stage *stage = &p->stages[j];
+        if(s->autopin) {
+            placement_autopin(&stage->place, s->nextSlot + j);
+        }
+        if(stage->builtin == NULL) {
+            placement_prepare(&stage->place);
+        }
+        else if(stage->place.pinned) {
+            builtin_pin(stage->builtin, &stage->place.cpus);
+        }
+    }
+    s->nextSlot += lineAmt;
+
+    // Create pipes.
+    createPipes(lineAmt, p->file_desc, p->stages, p->channels);
+
+    // Create a process for each external command, and pipe according to position of line.
+    for(int j = 0; j < lineAmt; j++) {
+        struct stage *stage = &p->stages[j];
+        if(stage->builtin != NULL || stage->done) {
+            continue;
+        }
+        pid = createFork();
+        // Child processes:
+        if(pid == 0) {
+            directPipes(j, lineAmt, p->file_desc, outfd, errfd, stage);
+            placement_enter(&stage->place);
+            if(stage->cacheFd != -1 || stage->teeFd != -1) {
+                copyStage(stage);
+            }
+            execute(stage->argv);
+        }
+        stage->pid = pid;
+        if((stage->pidfd = syscall(SYS_pidfd_open, pid, 0)) == -1) {
+            perror("pidfd_open");
+            exit(EXIT_FAILURE);
+        }
+        for(int fd = 0; fd < 3; fd++) {
+            if(stage->redir[fd] != -1) {
+                close(stage->redir[fd]);
+            }
+        }
+        if(stage->cacheFd != -1) {
+            close(stage->cacheFd);
+            stage->cacheFd = -1;
+        }
+        if(stage->teeFd != -1) {
+            close(stage->teeFd);
+            stage->teeFd = -1;
+        }
+    }
+
+    // Parent process.
+    // Close all fd's not used by a builtin. A redirected builtin doesn't use its pipe.
+    for(int i = 0; i < lineAmt-1; i++) {
+        if(p->channels[i] != NULL) {
+            continue;
+        }
+        if(p->stages[i].builtin == NULL || p->stages[i].redir[STDOUT_FILENO] != -1
+           || p->stages[i].dup[STDOUT_FILENO] != -1) {
+            close(p->file_desc[i][WRITE_END]);
+        }
+        if(p->stages[i+1].builtin == NULL || p->stages[i+1].redir[STDIN_FILENO] != -1) {
+            close(p->file_desc[i][READ_END]);
+        }
+    }
+
+    // Start builtins, reading from and writing to either a redirected file, a neighbouring
+    // pipe or a channel.
+    for(int j = 0; j < lineAmt; j++) {
+        struct stage *stage = &p->stages[j];
+        if(stage->builtin == NULL) {
+            continue;
+        }
+        int infd = STDIN_FILENO;
+        int stageOut = STDOUT_FILENO;
+        channel *in = NULL;
+        channel *out = NULL;
+        if(stage->redir[STDIN_FILENO] != -1) {
+            infd = stage->redir[STDIN_FILENO];
+        }
+        else if(j > 0) {
+            in = p->channels[j-1];
+            infd = in == NULL ? p->file_desc[j-1][READ_END] : -1;
+        }
+        if(stage->redir[STDOUT_FILENO] != -1) {
+            stageOut = stage->redir[STDOUT_FILENO];
+        }
+        // >&2, the builtin's stderr is mexec's.
+        else if(stage->dup[STDOUT_FILENO] != -1) {
+            if((stageOut = fcntl(errfd == -1 ? STDERR_FILENO : errfd, F_DUPFD_CLOEXEC, 0)) == -1) {
+                perror("fcntl");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(j < lineAmt-1) {
+            out = p->channels[j];
+            stageOut = out == NULL ? p->file_desc[j][WRITE_END] : -1;
+        }
+        // The builtin closes its descriptor when done, so give it its own copy.
+        else if(outfd != -1 && (stageOut = fcntl(outfd, F_DUPFD_CLOEXEC, 0)) == -1) {
+            perror("fcntl");
+            exit(EXIT_FAILURE);
+        }
+        // Builtins report errors on mexec's stderr.
+        if(stage->redir[STDERR_FILENO] != -1) {
+            close(stage->redir[STDERR_FILENO]);
+        }
+        builtin_start(stage->builtin, infd, in, stageOut, out, s->notify[WRITE_END]);
+    }
+}
+
+/*  Function: pipeline_status
+ *  Input:
+ *          const pipeline *p   :Finished pipeline.
+ *
+ *  Output: 0 if every stage succeeded, otherwise exit status of the first stage to fail.
+ */
+int pipeline_status(const pipeline *p) {
+    return p->failed == -1 ? 0 : p->stages[p->failed].status;
+}
+
+/*  Function: pipeline_failed
+ *  Input:
+ *          const pipeline *p   :Finished pipeline.
+ *
+ *  Output: Index of the first stage to fail, -1 if none failed.
+ */
+int pipeline_failed(const pipeline *p) {
+    // Number stages as in the input, without the one filling the cache.
+    if(p->teeAt != -1 && p->failed > p->teeAt) {
+        return p->failed - 1;
+    }
+    return p->failed;
+}
+
+/*  Function: pipeline_command
+ *  Input:
+ *          const pipeline *p   :Pipeline.
+ *          int stage           :Index of a stage.
+ *
+ *  Output: Name of the command of the stage.
+ */
+const char *pipeline_command(const pipeline *p, int stage) {
+    if(p->teeAt != -1 && stage >= p->teeAt) {
+        stage++;
+    }
+    return p->stages[stage].argv[0];
+}
+
+/*  Function: pipeline_seconds
+ *  Input:
+ *          const pipeline *p   :Finished pipeline.
+ *
+ *  Output: Seconds the pipeline ran.
+ */
+double pipeline_seconds(const pipeline *p) {
+    return (p->end.tv_sec - p->start.tv_sec) + (p->end.tv_nsec - p->start.tv_nsec) / 1e9;
+}
+
+/*  Function: pipeline_kill
+ *  Input:
+ *          pipeline *p     :Pipeline to free.
+ *
+ *  Output: Frees the pipeline.
+ */
+void pipeline_kill(pipeline *p) {
+    for(int j = 0; j < p->lineAmt; j++) {
+        if(j < p->lineAmt-1 && p->channels[j] != NULL) {
+            channel_kill(p->channels[j]);
+        }
+        // Builtins that were never started.
+        if(p->stages[j].builtin != NULL) {
+            builtin_kill(p->stages[j].builtin);
+        }
+        placement_release(&p->stages[j].place);
+        // Stages that were never started.
+        if(p->stages[j].cacheFd != -1) {
+            close(p->stages[j].cacheFd);
+        }
+        if(p->stages[j].teeFd != -1) {
+            close(p->stages[j].teeFd);
+        }
+        free(p->stages[j].argv);
+    }
+    if(p->tmpPath != NULL) {
+        cache_abort(p->tmpPath);
+    }
+    free(p->stages);
+    free(p->file_desc);
+    free(p->channels);
+    free(p);
+}
+
+/*  Function: createPipes
+ *  Input:
+            int lineAmt         :Amount of lines in file.
+            int file_desc       :The filedescriptors for the pipe, in a 2D array.
+            struct stage *stages:Stages of the pipeline.
+            channel **channels  :Set to the channel between two builtins, or NULL.
+ *
+ *  Output: Create pipes. Two adjacent builtins get a channel instead of a pipe, unless
+ *          a redirection replaces it.
+ */
+static void createPipes(int lineAmt, int file_desc[lineAmt -1][2], struct stage *stages, channel **channels) {
+    int ret;
+    for(int i = 0; i < lineAmt-1; i++) {
+        channels[i] = NULL;
+        if(stages[i].builtin != NULL && stages[i+1].builtin != NULL
+           && stages[i].outPath == NULL && stages[i].dup[STDOUT_FILENO] == -1
+           && stages[i+1].inPath == NULL) {
+            channels[i] = channel_create();
+            file_desc[i][READ_END] = -1;
+            file_desc[i][WRITE_END] = -1;
+            continue;
+        }
+        // Close on exec, so children only keep the endings they dup.
+        if((ret = pipe2(file_desc[i], O_CLOEXEC)) == -1){
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return;
+}
+
+/*  Function: createFork
+ *  Input:
+             void
+ *
+ *  Output: returns pid of child.
+ */
+static pid_t createFork(void) {
+    pid_t pid;
+    // Don't let a child that fails to exec write buffered output a second time.
+    fflush(stdout);
+    if((pid = fork()) == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+/*  Function: directPipes
+ *  Input:
+            int iteration   :Current iteration loop.
+            int lineAmt     :Amount of lines in file.
+            int file_desc   :The filedescriptors for the pipe, in a 2D array.
+            int outfd       :Output of the last process, -1 for stdout.
+            int errfd       :Error output, -1 for stderr.
+            struct stage *stage :Stage with the redirections of the command.
+ *
+ *  Output: Uses dup2 to direct pipes and redirections. The other pipe endings are close on exec.
+ *          Redirections are made in the order they were written, so >&N copies the
+ *          descriptor as redirected before it, like in a shell.
+ */
+static void directPipes(int iteration, int lineAmt, int file_desc[lineAmt-1][2], int outfd, int errfd, const struct stage *stage) {
+
+    signal(SIGPIPE, SIG_DFL);
+
+    // Every process but the first: change input to come from previous pipes read end.
+    if(iteration > 0) {
+        if((dup2(file_desc[iteration-1][READ_END], STDIN_FILENO))  == -1) {
+            perror("dup2");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Every process but the last: change output from STDOUT to pipe.
+    if(iteration < lineAmt-1) {
+        outfd = file_desc[iteration][WRITE_END];
+    }
+    if(outfd != -1 && dup2(outfd, STDOUT_FILENO) == -1) {
+        perror("dup2");
+        exit(EXIT_FAILURE);
+    }
+    if(errfd != -1 && dup2(errfd, STDERR_FILENO) == -1) {
+        perror("dup2");
+        exit(EXIT_FAILURE);
+    }
+    // Redirections replace the pipe endings, the earliest written first.
+    bool made[3] = {false, false, false};
+    while(true) {
+        int fd = -1;
+        for(int i = 0; i < 3; i++) {
+            if(!made[i] && stage->order[i] != 0 && (fd == -1 || stage->order[i] < stage->order[fd])) {
+                fd = i;
+            }
+        }
+        if(fd == -1) {
+            break;
+        }
+        made[fd] = true;
+        int from = stage->dup[fd] != -1 ? stage->dup[fd] : stage->redir[fd];
+        if(from != -1 && dup2(from, fd) == -1) {
+            perror("dup2");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*  Function: tokenize
+ *  Input:
+            char *command       :Command to split into arguments.
+            struct stage *stage :Stage to store redirections in.
+ *
+ *  Output: NULL terminated array of arguments, pointing into command. Words are split on
+ *          blanks, quotes and backslashes are removed in place. A word starting with <, >,
+ *          >>, 2> or 2>> names a file to redirect to instead of being an argument, and >&N or
+ *          2>&N with N 1 or 2 makes stdout or stderr a copy of that descriptor. Unquoted
+ *          words starting with @ before the command name are annotations, each followed by
+ *          its value. NULL if the command is empty, has an unterminated quote or an invalid
+ *          annotation.
+ */
+static char **tokenize(char *command, struct stage *stage) {
+    int i = 0;
+     // Array to store arguments in.
+    char **argv = NULL;
+    // Read and write position, unquoting never makes a word longer.
+    char *r = command;
+    char *w = command;
+    // Annotation waiting for its value.
+    char *key = NULL;
+    // Redirections read so far.
+    int order = 0;
+
+    while(true) {
+        while(*r == ' ' || *r == '\t') {
+            r++;
+        }
+        if(*r == '\0') {
+            break;
+        }
+
+        // Redirection operator, the file name follows directly or as the next word.
+        char **target = NULL;
+        int fd = -1;
+        bool append = false;
+        bool annotation = i == 0 && key == NULL && *r == '@';
+        if(key != NULL) {
+            // The value of an annotation is a plain word.
+        }
+        else if(*r == '<') {
+            target = &stage->inPath;
+            fd = STDIN_FILENO;
+            r++;
+        }
+        else if(*r == '>' || (r[0] == '2' && r[1] == '>')) {
+            bool err = *r == '2';
+            r += err ? 2 : 1;
+            append = *r == '>';
+            if(append) {
+                r++;
+            }
+            target = err ? &stage->errPath : &stage->outPath;
+            fd = err ? STDERR_FILENO : STDOUT_FILENO;
+            *(err ? &stage->errAppend : &stage->outAppend) = append;
+        }
+        if(target != NULL) {
+            while(*r == ' ' || *r == '\t') {
+                r++;
+            }
+            if(*r == '\0') {
+                fprintf(stderr, "mexec: missing file name after redirection\n");
+                free(argv);
+                return NULL;
+            }
+            // A descriptor to copy instead of a file, only stdout and stderr can be copied.
+            if(*r == '&') {
+                if(fd == STDIN_FILENO || append || (r[1] != '1' && r[1] != '2')
+                   || (r[2] != '\0' && r[2] != ' ' && r[2] != '\t')) {
+                    fprintf(stderr, "mexec: %.*s: only >&1, >&2, 2>&1 and 2>&2 are supported\n",
+                            (int)strcspn(r, " \t"), r);
+                    free(argv);
+                    return NULL;
+                }
+                // >&1 and 2>&2 leave the descriptor as it is.
+                if(r[1] - '0' != fd) {
+                    stage->dup[fd] = r[1] - '0';
+                    stage->order[fd] = ++order;
+                    *target = NULL;
+                }
+                r += 2;
+                continue;
+            }
+            stage->dup[fd] = -1;
+            stage->order[fd] = ++order;
+        }
+
+        char *word = w;
+        while(*r != '\0' && *r != ' ' && *r != '\t') {
+            // Single quotes: everything literal up to the next quote.
+            if(*r == '\'') {
+                char *close = strchr(r + 1, '\'');
+                if(close == NULL) {
+                    goto unterminated;
+                }
+                memmove(w, r + 1, close - r - 1);
+                w += close - r - 1;
+                r = close + 1;
+            }
+            // Double quotes: only \" and \\ are escapes.
+            else if(*r == '"') {
+                for(r++; *r != '"'; r++) {
+                    if(*r == '\0') {
+                        goto unterminated;
+                    }
+                    if(*r == '\\' && (r[1] == '"' || r[1] == '\\')) {
+                        r++;
+                    }
+                    *w++ = *r;
+                }
+                r++;
+            }
+            else {
+                if(*r == '\\' && r[1] != '\0') {
+                    r++;
+                }
+                *w++ = *r++;
+            }
+        }
+        // Step past the blank before terminating, w may be on it.
+        if(*r != '\0') {
+            r++;
+        }
+        *w++ = '\0';
+
+        if(target != NULL) {
+            *target = word;
+            continue;
+        }
+        if(annotation) {
+            // @pure is the only annotation without a value.
+            if(strcmp(word, "@pure") == 0) {
+                stage->pure = true;
+            }
+            else {
+                key = word;
+            }
+            continue;
+        }
+        if(key != NULL) {
+            if(!placement_parse(&stage->place, key, word)) {
+                free(argv);
+                return NULL;
+            }
+            key = NULL;
+            continue;
+        }
+        // Allocate space for each argument.
+        argv = realloc(argv, sizeof(char *) * (i + 1));
+        if(argv == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        argv[i++] = word;
+    }
+
+    if(key != NULL) {
+        fprintf(stderr, "mexec: %s: missing value\n", key);
+        free(argv);
+        return NULL;
+    }
+    if(i == 0) {
+        fprintf(stderr, "mexec: empty command\n");
+        free(argv);
+        return NULL;
+    }
+    // Allocate space for NULL.
+    argv = realloc(argv, sizeof(char*) * (i + 1));
+    if(argv == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    // Add a NULL in the last position of the array.
+    argv[i] = 0;
+    return argv;
+
+unterminated:
+    fprintf(stderr, "mexec: unterminated quote\n");
+    free(argv);
+    return NULL;
+}
+
+/*  Function: openRedirects
+ *  Input:
+            pipeline *p     :Pipeline whose redirections to open.
+ *
+ *  Output: Opens the redirected files of every stage, close on exec. Returns the index of
+ *          the first stage whose file couldn't be opened, after closing everything opened,
+ *          or -1 on success.
+ */
+static int openRedirects(pipeline *p) {
+    for(int j = 0; j < p->lineAmt; j++) {
+        struct stage *stage = &p->stages[j];
+        if(stage->done) {
+            continue;
+        }
+        const char *paths[3] = {stage->inPath, stage->outPath, stage->errPath};
+        int flags[3] = {
+            O_RDONLY,
+            O_WRONLY | O_CREAT | (stage->outAppend ? O_APPEND : O_TRUNC),
+            O_WRONLY | O_CREAT | (stage->errAppend ? O_APPEND : O_TRUNC)
+        };
+        for(int fd = 0; fd < 3; fd++) {
+            if(paths[fd] == NULL) {
+                continue;
+            }
+            if((stage->redir[fd] = open(paths[fd], flags[fd] | O_CLOEXEC, 0666)) != -1) {
+                continue;
+            }
+            perror(paths[fd]);
+            for(int k = 0; k <= j; k++) {
+                for(int i = 0; i < 3; i++) {
+                    if(p->stages[k].redir[i] != -1) {
+                        close(p->stages[k].redir[i]);
+                        p->stages[k].redir[i] = -1;
+                    }
+                }
+            }
+            return j;
+        }
+    }
+    return -1;
+}
+
+/*  Function: execute
+ *  Input:
+            char **argv     :Arguments of command to execute.
+ *
+ *  Output: Executes command and outputs it into pipe or if last line of file, to terminal.
+ */
+static void execute(char **argv) {
+    // Execute programs.
+    execvp(argv[0],argv);
+    // Child shouldn't reach these lines.
+    perror(argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+/*  Function: cachePrefix
+ *  Input:
+            supervisor *s   :Supervisor with the cache.
+            pipeline *p     :Pipeline about to start.
+ *
+ *  Output: Finds the leading @pure stages whose whole output goes to the next stage, and
+ *          keys their output by the commands, the programs run, the input of the first
+ *          stage and the files named by arguments. On a hit the last of them writes the
+ *          cached output and the others don't run. On a miss a stage copying their output
+ *          to the cache is added after them. A prefix reading something that can't be
+ *          identified, like a pipe, a terminal or a device, isn't cached.
+ */
+static void cachePrefix(supervisor *s, pipeline *p) {
+    int last = -1;
+    for(int j = 0; j < p->lineAmt; j++) {
+        struct stage *stage = &p->stages[j];
+        if(!stage->pure || stage->outPath != NULL || stage->dup[STDOUT_FILENO] != -1
+           || (j > 0 && stage->inPath != NULL)) {
+            break;
+        }
+        last = j;
+    }
+    if(last == -1 || (last < p->lineAmt-1 && p->stages[last+1].inPath != NULL)) {
+        return;
+    }
+
+    // Each key covers the key of the stage before it.
+    cache_key key;
+    for(int j = 0; j <= last; j++) {
+        struct stage *stage = &p->stages[j];
+        cache_hasher h;
+        struct stat st;
+        cache_hash_init(&h);
+        if(j == 0) {
+            cache_hash_update(&h, "mexec 2", 8);
+            if(stage->inPath == NULL ? fstat(STDIN_FILENO, &st) == -1 : stat(stage->inPath, &st) == -1) {
+                return;
+            }
+            if(!hashInput(&h, &st, stage->inPath == NULL ? lseek(STDIN_FILENO, 0, SEEK_CUR) : 0)) {
+                return;
+            }
+        }
+        else {
+            cache_hash_update(&h, &key, sizeof(key));
+        }
+        // A rebuilt program may write something else for the same input.
+        if(!statProgram(stage->argv[0], &st) || !hashInput(&h, &st, 0)) {
+            return;
+        }
+        // Arguments naming files add the files. Words that aren't files are just words.
+        for(char **arg = stage->argv; *arg != NULL; arg++) {
+            cache_hash_update(&h, *arg, strlen(*arg) + 1);
+            if(stat(*arg, &st) == 0 && !hashInput(&h, &st, 0)) {
+                return;
+            }
+        }
+        cache_hash_final(&h, &key);
+    }
+
+    char *tmpPath;
+    int fd = cache_lookup(s->cache, &key);
+    if(fd != -1) {
+        for(int j = 0; j <= last; j++) {
+            struct stage *stage = &p->stages[j];
+            if(stage->builtin != NULL) {
+                builtin_kill(stage->builtin);
+                stage->builtin = NULL;
+            }
+            stage->inPath = NULL;
+            stage->done = j < last;
+        }
+        p->stages[last].cacheFd = fd;
+        return;
+    }
+    if((fd = cache_create(s->cache, &tmpPath)) == -1) {
+        return;
+    }
+
+    int at = last + 1;
+    memmove(&p->stages[at+1], &p->stages[at], (p->lineAmt - at) * sizeof(struct stage));
+    struct stage *tee = &p->stages[at];
+    memset(tee, 0, sizeof(struct stage));
+    if((tee->argv = malloc(2 * sizeof(char *))) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    tee->argv[0] = ":cache";
+    tee->argv[1] = NULL;
+    placement_init(&tee->place);
+    tee->pidfd = -1;
+    tee->cacheFd = -1;
+    tee->teeFd = fd;
+    tee->redir[0] = tee->redir[1] = tee->redir[2] = -1;
+    tee->dup[0] = tee->dup[1] = tee->dup[2] = -1;
+    p->lineAmt++;
+    p->teeAt = at;
+    p->key = key;
+    p->tmpPath = tmpPath;
+}
+
+/*  Function: hashInput
+ *  Input:
+            cache_hasher *h         :Key being computed.
+            const struct stat *st   :Status of an input.
+            off_t offset            :Where the input is read from.
+ *
+ *  Output: Adds what identifies the content of a regular file to the key, or that the
+ *          input is /dev/null. False for anything else, like a pipe, a terminal, a
+ *          directory or another device, whose content may differ between runs.
+ */
+static bool hashInput(cache_hasher *h, const struct stat *st, off_t offset) {
+    struct {
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        off_t offset;
+        long long sec;
+        long long nsec;
+    } id;
+    // No padding bytes with stack garbage in the key.
+    memset(&id, 0, sizeof(id));
+    // Device 1:3 is /dev/null on Linux, it is always empty.
+    if(S_ISCHR(st->st_mode) && st->st_rdev == makedev(1, 3)) {
+        id.dev = st->st_rdev;
+    }
+    else if(S_ISREG(st->st_mode)) {
+        id.dev = st->st_dev;
+        id.ino = st->st_ino;
+        id.size = st->st_size;
+        id.offset = offset;
+        id.sec = st->st_mtim.tv_sec;
+        id.nsec = st->st_mtim.tv_nsec;
+    }
+    else {
+        return false;
+    }
+    cache_hash_update(h, &id, sizeof(id));
+    return true;
+}
+
+/*  Function: statProgram
+ *  Input:
+            const char *name    :First word of a command.
+            struct stat *st     :Set to the status of the program.
+ *
+ *  Output: Finds the program execvp would run for the command, searching PATH like it
+ *          does, and gets its status. A builtin is part of mexec, so that is mexec's own
+ *          executable. False if there is no such program.
+ */
+static bool statProgram(const char *name, struct stat *st) {
+    if(builtin_is(name)) {
+        return stat("/proc/self/exe", st) == 0;
+    }
+    if(strchr(name, '/') != NULL) {
+        return stat(name, st) == 0;
+    }
+    const char *dirs = getenv("PATH");
+    if(dirs == NULL) {
+        dirs = "/bin:/usr/bin";
+    }
+    size_t len = strlen(name);
+    while(true) {
+        const char *end = strchrnul(dirs, ':');
+        // An empty entry is the current directory.
+        int dirLen = end == dirs ? 1 : (int)(end - dirs);
+        char path[dirLen + len + 2];
+        snprintf(path, sizeof(path), "%.*s/%s", dirLen, end == dirs ? "." : dirs, name);
+        if(stat(path, st) == 0 && S_ISREG(st->st_mode) && access(path, X_OK) == 0) {
+            return true;
+        }
+        if(*end == '\0') {
+            return false;
+        }
+        dirs = end + 1;
+    }
+}
+
+/*  Function: cacheFinish
+ *  Input:
+            supervisor *s   :Supervisor with the cache.
+            pipeline *p     :Finished pipeline.
+ *
+ *  Output: Keeps the copied output if no stage of the prefix failed and all of it was
+ *          copied, and throws it away otherwise. A stage stopped because the stage after it
+ *          was done didn't change what that stage wrote.
+ */
+static void cacheFinish(supervisor *s, pipeline *p) {
+    if(p->tmpPath == NULL) {
+        return;
+    }
+    bool ok = p->teeOk;
+    for(int j = 0; j < p->teeAt; j++) {
+        ok = ok && p->stages[j].status == 0;
+    }
+    if(ok) {
+        cache_commit(s->cache, &p->key, p->tmpPath);
+    }
+    else {
+        cache_abort(p->tmpPath);
+    }
+    p->tmpPath = NULL;
+}
+
+/*  Function: copyStage
+ *  Input:
+            struct stage *stage     :Stage that feeds or fills the cache.
+ *
+ *  Output: In the child, instead of a command: writes the cached output to stdout with
+ *          sendfile, or passes stdin to stdout with tee and moves the same bytes into the
+ *          cache entry with splice. Falls back to read and write where the descriptors
+ *          don't allow that. The copy exits 0 only if it passed on and copied everything,
+ *          a reader that stops early is not a complete copy.
+ */
+static void copyStage(struct stage *stage) {
+    // Nothing is executed, so close every descriptor inherited from mexec.
+    if(dup2(stage->cacheFd != -1 ? stage->cacheFd : stage->teeFd, 3) == -1) {
+        perror("dup2");
+        _exit(EXIT_FAILURE);
+    }
+    close_range(4, ~0U, 0);
+
+    static char buf[65536];
+    ssize_t n;
+    if(stage->cacheFd != -1) {
+        while((n = sendfile(STDOUT_FILENO, 3, NULL, 1 << 20)) > 0) {
+        }
+        if(n == -1 && errno == EINVAL) {
+            while((n = read(3, buf, sizeof(buf))) > 0 && writeAll(STDOUT_FILENO, buf, n)) {
+            }
+        }
+        _exit(n == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // See a reader that stopped early as EPIPE, SIGPIPE would look like success.
+    signal(SIGPIPE, SIG_IGN);
+    bool copied = true;
+    while((n = tee(STDIN_FILENO, STDOUT_FILENO, sizeof(buf), 0)) > 0) {
+        // Consume what was passed on, into the entry if it still can be written.
+        while(n > 0) {
+            ssize_t m = copied ? splice(STDIN_FILENO, NULL, 3, NULL, n, 0) : -1;
+            if(m == -1) {
+                copied = false;
+                if((m = read(STDIN_FILENO, buf, n)) <= 0) {
+                    _exit(EXIT_FAILURE);
+                }
+            }
+            n -= m;
+        }
+    }
+    // Not a pipe on stdout.
+    if(n == -1 && errno == EINVAL) {
+        while((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+            if(!writeAll(STDOUT_FILENO, buf, n)) {
+                break;
+            }
+            copied = copied && writeAll(3, buf, n);
+        }
+    }
+    if(n == -1 && errno != EPIPE) {
+        perror(":cache");
+    }
+    _exit(n == 0 && copied ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*  Function: writeAll
+ *  Input:
+            int fd          :Descriptor to write to.
+            const char *buf :Bytes to write.
+            size_t len      :Amount of bytes.
+ *
+ *  Output: True if everything was written.
+ */
+static bool writeAll(int fd, const char *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if(n == -1) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+/*
+Pipeline header file
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+
+A pipeline is one mexec input: one command per stage, stdout of each stage
+piped to stdin of the next. Any number of pipelines can run at once, a
+supervisor reaps all of their stages from one event loop.
+*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include "cache.h"
+
+typedef struct pipeline pipeline;
+typedef struct supervisor supervisor;
+
+/**
+ * Creates a supervisor with no running pipelines. When a stage finishes, the
+ * stages before it that still run are sent SIGTERM, and SIGKILL if they are
+ * still running after the grace period.
+ *
+ * @param graceMs	Milliseconds between SIGTERM and SIGKILL.
+ * @return			Pointer to the supervisor.
+ */
+supervisor *supervisor_create(int graceMs);
+
+/**
+ * Frees a supervisor. All its pipelines must have been returned by
+ * supervisor_wait.
+ *
+ * @param s			Pointer to the supervisor.
+ */
+void supervisor_kill(supervisor *s);
+
+/**
+ * Makes the supervisor pin every stage without a @cpu annotation to its own
+ * CPU. Consecutive stages get neighbouring CPUs sharing a last level cache, so
+ * data passed through a pipe stays in that cache.
+ *
+ * @param s			Pointer to the supervisor.
+ * @param autopin	Whether to pin stages.
+ */
+void supervisor_set_autopin(supervisor *s, bool autopin);
+
+/**
+ * Makes the supervisor cache the output of pipeline prefixes. The leading
+ * stages annotated @pure are skipped when their output for the same commands
+ * and input files is in the cache, and their output is added to it otherwise.
+ *
+ * @param s			Pointer to the supervisor.
+ * @param c			Cache to use, or NULL to not cache.
+ */
+void supervisor_set_cache(supervisor *s, cache *c);
+
+/**
+ * Waits until a running pipeline has finished all its stages.
+ *
+ * @param s			Pointer to the supervisor.
+ * @return			The finished pipeline, or NULL if nothing is running.
+ */
+pipeline *supervisor_wait(supervisor *s);
+
+/**
+ * Creates a pipeline from its command lines. The lines are split into
+ * arguments in place, so they must outlive the pipeline.
+ *
+ * @param commands	Array of command lines.
+ * @param lineAmt	Amount of command lines.
+ * @return			Pointer to the pipeline, or NULL if a stage is invalid.
+ */
+pipeline *pipeline_create(char **commands, int lineAmt);
+
+/**
+ * Starts every stage of a pipeline.
+ *
+ * @param p			Pointer to the pipeline.
+ * @param s			Supervisor that reaps the stages.
+ * @param outfd		Where the last stage writes, -1 for stdout.
+ * @param errfd		Where the stages write errors, -1 for stderr.
+ */
+void pipeline_start(pipeline *p, supervisor *s, int outfd, int errfd);
+
+/**
+ * Gets the result of a finished pipeline.
+ *
+ * @param p			Pointer to the pipeline.
+ * @return			0 if all stages succeeded, otherwise the exit status of the
+ *					first stage to fail. A stage killed by a signal has status
+ *					128 + signal. Stages stopped by mexec or by SIGPIPE don't fail.
+ */
+int pipeline_status(const pipeline *p);
+
+/**
+ * Gets the stage that made a finished pipeline fail.
+ *
+ * @param p			Pointer to the pipeline.
+ * @return			Index of the first stage to fail, or -1 if none failed.
+ */
+int pipeline_failed(const pipeline *p);
+
+/**
+ * Gets the command name of a stage.
+ *
+ * @param p			Pointer to the pipeline.
+ * @param stage		Index of the stage.
+ * @return			Name of the command.
+ */
+const char *pipeline_command(const pipeline *p, int stage);
+
+/**
+ * Gets the time a finished pipeline ran.
+ *
+ * @param p			Pointer to the pipeline.
+ * @return			Seconds from start until the last stage finished.
+ */
+double pipeline_seconds(const pipeline *p);
+
+/**
+ * Frees a pipeline.
+ *
+ * @param p			Pointer to the pipeline.
+ */
+void pipeline_kill(pipeline *p);
+
+#endif
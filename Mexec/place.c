@@ -0,0 +1,432 @@
+/*
+Stage placement
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "place.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CPU_ROOT "/sys/devices/system/cpu"
+
+// Allowed CPUs, grouped by last level cache. Read on first use.
+static int cpuOrder[CPU_SETSIZE];
+static int cpuAmt = 0;
+
+// Cgroup all stage cgroups are created in: 0 not tried, 1 usable, -1 unusable.
+static int cgroupState = 0;
+static char *cgroupBase = NULL;
+static int cgroupCount = 0;
+
+// Function declaration
+static bool parseCpuList(const char *list, cpu_set_t *cpus);
+static bool readFile(const char *path, char *buf, size_t size);
+static bool writeFile(const char *path, const char *value);
+static bool hasWord(const char *list, const char *word);
+static void readTopology(void);
+static bool cgroupSetup(void);
+
+/*  Function: placement_init
+ *  Input:
+ *          placement *pl   :Placement to initialize.
+ *
+ *  Output: A placement without annotations.
+ */
+void placement_init(placement *pl) {
+    CPU_ZERO(&pl->cpus);
+    pl->pinned = false;
+    pl->memMax = -1;
+    pl->weight = 0;
+    pl->procsfd = -1;
+    pl->cgroup = NULL;
+}
+
+/*  Function: placement_parse
+ *  Input:
+ *          placement *pl       :Placement to update.
+ *          const char *key     :Annotation, e.g. "@cpu".
+ *          const char *value   :Value of the annotation.
+ *
+ *  Output: True if the annotation is known and its value valid.
+ */
+bool placement_parse(placement *pl, const char *key, const char *value) {
+    char *endp;
+    if(strcmp(key, "@cpu") == 0) {
+        if(!parseCpuList(value, &pl->cpus)) {
+            fprintf(stderr, "mexec: @cpu: invalid CPU list '%s'\n", value);
+            return false;
+        }
+        pl->pinned = true;
+        return true;
+    }
+    if(strcmp(key, "@mem") == 0) {
+        pl->memMax = strtoll(value, &endp, 10);
+        // Binary suffixes, like memory.max itself.
+        const char *suffixes = "KMGT";
+        const char *suffix = *endp != '\0' ? strchr(suffixes, *endp) : NULL;
+        if(suffix != NULL) {
+            pl->memMax <<= 10 * (suffix - suffixes + 1);
+            endp++;
+        }
+        if(endp == value || *endp != '\0' || pl->memMax <= 0) {
+            fprintf(stderr, "mexec: @mem: invalid size '%s'\n", value);
+            return false;
+        }
+        return true;
+    }
+    if(strcmp(key, "@weight") == 0) {
+        pl->weight = (int) strtol(value, &endp, 10);
+        if(endp == value || *endp != '\0' || pl->weight < 1 || pl->weight > 10000) {
+            fprintf(stderr, "mexec: @weight: must be 1-10000, not '%s'\n", value);
+            return false;
+        }
+        return true;
+    }
+    fprintf(stderr, "mexec: %s: unknown annotation\n", key);
+    return false;
+}
+
+/*  Function: placement_autopin
+ *  Input:
+ *          placement *pl   :Placement to update.
+ *          int slot        :Slot number.
+ *
+ *  Output: Pins the placement to the CPU of the slot, unless it has an @cpu already.
+ */
+void placement_autopin(placement *pl, int slot) {
+    if(pl->pinned) {
+        return;
+    }
+    if(cpuAmt == 0) {
+        readTopology();
+    }
+    CPU_ZERO(&pl->cpus);
+    CPU_SET(cpuOrder[slot % cpuAmt], &pl->cpus);
+    pl->pinned = true;
+}
+
+/*  Function: placement_prepare
+ *  Input:
+ *          placement *pl   :Placement to prepare.
+ *
+ *  Output: Creates a cgroup with the memory limit and CPU weight of the placement, and
+ *          opens its cgroup.procs for the child to join.
+ */
+void placement_prepare(placement *pl) {
+    if((pl->memMax == -1 && pl->weight == 0) || !cgroupSetup()) {
+        return;
+    }
+    char path[strlen(cgroupBase) + 64];
+    char value[32];
+    snprintf(path, sizeof(path), "%s/stage%d", cgroupBase, cgroupCount++);
+    if(mkdir(path, 0755) == -1) {
+        perror(path);
+        return;
+    }
+    if((pl->cgroup = strdup(path)) == NULL) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t len = strlen(path);
+    if(pl->memMax != -1) {
+        snprintf(path + len, sizeof(path) - len, "/memory.max");
+        snprintf(value, sizeof(value), "%lld", pl->memMax);
+        writeFile(path, value);
+    }
+    if(pl->weight != 0) {
+        snprintf(path + len, sizeof(path) - len, "/cpu.weight");
+        snprintf(value, sizeof(value), "%d", pl->weight);
+        writeFile(path, value);
+    }
+    snprintf(path + len, sizeof(path) - len, "/cgroup.procs");
+    if((pl->procsfd = open(path, O_WRONLY | O_CLOEXEC)) == -1) {
+        perror(path);
+    }
+}
+
+/*  Function: placement_enter
+ *  Input:
+ *          const placement *pl     :Placement to apply.
+ *
+ *  Output: Moves the calling process into the placement's cgroup and onto its CPUs.
+ *          Only async-signal-safe calls, this runs between fork and exec.
+ */
+void placement_enter(const placement *pl) {
+    // "0" is the writing process.
+    if(pl->procsfd != -1 && write(pl->procsfd, "0", 1) == -1) {
+        perror("cgroup.procs");
+        exit(EXIT_FAILURE);
+    }
+    if(pl->pinned && sched_setaffinity(0, sizeof(cpu_set_t), &pl->cpus) == -1) {
+        perror("sched_setaffinity");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*  Function: placement_release
+ *  Input:
+ *          placement *pl   :Placement whose stage has finished.
+ *
+ *  Output: Closes and removes the stage's cgroup. A cgroup still holding processes the
+ *          stage left behind stays until placement_cleanup.
+ */
+void placement_release(placement *pl) {
+    if(pl->procsfd != -1) {
+        close(pl->procsfd);
+        pl->procsfd = -1;
+    }
+    if(pl->cgroup != NULL) {
+        rmdir(pl->cgroup);
+        free(pl->cgroup);
+        pl->cgroup = NULL;
+    }
+}
+
+/*  Function: placement_cleanup
+ *  Input:
+ *          void
+ *
+ *  Output: Removes mexec's own cgroup, if it was created.
+ */
+void placement_cleanup(void) {
+    if(cgroupBase != NULL) {
+        rmdir(cgroupBase);
+        free(cgroupBase);
+        cgroupBase = NULL;
+    }
+    cgroupState = 0;
+}
+
+/*  Function: parseCpuList
+ *  Input:
+ *          const char *list    :CPU list, e.g. "0-3,8".
+ *          cpu_set_t *cpus     :Set to the CPUs in the list.
+ *
+ *  Output: True if the list was valid.
+ */
+static bool parseCpuList(const char *list, cpu_set_t *cpus) {
+    const char *p = list;
+    char *endp;
+    CPU_ZERO(cpus);
+    while(true) {
+        long from = strtol(p, &endp, 10);
+        long to = from;
+        if(endp == p || from < 0) {
+            return false;
+        }
+        if(*endp == '-') {
+            p = endp + 1;
+            to = strtol(p, &endp, 10);
+            if(endp == p || to < from) {
+                return false;
+            }
+        }
+        if(to >= CPU_SETSIZE) {
+            return false;
+        }
+        for(long cpu = from; cpu <= to; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        // Lists read from sysfs end with a newline.
+        if(*endp == '\0' || *endp == '\n') {
+            return true;
+        }
+        if(*endp != ',') {
+            return false;
+        }
+        p = endp + 1;
+    }
+}
+
+/*  Function: readFile
+ *  Input:
+ *          const char *path    :File to read.
+ *          char *buf           :Buffer to read into.
+ *          size_t size         :Size of buffer.
+ *
+ *  Output: True if the file could be read. buf is NUL terminated.
+ */
+static bool readFile(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        return false;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if(n < 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    return true;
+}
+
+/*  Function: writeFile
+ *  Input:
+ *          const char *path    :File to write, e.g. a cgroup control file.
+ *          const char *value   :Value to write.
+ *
+ *  Output: True if the value was written. Prints an error otherwise.
+ */
+static bool writeFile(const char *path, const char *value) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd == -1 || write(fd, value, strlen(value)) == -1) {
+        perror(path);
+        if(fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/*  Function: hasWord
+ *  Input:
+ *          const char *list    :Words separated by blanks, like cgroup.controllers.
+ *          const char *word    :Word to look for.
+ *
+ *  Output: True if word is one of the words of list, not just part of one.
+ */
+static bool hasWord(const char *list, const char *word) {
+    size_t len = strlen(word);
+    for(const char *p = list; (p = strstr(p, word)) != NULL; p += len) {
+        if((p == list || isspace((unsigned char)p[-1])) && (p[len] == '\0' || isspace((unsigned char)p[len]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*  Function: readTopology
+ *  Input:
+ *          void
+ *
+ *  Output: Orders the CPUs mexec may run on so that CPUs sharing a last level cache
+ *          are next to each other.
+ */
+static void readTopology(void) {
+    cpu_set_t allowed;
+    bool seen[CPU_SETSIZE] = {false};
+    char path[128];
+    char buf[1024];
+
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("sched_getaffinity");
+        exit(EXIT_FAILURE);
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(!CPU_ISSET(cpu, &allowed) || seen[cpu]) {
+            continue;
+        }
+        // The cache with the highest level is the last level cache.
+        cpu_set_t shared;
+        CPU_ZERO(&shared);
+        CPU_SET(cpu, &shared);
+        int bestLevel = 0;
+        for(int index = 0; ; index++) {
+            snprintf(path, sizeof(path), CPU_ROOT "/cpu%d/cache/index%d/level", cpu, index);
+            if(!readFile(path, buf, sizeof(buf))) {
+                break;
+            }
+            int level = atoi(buf);
+            snprintf(path, sizeof(path), CPU_ROOT "/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+            cpu_set_t cpus;
+            if(level >= bestLevel && readFile(path, buf, sizeof(buf)) && parseCpuList(buf, &cpus)) {
+                bestLevel = level;
+                shared = cpus;
+            }
+        }
+        for(int other = 0; other < CPU_SETSIZE; other++) {
+            if((other == cpu || CPU_ISSET(other, &shared)) && CPU_ISSET(other, &allowed) && !seen[other]) {
+                seen[other] = true;
+                cpuOrder[cpuAmt++] = other;
+            }
+        }
+    }
+}
+
+/*  Function: cgroupSetup
+ *  Input:
+ *          void
+ *
+ *  Output: Creates a cgroup for mexec's stages below the cgroup mexec runs in, with
+ *          the memory and cpu controllers enabled. True if that worked, otherwise a
+ *          warning is printed once and false is returned.
+ */
+static bool cgroupSetup(void) {
+    char buf[4096];
+    if(cgroupState != 0) {
+        return cgroupState == 1;
+    }
+    cgroupState = -1;
+
+    // The unified hierarchy is the "0::" line.
+    char *own = NULL;
+    if(readFile("/proc/self/cgroup", buf, sizeof(buf))) {
+        own = strstr(buf, "0::");
+    }
+    if(own == NULL || access(CGROUP_ROOT "/cgroup.controllers", R_OK) == -1) {
+        fprintf(stderr, "mexec: no cgroup v2 hierarchy, ignoring @mem and @weight\n");
+        return false;
+    }
+    own += 3;
+    own[strcspn(own, "\n")] = '\0';
+    if(strcmp(own, "/") == 0) {
+        own = "";
+    }
+
+    size_t size = strlen(CGROUP_ROOT) + strlen(own) + 64;
+    char parent[size];
+    char path[size];
+    snprintf(parent, size, "%s%s", CGROUP_ROOT, own);
+    if((cgroupBase = malloc(size)) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(cgroupBase, size, "%s/mexec.%d", parent, (int)getpid());
+    if(mkdir(cgroupBase, 0755) == -1) {
+        fprintf(stderr, "mexec: can't create cgroup %s (%s), ignoring @mem and @weight\n",
+                cgroupBase, strerror(errno));
+        free(cgroupBase);
+        cgroupBase = NULL;
+        return false;
+    }
+
+    // Enabling fails if they already are, or if mexec's own cgroup has processes and
+    // isn't the root. Check what the new cgroup actually got.
+    snprintf(path, size, "%s/cgroup.subtree_control", parent);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd != -1) {
+        if(write(fd, "+memory +cpu", 12) == -1) {
+            // Already enabled or not allowed, checked below.
+        }
+        close(fd);
+    }
+    snprintf(path, size, "%s/cgroup.controllers", cgroupBase);
+    if(!readFile(path, buf, sizeof(buf)) || !hasWord(buf, "memory") || !hasWord(buf, "cpu")) {
+        fprintf(stderr, "mexec: memory and cpu controllers not available in %s, ignoring @mem and @weight\n",
+                parent);
+        placement_cleanup();
+        cgroupState = -1;
+        return false;
+    }
+    snprintf(path, size, "%s/cgroup.subtree_control", cgroupBase);
+    if(!writeFile(path, "+memory +cpu")) {
+        placement_cleanup();
+        cgroupState = -1;
+        return false;
+    }
+    cgroupState = 1;
+    return true;
+}
@@ -0,0 +1,87 @@
+/*
+Stage placement header file
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+
+A stage can be placed with annotations before its command:
+    @cpu LIST       run on the given CPUs, e.g. 0-3,8
+    @mem SIZE       memory limit, e.g. 512M or 2G
+    @weight N       CPU weight, 1-10000 (default 100)
+CPUs are set with sched_setaffinity. Memory and weight need a writable cgroup
+v2 hierarchy, each such stage gets its own cgroup below mexec's. Without one
+they are ignored with a warning.
+*/
+
+#ifndef PLACE_H
+#define PLACE_H
+
+#include <stdbool.h>
+#include <sched.h>
+
+typedef struct placement {
+    cpu_set_t cpus;
+    bool pinned;
+    // Bytes, -1 for no limit.
+    long long memMax;
+    // 0 for the default weight.
+    int weight;
+    // cgroup.procs of the stage's cgroup, -1 if it has none.
+    int procsfd;
+    char *cgroup;
+} placement;
+
+/**
+ * Sets a placement to run anywhere without limits.
+ *
+ * @param pl		Placement to initialize.
+ */
+void placement_init(placement *pl);
+
+/**
+ * Parses one annotation. Prints an error if it is invalid.
+ *
+ * @param pl		Placement to update.
+ * @param key		Annotation name, including the '@'.
+ * @param value		Annotation value.
+ * @return			True if the annotation was valid.
+ */
+bool placement_parse(placement *pl, const char *key, const char *value);
+
+/**
+ * Pins a placement without @cpu to one CPU. Slots are numbered so that
+ * consecutive slots are neighbouring CPUs sharing a last level cache.
+ *
+ * @param pl		Placement to update.
+ * @param slot		Slot number, wraps around the available CPUs.
+ */
+void placement_autopin(placement *pl, int slot);
+
+/**
+ * Creates the cgroup of a placement with @mem or @weight, in the parent
+ * before forking.
+ *
+ * @param pl		Placement to prepare.
+ */
+void placement_prepare(placement *pl);
+
+/**
+ * Applies a placement to the calling process, in the child before exec.
+ *
+ * @param pl		Placement to apply.
+ */
+void placement_enter(const placement *pl);
+
+/**
+ * Removes the cgroup of a placement after its stage has finished.
+ *
+ * @param pl		Placement to release.
+ */
+void placement_release(placement *pl);
+
+/**
+ * Removes the cgroup directory mexec created for its stages.
+ */
+void placement_cleanup(void);
+
+#endif
@@ -0,0 +1,489 @@
+/*
+Server and client
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "server.h"
+
+#define MAGIC 0x6d657831
+// stdin, stdout, stderr and the working directory.
+#define NFDS 4
+
+// Sent with the client's descriptors, followed by len bytes of arguments and environment.
+struct request {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t len;
+};
+
+extern char **environ;
+
+static volatile sig_atomic_t stopping = 0;
+// The helper serving a client. Its children inherit the exit handler, but aren't it.
+static pid_t helperPid;
+// Connection to the client the helper serves.
+static int client = -1;
+
+// Function declaration
+static void stop(int sig);
+static pid_t spawnHelper(int listenfd, int (*serve)(int argc, char *argv[]));
+static void helper(int listenfd, int (*serve)(int argc, char *argv[]));
+static void sendStatus(int status, void *unused);
+static bool receiveRequest(int conn, struct request *req, int fds[NFDS]);
+static char **splitStrings(char **p, char *end, uint32_t amount);
+static bool sendAll(int fd, const void *buf, size_t len);
+static bool recvAll(int fd, void *buf, size_t len);
+static int createSocket(const char *path, struct sockaddr_un *addr);
+static bool removeStale(const char *path, const struct sockaddr_un *addr);
+
+/*  Function: server_run
+ *  Input:
+ *          const char *path    :Socket to listen on.
+ *          int helpers         :Amount of helpers to keep waiting.
+ *          int (*serve)        :Runs a client's request in a helper.
+ *
+ *  Output: Listens on the socket and forks the helpers, then replaces every helper that
+ *          exits until stopped by SIGINT or SIGTERM. Removes the socket when stopped. Only
+ *          a socket nobody listens on is replaced, anything else at the path is an error.
+ */
+int server_run(const char *path, int helpers, int (*serve)(int argc, char *argv[])) {
+    struct sockaddr_un addr;
+    int listenfd = createSocket(path, &addr);
+    if(listenfd == -1) {
+        return EXIT_FAILURE;
+    }
+    if(!removeStale(path, &addr)) {
+        close(listenfd);
+        return EXIT_FAILURE;
+    }
+    if(bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listenfd, 128) == -1) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    // No SA_RESTART, so wait returns when told to stop.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pid_t *pool = calloc(helpers, sizeof(pid_t));
+    if(pool == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < helpers; i++) {
+        pool[i] = spawnHelper(listenfd, serve);
+    }
+    while(!stopping) {
+        pid_t pid = wait(NULL);
+        if(pid == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("wait");
+            break;
+        }
+        for(int i = 0; i < helpers; i++) {
+            if(pool[i] == pid) {
+                pool[i] = spawnHelper(listenfd, serve);
+            }
+        }
+    }
+
+    // Helpers still serving a client are stopped too, their clients see them die.
+    for(int i = 0; i < helpers; i++) {
+        kill(pool[i], SIGTERM);
+    }
+    while(wait(NULL) > 0 || errno == EINTR) {
+    }
+    free(pool);
+    close(listenfd);
+    unlink(path);
+    return 0;
+}
+
+/*  Function: client_run
+ *  Input:
+ *          const char *path    :Socket of the server.
+ *          int argc            :Argument count.
+ *          char *argv[]        :Arguments.
+ *
+ *  Output: Sends the arguments, environment and descriptors to a helper and waits for
+ *          its exit status.
+ */
+int client_run(const char *path, int argc, char *argv[]) {
+    struct sockaddr_un addr;
+    int conn = createSocket(path, &addr);
+    if(conn == -1) {
+        return EXIT_FAILURE;
+    }
+    if(connect(conn, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    struct request req = {MAGIC, argc, 0, 0};
+    for(int i = 0; i < argc; i++) {
+        req.len += strlen(argv[i]) + 1;
+    }
+    for(char **env = environ; *env != NULL; env++) {
+        req.len += strlen(*env) + 1;
+        req.envc++;
+    }
+
+    int fds[NFDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1};
+    if((fds[3] = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        perror(".");
+        return EXIT_FAILURE;
+    }
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    bool sent = sendmsg(conn, &msg, MSG_NOSIGNAL) == sizeof(req);
+    close(fds[3]);
+    for(int i = 0; sent && i < argc; i++) {
+        sent = sendAll(conn, argv[i], strlen(argv[i]) + 1);
+    }
+    for(char **env = environ; sent && *env != NULL; env++) {
+        sent = sendAll(conn, *env, strlen(*env) + 1);
+    }
+    int32_t status;
+    if(!sent || !recvAll(conn, &status, sizeof(status))) {
+        fprintf(stderr, "mexec: %s: server didn't finish the request\n", path);
+        status = EXIT_FAILURE;
+    }
+    close(conn);
+    return status;
+}
+
+/*  Function: stop
+ *  Input:
+ *          int sig     :Signal.
+ *
+ *  Output: Makes the server stop.
+ */
+static void stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+/*  Function: spawnHelper
+ *  Input:
+ *          int listenfd        :Listening socket.
+ *          int (*serve)        :Runs a request.
+ *
+ *  Output: Pid of a new helper waiting for a client.
+ */
+static pid_t spawnHelper(int listenfd, int (*serve)(int argc, char *argv[])) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if(pid == 0) {
+        helper(listenfd, serve);
+    }
+    return pid;
+}
+
+/*  Function: helper
+ *  Input:
+ *          int listenfd        :Listening socket.
+ *          int (*serve)        :Runs a request.
+ *
+ *  Output: Accepts one client, takes over its descriptors, working directory and
+ *          environment, runs its request and sends back the exit status. Never returns.
+ *          Clients of other users are turned away, they would run commands as this one.
+ */
+static void helper(int listenfd, int (*serve)(int argc, char *argv[])) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    while(true) {
+        if((client = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+            if(errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+                _exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if(getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid()) {
+            break;
+        }
+        fprintf(stderr, "mexec: refused a client of another user\n");
+        close(client);
+    }
+    close(listenfd);
+
+    struct request req;
+    int fds[NFDS];
+    if(!receiveRequest(client, &req, fds)) {
+        _exit(EXIT_FAILURE);
+    }
+    char *body = malloc(req.len + 1);
+    if(body == NULL) {
+        perror("malloc");
+        _exit(EXIT_FAILURE);
+    }
+    body[req.len] = '\0';
+    char *p = body;
+    char **argv = NULL;
+    char **envp = NULL;
+    if(!recvAll(client, body, req.len) || (argv = splitStrings(&p, body + req.len, req.argc)) == NULL
+       || (envp = splitStrings(&p, body + req.len, req.envc)) == NULL || req.argc == 0) {
+        fprintf(stderr, "mexec: malformed request\n");
+        _exit(EXIT_FAILURE);
+    }
+
+    for(int fd = 0; fd < 3; fd++) {
+        if(dup2(fds[fd], fd) == -1) {
+            perror("dup2");
+            _exit(EXIT_FAILURE);
+        }
+        close(fds[fd]);
+    }
+    if(fchdir(fds[3]) == -1) {
+        perror("fchdir");
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[3]);
+    environ = envp;
+
+    // mexec exits directly on many errors, the client gets that status too.
+    helperPid = getpid();
+    on_exit(sendStatus, NULL);
+    exit(serve(req.argc, argv));
+}
+
+/*  Function: sendStatus
+ *  Input:
+ *          int status      :Exit status of the helper.
+ *          void *unused    :Unused, for on_exit.
+ *
+ *  Output: Sends the status to the client. The client exits when it has the status, so
+ *          everything is written before.
+ */
+static void sendStatus(int status, void *unused) {
+    (void)unused;
+    if(getpid() != helperPid) {
+        return;
+    }
+    int32_t code = status;
+    fflush(stdout);
+    fflush(stderr);
+    sendAll(client, &code, sizeof(code));
+}
+
+/*  Function: receiveRequest
+ *  Input:
+ *          int conn            :Connection to a client.
+ *          struct request *req :Set to the request header.
+ *          int fds             :Set to the passed descriptors, close on exec.
+ *
+ *  Output: True if a valid header with all descriptors was received.
+ */
+static bool receiveRequest(int conn, struct request *req, int fds[NFDS]) {
+    union {
+        char buf[CMSG_SPACE(NFDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+    ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    // Closed without a request, like a server checking if the socket is in use.
+    if(n == 0) {
+        return false;
+    }
+    if(n < 0 || !recvAll(conn, (char *)req + n, sizeof(*req) - n) || req->magic != MAGIC) {
+        fprintf(stderr, "mexec: malformed request\n");
+        return false;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(NFDS * sizeof(int))) {
+        fprintf(stderr, "mexec: request without descriptors\n");
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), NFDS * sizeof(int));
+    return true;
+}
+
+/*  Function: splitStrings
+ *  Input:
+ *          char **p        :Start of the strings, moved past them.
+ *          char *end       :End of the buffer, which is NUL terminated.
+ *          uint32_t amount :Amount of strings.
+ *
+ *  Output: NULL terminated array of the strings, or NULL if the buffer ends before them.
+ */
+static char **splitStrings(char **p, char *end, uint32_t amount) {
+    char **strings = malloc((amount + 1) * sizeof(char *));
+    if(strings == NULL) {
+        perror("malloc");
+        _exit(EXIT_FAILURE);
+    }
+    for(uint32_t i = 0; i < amount; i++) {
+        if(*p >= end) {
+            free(strings);
+            return NULL;
+        }
+        strings[i] = *p;
+        *p += strlen(*p) + 1;
+    }
+    strings[amount] = NULL;
+    return strings;
+}
+
+/*  Function: sendAll
+ *  Input:
+ *          int fd          :Socket.
+ *          const void *buf :Bytes to send.
+ *          size_t len      :Amount of bytes.
+ *
+ *  Output: True if everything was sent. A closed peer is an error, not SIGPIPE.
+ */
+static bool sendAll(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while(len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*  Function: recvAll
+ *  Input:
+ *          int fd          :Socket.
+ *          void *buf       :Buffer to fill.
+ *          size_t len      :Amount of bytes.
+ *
+ *  Output: True if all bytes were received before the peer closed.
+ */
+static bool recvAll(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while(len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if(n == -1 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*  Function: removeStale
+ *  Input:
+ *          const char *path                :Socket path.
+ *          const struct sockaddr_un *addr  :Address of the path.
+ *
+ *  Output: Removes a socket left at the path by a server that is gone, which refuses
+ *          connections. True if the path is free, false with an error printed if
+ *          something else is there or a server still listens on it.
+ */
+static bool removeStale(const char *path, const struct sockaddr_un *addr) {
+    struct stat st;
+    if(lstat(path, &st) == -1) {
+        if(errno == ENOENT) {
+            return true;
+        }
+        perror(path);
+        return false;
+    }
+    if(!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "mexec: %s: exists and is not a socket\n", path);
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1) {
+        perror("socket");
+        return false;
+    }
+    int ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    int err = errno;
+    close(fd);
+    if(ret == 0) {
+        fprintf(stderr, "mexec: %s: a server is already listening on it\n", path);
+        return false;
+    }
+    if(err != ECONNREFUSED) {
+        fprintf(stderr, "mexec: %s: %s\n", path, strerror(err));
+        return false;
+    }
+    if(unlink(path) == -1) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+/*  Function: createSocket
+ *  Input:
+ *          const char *path            :Socket path.
+ *          struct sockaddr_un *addr    :Set to the address of the path.
+ *
+ *  Output: A new close on exec stream socket, or -1 with an error printed.
+ */
+static int createSocket(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "mexec: %s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1) {
+        perror("socket");
+    }
+    return fd;
+}
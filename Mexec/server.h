@@ -0,0 +1,42 @@
+/*
+Server header file
+
+Author: Edvin Lindholm
+CS-user: c19elm@cs.umu.se
+
+"mexec --server SOCKET" keeps a pool of forked helpers waiting on a Unix
+socket, so an invocation through "mexec --client SOCKET ..." doesn't pay for
+starting and linking mexec, only for starting its stages. The client sends
+its arguments and environment, and passes its stdin, stdout, stderr and
+working directory as descriptors. A helper serves one client, sends back the
+exit status and exits, the server forks a new helper in its place. Only
+clients running as the same user as the server are served.
+*/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/**
+ * Runs a server until SIGINT or SIGTERM.
+ *
+ * @param path		Path of the socket to listen on. A socket left there by a
+ *					server that is gone is replaced, anything else is an error.
+ * @param helpers	Amount of helpers to keep waiting.
+ * @param serve		Called in a helper with a client's arguments, returns the
+ *					exit status for the client.
+ * @return			Exit status of the server.
+ */
+int server_run(const char *path, int helpers, int (*serve)(int argc, char *argv[]));
+
+/**
+ * Runs a command through a server.
+ *
+ * @param path		Path of the server's socket.
+ * @param argc		Argument count.
+ * @param argv		Arguments for the server's serve function.
+ * @return			Exit status from the server, or EXIT_FAILURE if it
+ *					couldn't be reached or the helper died.
+ */
+int client_run(const char *path, int argc, char *argv[]);
+
+#endif
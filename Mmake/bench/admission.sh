@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# Admission control by memory and load. Prints CSV on stdout.
+#
+# A build of BENCH_RULES commands that each take BENCH_MB of memory and hold
+# it for BENCH_HOLD seconds is run with a fixed -j, with the same -j and
+# --mem-reserve, with -l, and with a -j small enough to stay within memory.
+# Each is run once first so the history has the peak memory of the commands.
+# The peak is the most MemAvailable dropped below where it was before the
+# build, sampled every 10 ms.
+#
+# Environment:
+#     BENCH_RULES     Commands in the build (default 16)
+#     BENCH_MB        MiB each command takes (default 400)
+#     BENCH_HOLD      Seconds each command holds it (default 0.5)
+#     BENCH_JOBS      The fixed -j (default 8)
+#     BENCH_RESERVE   --mem-reserve (default 3G)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+ALLOC=$(realpath "${ALLOC:-./bench/alloc}")
+RULES=${BENCH_RULES:-16}
+MB=${BENCH_MB:-400}
+HOLD=${BENCH_HOLD:-0.5}
+JOBS=${BENCH_JOBS:-8}
+RESERVE=${BENCH_RESERVE:-3G}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+{
+    printf 'all:'
+    for i in $(seq "$RULES"); do
+        printf ' a%d' "$i"
+    done
+    printf '\n\ttrue\n'
+    for i in $(seq "$RULES"); do
+        printf 'a%d:\n\t%s %s %s\n' "$i" "$ALLOC" "$MB" "$HOLD"
+    done
+} > mmakefile
+mkfifo tick
+
+avail() {
+    local key value unit
+    while read -r key value unit; do
+        if [ "$key" = MemAvailable: ]; then
+            echo "$value"
+            return
+        fi
+    done < /proc/meminfo
+}
+
+# Prints the lowest MemAvailable in KiB until killed.
+sample() {
+    local low now
+    low=$(avail)
+    trap 'echo $low; exit' TERM
+    exec 3<> tick
+    while true; do
+        now=$(avail)
+        [ "$now" -lt "$low" ] && low=$now
+        read -r -t 0.01 <&3
+    done
+}
+
+echo "mode,flags,rules,mb,total_s,peak_mb"
+while read -r mode flags; do
+    "$MMAKE" -s -B $flags || exit 1
+    before=$(avail)
+    sample > low &
+    sampler=$!
+    start=$EPOCHREALTIME
+    "$MMAKE" -s -B $flags || exit 1
+    end=$EPOCHREALTIME
+    kill $sampler
+    wait $sampler
+    awk -v m="$mode" -v f="$flags" -v r="$RULES" -v mb="$MB" -v a="$start" -v e="$end" \
+        -v b="$before" -v l="$(cat low)" \
+        'BEGIN { printf "%s,%s,%d,%d,%.3f,%d\n", m, f, r, mb, e - a, (b - l) / 1024 }'
+done <<END
+fixed -j$JOBS
+reserve -j$JOBS --mem-reserve=$RESERVE
+load -j$JOBS -l2
+fitting -j$(( JOBS / 4 > 0 ? JOBS / 4 : 1 ))
+END
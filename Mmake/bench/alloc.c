@@ -0,0 +1,32 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Benchmark helper. Allocates the given amount of MiB, touches every
+*				 page so it is resident, and holds it for the given amount of seconds,
+*				 like a compiler or linker at its peak.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int main(int argc, char *argv[]) {
+	if(argc != 3) {
+		fprintf(stderr, "usage: %s MiB seconds\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	size_t size = strtoull(argv[1], NULL, 10) << 20;
+	double seconds = strtod(argv[2], NULL);
+	char *mem = malloc(size);
+	if(mem == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(mem, 1, size);
+	struct timespec hold = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+	nanosleep(&hold, NULL);
+	free(mem);
+	return 0;
+}
@@ -0,0 +1,96 @@
+#!/bin/bash
+#
+# Restoring targets from the artifact cache. Prints CSV on stdout.
+#
+# A rule "out: src" with the command "cp src out" is built with src holding
+# A, restored from the cache after out is removed, built again with src
+# holding B and restored once more with src back at A. cp writes out in
+# place, so a restored out sharing its inode with the cache entry of A would
+# turn that entry into B. Every step checks that out matches src and how many
+# links it has, and the script exits 1 after a step where out is wrong. src
+# is BENCH_SIZE MiB, so the restore times show what a hit costs on the file
+# system of the temporary directory.
+#
+# The evict step then builds six targets of 100 KiB in one run with
+# --cache-size 250K, so the cache crosses its limit several times in the same
+# process, and fails if the entries left take more than the limit. The
+# entries and KiB columns are the cache directory after each step.
+#
+# Environment:
+#     BENCH_SIZE      MiB in src (default 64)
+#     BENCH_REPS      runs of the whole sequence (default 3)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+SIZE=${BENCH_SIZE:-64}
+REPS=${BENCH_REPS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+now() {
+    date +%s.%N
+}
+
+# Prints the row of a step that ran from $2 to $3, with the links of out.
+row() {
+    local entries kib
+    entries=$(ls cache | wc -l)
+    # du counts the directory itself too.
+    kib=$(($(du -sk cache | cut -f1) - $(stat -c %b cache) / 2))
+    awk -v i="$rep" -v s="$1" -v a="$2" -v b="$3" -v l="$4" -v n="$entries" -v k="$kib" -v ok="$ok" \
+        'BEGIN { printf "%d,%s,%.4f,%d,%d,%d,%d\n", i, s, b - a, l, n, k, ok }'
+    ((ok)) || failed=1
+}
+
+# Runs mmake for a step and prints its row.
+step() {
+    local start end
+    ok=1
+    start=$(now)
+    "$MMAKE" -s --cache cache > /dev/null || exit 1
+    end=$(now)
+    cmp -s src out || ok=0
+    row "$1" "$start" "$end" "$(stat -c %h out)"
+}
+
+# Builds six targets of 100 KiB into a cache limited to 250 KiB.
+evict() {
+    local start end
+    ok=1
+    rm -rf cache .mmake_*
+    mv mmakefile mmakefile.restore
+    {
+        printf 'all: t1 t2 t3 t4 t5 t6\n\ttrue\n'
+        for i in 1 2 3 4 5 6; do
+            head -c 102400 /dev/urandom > s$i
+            printf 't%d: s%d\n\tcp s%d t%d\n' $i $i $i $i
+        done
+    } > mmakefile
+    start=$(now)
+    "$MMAKE" -s --cache cache --cache-size 250K > /dev/null || exit 1
+    end=$(now)
+    mv mmakefile.restore mmakefile
+    rm -f t? s?
+    (($(ls cache | wc -l) > 0 && $(du -sk cache | cut -f1) - $(stat -c %b cache) / 2 <= 250)) || ok=0
+    row evict "$start" "$end" 0
+}
+
+printf 'out: src\n\tcp src out\n' > mmakefile
+head -c $((SIZE << 20)) /dev/urandom > a
+head -c $((SIZE << 20)) /dev/urandom > b
+failed=0
+echo "rep,step,total_s,links,entries,kib,ok"
+for ((rep = 1; rep <= REPS; rep++)); do
+    rm -rf cache out .mmake_*
+    cp a src
+    step build-a
+    rm out
+    step restore-a
+    cp b src
+    step build-b
+    cp a src
+    rm out
+    step restore-a-again
+    evict
+done
+exit $failed
@@ -0,0 +1,85 @@
+#!/bin/bash
+#
+# Header dependencies from depfiles. Prints CSV on stdout.
+#
+# BENCH_RULES objects are built by a stand-in compiler that writes a depfile
+# listing BENCH_HEADERS headers each, picked from a shared pool. After the
+# first build, mmake finds the headers in its binary deps log, while GNU make
+# includes every .d file. Both are timed on a build with nothing to do and on
+# one after a single header is touched, which rebuilds the objects using it.
+#
+# Environment:
+#     BENCH_RULES     objects in the build (default 2000)
+#     BENCH_HEADERS   headers of each object (default 50)
+#     BENCH_REPS      measurements of each, the fastest is kept (default 5)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+RULES=${BENCH_RULES:-2000}
+HEADERS=${BENCH_HEADERS:-50}
+REPS=${BENCH_REPS:-5}
+POOL=$((HEADERS * 4))
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+# cc.sh -MD -MF t1.d -o t1.o t1.c copies the prepared depfile and creates the object.
+printf '#!/bin/sh\ncp "$3.in" "$3" && touch "$5"\n' > cc.sh
+chmod +x cc.sh
+mkdir inc
+for ((h = 0; h < POOL; h++)); do
+    : > inc/h$h.h
+done
+for ((i = 1; i <= RULES; i++)); do
+    : > t$i.c
+    {
+        printf 't%d.o: t%d.c' $i $i
+        for ((k = 0; k < HEADERS; k++)); do
+            printf ' \\\n inc/h%d.h' $(((i * 7 + k * 13) % POOL))
+        done
+        printf '\n'
+    } > t$i.d.in
+done
+{
+    printf 'all:'
+    for ((i = 1; i <= RULES; i++)); do
+        printf ' t%d.o' $i
+    done
+    printf '\n\ttrue\n'
+    for ((i = 1; i <= RULES; i++)); do
+        printf 't%d.o: t%d.c\n\t./cc.sh -MD -MF t%d.d -o t%d.o t%d.c\n' $i $i $i $i $i
+    done
+} > mmakefile
+{
+    printf 'all:'
+    for ((i = 1; i <= RULES; i++)); do
+        printf ' t%d.o' $i
+    done
+    printf '\nt%%.o: t%%.c\n\t@./cc.sh -MD -MF t$*.d -o $@ $<\n'
+    printf -- '-include $(wildcard *.d)\n'
+} > Makefile
+"$MMAKE" -s || exit 1
+
+time_best() {
+    local best= start end
+    for ((r = 0; r < REPS; r++)); do
+        start=$EPOCHREALTIME
+        "$@" > /dev/null || exit 1
+        end=$EPOCHREALTIME
+        best=$(awk -v b="$best" -v t="$(awk -v a="$start" -v e="$end" 'BEGIN { print e - a }')" \
+            'BEGIN { print (b == "" || t < b) ? t : b }')
+    done
+    echo "$best"
+}
+
+touched() {
+    touch inc/h0.h
+    "$@"
+}
+
+rebuilt=$(grep -l 'inc/h0\.h' t*.d.in | wc -l)
+echo "program,rules,headers,deps_bytes,noop_s,touch_s,rebuilt"
+if command -v make > /dev/null; then
+    make -s > /dev/null || exit 1
+    echo "make,$RULES,$HEADERS,$(cat t*.d | wc -c),$(time_best make -s),$(time_best touched make -s),$rebuilt"
+fi
+echo "mmake,$RULES,$HEADERS,$(stat -c %s .mmake_deps),$(time_best "$MMAKE" -s),$(time_best touched "$MMAKE" -s),$rebuilt"
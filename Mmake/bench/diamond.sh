@@ -0,0 +1,55 @@
+#!/bin/bash
+#
+# Up-to-date check of mmake on a generated diamond graph. Prints CSV on
+# stdout.
+#
+# The makefile is a ladder of BENCH_RULES rules: every level has two targets
+# that both depend on the two targets of the level below, so the number of
+# paths from the top to the bottom doubles with each level. Every target
+# exists and is newer than its prerequisites, so a run only walks the graph
+# and stats files. GNU make, when installed, is timed on the same makefile
+# with -q.
+#
+# Environment:
+#     BENCH_RULES     rules of the graph (default 10000)
+#     BENCH_REPS      measurements of each program (default 5)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+RULES=${BENCH_RULES:-10000}
+REPS=${BENCH_REPS:-5}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+LEVELS=$((RULES / 2))
+cd "$TMP" || exit 1
+{
+    printf 'top: a%d b%d\n\ttouch top\n' $LEVELS $LEVELS
+    for ((i = LEVELS; i > 1; i--)); do
+        printf 'a%d: a%d b%d\n\ttouch a%d\n' $i $((i - 1)) $((i - 1)) $i
+        printf 'b%d: a%d b%d\n\ttouch b%d\n' $i $((i - 1)) $((i - 1)) $i
+    done
+    printf 'a1: base\n\ttouch a1\nb1: base\n\ttouch b1\n'
+} > mmakefile
+touch base
+"$MMAKE" -s || exit 1
+
+now() {
+    date +%s.%N
+}
+
+report() {
+    awk -v p="$1" -v n="$RULES" -v r="$rep" -v s="$2" -v e="$3" \
+        'BEGIN { printf "%s,%d,%d,%.4f\n", p, n, r, e - s }'
+}
+
+echo "program,rules,rep,total_s"
+for ((rep = 1; rep <= REPS; rep++)); do
+    start=$(now)
+    "$MMAKE" || exit 1
+    report mmake "$start" "$(now)"
+    if command -v make > /dev/null; then
+        start=$(now)
+        make -q -f mmakefile
+        report make "$start" "$(now)"
+    fi
+done
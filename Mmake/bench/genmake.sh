@@ -0,0 +1,96 @@
+#!/bin/bash
+#
+# Generates a makefile of a given shape for the benchmarks and prints it on
+# stdout. It is read the same by mmake and GNU make.
+#
+# Usage: bench/genmake.sh SHAPE RULES [SEED]
+#
+# There are RULES targets t0 ... t<RULES-1>. t0 is the default goal and
+# reaches all of them. Every target without other prerequisites depends on
+# the file src, and every command is "touch <target>". The last rule builds
+# the goal "parse" from src. Once it exists, running it only parses the
+# makefile. Shapes:
+#     chain       t<i> depends on t<i+1>, one chain RULES long
+#     fanin       t0 depends on all the others directly
+#     diamond     a ladder of diamonds: the two targets of a level both
+#                 depend on the two of the level below
+#     random      a random DAG: every target is a prerequisite of a random
+#                 earlier one, and has up to BENCH_DEGREE - 1 more random
+#                 prerequisites among the later ones. SEED picks the graph
+#                 (default 1).
+#
+# Environment:
+#     BENCH_DEGREE    prerequisites per target of random (default 4)
+
+SHAPE=$1
+RULES=$2
+SEED=${3:-1}
+DEGREE=${BENCH_DEGREE:-4}
+
+case "$SHAPE" in
+    chain | fanin | diamond | random) ;;
+    *)
+        echo "usage: $0 chain|fanin|diamond|random rules [seed]" >&2
+        exit 1
+        ;;
+esac
+if ! [ "$RULES" -gt 0 ] 2> /dev/null; then
+    echo "$0: rules must be a positive number" >&2
+    exit 1
+fi
+
+awk -v shape="$SHAPE" -v n="$RULES" -v seed="$SEED" -v degree="$DEGREE" '
+function rule(i, list) {
+    printf "t%d:%s\n\ttouch t%d\n", i, list == "" ? " src" : list, i
+}
+BEGIN {
+    if (shape == "chain") {
+        for (i = 0; i < n; i++)
+            rule(i, i + 1 < n ? " t" (i + 1) : "")
+    }
+    else if (shape == "fanin") {
+        printf "t0:"
+        for (i = 1; i < n; i++)
+            printf " t%d", i
+        printf "%s\n\ttouch t0\n", n == 1 ? " src" : ""
+        for (i = 1; i < n; i++)
+            rule(i, "")
+    }
+    else if (shape == "diamond") {
+        # t0 on top, then levels of t<2k+1> and t<2k+2>.
+        rule(0, n > 2 ? " t1 t2" : n > 1 ? " t1" : "")
+        for (i = 1; i < n; i++) {
+            below = i % 2 == 1 ? i + 2 : i + 1
+            list = ""
+            if (below < n)
+                list = " t" below
+            if (below + 1 < n)
+                list = list " t" (below + 1)
+            rule(i, list)
+        }
+    }
+    else {
+        srand(seed)
+        for (i = 1; i < n; i++) {
+            p = int(rand() * i)
+            deps[p] = deps[p] " t" i
+        }
+        for (i = 0; i < n; i++) {
+            # The extra prerequisites skip the ones the target has already.
+            split("", have)
+            amount = split(deps[i], names, " ")
+            for (k = 1; k <= amount; k++)
+                have[names[k]] = 1
+            for (k = 1; k < degree && i + 1 < n; k++) {
+                name = "t" (i + 1 + int(rand() * (n - i - 1)))
+                if (!(name in have)) {
+                    deps[i] = deps[i] " " name
+                    have[name] = 1
+                }
+            }
+            rule(i, deps[i])
+            delete deps[i]
+        }
+    }
+    print "parse: src\n\ttouch parse"
+}'
@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# Nested builds sharing GNU make's jobserver. Prints CSV on stdout.
+#
+# A top build with -j BENCH_JOBS runs two sub-builds, each with eight
+# commands that sleep and log when they start and end, and no -j of their
+# own. The most commands running at once should never exceed the top -j.
+# Every combination of mmake and GNU make as the top and sub build is run,
+# and mmake as top with both the pipe and the fifo style. GNU make before 4.4
+# doesn't know the fifo style and isn't run with it.
+#
+# Environment:
+#     BENCH_JOBS      -j of the top build (default 3)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+JOBS=${BENCH_JOBS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+cat > job.sh <<'END'
+#!/bin/sh
+echo + >> "$1/log"
+sleep 0.2
+echo - >> "$1/log"
+END
+chmod +x job.sh
+for d in d1 d2; do
+    mkdir $d
+    {
+        printf 'all: j1 j2 j3 j4 j5 j6 j7 j8\n\ttrue\n'
+        for j in 1 2 3 4 5 6 7 8; do
+            printf 'j%d:\n\t%s/job.sh %s\n' $j "$TMP" "$TMP"
+        done
+    } > $d/mmakefile
+    cp $d/mmakefile $d/Makefile
+done
+printf '#!/bin/sh\ncd "$1" && shift && exec "$@"\n' > in.sh
+chmod +x in.sh
+
+fifo_make=false
+make -s -f /dev/null --jobserver-style=fifo -j2 > /dev/null 2>&1 && fifo_make=true
+
+now() {
+    date +%s.%N
+}
+
+echo "top,sub,style,jobs,max_running,total_s"
+for top in mmake make; do
+    for sub in mmake make; do
+        for style in pipe fifo; do
+            [ $top = make ] && [ $style = fifo ] && continue
+            [ $sub = make ] && [ $style = fifo ] && ! $fifo_make && continue
+            subcmd=$MMAKE
+            [ $sub = make ] && subcmd="make -s"
+            rm -f log
+            start=$(now)
+            if [ $top = mmake ]; then
+                printf 'all: s1 s2\n\ttrue\ns1:\n\t./in.sh d1 %s\ns2:\n\t./in.sh d2 %s\n' \
+                    "$subcmd" "$subcmd" > mmakefile
+                "$MMAKE" -s -j "$JOBS" --jobserver-style=$style || exit 1
+            else
+                printf 'all: s1 s2\ns1:\n\t+@./in.sh d1 %s\ns2:\n\t+@./in.sh d2 %s\n' \
+                    "$subcmd" "$subcmd" > Makefile
+                make -s -j "$JOBS" || exit 1
+            fi
+            awk -v t=$top -v s=$sub -v y=$style -v j="$JOBS" -v a="$start" -v e="$(now)" '
+                /^\+/ { c++; if (c > m) m = c }
+                /^-/ { c-- }
+                END { printf "%s,%s,%s,%d,%d,%.3f\n", t, s, y, j, m, e - a }' log
+        done
+    done
+done
@@ -0,0 +1,58 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Benchmark helper. Runs a command with its output discarded and prints
+*				 one CSV row: status,wall_s,peak_kb
+*				 The peak is the most resident memory of the command or any process it
+*				 waited for, as wait4 reports it, which for a make is the make itself.
+*
+*				 Usage: measure COMMAND [ARGS...]
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+	struct timespec start, end;
+	struct rusage usage;
+	int status;
+
+	if(argc < 2) {
+		fprintf(stderr, "usage: %s command [args...]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = fork();
+	if(pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if(pid == 0) {
+		// Only the measurements go to stdout.
+		int null = open("/dev/null", O_WRONLY);
+		if(null == -1 || dup2(null, STDOUT_FILENO) == -1 || dup2(null, STDERR_FILENO) == -1) {
+			perror("/dev/null");
+			exit(EXIT_FAILURE);
+		}
+		close(null);
+		execvp(argv[1], argv + 1);
+		exit(127);
+	}
+	if(wait4(pid, &status, 0, &usage) == -1) {
+		perror("wait4");
+		exit(EXIT_FAILURE);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%d,%.4f,%ld\n", WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+		   (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, usage.ru_maxrss);
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Benchmark helper. Parses a makefile whose targets are t0, t1, ... and
+*				 looks every one of them up, plus as many names without a rule. Given an
+*				 image path, goes through parse_makefile_image instead. Prints one CSV
+*				 row: rules,parse_s,lookup_s,lookup_ns
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../parser.h"
+
+// Function declaration.
+static double seconds(struct timespec start, struct timespec end);
+
+int main(int argc, char *argv[]) {
+	struct timespec start, parsed, end;
+	char name[32];
+
+	if(argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s makefile rules [image]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	FILE *fp = fopen(argv[1], "r");
+	if(fp == NULL) {
+		perror(argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	long rules = strtol(argv[2], NULL, 10);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	makefile *m = argc == 4 ? parse_makefile_image(fp, argv[3]) : parse_makefile(fp);
+	clock_gettime(CLOCK_MONOTONIC, &parsed);
+	if(m == NULL) {
+		fprintf(stderr, "%s: Could not parse makefile\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	long found = 0;
+	for(long i = 0; i < 2 * rules; i++) {
+		// Names past the last rule have none.
+		snprintf(name, sizeof(name), "t%ld", i);
+		found += makefile_rule(m, name) != NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if(found != rules) {
+		fprintf(stderr, "%s: found %ld of %ld rules\n", argv[1], found, rules);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%ld,%.4f,%.4f,%.1f\n", rules, seconds(start, parsed), seconds(parsed, end),
+		   seconds(parsed, end) * 1e9 / (2 * rules));
+	makefile_del(m);
+	fclose(fp);
+	return 0;
+}
+
+/*  Function: seconds
+*  Input:
+*			struct timespec start	:Start time.
+*			struct timespec end		:End time.
+*
+*  Output: Seconds from start to end.
+*/
+static double seconds(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
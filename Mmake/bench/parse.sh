@@ -0,0 +1,45 @@
+#!/bin/bash
+#
+# Parse and rule lookup time of the makefile parser. Prints CSV on stdout.
+#
+# For every size a makefile is generated where rule t<i> has BENCH_PREREQS
+# prerequisites among the rules after it and a command of as many words.
+# bench/parse parses it and looks up every target and as many names without
+# a rule. Modes:
+#     parse       parse_makefile
+#     image       parse_makefile_image with an image written beforehand, so
+#                 only the mapping and the source hash are timed
+#
+# Environment:
+#     BENCH_SIZES     rule counts to measure (default "1000 10000 100000")
+#     BENCH_PREREQS   prerequisites per rule (default 8)
+#     BENCH_REPS      measurements of each size (default 3)
+
+PARSE=${PARSE:-bench/parse}
+SIZES=${BENCH_SIZES:-1000 10000 100000}
+PREREQS=${BENCH_PREREQS:-8}
+REPS=${BENCH_REPS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+echo "mode,rules,rep,parse_s,lookup_s,lookup_ns"
+for n in $SIZES; do
+    awk -v n="$n" -v k="$PREREQS" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            line = "t" i ":"
+            cmd = "\tcc -o t" i
+            for (j = 1; j <= k && i + j < n; j++) {
+                line = line " t" (i + j)
+                cmd = cmd " t" (i + j)
+            }
+            print line
+            print cmd
+        }
+    }' > "$TMP/mmakefile"
+    rm -f "$TMP/image"
+    "$PARSE" "$TMP/mmakefile" "$n" "$TMP/image" > /dev/null || exit 1
+    for ((rep = 1; rep <= REPS; rep++)); do
+        "$PARSE" "$TMP/mmakefile" "$n" | sed "s/^/parse,/; s/,/,$rep,/2" || exit 1
+        "$PARSE" "$TMP/mmakefile" "$n" "$TMP/image" | sed "s/^/image,/; s/,/,$rep,/2" || exit 1
+    done
+done
@@ -0,0 +1,92 @@
+#!/bin/bash
+#
+# Cost of starting recipe lines. Prints CSV on stdout.
+#
+# A makefile of BENCH_RULES tiny rules is built from scratch, after
+# BENCH_EXTRA up-to-date rules have been added so that mmake has the memory
+# of a real project. Recipes:
+#     direct      one line "touch t<i>", run without a shell
+#     lines       three lines "touch t<i>.a", "cp t<i>.a t<i>.b" and
+#                 "mv t<i>.b t<i>", each run without a shell
+#     shell       one line "echo <i> > t<i>", which needs the shell
+#     script      one line "sh mk.sh t<i>", where mk.sh touches its argument,
+#                 which is how a rule with more than one step had to start
+#                 a shell before recipes could have more than one line
+# mmake is timed with one job, and so is GNU make on the same makefile.
+# With MMAKE_BEFORE set to an older mmake, it is timed too where it can run
+# the recipe, which before multi-line recipes is direct and script.
+#
+# Environment:
+#     BENCH_RULES     rules built (default 2000)
+#     BENCH_EXTRA     up-to-date rules besides (default 100000)
+#     BENCH_REPS      measurements of each (default 3)
+#     MMAKE_BEFORE    older mmake binary, optional
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+BEFORE=${MMAKE_BEFORE:+$(realpath "$MMAKE_BEFORE")}
+RULES=${BENCH_RULES:-2000}
+EXTRA=${BENCH_EXTRA:-100000}
+REPS=${BENCH_REPS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+now() {
+    date +%s.%N
+}
+
+report() {
+    awk -v p="$1" -v r="$recipe" -v n="$RULES" -v x="$EXTRA" -v i="$rep" -v s="$2" -v e="$3" \
+        'BEGIN { printf "%s,%s,%d,%d,%d,%.4f\n", p, r, n, x, i, e - s }'
+}
+
+# Prints the makefile of a recipe.
+generate() {
+    awk -v recipe="$1" -v n="$RULES" -v x="$EXTRA" 'BEGIN {
+        printf "all: top"
+        for (i = 0; i < n; i++)
+            printf " t%d", i
+        printf "\n\ttouch all\ntop:"
+        for (i = 0; i < x; i++)
+            printf " u%d", i
+        printf "\n\ttouch top\n"
+        for (i = 0; i < n; i++) {
+            printf "t%d: src\n", i
+            if (recipe == "direct")
+                printf "\ttouch t%d\n", i
+            else if (recipe == "lines")
+                printf "\ttouch t%d.a\n\tcp t%d.a t%d.b\n\tmv t%d.b t%d\n", i, i, i, i, i
+            else if (recipe == "shell")
+                printf "\techo %d > t%d\n", i, i
+            else
+                printf "\tsh mk.sh t%d\n", i
+        }
+        for (i = 0; i < x; i++)
+            printf "u%d: src\n\ttouch u%d\n", i, i
+    }'
+}
+
+echo "program,recipe,rules,extra,rep,total_s"
+touch -d '-1 minute' src
+echo 'touch "$1"' > mk.sh
+awk -v x="$EXTRA" 'BEGIN { for (i = 0; i < x; i++) print "u" i; print "top" }' | xargs touch
+for recipe in direct lines shell script; do
+    generate "$recipe" > mmakefile
+    programs="mmake make"
+    if [ -n "$BEFORE" ] && [ "$recipe" != lines ] && [ "$recipe" != shell ]; then
+        programs="mmake before make"
+    fi
+    for ((rep = 1; rep <= REPS; rep++)); do
+        for program in $programs; do
+            find . -maxdepth 1 -name 't[0-9]*' -delete
+            rm -f all .mmake_log .mmake_image
+            start=$(now)
+            case $program in
+                mmake) "$MMAKE" -s > /dev/null || exit 1 ;;
+                before) "$BEFORE" -s > /dev/null || exit 1 ;;
+                make) make -r -s -f mmakefile > /dev/null || exit 1 ;;
+            esac
+            report "$program" "$start" "$(now)"
+        done
+    done
+done
@@ -0,0 +1,81 @@
+#!/bin/bash
+#
+# Scalability of mmake against GNU make on generated makefiles. Prints CSV on
+# stdout, one row per phase of every run.
+#
+# For every shape and size bench/genmake.sh writes a makefile, and each
+# program is run on it in three phases, timed by bench/measure with its peak
+# resident memory:
+#     build       every target built from scratch, one job, mmake's files
+#                 of earlier runs removed. Sizes above BENCH_BUILD_MAX run
+#                 one touch per target for too long, there the targets are
+#                 created up to date without a row.
+#     noop        the default goal again, with everything up to date.
+#     parse       the goal "parse", which depends only on src and is up to
+#                 date, so what is left is reading the makefile. mmake's
+#                 image of the makefile is removed first, so it parses the
+#                 text like GNU make does, and then writes the image.
+# GNU make runs with -r, as the makefiles need none of its built-in rules.
+# A run that fails, like GNU make overflowing its stack on a deep chain,
+# keeps its exit status in the status column.
+#
+# Environment:
+#     BENCH_SHAPES    shapes to generate (default "chain fanin diamond random")
+#     BENCH_SIZES     rule counts (default "100 1000 10000 100000 1000000")
+#     BENCH_BUILD_MAX largest rule count to time full builds of (default 10000)
+#     BENCH_REPS      measurements of each phase (default 3)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+MEASURE=$(realpath "${MEASURE:-bench/measure}")
+GENMAKE=$(realpath "${GENMAKE:-bench/genmake.sh}")
+SHAPES=${BENCH_SHAPES:-chain fanin diamond random}
+SIZES=${BENCH_SIZES:-100 1000 10000 100000 1000000}
+BUILD_MAX=${BENCH_BUILD_MAX:-10000}
+REPS=${BENCH_REPS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+# Runs a phase of a program and prints its row.
+run() {
+    local program=$1 phase=$2
+    shift 2
+    printf '%s,%s,%d,%d,%s,%s\n' "$program" "$shape" "$n" "$rep" "$phase" "$("$MEASURE" "$@")"
+}
+
+# Removes the targets, and mmake's state of earlier runs.
+clean() {
+    find . -maxdepth 1 -name 't[0-9]*' -delete
+    rm -f .mmake_*
+}
+
+echo "program,shape,rules,rep,phase,status,total_s,peak_kb"
+for shape in $SHAPES; do
+    for n in $SIZES; do
+        clean
+        "$GENMAKE" "$shape" "$n" > mmakefile || exit 1
+        touch -d '-1 minute' src
+        touch parse
+        for program in mmake make; do
+            if [ "$program" = mmake ]; then
+                cmd=("$MMAKE" -s)
+            else
+                cmd=(make -r -s -f mmakefile)
+            fi
+            if ((n > BUILD_MAX)); then
+                clean
+                awk -v n="$n" 'BEGIN { for (i = 0; i < n; i++) print "t" i }' \
+                    | xargs touch -r parse
+            fi
+            for ((rep = 1; rep <= REPS; rep++)); do
+                if ((n <= BUILD_MAX)); then
+                    clean
+                    run "$program" build "${cmd[@]}"
+                fi
+                run "$program" noop "${cmd[@]}"
+                rm -f .mmake_image
+                run "$program" parse "${cmd[@]}" parse
+            done
+        done
+    done
+done
@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# Makespan of mmake -j with critical-path-first and FIFO order on generated
+# DAGs. Prints CSV on stdout.
+#
+# Every command sleeps, so the jobs don't compete for the CPU and the
+# makespan only depends on the order they are started in. Most commands are
+# short and a few are long. Two shapes are generated:
+#     random  every rule depends on up to three random earlier rules
+#     tail    independent short rules first, then one chain of long rules
+# A first run fills .mmake_log, the measured runs use -B. bound_s is the
+# lower bound of any order, the longest chain or the total work divided by
+# the jobs.
+#
+# Environment:
+#     BENCH_RULES     rules of each graph (default 60)
+#     BENCH_JOBS      jobs to run at once (default 4)
+#     BENCH_REPS      measurements of each order (default 3)
+#     BENCH_SEED      seed of the random graph (default 1)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+RULES=${BENCH_RULES:-60}
+JOBS=${BENCH_JOBS:-4}
+REPS=${BENCH_REPS:-3}
+SEED=${BENCH_SEED:-1}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+# Writes the makefile of a shape and prints its bound.
+generate() {
+    awk -v shape="$1" -v n="$RULES" -v jobs="$JOBS" -v seed="$SEED" '
+    BEGIN {
+        srand(seed)
+        for (i = 1; i <= n; i++) {
+            if (shape == "tail") {
+                long = i > n * 3 / 4
+                t[i] = long ? 0.3 : 0.02 + rand() * 0.03
+                deps = long && i > int(n * 3 / 4) + 1 ? "r" (i - 1) : ""
+            }
+            else {
+                t[i] = rand() < 0.1 ? 0.2 + rand() * 0.3 : 0.01 + rand() * 0.05
+                deps = ""
+                for (k = 0; k < 3 && i > 1; k++) {
+                    if (rand() < 0.5) {
+                        deps = deps " r" int(1 + rand() * (i - 1))
+                    }
+                }
+            }
+            path[i] = t[i]
+            split(deps, d, " ")
+            for (k in d) {
+                j = substr(d[k], 2)
+                if (path[j] + t[i] > path[i]) {
+                    path[i] = path[j] + t[i]
+                }
+            }
+            work += t[i]
+            if (path[i] > bound) {
+                bound = path[i]
+            }
+            rules = rules sprintf("r%d:%s\n\tsleep %.3f\n", i, deps, t[i])
+            all = all " r" i
+        }
+        printf "all:%s\n\ttrue\n%s", all, rules > "mmakefile"
+        printf "%.4f\n", (work / jobs > bound ? work / jobs : bound)
+    }'
+}
+
+now() {
+    date +%s.%N
+}
+
+echo "shape,rules,jobs,rep,order,makespan_s,bound_s"
+for shape in random tail; do
+    rm -f .mmake_log
+    bound=$(generate "$shape")
+    "$MMAKE" -s -j "$JOBS" --fifo || exit 1
+    for ((rep = 1; rep <= REPS; rep++)); do
+        for order in critical fifo; do
+            flag=
+            [ "$order" = fifo ] && flag=--fifo
+            start=$(now)
+            "$MMAKE" -s -B -j "$JOBS" $flag || exit 1
+            awk -v s="$shape" -v n="$RULES" -v j="$JOBS" -v r="$rep" -v o="$order" \
+                -v a="$start" -v e="$(now)" -v b="$bound" \
+                'BEGIN { printf "%s,%d,%d,%d,%s,%.4f,%s\n", s, n, j, r, o, e - a, b }'
+        done
+    done
+done
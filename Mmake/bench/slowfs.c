@@ -0,0 +1,325 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Benchmark helper. Mounts a read-only view of a directory with FUSE,
+*				 where every lookup of a name waits the given amount of microseconds
+*				 before it is answered, like a file server over the network. Requests
+*				 are served by many threads, so lookups that are sent together wait
+*				 together. Only looking names up, getting attributes and listing
+*				 directories is supported, which is all a no-op build needs. Listing
+*				 a directory waits the latency as well. Runs until unmounted.
+*
+*				 Usage: slowfs SOURCE MOUNTPOINT MICROSECONDS
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/uio.h>
+#include <linux/fuse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+// Threads answering requests.
+#define THREADS 64
+// Seconds the kernel may cache names and attributes, the benchmark drops them.
+#define VALID 3600
+#define BUFFER_SIZE (FUSE_MIN_READ_BUFFER + 65536)
+
+static int fuseFd;
+static long latency;
+// Path of every node id given out, ids are never reused.
+static char **paths;
+static size_t pathAmt;
+static size_t pathCap;
+static pthread_mutex_t pathLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function declaration.
+static void *serve(void *arg);
+static void handle(struct fuse_in_header *in, char *arg);
+static void reply(uint64_t unique, int error, const void *data, size_t size);
+static size_t addPath(char *path);
+static char *pathOf(uint64_t id);
+static void fillAttr(struct fuse_attr *attr, const struct stat *info);
+static void readDir(struct fuse_in_header *in, struct fuse_read_in *read);
+static void delay(void);
+
+int main(int argc, char *argv[]) {
+	if(argc != 4) {
+		fprintf(stderr, "usage: %s source mountpoint microseconds\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	latency = strtol(argv[3], NULL, 10);
+	// Id 0 isn't a node, id 1 is the root.
+	addPath(strdup(""));
+	addPath(realpath(argv[1], NULL));
+	if(paths[1] == NULL) {
+		perror(argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	if((fuseFd = open("/dev/fuse", O_RDWR | O_CLOEXEC)) == -1) {
+		perror("/dev/fuse");
+		exit(EXIT_FAILURE);
+	}
+	char options[128];
+	snprintf(options, sizeof(options), "fd=%d,rootmode=40000,user_id=0,group_id=0,allow_other", fuseFd);
+	if(mount("slowfs", argv[2], "fuse.slowfs", MS_NOSUID | MS_NODEV | MS_RDONLY, options) == -1) {
+		perror("mount");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_t tids[THREADS];
+	for(int i = 1; i < THREADS; i++) {
+		pthread_create(&tids[i], NULL, serve, NULL);
+	}
+	serve(NULL);
+	return 0;
+}
+
+/*  Function: serve
+*  Input:
+*			void *arg			:Unused.
+*
+*  Output: Reads and answers requests until the file system is unmounted, then
+*		   exits the process.
+*/
+static void *serve(void *arg) {
+	(void)arg;
+	char *buf = malloc(BUFFER_SIZE);
+	if(buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	while(true) {
+		ssize_t n = read(fuseFd, buf, BUFFER_SIZE);
+		if(n == -1 && (errno == EINTR || errno == ENOENT || errno == EAGAIN)) {
+			continue;
+		}
+		if(n == -1) {
+			// ENODEV once unmounted.
+			exit(errno == ENODEV ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+		handle((struct fuse_in_header *)buf, buf + sizeof(struct fuse_in_header));
+	}
+	return NULL;
+}
+
+/*  Function: handle
+*  Input:
+*			struct fuse_in_header *in	:Request.
+*			char *arg			:Its argument.
+*
+*  Output: Answers the request. Lookups wait the latency first.
+*/
+static void handle(struct fuse_in_header *in, char *arg) {
+	struct stat info;
+	switch(in->opcode) {
+		case FUSE_INIT: {
+			struct fuse_init_in *init = (struct fuse_init_in *)arg;
+			struct fuse_init_out out = {0};
+			out.major = FUSE_KERNEL_VERSION;
+			out.minor = FUSE_KERNEL_MINOR_VERSION;
+			out.max_readahead = init->max_readahead;
+			out.max_background = THREADS;
+			out.congestion_threshold = THREADS;
+			out.max_write = 65536;
+			out.time_gran = 1;
+			// Without it the kernel sends one lookup at a time per directory.
+			out.flags = init->flags & FUSE_PARALLEL_DIROPS;
+			reply(in->unique, 0, &out, sizeof(out));
+			break;
+		}
+		case FUSE_LOOKUP: {
+			delay();
+			char *parent = pathOf(in->nodeid);
+			char *path = malloc(strlen(parent) + strlen(arg) + 2);
+			if(path == NULL) {
+				perror("malloc");
+				exit(EXIT_FAILURE);
+			}
+			sprintf(path, "%s/%s", parent, arg);
+			if(lstat(path, &info) == -1) {
+				reply(in->unique, -errno, NULL, 0);
+				free(path);
+				break;
+			}
+			struct fuse_entry_out out = {0};
+			out.nodeid = addPath(path);
+			out.entry_valid = VALID;
+			out.attr_valid = VALID;
+			fillAttr(&out.attr, &info);
+			reply(in->unique, 0, &out, sizeof(out));
+			break;
+		}
+		case FUSE_GETATTR: {
+			if(lstat(pathOf(in->nodeid), &info) == -1) {
+				reply(in->unique, -errno, NULL, 0);
+				break;
+			}
+			struct fuse_attr_out out = {0};
+			out.attr_valid = VALID;
+			fillAttr(&out.attr, &info);
+			reply(in->unique, 0, &out, sizeof(out));
+			break;
+		}
+		case FUSE_OPENDIR: {
+			struct fuse_open_out out = {0};
+			reply(in->unique, 0, &out, sizeof(out));
+			break;
+		}
+		case FUSE_READDIR:
+			readDir(in, (struct fuse_read_in *)arg);
+			break;
+		case FUSE_RELEASEDIR:
+			reply(in->unique, 0, NULL, 0);
+			break;
+		case FUSE_FORGET:
+		case FUSE_BATCH_FORGET:
+			break;
+		case FUSE_DESTROY:
+			reply(in->unique, 0, NULL, 0);
+			break;
+		default:
+			reply(in->unique, -ENOSYS, NULL, 0);
+			break;
+	}
+}
+
+/*  Function: reply
+*  Input:
+*			uint64_t unique		:Request answered.
+*			int error			:0 or a negative errno.
+*			const void *data	:Answer.
+*			size_t size			:Size of the answer.
+*
+*  Output: Writes the answer to the kernel.
+*/
+static void reply(uint64_t unique, int error, const void *data, size_t size) {
+	struct fuse_out_header out = {sizeof(out) + size, error, unique};
+	struct iovec iov[2] = {{&out, sizeof(out)}, {(void *)data, size}};
+	if(writev(fuseFd, iov, size > 0 ? 2 : 1) == -1 && errno != ENOENT) {
+		perror("writev");
+	}
+}
+
+/*  Function: addPath
+*  Input:
+*			char *path			:Path of a node, kept.
+*
+*  Output: The id given to the node.
+*/
+static size_t addPath(char *path) {
+	pthread_mutex_lock(&pathLock);
+	if(pathAmt == pathCap) {
+		pathCap = pathCap == 0 ? 1024 : pathCap * 2;
+		if((paths = realloc(paths, pathCap * sizeof(char *))) == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	size_t id = pathAmt++;
+	paths[id] = path;
+	pthread_mutex_unlock(&pathLock);
+	return id;
+}
+
+/*  Function: pathOf
+*  Input:
+*			uint64_t id			:Node id.
+*
+*  Output: The path of the node.
+*/
+static char *pathOf(uint64_t id) {
+	pthread_mutex_lock(&pathLock);
+	char *path = paths[id];
+	pthread_mutex_unlock(&pathLock);
+	return path;
+}
+
+/*  Function: fillAttr
+*  Input:
+*			struct fuse_attr *attr	:Attributes to fill.
+*			const struct stat *info	:Stat of the file.
+*
+*  Output: Copies the stat.
+*/
+static void fillAttr(struct fuse_attr *attr, const struct stat *info) {
+	attr->ino = info->st_ino;
+	attr->size = info->st_size;
+	attr->blocks = info->st_blocks;
+	attr->atime = info->st_atim.tv_sec;
+	attr->atimensec = info->st_atim.tv_nsec;
+	attr->mtime = info->st_mtim.tv_sec;
+	attr->mtimensec = info->st_mtim.tv_nsec;
+	attr->ctime = info->st_ctim.tv_sec;
+	attr->ctimensec = info->st_ctim.tv_nsec;
+	attr->mode = info->st_mode;
+	attr->nlink = info->st_nlink;
+	attr->uid = info->st_uid;
+	attr->gid = info->st_gid;
+	attr->rdev = info->st_rdev;
+	attr->blksize = info->st_blksize;
+}
+
+/*  Function: readDir
+*  Input:
+*			struct fuse_in_header *in	:Request.
+*			struct fuse_read_in *read	:Offset and size to read.
+*
+*  Output: Answers with the entries of the directory from the offset, which is the
+*		   index of the entry, as many as fit.
+*/
+static void readDir(struct fuse_in_header *in, struct fuse_read_in *read) {
+	delay();
+	DIR *dir = opendir(pathOf(in->nodeid));
+	if(dir == NULL) {
+		reply(in->unique, -errno, NULL, 0);
+		return;
+	}
+	char *buf = calloc(1, read->size);
+	if(buf == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	size_t size = 0;
+	uint64_t index = 0;
+	struct dirent *e;
+	while((e = readdir(dir)) != NULL) {
+		if(index++ < read->offset) {
+			continue;
+		}
+		struct fuse_dirent *d = (struct fuse_dirent *)(buf + size);
+		size_t len = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + strlen(e->d_name));
+		if(size + len > read->size) {
+			break;
+		}
+		d->ino = e->d_ino;
+		d->off = index;
+		d->namelen = strlen(e->d_name);
+		d->type = e->d_type;
+		memcpy(d->name, e->d_name, d->namelen);
+		size += len;
+	}
+	closedir(dir);
+	reply(in->unique, 0, buf, size);
+	free(buf);
+}
+
+/*  Function: delay
+*  Input:	-
+*
+*  Output: Waits the latency.
+*/
+static void delay(void) {
+	struct timespec wait = {latency / 1000000, latency % 1000000 * 1000};
+	nanosleep(&wait, NULL);
+}
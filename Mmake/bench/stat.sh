@@ -0,0 +1,95 @@
+#!/bin/bash
+#
+# No-op build of a large source tree, with the page, dentry and inode caches
+# dropped before every run. Prints CSV on stdout.
+#
+# BENCH_FILES source files are spread over directories of 100, and every
+# directory has one up to date target depending on its files. A run only
+# stats files, so on a cold cache its time is the time of the stats. The tree
+# is used where it is, and through bench/slowfs, which answers every lookup
+# after BENCH_LATENCY_US like a file server would. Dropping the caches and
+# mounting need root, without it the runs are warm and only local, and the
+# cache column says so.
+#
+# GNU make is timed with -q on the same makefile. Set MMAKE_BEFORE to another
+# mmake binary to time it as well, like one built before a change.
+#
+# Environment:
+#     BENCH_FILES       source files of the tree (default 50000)
+#     BENCH_LATENCY_US  latency of a lookup through slowfs (default 200)
+#     BENCH_REPS        measurements of each program (default 3)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+SLOWFS=$(realpath "${SLOWFS:-./bench/slowfs}")
+FILES=${BENCH_FILES:-50000}
+LATENCY=${BENCH_LATENCY_US:-200}
+REPS=${BENCH_REPS:-3}
+TMP=$(mktemp -d)
+trap 'mountpoint -q "$TMP/mnt" && umount "$TMP/mnt"; rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+# The makefile names everything under t, a link to the tree or to its mount.
+DIRS=$(((FILES + 99) / 100))
+mkdir src mnt
+ln -s src t
+for ((d = 0; d < DIRS; d++)); do
+    mkdir src/d$d
+    (cd src/d$d && touch $(seq -f 'f%g.c' 0 $((d == DIRS - 1 ? (FILES - 1) % 100 : 99))))
+done
+{
+    printf 'all:'
+    for ((d = 0; d < DIRS; d++)); do
+        printf ' t/d%d/out' $d
+    done
+    printf '\n\ttrue\n'
+    for ((d = 0; d < DIRS; d++)); do
+        printf 't/d%d/out:' $d
+        for f in src/d$d/*.c; do
+            printf ' t/%s' "${f#src/}"
+        done
+        printf '\n\ttouch t/d%d/out\n' $d
+    done
+} > mmakefile
+sed 's/^all:\(.*\)/all:\1\n/; /^\ttrue$/d' mmakefile > Makefile
+"$MMAKE" -s || exit 1
+"$MMAKE" -s || exit 1
+
+cache=warm
+drop() {
+    sync
+    echo 3 > /proc/sys/vm/drop_caches 2> /dev/null && cache=cold
+}
+drop
+
+run() {
+    local name=$1 start end
+    shift
+    for ((r = 1; r <= REPS; r++)); do
+        drop
+        start=$EPOCHREALTIME
+        "$@" > /dev/null
+        end=$EPOCHREALTIME
+        awk -v p="$name" -v f="$FILES" -v s="$fs" -v c=$cache -v r=$r -v a="$start" -v e="$end" \
+            'BEGIN { printf "%s,%d,%s,%s,%d,%.4f\n", p, f, s, c, r, e - a }'
+    done
+}
+
+echo "program,files,fs,cache,rep,total_s"
+for fs in local slowfs-${LATENCY}us; do
+    if [ $fs != local ]; then
+        "$SLOWFS" src mnt "$LATENCY" &
+        for ((i = 0; i < 100; i++)); do
+            [ -e mnt/d0 ] && break
+            read -r -t 0.01 <> <(:)
+        done
+        [ -e mnt/d0 ] || break
+        ln -sfn mnt t
+    fi
+    run mmake "$MMAKE" -s
+    if [ -n "$MMAKE_BEFORE" ]; then
+        run mmake-before "$(realpath "$MMAKE_BEFORE")" -s
+    fi
+    if command -v make > /dev/null; then
+        run make make -q all
+    fi
+done
@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# Reaction time of mmake --watch on a generated tree of source files. Prints
+# CSV on stdout.
+#
+# BENCH_FILES files are spread over directories of 100 files each, and every
+# directory has one target depending on all its files. The target's command
+# prints the time it started. After the first build, one file at a time is
+# appended to and the time from the write until the command started is
+# measured. It includes the quiet time that ends a burst of changes.
+#
+# Environment:
+#     BENCH_FILES     source files (default 50000)
+#     BENCH_REPS      changes to measure (default 20)
+
+MMAKE=$(realpath "${MMAKE:-./mmake}")
+FILES=${BENCH_FILES:-50000}
+REPS=${BENCH_REPS:-20}
+TMP=$(mktemp -d)
+cd "$TMP" || exit 1
+
+DIRS=$(((FILES + 99) / 100))
+for ((d = 0; d < DIRS; d++)); do
+    mkdir "d$d"
+    (cd "d$d" && touch $(seq -f 'f%g' 0 $((FILES / DIRS - 1))))
+done
+{
+    printf 'all:'
+    for ((d = 0; d < DIRS; d++)); do
+        printf ' o%d' $d
+    done
+    printf '\n\ttrue\n'
+    for ((d = 0; d < DIRS; d++)); do
+        printf 'o%d:' $d
+        printf " d$d/%s" $(ls "d$d")
+        printf '\n\tdate +%%s.%%N\n'
+    done
+} > mmakefile
+
+"$MMAKE" -s --watch > out.txt 2> err.txt &
+pid=$!
+trap 'kill $pid; wait $pid 2> /dev/null; cd /; rm -rf "$TMP"' EXIT
+# Wait for the first build to finish and the watches to be set up.
+sleep 1
+lines=$(wc -l < out.txt)
+while sleep 0.2; [ "$(wc -l < out.txt)" != "$lines" ]; do
+    lines=$(wc -l < out.txt)
+done
+
+# Wait with the read builtin on a fifo that nobody writes, a sleep process
+# would compete with mmake for the CPU.
+mkfifo idle
+exec 3<> idle
+
+echo "files,rep,reaction_ms"
+for ((rep = 1; rep <= REPS; rep++)); do
+    file=d$((RANDOM % DIRS))/f$((RANDOM % (FILES / DIRS)))
+    start=$EPOCHREALTIME
+    echo x >> "$file"
+    read -r -t 0.2 -u 3
+    awk -v n="$FILES" -v r="$rep" -v s="$start" \
+        'END { printf "%d,%d,%.2f\n", n, r, ($1 - s) * 1000 }' out.txt
+done
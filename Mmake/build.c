@@ -0,0 +1,1076 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Runs the commands of a dependency graph, see build.h.
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include "build.h"
+
+// How often the load and memory are sampled again while they hold back a job.
+#define THROTTLE_MS 50
+
+struct job {
+	node *node;
+	// Command line running, the lines of the rule run one at a time.
+	char **line;
+	pid_t pid;
+	int pidfd;
+	// Job slot it runs in, its track in the trace.
+	int lane;
+	// Job slots it takes.
+	int weight;
+	// When the first line and the running one started.
+	struct timespec start;
+	struct timespec lineStart;
+	// Most memory any of its lines used, in KiB.
+	long maxRss;
+	// Buffered stdout and stderr of the command, -1 if not buffered.
+	int out;
+	int err;
+	// Store the target in the artifact cache under key if the command succeeds.
+	bool cacheable;
+	cache_key key;
+	// The target of a restat rule existed, with this modification time and content.
+	bool restat;
+	struct timespec oldMtime;
+	uint64_t oldHash;
+};
+
+// A queue of nodes. Every node is pushed at most once, so it never wraps.
+struct queue {
+	node **nodes;
+	int head;
+	int tail;
+};
+
+// A binary max-heap of nodes by priority.
+struct heap {
+	node **nodes;
+	int amount;
+};
+
+struct build {
+	graph *g;
+	build_options opts;
+	// Finished prerequisites, not yet checked.
+	struct queue ready;
+	// Out of date, waiting for a job slot.
+	struct heap runnable;
+	// Nodes found out of date so far.
+	int outOfDate;
+	struct job *jobs;
+	struct pollfd *fds;
+	// Which job slots are in use.
+	bool *laneBusy;
+	int running;
+	// Sum of the weights of the running jobs.
+	int slotsUsed;
+	bool failed;
+	// Jobserver tokens held, one for every slot in use but the first.
+	char *tokens;
+	int tokenAmt;
+	// A node is runnable but no token could be taken.
+	bool waitToken;
+	// A node is runnable but the load or memory limit was reached.
+	bool throttled;
+};
+
+
+// Function declaration.
+static bool needsBuild(struct build *b, node *n);
+static bool newer(struct timespec a, struct timespec b);
+static bool inputHashes(node *n, uint64_t *hashes);
+static bool recordMatches(node *n, db_record *r);
+static void updateRecord(db *d, node *n);
+static bool cacheKey(node *n, cache_key *key);
+static void recordDeps(struct build *b, node *n, bool ran);
+static void restat(struct build *b, struct job *job);
+static int run(graph *g, node **nodes, int nodeAmt, build_options opts);
+static void printCriticalPath(node **nodes, int nodeAmt);
+static void finish(struct build *b, node *n);
+static void startJob(struct build *b, node *n);
+static bool startLine(struct build *b, struct job *job);
+static void waitJobs(struct build *b);
+static void emitOutput(int fd, int to);
+static void push(struct queue *q, node *n);
+static bool admit(struct build *b, node *n);
+static int weight(struct build *b, node *n);
+static long peakKb(struct build *b, node *n);
+static bool takeSlot(struct build *b, int slots);
+static void releaseSpare(struct build *b);
+static void prioritize(node **nodes, int nodeAmt, build_options opts);
+static void heapPush(struct heap *h, node *n);
+static node *heapPop(struct heap *h);
+static bool before(node *a, node *b);
+
+/*  Function: build_run
+*  Input:
+*			graph *g			:Graph to build.
+*			build_options opts	:Build options.
+*
+*  Output: Builds every node.
+*/
+int build_run(graph *g, build_options opts) {
+	// Headers read from depfiles add nodes to the graph while it is built.
+	int nodeAmt = g->nodeAmt;
+	node **nodes = malloc((nodeAmt + 1) * sizeof(node *));
+	if(nodes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(nodes, g->nodes, nodeAmt * sizeof(node *));
+	for(int i = 0; i < nodeAmt; i++) {
+		nodes[i]->inBuild = true;
+	}
+	int status = run(g, nodes, nodeAmt, opts);
+	for(int i = 0; i < nodeAmt; i++) {
+		nodes[i]->inBuild = false;
+	}
+	free(nodes);
+	return status;
+}
+
+/*  Function: build_downstream
+*  Input:
+*			graph *g			:Graph that has been built.
+*			build_options opts	:Build options.
+*			node **changed		:Nodes whose files have changed.
+*			int changedAmt		:Amount of changed nodes.
+*
+*  Output: Collects the changed nodes and everything depending on them, and builds
+*		   only those. The other nodes keep their cached stats and count as finished
+*		   and not rebuilt. Nothing is done per node of the whole graph, inBuild is
+*		   false everywhere between builds.
+*/
+int build_downstream(graph *g, build_options opts, node **changed, int changedAmt) {
+	node **nodes = malloc((g->nodeAmt + 1) * sizeof(node *));
+	if(nodes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int nodeAmt = 0;
+	for(int i = 0; i < changedAmt; i++) {
+		if(!changed[i]->inBuild) {
+			changed[i]->inBuild = true;
+			nodes[nodeAmt++] = changed[i];
+		}
+	}
+	// The list doubles as the queue of the walk up the dependents.
+	for(int i = 0; i < nodeAmt; i++) {
+		for(int j = 0; j < nodes[i]->dependentAmt; j++) {
+			node *d = nodes[i]->dependents[j];
+			if(!d->inBuild) {
+				d->inBuild = true;
+				nodes[nodeAmt++] = d;
+			}
+		}
+	}
+	int status = run(g, nodes, nodeAmt, opts);
+	for(int i = 0; i < nodeAmt; i++) {
+		nodes[i]->inBuild = false;
+	}
+	free(nodes);
+	return status;
+}
+
+/*  Function: run
+*  Input:
+*			graph *g			:Graph of the nodes.
+*			node **nodes		:Nodes to build, marked inBuild.
+*			int nodeAmt			:Amount of nodes to build.
+*			build_options opts	:Build options.
+*
+*  Output: Walks the nodes from the leaves up. A node whose prerequisites are all finished
+*		   is checked, and its command is started if it is out of date and a job slot is
+*		   free, highest priority first. Up to date nodes finish at once. Prerequisites
+*		   that aren't built count as finished.
+*/
+static int run(graph *g, node **nodes, int nodeAmt, build_options opts) {
+	struct build b = {0};
+	b.g = g;
+	b.opts = opts;
+	b.ready.nodes = malloc((nodeAmt + 1) * sizeof(node *));
+	b.runnable.nodes = malloc((nodeAmt + 1) * sizeof(node *));
+	b.jobs = malloc(opts.jobs * sizeof(struct job));
+	b.fds = malloc((opts.jobs + 1) * sizeof(struct pollfd));
+	b.laneBusy = calloc(opts.jobs, sizeof(bool));
+	b.tokens = malloc(opts.jobs);
+	if(b.ready.nodes == NULL || b.runnable.nodes == NULL || b.jobs == NULL || b.fds == NULL
+	   || b.laneBusy == NULL || b.tokens == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i = 0; i < nodeAmt; i++) {
+		node *n = nodes[i];
+		n->priority = 0;
+		n->waiting = 0;
+		for(int j = 0; j < n->prereqAmt; j++) {
+			n->waiting += n->prereqs[j]->inBuild;
+		}
+		n->done = false;
+		n->rebuilt = false;
+		n->runTime = 0;
+		n->pathTime = 0;
+		n->pathPrev = NULL;
+		if(n->waiting == 0) {
+			push(&b.ready, n);
+		}
+	}
+
+	while(true) {
+		// Check every ready node, finishing the ones that are up to date may make more ready.
+		while(!b.failed && b.ready.head < b.ready.tail) {
+			node *n = b.ready.nodes[b.ready.head++];
+			struct timespec checkStart = trace_now();
+			bool outOfDate = needsBuild(&b, n);
+			if(b.failed) {
+				break;
+			}
+			n->queued = trace_now();
+			if(opts.trace != NULL) {
+				trace_overhead(opts.trace, "up-to-date checks", trace_seconds(checkStart, n->queued));
+			}
+			if(outOfDate) {
+				// Order only matters with several jobs, and a build with nothing to do
+				// never reads the history.
+				if(b.outOfDate == 0 && opts.jobs > 1 && !opts.fifo) {
+					prioritize(nodes, nodeAmt, opts);
+				}
+				n->order = b.outOfDate++;
+				heapPush(&b.runnable, n);
+			}
+			else {
+				finish(&b, n);
+			}
+		}
+		b.waitToken = false;
+		b.throttled = false;
+		while(!b.failed && b.runnable.amount > 0 && admit(&b, b.runnable.nodes[0])) {
+			startJob(&b, heapPop(&b.runnable));
+			releaseSpare(&b);
+		}
+		// startJob finishes commands that are empty, which can make nodes ready.
+		if(!b.failed && b.ready.head < b.ready.tail) {
+			continue;
+		}
+		if(b.running == 0) {
+			break;
+		}
+		waitJobs(&b);
+	}
+	// Nothing runs, so nothing would ever make room for what is left.
+	if(!b.failed && b.runnable.amount > 0) {
+		fprintf(stderr, "mmake: %s: could not be started\n", b.runnable.nodes[0]->name);
+		b.failed = true;
+	}
+
+	if(opts.trace != NULL && !b.failed) {
+		printCriticalPath(nodes, nodeAmt);
+	}
+	free(b.ready.nodes);
+	free(b.runnable.nodes);
+	free(b.jobs);
+	free(b.fds);
+	free(b.laneBusy);
+	free(b.tokens);
+	return b.failed ? EXIT_FAILURE : 0;
+}
+
+/*  Function: needsBuild
+*  Input:
+*			struct build *b		:Build state.
+*			node *n				:Node whose prerequisites are finished.
+*
+*  Output: True if the node has a rule and its target is missing, older than a prerequisite
+*		   or has a prerequisite that was rebuilt, or if its header dependencies are
+*		   stale. In --hash mode a target with a record
+*		   in the database is instead rebuilt only if its command or the content of a
+*		   prerequisite differs from the record. A restat target that its command
+*		   left unchanged counts as new as the prerequisites it was built from.
+*		   A missing prerequisite fails the build, the running jobs are waited for.
+*/
+static bool needsBuild(struct build *b, node *n) {
+	struct timespec targetTime;
+	struct timespec prereqTime;
+	struct timespec output;
+	struct timespec inputs;
+
+	if(n->rule == NULL) {
+		return false;
+	}
+	if(b->opts.force || n->staleDeps || !graph_mtime(n, &targetTime)) {
+		return true;
+	}
+	db_record *r = b->opts.db != NULL ? db_find(b->opts.db, n->name) : NULL;
+	if(r != NULL) {
+		return !recordMatches(n, r);
+	}
+	// Only while it keeps the modification time it was left with, a target put back
+	// from elsewhere is compared as it is.
+	if(rule_restat(n->rule) && b->opts.history != NULL
+	   && history_get_restat(b->opts.history, n->name, &output, &inputs)
+	   && !newer(output, targetTime) && !newer(targetTime, output) && newer(inputs, targetTime)) {
+		targetTime = inputs;
+	}
+	for(int i = 0; i < n->prereqAmt; i++) {
+		if(n->prereqs[i]->inBuild && n->prereqs[i]->rebuilt) {
+			return true;
+		}
+		// Prerequisites exist at this point, a rule that didn't create its target was rebuilt.
+		if(!graph_mtime(n->prereqs[i], &prereqTime)) {
+			fprintf(stderr, "mmake: %s: No such file or directory\n", n->prereqs[i]->name);
+			if(b->running > 0) {
+				fprintf(stderr, "mmake: waiting for unfinished jobs\n");
+			}
+			b->failed = true;
+			return false;
+		}
+		if(newer(prereqTime, targetTime)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*  Function: newer
+*  Input:
+*			struct timespec a	:Modification time.
+*			struct timespec b	:Modification time.
+*
+*  Output: True if a is later than b, to the nanosecond.
+*/
+static bool newer(struct timespec a, struct timespec b) {
+	return a.tv_sec != b.tv_sec ? a.tv_sec > b.tv_sec : a.tv_nsec > b.tv_nsec;
+}
+
+/*  Function: inputHashes
+*  Input:
+*			node *n				:Node with a rule.
+*			uint64_t *hashes	:Set to the content hash of each prerequisite.
+*
+*  Output: false if a prerequisite can't be read, like one whose rule doesn't create it.
+*/
+static bool inputHashes(node *n, uint64_t *hashes) {
+	for(int i = 0; i < n->prereqAmt; i++) {
+		if(!graph_hash(n->prereqs[i], &hashes[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*  Function: recordMatches
+*  Input:
+*			node *n				:Node with a rule.
+*			db_record *r		:Record of its last build.
+*
+*  Output: True if the command, the prerequisites and their contents are the same as
+*		   in the record.
+*/
+static bool recordMatches(node *n, db_record *r) {
+	if(r->cmdHash != db_hash_cmd(rule_cmd(n->rule)) || r->inputAmt != n->prereqAmt) {
+		return false;
+	}
+	uint64_t hash;
+	for(int i = 0; i < n->prereqAmt; i++) {
+		if(!graph_hash(n->prereqs[i], &hash) || r->hashes[i] != hash
+		   || strcmp(r->inputs[i], n->prereqs[i]->name) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*  Function: updateRecord
+*  Input:
+*			db *d				:Build database.
+*			node *n				:Node with a rule that is built or up to date.
+*
+*  Output: Records the command and the prerequisite hashes of the node, unless they
+*		   are already recorded or a prerequisite can't be read.
+*/
+static void updateRecord(db *d, node *n) {
+	db_record *r = db_find(d, n->name);
+	if(r != NULL && recordMatches(n, r)) {
+		return;
+	}
+	uint64_t *hashes = malloc((n->prereqAmt + 1) * sizeof(uint64_t));
+	const char **inputs = malloc((n->prereqAmt + 1) * sizeof(char *));
+	if(hashes == NULL || inputs == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	if(inputHashes(n, hashes)) {
+		for(int i = 0; i < n->prereqAmt; i++) {
+			inputs[i] = n->prereqs[i]->name;
+		}
+		db_put(d, n->name, db_hash_cmd(rule_cmd(n->rule)), n->prereqAmt, inputs, hashes);
+	}
+	free(hashes);
+	free(inputs);
+}
+
+/*  Function: cacheKey
+*  Input:
+*			node *n				:Node with a rule.
+*			cache_key *key		:Set to the artifact cache key of the node.
+*
+*  Output: false if a prerequisite can't be read, then the node isn't cached.
+*/
+static bool cacheKey(node *n, cache_key *key) {
+	uint64_t *hashes = malloc((n->prereqAmt + 1) * sizeof(uint64_t));
+	const char **inputs = malloc((n->prereqAmt + 1) * sizeof(char *));
+	if(hashes == NULL || inputs == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	bool ok = inputHashes(n, hashes);
+	if(ok) {
+		for(int i = 0; i < n->prereqAmt; i++) {
+			inputs[i] = n->prereqs[i]->name;
+		}
+		cache_key_of(n->name, rule_cmd(n->rule), n->prereqAmt, inputs, hashes, key);
+	}
+	free(hashes);
+	free(inputs);
+	return ok;
+}
+
+/*  Function: recordDeps
+*  Input:
+*			struct build *b		:Build state.
+*			node *n				:Node that was just built.
+*			bool ran			:Its command ran, it wasn't restored from the cache.
+*
+*  Output: If the command writes a depfile, its headers are recorded in the deps log
+*		   with the new modification time of the target, and become the node's headers
+*		   in the graph. A restored target keeps the headers recorded before, as no
+*		   depfile came with it.
+*/
+static void recordDeps(struct build *b, node *n, bool ran) {
+	char depfile[PATH_MAX];
+	struct timespec mtime;
+	const char **deps;
+	int depAmt;
+	struct timespec recorded;
+	if(b->opts.deps == NULL || !depslog_depfile(rule_cmd(n->rule), n->name, depfile, sizeof(depfile))
+	   || !graph_mtime(n, &mtime)) {
+		return;
+	}
+	if(ran) {
+		if(depslog_ingest(b->opts.deps, n->name, depfile, rule_prereq(n->rule), mtime) == 0) {
+			n->staleDeps = false;
+			graph_set_deps(b->g, n);
+		}
+	}
+	else if(depslog_find(b->opts.deps, n->name, &deps, &depAmt, &recorded)) {
+		depslog_put(b->opts.deps, n->name, deps, depAmt, mtime);
+		n->staleDeps = false;
+	}
+}
+
+/*  Function: restat
+*  Input:
+*			struct build *b		:Build state.
+*			struct job *job		:Finished job of a restat rule whose target existed.
+*
+*  Output: If the command left the target with the content it had, the target gets
+*		   back its old modification time and doesn't count as rebuilt, so dependents
+*		   that wait only for it stay up to date. The newest modification time of its
+*		   prerequisites is kept in the history, for the target itself to be up to date
+*		   in later builds although it is older.
+*/
+static void restat(struct build *b, struct job *job) {
+	node *n = job->node;
+	struct timespec mtime;
+	struct timespec prereqTime;
+	uint64_t hash;
+	if(!graph_mtime(n, &mtime)) {
+		return;
+	}
+	if(newer(mtime, job->oldMtime) || newer(job->oldMtime, mtime)) {
+		if(!graph_hash(n, &hash) || hash != job->oldHash) {
+			return;
+		}
+		struct timespec times[2] = {{0, UTIME_OMIT}, job->oldMtime};
+		if(utimensat(AT_FDCWD, n->name, times, 0) == -1) {
+			perror(n->name);
+			return;
+		}
+		graph_invalidate(n);
+	}
+	n->rebuilt = false;
+	if(b->opts.history != NULL) {
+		struct timespec inputs = job->oldMtime;
+		for(int i = 0; i < n->prereqAmt; i++) {
+			if(graph_mtime(n->prereqs[i], &prereqTime) && newer(prereqTime, inputs)) {
+				inputs = prereqTime;
+			}
+		}
+		history_put_restat(b->opts.history, n->name, job->oldMtime, inputs);
+	}
+}
+
+/*  Function: finish
+*  Input:
+*			struct build *b		:Build state.
+*			node *n				:Node that is built or up to date.
+*
+*  Output: Marks the node done, and makes the dependents waiting only for it ready. In
+*		   --hash mode the node's inputs are recorded in the database. Its prerequisites
+*		   are all done, so the longest chain of commands ending with it is known.
+*/
+static void finish(struct build *b, node *n) {
+	n->done = true;
+	n->pathTime = n->runTime;
+	for(int i = 0; i < n->prereqAmt; i++) {
+		if(n->prereqs[i]->inBuild && n->prereqs[i]->pathTime + n->runTime > n->pathTime) {
+			n->pathTime = n->prereqs[i]->pathTime + n->runTime;
+			n->pathPrev = n->prereqs[i];
+		}
+	}
+	if(b->opts.db != NULL && n->rule != NULL) {
+		updateRecord(b->opts.db, n);
+	}
+	for(int i = 0; i < n->dependentAmt; i++) {
+		if(--n->dependents[i]->waiting == 0) {
+			push(&b->ready, n->dependents[i]);
+		}
+	}
+}
+
+/*  Function: startJob
+*  Input:
+*			struct build *b		:Build state with a free job slot.
+*			node *n				:Node to build.
+*
+*  Output: Starts the first line of the node's command. With more than one job the lines
+*		   write to memory files that are printed when the last is done. A target in the
+*		   artifact cache is restored instead.
+*/
+static void startJob(struct build *b, node *n) {
+	char **cmd = rule_cmd(n->rule);
+	if(cmd[0] == NULL) {
+		n->rebuilt = true;
+		finish(b, n);
+		return;
+	}
+	cache_key key = {{0, 0}};
+	bool cacheable = b->opts.cache != NULL && cacheKey(n, &key);
+	// -B rebuilds everything, but still fills the cache.
+	if(cacheable && !b->opts.force && cache_restore(b->opts.cache, &key, n->name)) {
+		if(b->opts.silent != true) {
+			printf("mmake: %s: restored from cache\n", n->name);
+		}
+		n->rebuilt = true;
+		graph_invalidate(n);
+		recordDeps(b, n, false);
+		finish(b, n);
+		return;
+	}
+	struct job *job = &b->jobs[b->running];
+	job->node = n;
+	job->line = cmd;
+	job->maxRss = 0;
+	job->lane = 0;
+	while(b->laneBusy[job->lane]) {
+		job->lane++;
+	}
+	b->laneBusy[job->lane] = true;
+	job->weight = weight(b, n);
+	// A job started on a starved jobserver pool runs on the slots it holds.
+	if(b->opts.jobserver != NULL && job->weight > b->tokenAmt + 1 - b->slotsUsed) {
+		job->weight = b->tokenAmt + 1 - b->slotsUsed;
+	}
+	job->cacheable = cacheable;
+	job->key = key;
+	// The old content is gone once the command has run.
+	job->restat = rule_restat(n->rule) && graph_mtime(n, &job->oldMtime) && graph_hash(n, &job->oldHash);
+	job->out = -1;
+	job->err = -1;
+	if(b->opts.jobs > 1) {
+		if((job->out = memfd_create("mmake-out", MFD_CLOEXEC)) == -1
+		   || (job->err = memfd_create("mmake-err", MFD_CLOEXEC)) == -1) {
+			perror("memfd_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	job->start = trace_now();
+	if(!startLine(b, job)) {
+		b->laneBusy[job->lane] = false;
+		if(job->out != -1) {
+			close(job->out);
+			close(job->err);
+		}
+		fprintf(stderr, "mmake: %s: command failed with exit status 127\n", n->name);
+		if(!b->failed && b->running > 0) {
+			fprintf(stderr, "mmake: waiting for unfinished jobs\n");
+		}
+		b->failed = true;
+		return;
+	}
+	b->slotsUsed += job->weight;
+	b->running++;
+}
+
+/*  Function: startLine
+*  Input:
+*			struct build *b		:Build state.
+*			struct job *job		:Job whose line to start.
+*
+*  Output: Prints the job's current command line and spawns it with the job's output,
+*		   without forking mmake. The words of the line are the program and its arguments,
+*		   a line that needs the shell is the shell and the text. false with an error
+*		   printed if the program can't be run.
+*/
+static bool startLine(struct build *b, struct job *job) {
+	char **line = job->line;
+	// Write command and arguments, add spaces between arguments and newline when command is done.
+	if(b->opts.silent != true) {
+		if(rule_cmd_shell(line)) {
+			printf("%s\n", line[2]);
+		}
+		else {
+			for(int i = 0; line[i] != NULL; i++) {
+				printf(line[i+1] != NULL ? "%s " : "%s\n", line[i]);
+			}
+		}
+	}
+
+	// Unbuffered output of the line comes after what mmake printed before it.
+	fflush(stdout);
+	fflush(stderr);
+	posix_spawn_file_actions_t actions;
+	if(posix_spawn_file_actions_init(&actions) != 0
+	   || (job->out != -1 && (posix_spawn_file_actions_adddup2(&actions, job->out, STDOUT_FILENO) != 0
+							  || posix_spawn_file_actions_adddup2(&actions, job->err, STDERR_FILENO) != 0))) {
+		perror("posix_spawn_file_actions");
+		exit(EXIT_FAILURE);
+	}
+	job->lineStart = trace_now();
+	int error = posix_spawnp(&job->pid, line[0], &actions, NULL, line, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if(error != 0) {
+		fprintf(stderr, "mmake: %s: %s\n", line[0], strerror(error));
+		return false;
+	}
+	if((job->pidfd = syscall(SYS_pidfd_open, job->pid, 0)) == -1) {
+		perror("pidfd_open");
+		exit(EXIT_FAILURE);
+	}
+	if(b->opts.load != NULL) {
+		load_started(b->opts.load, job->pid, peakKb(b, job->node));
+	}
+	return true;
+}
+
+/*  Function: waitJobs
+*  Input:
+*			struct build *b		:Build state with running jobs.
+*
+*  Output: Polls the pidfds of the running jobs and reaps every line that is done. A job
+*		   goes on with its next line, and is done after the last or one that failed. A
+*		   failed command stops new jobs from being started. When waiting for a jobserver token
+*		   it also returns when one can be read, and when held back by the load or
+*		   memory limit after a while, to sample them again.
+*/
+static void waitJobs(struct build *b) {
+	for(int i = 0; i < b->running; i++) {
+		b->fds[i] = (struct pollfd){b->jobs[i].pidfd, POLLIN, 0};
+	}
+	if(b->waitToken) {
+		b->fds[b->running] = (struct pollfd){jobserver_fd(b->opts.jobserver), POLLIN, 0};
+	}
+	if(poll(b->fds, b->running + b->waitToken, b->throttled ? THROTTLE_MS : -1) == -1) {
+		if(errno == EINTR) {
+			return;
+		}
+		perror("poll");
+		exit(EXIT_FAILURE);
+	}
+
+	// Go backwards, a finished job is replaced by the last one.
+	for(int i = b->running - 1; i >= 0; i--) {
+		if(b->fds[i].revents == 0) {
+			continue;
+		}
+		struct job *job = &b->jobs[i];
+		int status;
+		struct rusage usage;
+		if(wait4(job->pid, &status, 0, &usage) == -1) {
+			perror("wait4");
+			exit(EXIT_FAILURE);
+		}
+		struct timespec end = trace_now();
+		if(b->opts.load != NULL) {
+			load_finished(b->opts.load, job->pid);
+		}
+		close(job->pidfd);
+		int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		if(b->opts.trace != NULL) {
+			bool first = job->line == rule_cmd(job->node->rule);
+			trace_job(b->opts.trace, job->node->name, job->line, job->lane,
+					  first ? job->node->queued : job->lineStart, job->lineStart, end, code, &usage);
+		}
+		if(usage.ru_maxrss > job->maxRss) {
+			job->maxRss = usage.ru_maxrss;
+		}
+		if(code == 0 && (job->line = rule_next_cmd(job->line)) != NULL) {
+			if(startLine(b, job)) {
+				continue;
+			}
+			code = 127;
+		}
+
+		job->node->runTime = trace_seconds(job->start, end);
+		if(b->opts.history != NULL && code == 0) {
+			history_put(b->opts.history, job->node->name, job->node->runTime, job->maxRss);
+		}
+		b->laneBusy[job->lane] = false;
+		if(job->out != -1) {
+			emitOutput(job->out, STDOUT_FILENO);
+			emitOutput(job->err, STDERR_FILENO);
+		}
+		if(code != 0) {
+			fprintf(stderr, "mmake: %s: command failed with exit status %d\n", job->node->name, code);
+			if(!b->failed && b->running > 1) {
+				fprintf(stderr, "mmake: waiting for unfinished jobs\n");
+			}
+			b->failed = true;
+		}
+		else {
+			job->node->rebuilt = true;
+			graph_invalidate(job->node);
+			if(job->restat) {
+				restat(b, job);
+			}
+			recordDeps(b, job->node, true);
+			if(job->cacheable) {
+				cache_store(b->opts.cache, &job->key, job->node->name);
+			}
+			finish(b, job->node);
+		}
+		b->slotsUsed -= job->weight;
+		*job = b->jobs[--b->running];
+		releaseSpare(b);
+	}
+}
+
+/*  Function: printCriticalPath
+*  Input:
+*			node **nodes		:Nodes that have been built.
+*			int nodeAmt			:Amount of nodes.
+*
+*  Output: Prints the chain of commands that took the longest together, which bounds
+*		   how fast the build can be with any amount of jobs, and the run time of each.
+*/
+static void printCriticalPath(node **nodes, int nodeAmt) {
+	node *last = NULL;
+	int total = 0;
+	for(int i = 0; i < nodeAmt; i++) {
+		if(last == NULL || nodes[i]->pathTime > last->pathTime) {
+			last = nodes[i];
+		}
+		total += nodes[i]->runTime > 0;
+	}
+	if(last == NULL || last->pathTime == 0) {
+		return;
+	}
+
+	// The chain is linked from its end, reverse it to print from the start.
+	int amount = 0;
+	for(node *n = last; n != NULL; n = n->pathPrev) {
+		amount += n->runTime > 0;
+	}
+	node **chain = malloc(amount * sizeof(node *));
+	if(chain == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int i = amount;
+	for(node *n = last; n != NULL; n = n->pathPrev) {
+		if(n->runTime > 0) {
+			chain[--i] = n;
+		}
+	}
+	fflush(stdout);
+	fprintf(stderr, "mmake: critical path %.3f s, %d of %d commands:\n", last->pathTime, amount, total);
+	for(i = 0; i < amount; i++) {
+		fprintf(stderr, "mmake: %10.3f s  %s\n", chain[i]->runTime, chain[i]->name);
+	}
+	free(chain);
+}
+
+/*  Function: emitOutput
+*  Input:
+*			int fd				:Memory file with a command's output.
+*			int to				:Where to print it.
+*
+*  Output: Copies the output in one go, so it isn't mixed with other commands', and
+*		   closes the memory file. Falls back to read and write where sendfile can't
+*		   write, like to a file opened for appending.
+*/
+static void emitOutput(int fd, int to) {
+	char buf[8192];
+	off_t offset = 0;
+	off_t size = lseek(fd, 0, SEEK_END);
+	fflush(to == STDOUT_FILENO ? stdout : stderr);
+	while(offset < size) {
+		ssize_t n = sendfile(to, fd, &offset, size - offset);
+		if(n == -1 && errno == EINVAL) {
+			if((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+				n = write(to, buf, n);
+				offset += n > 0 ? n : 0;
+			}
+		}
+		if(n <= 0) {
+			if(n == -1) {
+				perror("write");
+			}
+			break;
+		}
+	}
+	close(fd);
+}
+
+/*  Function: push
+*  Input:
+*			struct queue *q		:Queue.
+*			node *n				:Node to add last.
+*
+*  Output: Adds the node to the queue.
+*/
+static void push(struct queue *q, node *n) {
+	q->nodes[q->tail++] = n;
+}
+
+/*  Function: prioritize
+*  Input:
+*			node **nodes		:Nodes to build.
+*			int nodeAmt			:Amount of nodes.
+*			build_options opts	:Build options.
+*
+*  Output: Sets the priority of every node to the estimated run time of its command
+*		   plus the highest priority of its dependents, the longest chain of commands
+*		   it heads. Nodes are taken after all their dependents, counted down in
+*		   order, which isn't in use before the first node is found out of date.
+*		   A command without a run time in the history is estimated as the mean of
+*		   the ones that have one, or one second if none has, so the chains are then
+*		   ranked by their amount of commands.
+*/
+static void prioritize(node **nodes, int nodeAmt, build_options opts) {
+	node **stack = malloc((nodeAmt + 1) * sizeof(node *));
+	if(stack == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	double known = 0;
+	int knownAmt = 0;
+	double seconds;
+	for(int i = 0; i < nodeAmt; i++) {
+		node *n = nodes[i];
+		n->order = n->dependentAmt;
+		if(opts.history != NULL && n->rule != NULL && history_get(opts.history, n->name, &seconds, NULL)) {
+			known += seconds;
+			knownAmt++;
+		}
+	}
+	double guess = knownAmt > 0 ? known / knownAmt : 1;
+
+	int depth = 0;
+	for(int i = 0; i < nodeAmt; i++) {
+		if(nodes[i]->order == 0) {
+			stack[depth++] = nodes[i];
+		}
+	}
+	while(depth > 0) {
+		node *n = stack[--depth];
+		// Dependents have added the longest chain above the node already.
+		if(n->rule != NULL && rule_cmd(n->rule)[0] != NULL) {
+			if(opts.history == NULL || !history_get(opts.history, n->name, &seconds, NULL)) {
+				seconds = guess;
+			}
+			n->priority += seconds;
+		}
+		for(int i = 0; i < n->prereqAmt; i++) {
+			node *p = n->prereqs[i];
+			if(!p->inBuild) {
+				continue;
+			}
+			if(n->priority > p->priority) {
+				p->priority = n->priority;
+			}
+			if(--p->order == 0) {
+				stack[depth++] = p;
+			}
+		}
+	}
+	free(stack);
+}
+
+/*  Function: heapPush
+*  Input:
+*			struct heap *h		:Heap with room for the node.
+*			node *n				:Node to add.
+*
+*  Output: Adds the node and sifts it up past the nodes it goes before.
+*/
+static void heapPush(struct heap *h, node *n) {
+	int i = h->amount++;
+	while(i > 0 && before(n, h->nodes[(i - 1) / 2])) {
+		h->nodes[i] = h->nodes[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	h->nodes[i] = n;
+}
+
+/*  Function: heapPop
+*  Input:
+*			struct heap *h		:Heap that isn't empty.
+*
+*  Output: Removes and returns the node that goes first. The last node takes its place
+*		   and is sifted down.
+*/
+static node *heapPop(struct heap *h) {
+	node *first = h->nodes[0];
+	node *last = h->nodes[--h->amount];
+	int i = 0;
+	while(2 * i + 1 < h->amount) {
+		int child = 2 * i + 1;
+		if(child + 1 < h->amount && before(h->nodes[child + 1], h->nodes[child])) {
+			child++;
+		}
+		if(!before(h->nodes[child], last)) {
+			break;
+		}
+		h->nodes[i] = h->nodes[child];
+		i = child;
+	}
+	h->nodes[i] = last;
+	return first;
+}
+
+/*  Function: before
+*  Input:
+*			node *a				:Node.
+*			node *b				:Node.
+*
+*  Output: True if a is started before b, by higher priority and then by the order
+*		   they were found out of date.
+*/
+static bool before(node *a, node *b) {
+	return a->priority != b->priority ? a->priority > b->priority : a->order < b->order;
+}
+
+/*  Function: admit
+*  Input:
+*			struct build *b		:Build state.
+*			node *n				:Node that is started next.
+*
+*  Output: true if the node's command may start now. Its weight in job slots must be
+*		   free, the load and memory must be below the limits unless nothing runs,
+*		   and with a jobserver a token must be held for each slot in use but the
+*		   first unless nothing runs. The limits are checked before tokens are taken so none are held
+*		   while throttled.
+*/
+static bool admit(struct build *b, node *n) {
+	if(b->slotsUsed + weight(b, n) > b->opts.jobs) {
+		return false;
+	}
+	if(b->opts.load != NULL && b->running > 0 && !load_admit(b->opts.load, peakKb(b, n))) {
+		b->throttled = true;
+		return false;
+	}
+	return takeSlot(b, weight(b, n));
+}
+
+/*  Function: weight
+*  Input:
+*			struct build *b		:Build state.
+*			node *n				:Out of date node.
+*
+*  Output: Job slots the node's command takes, its weight annotation but at most -j
+*		   so that it can run at all.
+*/
+static int weight(struct build *b, node *n) {
+	int w = rule_weight(n->rule);
+	return w < b->opts.jobs ? w : b->opts.jobs;
+}
+
+/*  Function: peakKb
+*  Input:
+*			struct build *b		:Build state.
+*			node *n				:Out of date node.
+*
+*  Output: Peak memory in KiB of the node's command in earlier builds, 0 if unknown.
+*/
+static long peakKb(struct build *b, node *n) {
+	long kb = 0;
+	if(b->opts.history == NULL || !history_get(b->opts.history, n->name, NULL, &kb)) {
+		return 0;
+	}
+	return kb;
+}
+
+/*  Function: takeSlot
+*  Input:
+*			struct build *b		:Build state.
+*			int slots			:Job slots the job takes.
+*
+*  Output: true if one more job may start. Without a jobserver that is decided by -j
+*		   alone. With one, the first slot is the one every make has and each slot
+*		   after it needs a token from the pool. Tokens taken for a job that can't
+*		   get all it needs are given back while waiting for the pool, unless nothing
+*		   runs: then no token would ever come back to this make, so the job starts
+*		   on the first slot and the tokens already held.
+*/
+static bool takeSlot(struct build *b, int slots) {
+	if(b->opts.jobserver == NULL) {
+		return true;
+	}
+	while(b->tokenAmt < b->slotsUsed + slots - 1) {
+		if(!jobserver_acquire(b->opts.jobserver, &b->tokens[b->tokenAmt])) {
+			if(b->running == 0) {
+				return true;
+			}
+			releaseSpare(b);
+			b->waitToken = true;
+			return false;
+		}
+		b->tokenAmt++;
+	}
+	return true;
+}
+
+/*  Function: releaseSpare
+*  Input:
+*			struct build *b		:Build state.
+*
+*  Output: Gives back the tokens not needed by the running jobs, like the one taken
+*		   for a target that was restored from the cache.
+*/
+static void releaseSpare(struct build *b) {
+	while(b->tokenAmt > 0 && b->tokenAmt > b->slotsUsed - 1) {
+		jobserver_release(b->opts.jobserver, b->tokens[--b->tokenAmt]);
+	}
+}
@@ -0,0 +1,81 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Runs the commands of a dependency graph. A node is ready when all
+*				 its prerequisites are finished, and ready nodes that are out of
+*				 date are started while there are free job slots. When more are
+*				 waiting than there are slots, the one with the longest chain of
+*				 commands left to a goal goes first, timed by the run times of
+*				 earlier builds. A command annotated with a weight takes that many
+*				 slots, and with -l or --mem-reserve a job waits while the machine
+*				 is loaded or short of memory. All running commands are reaped
+*				 from one poll loop over their pidfds.
+*
+*				 The target of a restat rule is compared with what it was before
+*				 its command ran. If the content is the same it keeps its old
+*				 modification time, and what depends on it alone isn't rebuilt.
+*/
+
+#ifndef BUILD_H
+#define BUILD_H
+
+#include <stdbool.h>
+#include "graph.h"
+#include "db.h"
+#include "cache.h"
+#include "trace.h"
+#include "history.h"
+#include "jobserver.h"
+#include "load.h"
+#include "depslog.h"
+
+typedef struct build_options {
+	// Commands to run at once.
+	int jobs;
+	// Rebuild every target.
+	bool force;
+	// Don't print the commands.
+	bool silent;
+	// Build database of --hash mode, NULL to compare modification times only.
+	db *db;
+	// Artifact cache to restore targets from, NULL to always run the commands.
+	cache *cache;
+	// Trace to record the commands in, NULL if not tracing.
+	trace *trace;
+	// Run times of earlier builds, NULL if not kept. Updated with every command run.
+	history *history;
+	// Start out of date nodes in the order they are found, not by priority.
+	bool fifo;
+	// Token pool shared with other makes, NULL to be limited by jobs alone.
+	jobserver *jobserver;
+	// Load and memory limits checked before starting a job, NULL for none.
+	load *load;
+	// Log to record the depfiles of the commands in, NULL to not read them.
+	depslog *deps;
+} build_options;
+
+/**
+ * Builds every node of a graph. With more than one job the output of each
+ * command is buffered and printed when it finishes. After a command fails no
+ * more commands are started, the running ones are waited for. When tracing,
+ * the critical path of the build is printed at the end.
+ *
+ * @param g			Graph holding the goals and everything they depend on.
+ * @param opts		Build options.
+ * @return			0 if everything was built, otherwise EXIT_FAILURE.
+ */
+int build_run(graph *g, build_options opts);
+
+/**
+ * Builds the nodes of a graph that depend on changed files, after a first
+ * build of the whole graph. The changed nodes should have been invalidated.
+ *
+ * @param g			Graph that has been built.
+ * @param opts		Build options.
+ * @param changed	Nodes whose files have changed.
+ * @param changedAmt	Amount of changed nodes.
+ * @return			0 if everything was built, otherwise EXIT_FAILURE.
+ */
+int build_downstream(graph *g, build_options opts, node **changed, int changedAmt);
+
+#endif
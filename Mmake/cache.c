@@ -0,0 +1,348 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Local content-addressed cache of built targets, see cache.h.
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "cache.h"
+#include "db.h"
+#include "parser.h"
+
+#define KEY_HEX 32
+// Bumped when the key or the entries change meaning.
+#define KEY_VERSION "mmake cache 1"
+
+struct cache {
+	char *dir;
+	int dirfd;
+	long long maxBytes;
+	// Size of the entries, -1 until the directory has been scanned.
+	long long total;
+	// Numbers temporary files, together with the pid.
+	unsigned tmpCount;
+	int hits;
+	int misses;
+	int stores;
+};
+
+struct entry {
+	char name[KEY_HEX + 1];
+	long long size;
+	struct timespec used;
+};
+
+
+// Function declaration.
+static bool copyFile(int from, int to);
+static void keyName(const cache_key *key, char name[KEY_HEX + 1]);
+static bool isEntry(const char *name);
+static int compareUsed(const void *a, const void *b);
+static void evict(cache *c);
+
+/*  Function: cache_open
+*  Input:
+*			const char *dir		:Cache directory.
+*			long long maxBytes	:Size limit of the entries.
+*
+*  Output: The opened cache, or NULL with an error printed.
+*/
+cache *cache_open(const char *dir, long long maxBytes) {
+	if(mkdir(dir, 0777) == -1 && errno != EEXIST) {
+		perror(dir);
+		return NULL;
+	}
+	int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dirfd == -1) {
+		perror(dir);
+		return NULL;
+	}
+	cache *c = calloc(1, sizeof(cache));
+	if(c == NULL || (c->dir = strdup(dir)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	c->dirfd = dirfd;
+	c->maxBytes = maxBytes;
+	c->total = -1;
+	return c;
+}
+
+/*  Function: cache_key_of
+*  Input:
+*			const char *target	:Target.
+*			char **cmd			:Command lines building it.
+*			int inputAmt		:Amount of prerequisites.
+*			const char **inputs	:Names of the prerequisites.
+*			const uint64_t *hashes	:Content hashes of the prerequisites.
+*			cache_key *key		:Set to the key.
+*
+*  Output: Two XXH64 chains with different seeds over everything the target depends
+*		   on, strings including their terminators so word boundaries count. The
+*		   lines of the command are told apart like in db_hash_cmd.
+*/
+void cache_key_of(const char *target, char **cmd, int inputAmt, const char **inputs,
+				  const uint64_t *hashes, cache_key *key) {
+	for(int k = 0; k < 2; k++) {
+		uint64_t h = db_xxh64(KEY_VERSION, sizeof(KEY_VERSION), k);
+		h = db_xxh64(target, strlen(target) + 1, h);
+		for(char **line = cmd; line != NULL; line = rule_next_cmd(line)) {
+			if(line != cmd) {
+				h = db_xxh64("", 1, h);
+			}
+			for(int i = 0; line[i] != NULL; i++) {
+				h = db_xxh64(line[i], strlen(line[i]) + 1, h);
+			}
+		}
+		h = db_xxh64(&inputAmt, sizeof(inputAmt), h);
+		for(int i = 0; i < inputAmt; i++) {
+			h = db_xxh64(inputs[i], strlen(inputs[i]) + 1, h);
+			h = db_xxh64(&hashes[i], sizeof(hashes[i]), h);
+		}
+		key->hash[k] = h;
+	}
+}
+
+/*  Function: cache_restore
+*  Input:
+*			cache *c			:Cache.
+*			const cache_key *key	:Key of the target.
+*			const char *target	:Path to restore to.
+*
+*  Output: true if the target was restored. The entry is reflinked to a temporary file
+*		   next to the target, or copied if that isn't supported, then renamed over the
+*		   target. The target gets the current time as modification time, and so does
+*		   the entry, which is what eviction goes by. A hardlink isn't used, a command
+*		   writing the target in place later would change the entry with it.
+*/
+bool cache_restore(cache *c, const cache_key *key, const char *target) {
+	char name[KEY_HEX + 1];
+	struct stat info;
+	keyName(key, name);
+	int from = openat(c->dirfd, name, O_RDONLY | O_CLOEXEC);
+	if(from == -1 || fstat(from, &info) == -1) {
+		if(from != -1) {
+			close(from);
+		}
+		c->misses++;
+		return false;
+	}
+
+	char tmpPath[strlen(target) + 32];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.mmake.%d", target, (int)getpid());
+	unlink(tmpPath);
+	bool restored = false;
+	int to = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, info.st_mode & 07777);
+	if(to != -1) {
+		restored = ioctl(to, FICLONE, from) == 0 || copyFile(from, to);
+		futimens(from, NULL);
+		if(close(to) == -1) {
+			restored = false;
+		}
+	}
+	close(from);
+
+	if(restored && (utimensat(AT_FDCWD, tmpPath, NULL, 0) == -1 || rename(tmpPath, target) == -1)) {
+		perror(target);
+		restored = false;
+	}
+	if(!restored) {
+		unlink(tmpPath);
+		c->misses++;
+		return false;
+	}
+	c->hits++;
+	return true;
+}
+
+/*  Function: cache_store
+*  Input:
+*			cache *c			:Cache.
+*			const cache_key *key	:Key of the target.
+*			const char *target	:Built target.
+*
+*  Output: Copies the target to a temporary file in the cache directory, with a reflink
+*		   if possible, and renames it to its key. A hardlink isn't used, since the
+*		   target may be changed in place after the build.
+*/
+void cache_store(cache *c, const cache_key *key, const char *target) {
+	struct stat info;
+	int from = open(target, O_RDONLY | O_CLOEXEC);
+	if(from == -1 || fstat(from, &info) == -1 || !S_ISREG(info.st_mode)) {
+		if(from != -1) {
+			close(from);
+		}
+		return;
+	}
+
+	char tmpName[64];
+	char name[KEY_HEX + 1];
+	snprintf(tmpName, sizeof(tmpName), "tmp.%d.%u", (int)getpid(), c->tmpCount++);
+	keyName(key, name);
+	int to = openat(c->dirfd, tmpName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 07777);
+	if(to == -1) {
+		perror(c->dir);
+		close(from);
+		return;
+	}
+	bool copied = ioctl(to, FICLONE, from) == 0 || copyFile(from, to);
+	close(from);
+	if(close(to) == -1 || !copied || renameat(c->dirfd, tmpName, c->dirfd, name) == -1) {
+		perror(target);
+		unlinkat(c->dirfd, tmpName, 0);
+		return;
+	}
+	c->stores++;
+
+	if(c->total >= 0) {
+		c->total += info.st_blocks * 512LL;
+	}
+	// Only scan the directory when the running total says it is too big.
+	if(c->total < 0 || c->total > c->maxBytes) {
+		evict(c);
+	}
+}
+
+/*  Function: cache_print_stats
+*  Input:
+*			cache *c			:Cache.
+*			FILE *fp			:Where to print.
+*
+*  Output: One line with the counts of this run.
+*/
+void cache_print_stats(cache *c, FILE *fp) {
+	int lookups = c->hits + c->misses;
+	fprintf(fp, "mmake: cache: %d hits, %d misses, %d%% hit rate, %d stored\n", c->hits, c->misses,
+			lookups > 0 ? c->hits * 100 / lookups : 0, c->stores);
+}
+
+/*  Function: cache_close
+*  Input:
+*			cache *c			:Cache to free.
+*
+*  Output: Frees the cache.
+*/
+void cache_close(cache *c) {
+	close(c->dirfd);
+	free(c->dir);
+	free(c);
+}
+
+/*  Function: copyFile
+*  Input:
+*			int from			:File to copy, at offset 0.
+*			int to				:Empty file to copy to.
+*
+*  Output: true if everything was copied.
+*/
+static bool copyFile(int from, int to) {
+	ssize_t n;
+	do {
+		n = copy_file_range(from, NULL, to, NULL, 1 << 30, 0);
+	} while(n > 0);
+	return n == 0;
+}
+
+/*  Function: keyName
+*  Input:
+*			const cache_key *key	:Key.
+*			char name[]			:Set to the file name of the key.
+*
+*  Output: The key in hex.
+*/
+static void keyName(const cache_key *key, char name[KEY_HEX + 1]) {
+	snprintf(name, KEY_HEX + 1, "%016llx%016llx", (unsigned long long)key->hash[0],
+			 (unsigned long long)key->hash[1]);
+}
+
+/*  Function: isEntry
+*  Input:
+*			const char *name	:File name in the cache directory.
+*
+*  Output: true if the name is a key, not a temporary file or anything else.
+*/
+static bool isEntry(const char *name) {
+	return strlen(name) == KEY_HEX && strspn(name, "0123456789abcdef") == KEY_HEX;
+}
+
+/*  Function: compareUsed
+*  Input:
+*			const void *a		:Entry.
+*			const void *b		:Entry.
+*
+*  Output: qsort comparison, least recently used first.
+*/
+static int compareUsed(const void *a, const void *b) {
+	const struct timespec *x = &((const struct entry *)a)->used;
+	const struct timespec *y = &((const struct entry *)b)->used;
+	if(x->tv_sec != y->tv_sec) {
+		return x->tv_sec < y->tv_sec ? -1 : 1;
+	}
+	return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+/*  Function: evict
+*  Input:
+*			cache *c			:Cache.
+*
+*  Output: Sums the size of the entries and removes the least recently used ones until
+*		   the rest fit the size limit.
+*/
+static void evict(cache *c) {
+	// A dup of dirfd would share its offset, left at the end by the last scan.
+	int fd = openat(c->dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+	if(dir == NULL) {
+		perror(c->dir);
+		if(fd != -1) {
+			close(fd);
+		}
+		return;
+	}
+	struct entry *entries = NULL;
+	size_t amount = 0;
+	size_t cap = 0;
+	long long total = 0;
+	struct dirent *d;
+	while((d = readdir(dir)) != NULL) {
+		struct stat st;
+		if(!isEntry(d->d_name) || fstatat(c->dirfd, d->d_name, &st, 0) == -1) {
+			continue;
+		}
+		if(amount == cap) {
+			cap = cap == 0 ? 64 : cap * 2;
+			if((entries = realloc(entries, cap * sizeof(struct entry))) == NULL) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		memcpy(entries[amount].name, d->d_name, KEY_HEX + 1);
+		entries[amount].size = st.st_blocks * 512LL;
+		entries[amount].used = st.st_mtim;
+		total += entries[amount].size;
+		amount++;
+	}
+	closedir(dir);
+
+	if(total > c->maxBytes) {
+		qsort(entries, amount, sizeof(struct entry), compareUsed);
+		for(size_t i = 0; i < amount && total > c->maxBytes; i++) {
+			if(unlinkat(c->dirfd, entries[i].name, 0) == 0) {
+				total -= entries[i].size;
+			}
+		}
+	}
+	c->total = total;
+	free(entries);
+}
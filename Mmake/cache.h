@@ -0,0 +1,85 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Local content-addressed cache of built targets. An entry is a copy
+*				 of a target, named by a key of the command that built it and the
+*				 content hashes of its prerequisites. Restoring an entry reflinks it
+*				 when the file system can, so a hit costs no copying, and copies it
+*				 otherwise. A restored target never shares its inode with the entry,
+*				 so commands may write it in place. Entries are written to a
+*				 temporary file and renamed into place, and the least recently used
+*				 ones are removed when the directory grows past its size limit.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct cache cache;
+
+typedef struct cache_key {
+	uint64_t hash[2];
+} cache_key;
+
+/**
+ * Opens a cache directory, creating it if it doesn't exist.
+ *
+ * @param dir		Cache directory.
+ * @param maxBytes	Size the entries may use together.
+ * @return			Pointer to the cache, or NULL if the directory can't be used.
+ */
+cache *cache_open(const char *dir, long long maxBytes);
+
+/**
+ * Computes the key of a target from its command and the content hashes of
+ * its prerequisites.
+ *
+ * @param target	Name of the target.
+ * @param cmd		Command lines building it, see rule_cmd.
+ * @param inputAmt	Amount of prerequisites.
+ * @param inputs	Names of the prerequisites.
+ * @param hashes	Content hashes of the prerequisites.
+ * @param key		Set to the key.
+ */
+void cache_key_of(const char *target, char **cmd, int inputAmt, const char **inputs,
+				  const uint64_t *hashes, cache_key *key);
+
+/**
+ * Restores a target from its entry. Counts a hit or a miss.
+ *
+ * @param c			Pointer to the cache.
+ * @param key		Key of the target.
+ * @param target	Path to restore to, replaced atomically.
+ * @return			true if the entry existed and was restored.
+ */
+bool cache_restore(cache *c, const cache_key *key, const char *target);
+
+/**
+ * Stores a copy of a built target, then evicts old entries if the cache has
+ * grown past its limit. Targets that aren't regular files are not stored.
+ *
+ * @param c			Pointer to the cache.
+ * @param key		Key of the target.
+ * @param target	Path of the built target.
+ */
+void cache_store(cache *c, const cache_key *key, const char *target);
+
+/**
+ * Prints the hits, misses and stores of this run.
+ *
+ * @param c			Pointer to the cache.
+ * @param fp		Where to print.
+ */
+void cache_print_stats(cache *c, FILE *fp);
+
+/**
+ * Frees a cache. The entries stay on disk.
+ *
+ * @param c			Pointer to the cache.
+ */
+void cache_close(cache *c);
+
+#endif
@@ -0,0 +1,456 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Build database of --hash mode, see db.h.
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "db.h"
+#include "parser.h"
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+#define P5 0x27D4EB2F165667C5ULL
+
+struct db {
+	char *path;
+	// Open addressing hash table of the records by target.
+	db_record **table;
+	size_t tableCap;
+	size_t recordAmt;
+	bool changed;
+};
+
+
+// Function declaration.
+static void load(db *d, FILE *fp);
+static db_record **slot(db *d, const char *target);
+static void freeRecord(db_record *r);
+static char *copyString(const char *s);
+static uint64_t rotl(uint64_t x, int r);
+static uint64_t round64(uint64_t acc, uint64_t input);
+static uint64_t merge64(uint64_t acc, uint64_t val);
+static uint64_t read64(const unsigned char *p);
+static uint32_t read32(const unsigned char *p);
+
+/*  Function: db_open
+*  Input:
+*			const char *path	:Path of the database file.
+*
+*  Output: The database loaded from the file, empty if there is none.
+*/
+db *db_open(const char *path) {
+	db *d = calloc(1, sizeof(db));
+	if(d == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	d->path = copyString(path);
+	d->tableCap = 64;
+	d->table = calloc(d->tableCap, sizeof(db_record *));
+	if(d->table == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	FILE *fp = fopen(path, "r");
+	if(fp != NULL) {
+		load(d, fp);
+		fclose(fp);
+	}
+	return d;
+}
+
+/*  Function: db_find
+*  Input:
+*			db *d				:Database.
+*			const char *target	:Target to find.
+*
+*  Output: The record of the target, or NULL.
+*/
+db_record *db_find(db *d, const char *target) {
+	return *slot(d, target);
+}
+
+/*  Function: db_put
+*  Input:
+*			db *d				:Database.
+*			const char *target	:Target of the record.
+*			uint64_t cmdHash	:Hash of the command.
+*			int inputAmt		:Amount of prerequisites.
+*			const char **inputs	:Names of the prerequisites.
+*			const uint64_t *hashes	:Their content hashes.
+*
+*  Output: Replaces the record of the target, or adds one.
+*/
+void db_put(db *d, const char *target, uint64_t cmdHash, int inputAmt, const char **inputs,
+			const uint64_t *hashes) {
+	db_record *r = calloc(1, sizeof(db_record));
+	if(r == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	r->target = copyString(target);
+	r->cmdHash = cmdHash;
+	r->inputAmt = inputAmt;
+	r->inputs = malloc((inputAmt + 1) * sizeof(char *));
+	r->hashes = malloc((inputAmt + 1) * sizeof(uint64_t));
+	if(r->inputs == NULL || r->hashes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < inputAmt; i++) {
+		r->inputs[i] = copyString(inputs[i]);
+		r->hashes[i] = hashes[i];
+	}
+
+	db_record **s = slot(d, target);
+	if(*s != NULL) {
+		freeRecord(*s);
+		*s = r;
+		d->changed = true;
+		return;
+	}
+
+	// Keep the table at most half full.
+	if((d->recordAmt + 1) * 2 > d->tableCap) {
+		db_record **old = d->table;
+		size_t oldCap = d->tableCap;
+		d->tableCap *= 2;
+		d->table = calloc(d->tableCap, sizeof(db_record *));
+		if(d->table == NULL) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for(size_t i = 0; i < oldCap; i++) {
+			if(old[i] != NULL) {
+				*slot(d, old[i]->target) = old[i];
+			}
+		}
+		free(old);
+		s = slot(d, target);
+	}
+	*s = r;
+	d->recordAmt++;
+	d->changed = true;
+}
+
+/*  Function: db_save
+*  Input:
+*			db *d				:Database.
+*
+*  Output: 0 if the file was written or nothing had changed, otherwise -1. Writes a
+*		   temporary file next to it and renames it into place.
+*/
+int db_save(db *d) {
+	if(!d->changed) {
+		return 0;
+	}
+	char tmpPath[strlen(d->path) + 32];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%d", d->path, (int)getpid());
+	FILE *fp = fopen(tmpPath, "w");
+	if(fp == NULL) {
+		perror(tmpPath);
+		return -1;
+	}
+	for(size_t i = 0; i < d->tableCap; i++) {
+		db_record *r = d->table[i];
+		if(r == NULL) {
+			continue;
+		}
+		fprintf(fp, "T %016llx %d %s\n", (unsigned long long)r->cmdHash, r->inputAmt, r->target);
+		for(int j = 0; j < r->inputAmt; j++) {
+			fprintf(fp, "%016llx %s\n", (unsigned long long)r->hashes[j], r->inputs[j]);
+		}
+	}
+	if(fclose(fp) == EOF || rename(tmpPath, d->path) == -1) {
+		perror(d->path);
+		unlink(tmpPath);
+		return -1;
+	}
+	d->changed = false;
+	return 0;
+}
+
+/*  Function: db_close
+*  Input:
+*			db *d				:Database to free.
+*
+*  Output: Frees the database and its records.
+*/
+void db_close(db *d) {
+	for(size_t i = 0; i < d->tableCap; i++) {
+		if(d->table[i] != NULL) {
+			freeRecord(d->table[i]);
+		}
+	}
+	free(d->table);
+	free(d->path);
+	free(d);
+}
+
+/*  Function: db_hash_file
+*  Input:
+*			const char *path	:File to hash.
+*			uint64_t *hash		:Set to the hash.
+*
+*  Output: false if the file can't be read. The file is mapped and hashed in one go.
+*/
+bool db_hash_file(const char *path, uint64_t *hash) {
+	struct stat info;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1 || fstat(fd, &info) == -1) {
+		if(fd != -1) {
+			close(fd);
+		}
+		return false;
+	}
+	if(!S_ISREG(info.st_mode) || info.st_size == 0) {
+		close(fd);
+		*hash = S_ISREG(info.st_mode) ? db_xxh64("", 0, 0)
+										: db_xxh64(&info.st_mtim, sizeof(info.st_mtim), 1);
+		return true;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		return false;
+	}
+	*hash = db_xxh64(data, info.st_size, 0);
+	munmap(data, info.st_size);
+	return true;
+}
+
+/*  Function: db_hash_cmd
+*  Input:
+*			char **cmd			:Command lines of a rule.
+*
+*  Output: Hash of the words, each hashed with the one before as seed so that
+*		   "a b" and "ab" differ. An empty word, which no line has, goes before
+*		   every line but the first, so a command of one line hashes as it did
+*		   before rules had more.
+*/
+uint64_t db_hash_cmd(char **cmd) {
+	uint64_t hash = 0;
+	for(char **line = cmd; line != NULL; line = rule_next_cmd(line)) {
+		if(line != cmd) {
+			hash = db_xxh64("", 1, hash);
+		}
+		for(int i = 0; line[i] != NULL; i++) {
+			hash = db_xxh64(line[i], strlen(line[i]) + 1, hash);
+		}
+	}
+	return hash;
+}
+
+/*  Function: db_xxh64
+*  Input:
+*			const void *data	:Buffer to hash.
+*			size_t len			:Its length.
+*			uint64_t seed		:Seed.
+*
+*  Output: XXH64 of the buffer.
+*/
+uint64_t db_xxh64(const void *data, size_t len, uint64_t seed) {
+	const unsigned char *p = data;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if(len >= 32) {
+		uint64_t v1 = seed + P1 + P2;
+		uint64_t v2 = seed + P2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - P1;
+		do {
+			v1 = round64(v1, read64(p));
+			v2 = round64(v2, read64(p + 8));
+			v3 = round64(v3, read64(p + 16));
+			v4 = round64(v4, read64(p + 24));
+			p += 32;
+		} while(end - p >= 32);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge64(h, v1);
+		h = merge64(h, v2);
+		h = merge64(h, v3);
+		h = merge64(h, v4);
+	}
+	else {
+		h = seed + P5;
+	}
+	h += len;
+
+	for(; end - p >= 8; p += 8) {
+		h ^= round64(0, read64(p));
+		h = rotl(h, 27) * P1 + P4;
+	}
+	if(end - p >= 4) {
+		h ^= read32(p) * P1;
+		h = rotl(h, 23) * P2 + P3;
+		p += 4;
+	}
+	for(; p < end; p++) {
+		h ^= *p * P5;
+		h = rotl(h, 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/*  Function: load
+*  Input:
+*			db *d				:Empty database.
+*			FILE *fp			:Database file.
+*
+*  Output: Adds the records of the file. On a line that doesn't parse, the records
+*		   read so far are dropped.
+*/
+static void load(db *d, FILE *fp) {
+	char *line = NULL;
+	size_t lineCap = 0;
+	unsigned long long cmdHash;
+	int inputAmt;
+	int nameStart;
+	bool corrupt = false;
+
+	while(!corrupt && getline(&line, &lineCap, fp) != -1) {
+		line[strcspn(line, "\n")] = '\0';
+		if(sscanf(line, "T %llx %d %n", &cmdHash, &inputAmt, &nameStart) != 2 || inputAmt < 0
+		   || line[nameStart] == '\0') {
+			corrupt = true;
+			break;
+		}
+		char *target = copyString(line + nameStart);
+		char **inputs = malloc((inputAmt + 1) * sizeof(char *));
+		uint64_t *hashes = malloc((inputAmt + 1) * sizeof(uint64_t));
+		if(inputs == NULL || hashes == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		int i;
+		for(i = 0; i < inputAmt && getline(&line, &lineCap, fp) != -1; i++) {
+			unsigned long long hash;
+			line[strcspn(line, "\n")] = '\0';
+			if(sscanf(line, "%llx %n", &hash, &nameStart) != 1 || line[nameStart] == '\0') {
+				break;
+			}
+			hashes[i] = hash;
+			inputs[i] = copyString(line + nameStart);
+		}
+		if(i == inputAmt) {
+			db_put(d, target, cmdHash, inputAmt, (const char **)inputs, hashes);
+		}
+		else {
+			corrupt = true;
+		}
+		while(i > 0) {
+			free(inputs[--i]);
+		}
+		free(inputs);
+		free(hashes);
+		free(target);
+	}
+	free(line);
+
+	if(corrupt) {
+		fprintf(stderr, "mmake: %s: corrupt, ignored\n", d->path);
+		for(size_t i = 0; i < d->tableCap; i++) {
+			if(d->table[i] != NULL) {
+				freeRecord(d->table[i]);
+				d->table[i] = NULL;
+			}
+		}
+		d->recordAmt = 0;
+	}
+	// Nothing new to write yet, unless the file has to be replaced.
+	d->changed = corrupt;
+}
+
+/*  Function: slot
+*  Input:
+*			db *d				:Database.
+*			const char *target	:Target to find.
+*
+*  Output: The slot of the target in the table, or the free slot where it belongs.
+*/
+static db_record **slot(db *d, const char *target) {
+	size_t mask = d->tableCap - 1;
+	size_t i = hash_bytes(target, strlen(target)) & mask;
+	while(d->table[i] != NULL && strcmp(d->table[i]->target, target) != 0) {
+		i = (i + 1) & mask;
+	}
+	return &d->table[i];
+}
+
+/*  Function: freeRecord
+*  Input:
+*			db_record *r		:Record to free.
+*
+*  Output: Frees the record and its strings.
+*/
+static void freeRecord(db_record *r) {
+	for(int i = 0; i < r->inputAmt; i++) {
+		free(r->inputs[i]);
+	}
+	free(r->inputs);
+	free(r->hashes);
+	free(r->target);
+	free(r);
+}
+
+/*  Function: copyString
+*  Input:
+*			const char *s		:String to copy.
+*
+*  Output: A copy on the heap.
+*/
+static char *copyString(const char *s) {
+	char *copy = strdup(s);
+	if(copy == NULL) {
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	return copy;
+}
+
+// Steps of XXH64.
+static uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+	acc += input * P2;
+	acc = rotl(acc, 31);
+	return acc * P1;
+}
+
+static uint64_t merge64(uint64_t acc, uint64_t val) {
+	acc ^= round64(0, val);
+	return acc * P1 + P4;
+}
+
+static uint64_t read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
@@ -0,0 +1,109 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Build database of --hash mode, kept in .mmake_db between runs. For
+*				 every target built it records a hash of the command and the content
+*				 hash of each prerequisite, so a target is rebuilt only when one of
+*				 them has actually changed. File contents are hashed with XXH64.
+*
+*				 The file is text, one record per target:
+*					T <command hash> <prerequisite amount> <target>
+*				 followed by one line per prerequisite:
+*					<content hash> <prerequisite>
+*/
+
+#ifndef DB_H
+#define DB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DB_FILE ".mmake_db"
+
+typedef struct db_record {
+	char *target;
+	uint64_t cmdHash;
+	int inputAmt;
+	char **inputs;
+	uint64_t *hashes;
+} db_record;
+
+typedef struct db db;
+
+/**
+ * Loads a database. A missing file gives an empty database, a corrupt one is
+ * ignored with a warning.
+ *
+ * @param path		Path of the database file.
+ * @return			Pointer to the database.
+ */
+db *db_open(const char *path);
+
+/**
+ * Finds the record of a target.
+ *
+ * @param d			Pointer to the database.
+ * @param target	Name of the target.
+ * @return			The record, or NULL if the target has none.
+ */
+db_record *db_find(db *d, const char *target);
+
+/**
+ * Sets the record of a target, replacing any earlier one.
+ *
+ * @param d			Pointer to the database.
+ * @param target	Name of the target.
+ * @param cmdHash	Hash of the command, see db_hash_cmd.
+ * @param inputAmt	Amount of prerequisites.
+ * @param inputs	Names of the prerequisites.
+ * @param hashes	Content hashes of the prerequisites.
+ */
+void db_put(db *d, const char *target, uint64_t cmdHash, int inputAmt, const char **inputs,
+			const uint64_t *hashes);
+
+/**
+ * Writes a database back to its file if it has changed. The file is replaced
+ * atomically.
+ *
+ * @param d			Pointer to the database.
+ * @return			0 on success, -1 with an error printed otherwise.
+ */
+int db_save(db *d);
+
+/**
+ * Frees a database without saving it.
+ *
+ * @param d			Pointer to the database.
+ */
+void db_close(db *d);
+
+/**
+ * Hashes the content of a file. Anything but a regular file is hashed by its
+ * modification time.
+ *
+ * @param path		Path of the file.
+ * @param hash		Set to the hash.
+ * @return			false if the file can't be read.
+ */
+bool db_hash_file(const char *path, uint64_t *hash);
+
+/**
+ * Hashes the words of a command.
+ *
+ * @param cmd		Command lines of a rule, see rule_cmd.
+ * @return			The hash.
+ */
+uint64_t db_hash_cmd(char **cmd);
+
+/**
+ * XXH64 of a buffer.
+ *
+ * @param data		Buffer to hash.
+ * @param len		Length of the buffer.
+ * @param seed		Seed of the hash.
+ * @return			The hash.
+ */
+uint64_t db_xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif
@@ -0,0 +1,760 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Header dependencies of compiled targets, see depslog.h.
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "depslog.h"
+#include "parser.h"
+
+#define MAGIC "# mmakedeps\n"
+#define MAGIC_LEN 12
+#define VERSION 1
+// Top bit of the size word of a dependency record.
+#define DEPS_FLAG 0x80000000u
+// Largest record that is read, anything bigger is corruption.
+#define MAX_RECORD (1u << 24)
+// Records in the file before it is worth rewriting.
+#define COMPACT_MIN 1000
+
+struct record {
+	struct timespec mtime;
+	int depAmt;
+	const char **deps;
+};
+
+// A word of a command line, not terminated in the text of a shell line.
+struct span {
+	const char *s;
+	int len;
+};
+
+// Bytes to append to the file.
+struct buffer {
+	char *data;
+	size_t size;
+	size_t cap;
+};
+
+struct depslog {
+	char *path;
+	// Opened for appending on the first write, -1 before that.
+	int fd;
+	// Length of the part of the file that was read as valid records.
+	off_t validSize;
+	bool writeFailed;
+	// The file as read. Names loaded from it point into it.
+	char *data;
+	size_t dataSize;
+	// Every path by number, and the record of each, NULL for a path that is
+	// only a dependency.
+	const char **paths;
+	struct record **records;
+	int pathAmt;
+	int pathCap;
+	// Open addressing hash table of the path numbers by name, -1 for empty.
+	int *table;
+	size_t tableCap;
+	// Dependency records in the file, and how many of them are the last of
+	// their target.
+	int recordAmt;
+	int liveAmt;
+};
+
+
+// Function declaration.
+static void load(depslog *l);
+static int findPath(depslog *l, const char *name);
+static int addPath(depslog *l, const char *name);
+static void setRecord(depslog *l, int id, const int *numbers, int depAmt, struct timespec mtime);
+static void appendPath(struct buffer *b, const char *name);
+static void appendDeps(struct buffer *b, int id, struct record *r, int *numbers);
+static void append(struct buffer *b, const void *data, size_t size);
+static bool openAppend(depslog *l);
+static int compact(depslog *l);
+static int parseDepfile(char *p, char *end, char ***words, int *wordCap);
+static bool nextWord(char **line, bool shell, int *pos, struct span *w);
+
+/*  Function: depslog_open
+*  Input:
+*			const char *path	:Path of the log file.
+*
+*  Output: The log loaded from the file, empty if there is none.
+*/
+depslog *depslog_open(const char *path) {
+	depslog *l = calloc(1, sizeof(depslog));
+	if(l == NULL || (l->path = strdup(path)) == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	l->fd = -1;
+	l->tableCap = 64;
+	l->table = malloc(l->tableCap * sizeof(int));
+	if(l->table == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(l->table, -1, l->tableCap * sizeof(int));
+	load(l);
+	return l;
+}
+
+/*  Function: depslog_depfile
+*  Input:
+*			char **cmd			:Command lines.
+*			const char *target	:Target it builds.
+*			char *path			:Set to the depfile path, unless NULL.
+*			size_t size			:Size of path.
+*
+*  Output: true if the command writes a depfile and its path fits.
+*/
+bool depslog_depfile(char **cmd, const char *target, char *path, size_t size) {
+	bool writes = false;
+	struct span depfile = {NULL, 0};
+	struct span output = {NULL, 0};
+	struct span w;
+	for(char **line = cmd; line != NULL; line = rule_next_cmd(line)) {
+		bool shell = rule_cmd_shell(line);
+		// -MF or -o waiting for the word after it.
+		struct span *arg = NULL;
+		int pos = 0;
+		while(nextWord(line, shell, &pos, &w)) {
+			if(arg != NULL) {
+				*arg = w;
+				arg = NULL;
+			}
+			else if((w.len == 3 && memcmp(w.s, "-MD", 3) == 0) || (w.len == 4 && memcmp(w.s, "-MMD", 4) == 0)) {
+				writes = true;
+			}
+			else if(w.len >= 3 && memcmp(w.s, "-MF", 3) == 0) {
+				depfile = (struct span){w.s + 3, w.len - 3};
+				arg = w.len == 3 ? &depfile : NULL;
+			}
+			else if(w.len >= 2 && memcmp(w.s, "-o", 2) == 0) {
+				output = (struct span){w.s + 2, w.len - 2};
+				arg = w.len == 2 ? &output : NULL;
+			}
+		}
+	}
+	if(!writes || path == NULL) {
+		return writes;
+	}
+	if(depfile.len > 0) {
+		return (size_t)snprintf(path, size, "%.*s", depfile.len, depfile.s) < size;
+	}
+	struct span base = output.len > 0 ? output : (struct span){target, strlen(target)};
+	const char *dot = memrchr(base.s, '.', base.len);
+	const char *slash = memrchr(base.s, '/', base.len);
+	int len = dot != NULL && (slash == NULL || dot > slash) ? dot - base.s : base.len;
+	return (size_t)snprintf(path, size, "%.*s.d", len, base.s) < size;
+}
+
+/*  Function: nextWord
+*  Input:
+*			char **line			:Command line.
+*			bool shell			:The line is run by the shell.
+*			int *pos			:Index of the next word, or where it starts in the text of
+*								 a shell line. Start at 0.
+*			struct span *w		:Set to the word.
+*
+*  Output: false after the last word. The text of a shell line is split at whitespace,
+*		   without regard to quotes.
+*/
+static bool nextWord(char **line, bool shell, int *pos, struct span *w) {
+	if(!shell) {
+		if(line[*pos] == NULL) {
+			return false;
+		}
+		*w = (struct span){line[*pos], strlen(line[*pos])};
+		(*pos)++;
+		return true;
+	}
+	const char *s = line[2] + *pos;
+	while(isspace((unsigned char)*s)) {
+		s++;
+	}
+	if(*s == '\0') {
+		return false;
+	}
+	const char *e = s;
+	while(*e != '\0' && !isspace((unsigned char)*e)) {
+		e++;
+	}
+	*w = (struct span){s, e - s};
+	*pos = e - line[2];
+	return true;
+}
+
+/*  Function: depslog_find
+*  Input:
+*			depslog *l			:Log.
+*			const char *target	:Target to find.
+*			const char ***deps	:Set to its dependencies.
+*			int *depAmt			:Set to the amount.
+*			struct timespec *mtime	:Set to the recorded modification time.
+*
+*  Output: true if the target has a record.
+*/
+bool depslog_find(depslog *l, const char *target, const char ***deps, int *depAmt,
+				  struct timespec *mtime) {
+	int id = findPath(l, target);
+	if(id == -1 || l->records[id] == NULL) {
+		return false;
+	}
+	*deps = l->records[id]->deps;
+	*depAmt = l->records[id]->depAmt;
+	*mtime = l->records[id]->mtime;
+	return true;
+}
+
+/*  Function: depslog_put
+*  Input:
+*			depslog *l			:Log.
+*			const char *target	:Target of the record.
+*			const char **deps	:Its dependencies.
+*			int depAmt			:Amount of dependencies.
+*			struct timespec mtime	:Modification time of the target.
+*
+*  Output: 0 if the record was appended to the file. New paths are appended before
+*		   it, all in one write.
+*/
+int depslog_put(depslog *l, const char *target, const char **deps, int depAmt, struct timespec mtime) {
+	struct buffer b = {0};
+	int *numbers = malloc((depAmt + 1) * sizeof(int));
+	if(numbers == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int id = findPath(l, target);
+	if(id == -1) {
+		id = addPath(l, strdup(target));
+		appendPath(&b, target);
+	}
+	for(int i = 0; i < depAmt; i++) {
+		if((numbers[i] = findPath(l, deps[i])) == -1) {
+			numbers[i] = addPath(l, strdup(deps[i]));
+			appendPath(&b, deps[i]);
+		}
+	}
+	setRecord(l, id, numbers, depAmt, mtime);
+	appendDeps(&b, id, l->records[id], numbers);
+	l->recordAmt++;
+	free(numbers);
+
+	int status = 0;
+	if(!openAppend(l) || write(l->fd, b.data, b.size) != (ssize_t)b.size) {
+		if(!l->writeFailed) {
+			perror(l->path);
+		}
+		l->writeFailed = true;
+		status = -1;
+	}
+	free(b.data);
+	return status;
+}
+
+/*  Function: depslog_ingest
+*  Input:
+*			depslog *l			:Log.
+*			const char *target	:Target of the record.
+*			const char *depfile	:Depfile its command wrote.
+*			const char **skip	:Names to leave out.
+*			struct timespec mtime	:Modification time of the target.
+*
+*  Output: 0 if the depfile was read and its dependencies recorded.
+*/
+int depslog_ingest(depslog *l, const char *target, const char *depfile, const char **skip,
+				   struct timespec mtime) {
+	int fd = open(depfile, O_RDONLY | O_CLOEXEC);
+	struct stat info;
+	if(fd == -1 || fstat(fd, &info) == -1) {
+		fprintf(stderr, "mmake: %s: ", target);
+		perror(depfile);
+		if(fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	char *text = malloc(info.st_size + 1);
+	if(text == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	ssize_t size = read(fd, text, info.st_size);
+	close(fd);
+	char **words = NULL;
+	int wordCap = 0;
+	int wordAmt = size < 0 ? -1 : parseDepfile(text, text + size, &words, &wordCap);
+	if(wordAmt == -1) {
+		fprintf(stderr, "mmake: %s: %s: not a depfile\n", target, depfile);
+		free(text);
+		free(words);
+		return -1;
+	}
+
+	// Keep the ones the makefile doesn't already list.
+	int keptAmt = 0;
+	for(int i = 0; i < wordAmt; i++) {
+		int j = 0;
+		while(skip[j] != NULL && strcmp(skip[j], words[i]) != 0) {
+			j++;
+		}
+		if(skip[j] == NULL && strcmp(words[i], target) != 0) {
+			words[keptAmt++] = words[i];
+		}
+	}
+	int status = depslog_put(l, target, (const char **)words, keptAmt, mtime);
+	free(text);
+	free(words);
+	return status;
+}
+
+/*  Function: depslog_close
+*  Input:
+*			depslog *l			:Log to free.
+*
+*  Output: 0 unless rewriting the file failed. Frees the log and its names.
+*/
+int depslog_close(depslog *l) {
+	int status = 0;
+	if(l->recordAmt > COMPACT_MIN && l->recordAmt > 3 * l->liveAmt && !l->writeFailed) {
+		status = compact(l);
+	}
+	if(l->fd != -1) {
+		close(l->fd);
+	}
+	for(int i = 0; i < l->pathAmt; i++) {
+		if(l->paths[i] < l->data || l->paths[i] >= l->data + l->dataSize) {
+			free((char *)l->paths[i]);
+		}
+		if(l->records[i] != NULL) {
+			free(l->records[i]->deps);
+			free(l->records[i]);
+		}
+	}
+	free(l->paths);
+	free(l->records);
+	free(l->table);
+	free(l->data);
+	free(l->path);
+	free(l);
+	return status;
+}
+
+/*  Function: load
+*  Input:
+*			depslog *l			:Empty log.
+*
+*  Output: Reads the file and every whole record in it. Reading stops at the first
+*		   record that is cut short or doesn't make sense, and the file is later
+*		   appended to from there.
+*/
+static void load(depslog *l) {
+	int fd = open(l->path, O_RDONLY | O_CLOEXEC);
+	struct stat info;
+	if(fd == -1) {
+		return;
+	}
+	if(fstat(fd, &info) == -1 || (l->data = malloc(info.st_size + 1)) == NULL
+	   || read(fd, l->data, info.st_size) != info.st_size) {
+		perror(l->path);
+		close(fd);
+		return;
+	}
+	close(fd);
+	l->dataSize = info.st_size;
+	uint32_t version;
+	if(l->dataSize < MAGIC_LEN + 4 || memcmp(l->data, MAGIC, MAGIC_LEN) != 0
+	   || (memcpy(&version, l->data + MAGIC_LEN, 4), version != VERSION)) {
+		fprintf(stderr, "mmake: %s: not a deps log of this version, ignored\n", l->path);
+		return;
+	}
+
+	size_t pos = MAGIC_LEN + 4;
+	uint32_t head;
+	while(pos + 4 <= l->dataSize) {
+		memcpy(&head, l->data + pos, 4);
+		uint32_t size = head & ~DEPS_FLAG;
+		char *p = l->data + pos + 4;
+		if(size % 4 != 0 || size > MAX_RECORD || size > l->dataSize - pos - 4) {
+			break;
+		}
+		if(!(head & DEPS_FLAG)) {
+			// Names are padded with at least one NUL.
+			if(size == 0 || p[size - 1] != '\0' || findPath(l, p) != -1) {
+				break;
+			}
+			addPath(l, p);
+		}
+		else {
+			int32_t id;
+			uint32_t nsec;
+			int64_t sec;
+			if(size < 16) {
+				break;
+			}
+			memcpy(&id, p, 4);
+			memcpy(&nsec, p + 4, 4);
+			memcpy(&sec, p + 8, 8);
+			int depAmt = (size - 16) / 4;
+			int32_t *numbers = malloc((depAmt + 1) * sizeof(int32_t));
+			if(numbers == NULL) {
+				perror("malloc");
+				exit(EXIT_FAILURE);
+			}
+			memcpy(numbers, p + 16, depAmt * sizeof(int32_t));
+			bool ok = id >= 0 && id < l->pathAmt && nsec < 1000000000;
+			for(int i = 0; ok && i < depAmt; i++) {
+				ok = numbers[i] >= 0 && numbers[i] < l->pathAmt;
+			}
+			if(ok) {
+				setRecord(l, id, numbers, depAmt, (struct timespec){sec, nsec});
+				l->recordAmt++;
+			}
+			free(numbers);
+			if(!ok) {
+				break;
+			}
+		}
+		pos += 4 + size;
+	}
+	l->validSize = pos;
+}
+
+/*  Function: findPath
+*  Input:
+*			depslog *l			:Log.
+*			const char *name	:Path name.
+*
+*  Output: The number of the path, or -1 if it isn't in the log.
+*/
+static int findPath(depslog *l, const char *name) {
+	size_t mask = l->tableCap - 1;
+	for(size_t i = hash_bytes(name, strlen(name)) & mask; l->table[i] != -1; i = (i + 1) & mask) {
+		if(strcmp(l->paths[l->table[i]], name) == 0) {
+			return l->table[i];
+		}
+	}
+	return -1;
+}
+
+/*  Function: addPath
+*  Input:
+*			depslog *l			:Log.
+*			const char *name	:Path name not in the log, kept by the log.
+*
+*  Output: The number given to the path.
+*/
+static int addPath(depslog *l, const char *name) {
+	if(name == NULL) {
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	if(l->pathAmt == l->pathCap) {
+		l->pathCap = l->pathCap == 0 ? 64 : l->pathCap * 2;
+		l->paths = realloc(l->paths, l->pathCap * sizeof(char *));
+		l->records = realloc(l->records, l->pathCap * sizeof(struct record *));
+		if(l->paths == NULL || l->records == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	int id = l->pathAmt++;
+	l->paths[id] = name;
+	l->records[id] = NULL;
+
+	// Keep the table at most half full.
+	if((size_t)l->pathAmt * 2 > l->tableCap) {
+		l->tableCap *= 2;
+		l->table = realloc(l->table, l->tableCap * sizeof(int));
+		if(l->table == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		memset(l->table, -1, l->tableCap * sizeof(int));
+		for(int i = 0; i < id; i++) {
+			size_t j = hash_bytes(l->paths[i], strlen(l->paths[i])) & (l->tableCap - 1);
+			while(l->table[j] != -1) {
+				j = (j + 1) & (l->tableCap - 1);
+			}
+			l->table[j] = i;
+		}
+	}
+	size_t j = hash_bytes(name, strlen(name)) & (l->tableCap - 1);
+	while(l->table[j] != -1) {
+		j = (j + 1) & (l->tableCap - 1);
+	}
+	l->table[j] = id;
+	return id;
+}
+
+/*  Function: setRecord
+*  Input:
+*			depslog *l			:Log.
+*			int id				:Number of the target.
+*			const int *numbers	:Numbers of its dependencies.
+*			int depAmt			:Amount of dependencies.
+*			struct timespec mtime	:Modification time of the target.
+*
+*  Output: Replaces the record of the target in memory, or adds one.
+*/
+static void setRecord(depslog *l, int id, const int *numbers, int depAmt, struct timespec mtime) {
+	struct record *r = l->records[id];
+	if(r == NULL) {
+		if((r = malloc(sizeof(struct record))) == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		l->records[id] = r;
+		l->liveAmt++;
+	}
+	else {
+		free(r->deps);
+	}
+	r->mtime = mtime;
+	r->depAmt = depAmt;
+	if((r->deps = malloc((depAmt + 1) * sizeof(char *))) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < depAmt; i++) {
+		r->deps[i] = l->paths[numbers[i]];
+	}
+}
+
+/*  Function: appendPath
+*  Input:
+*			struct buffer *b	:Bytes to write.
+*			const char *name	:Path name.
+*
+*  Output: Adds a path record.
+*/
+static void appendPath(struct buffer *b, const char *name) {
+	size_t len = strlen(name);
+	uint32_t size = (len + 4) & ~3u;
+	char pad[4] = {0};
+	append(b, &size, 4);
+	append(b, name, len);
+	append(b, pad, size - len);
+}
+
+/*  Function: appendDeps
+*  Input:
+*			struct buffer *b	:Bytes to write.
+*			int id				:Number of the target.
+*			struct record *r	:Its record.
+*			int *numbers		:Numbers of its dependencies.
+*
+*  Output: Adds a dependency record.
+*/
+static void appendDeps(struct buffer *b, int id, struct record *r, int *numbers) {
+	uint32_t head = DEPS_FLAG | (16 + 4 * r->depAmt);
+	uint32_t nsec = r->mtime.tv_nsec;
+	int64_t sec = r->mtime.tv_sec;
+	int32_t number = id;
+	append(b, &head, 4);
+	append(b, &number, 4);
+	append(b, &nsec, 4);
+	append(b, &sec, 8);
+	for(int i = 0; i < r->depAmt; i++) {
+		number = numbers[i];
+		append(b, &number, 4);
+	}
+}
+
+/*  Function: append
+*  Input:
+*			struct buffer *b	:Buffer.
+*			const void *data	:Bytes to add.
+*			size_t size			:Amount of bytes.
+*
+*  Output: Adds the bytes to the end of the buffer, growing it if needed.
+*/
+static void append(struct buffer *b, const void *data, size_t size) {
+	if(b->size + size > b->cap) {
+		b->cap = b->cap == 0 ? 256 : b->cap;
+		while(b->size + size > b->cap) {
+			b->cap *= 2;
+		}
+		if((b->data = realloc(b->data, b->cap)) == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+/*  Function: openAppend
+*  Input:
+*			depslog *l			:Log.
+*
+*  Output: true if the file is open for appending. The first time, anything after the
+*		   valid records is cut off, and a new file gets its magic line and version.
+*/
+static bool openAppend(depslog *l) {
+	if(l->fd != -1) {
+		return true;
+	}
+	if(l->writeFailed) {
+		return false;
+	}
+	if((l->fd = open(l->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1
+	   || ftruncate(l->fd, l->validSize) == -1) {
+		return false;
+	}
+	if(l->validSize == 0) {
+		uint32_t version = VERSION;
+		if(write(l->fd, MAGIC, MAGIC_LEN) != MAGIC_LEN || write(l->fd, &version, 4) != 4) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*  Function: compact
+*  Input:
+*			depslog *l			:Log.
+*
+*  Output: 0 if the file was rewritten with only the last record of each target and
+*		   the paths they use. Writes a temporary file next to it and renames it into
+*		   place.
+*/
+static int compact(depslog *l) {
+	struct buffer b = {0};
+	uint32_t version = VERSION;
+	int *numbers = malloc((l->pathAmt + 1) * sizeof(int));
+	int *deps = NULL;
+	int depCap = 0;
+	if(numbers == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(numbers, -1, l->pathAmt * sizeof(int));
+	int numbered = 0;
+	append(&b, MAGIC, MAGIC_LEN);
+	append(&b, &version, 4);
+	for(int id = 0; id < l->pathAmt; id++) {
+		struct record *r = l->records[id];
+		if(r == NULL) {
+			continue;
+		}
+		if(r->depAmt > depCap) {
+			depCap = r->depAmt;
+			if((deps = realloc(deps, depCap * sizeof(int))) == NULL) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		for(int i = -1; i < r->depAmt; i++) {
+			int old = i == -1 ? id : findPath(l, r->deps[i]);
+			if(numbers[old] == -1) {
+				numbers[old] = numbered++;
+				appendPath(&b, l->paths[old]);
+			}
+			if(i >= 0) {
+				deps[i] = numbers[old];
+			}
+		}
+		appendDeps(&b, numbers[id], r, deps);
+	}
+	free(numbers);
+	free(deps);
+
+	char tmpPath[strlen(l->path) + 32];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%d", l->path, (int)getpid());
+	int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	int status = 0;
+	if(fd == -1 || write(fd, b.data, b.size) != (ssize_t)b.size || close(fd) == -1
+	   || rename(tmpPath, l->path) == -1) {
+		perror(l->path);
+		unlink(tmpPath);
+		status = -1;
+	}
+	free(b.data);
+	return status;
+}
+
+/*  Function: parseDepfile
+*  Input:
+*			char *p				:Start of the depfile text, unescaped in place.
+*			char *end			:End of the text.
+*			char ***words		:Array grown to hold the dependencies.
+*			int *wordCap		:Its capacity.
+*
+*  Output: The amount of dependencies of the first rule, or -1 if it has no colon.
+*		   Lines continue after a backslash, "\ " and "\#" are a space and a # in a
+*		   name and "$$" is a $. The phony rules of -MP come after the first rule
+*		   and are not read.
+*/
+static int parseDepfile(char *p, char *end, char ***words, int *wordCap) {
+	bool colon = false;
+	int wordAmt = 0;
+	while(p < end) {
+		if(*p == ' ' || *p == '\t' || *p == '\r') {
+			p++;
+			continue;
+		}
+		if(*p == '\\' && p + 1 < end && (p[1] == '\n' || p[1] == '\r')) {
+			p += p[1] == '\r' && p + 2 < end && p[2] == '\n' ? 3 : 2;
+			continue;
+		}
+		if(*p == '\n') {
+			if(colon) {
+				break;
+			}
+			p++;
+			continue;
+		}
+
+		char *word = p;
+		char *out = p;
+		while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+			if(*p == '\\' && p + 1 < end && (p[1] == ' ' || p[1] == '#')) {
+				p++;
+			}
+			else if(*p == '\\' && p + 1 < end && p[1] == '\n') {
+				break;
+			}
+			else if(*p == '$' && p + 1 < end && p[1] == '$') {
+				p++;
+			}
+			*out++ = *p++;
+		}
+		bool separator = !colon && out > word && out[-1] == ':';
+		if(separator) {
+			out--;
+		}
+		// The NUL may take the place of the character after the word.
+		char next = p < end ? *p : '\0';
+		*out = '\0';
+		if(out > word && colon) {
+			if(wordAmt == *wordCap) {
+				*wordCap = *wordCap == 0 ? 64 : *wordCap * 2;
+				if((*words = realloc(*words, *wordCap * sizeof(char *))) == NULL) {
+					perror("realloc");
+					exit(EXIT_FAILURE);
+				}
+			}
+			(*words)[wordAmt++] = word;
+		}
+		colon = colon || separator;
+		if(next == '\n' && colon) {
+			break;
+		}
+		// Step over the character after the word, and the newline of a continuation.
+		p += next == '\\' ? 2 : p < end;
+	}
+	return colon ? wordAmt : -1;
+}
+
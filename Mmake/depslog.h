@@ -0,0 +1,109 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Header dependencies found by the compiler, kept in .mmake_deps
+*				 between runs. A command with -MD or -MMD writes a make depfile
+*				 listing the headers it read. Once the command is done the depfile
+*				 is read and the headers are appended to the log, so later runs
+*				 never read the depfiles again.
+*
+*				 The log is binary and only appended to while building. It starts
+*				 with a magic line and a version, followed by records that each
+*				 start with a 32 bit word of their size, with the top bit set for
+*				 a dependency record:
+*					path: the name, NUL padded to a multiple of 4 bytes. The paths
+*						  are numbered in the order they appear.
+*					deps: the path number of the target, the modification time of
+*						  the target as nanoseconds and seconds, and the path number
+*						  of each dependency.
+*				 The last dependency record of a target is the one used. When most
+*				 records are replaced ones, the log is rewritten with only the last.
+*/
+
+#ifndef DEPSLOG_H
+#define DEPSLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#define DEPS_FILE ".mmake_deps"
+
+typedef struct depslog depslog;
+
+/**
+ * Loads a deps log. A missing file gives an empty log, and a record cut short
+ * by a crash ends it. A file that isn't a deps log is ignored with a warning
+ * and replaced on the first write.
+ *
+ * @param path		Path of the log file.
+ * @return			Pointer to the log.
+ */
+depslog *depslog_open(const char *path);
+
+/**
+ * Finds where the depfile of a command goes, if it writes one: the -MF
+ * argument, or else the -o argument or the target with its suffix replaced
+ * by .d, like gcc does. Every line of the command is looked at, and a line
+ * run by the shell is split at whitespace.
+ *
+ * @param cmd		Command lines of a rule, see rule_cmd.
+ * @param target	Target the command builds.
+ * @param path		Set to the path of the depfile, may be NULL.
+ * @param size		Size of path.
+ * @return			true if the command has -MD or -MMD.
+ */
+bool depslog_depfile(char **cmd, const char *target, char *path, size_t size);
+
+/**
+ * Finds the dependencies of a target.
+ *
+ * @param l			Pointer to the log.
+ * @param target	Name of the target.
+ * @param deps		Set to the names of the dependencies, owned by the log.
+ * @param depAmt	Set to the amount of dependencies.
+ * @param mtime		Set to the modification time the target had when they were
+ *					recorded.
+ * @return			true if the target has a record.
+ */
+bool depslog_find(depslog *l, const char *target, const char ***deps, int *depAmt,
+				  struct timespec *mtime);
+
+/**
+ * Sets the dependencies of a target and appends them to the log file.
+ *
+ * @param l			Pointer to the log.
+ * @param target	Name of the target.
+ * @param deps		Names of the dependencies.
+ * @param depAmt	Amount of dependencies.
+ * @param mtime		Modification time of the target.
+ * @return			0 on success, -1 with an error printed if the file can't be
+ *					written. The record is kept for this run anyway.
+ */
+int depslog_put(depslog *l, const char *target, const char **deps, int depAmt, struct timespec mtime);
+
+/**
+ * Reads a depfile and sets the dependencies of a target to the files after the
+ * colon of its first rule. Names listed in skip, the target's prerequisites in
+ * the makefile, are left out.
+ *
+ * @param l			Pointer to the log.
+ * @param target	Name of the target.
+ * @param depfile	Path of the depfile.
+ * @param skip		NULL terminated names to leave out.
+ * @param mtime		Modification time of the target.
+ * @return			0 on success, -1 with an error printed otherwise.
+ */
+int depslog_ingest(depslog *l, const char *target, const char *depfile, const char **skip,
+				   struct timespec mtime);
+
+/**
+ * Closes a deps log, rewriting it first if most of its records are replaced
+ * ones. The names it returned must not be used after this.
+ *
+ * @param l			Pointer to the log.
+ * @return			0 on success, -1 with an error printed otherwise.
+ */
+int depslog_close(depslog *l);
+
+#endif
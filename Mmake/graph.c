@@ -0,0 +1,557 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Dependency graph of the targets to build, see graph.h.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "graph.h"
+#include "db.h"
+
+// Nodes a stat thread takes at least, fewer aren't worth starting a thread for.
+#define STAT_BATCH 64
+
+// A node on the walk stack and the index of its next prerequisite, counting the
+// rule's own first and then the headers from the deps log.
+struct frame {
+	node *n;
+	int next;
+	int total;
+	const char **deps;
+};
+
+// Nodes shared by the threads of graph_hash_all and graph_stat_all.
+struct nodeWork {
+	node **nodes;
+	int nodeAmt;
+	int next;
+};
+
+// Function declaration.
+static node *newNode(graph *g, const char *name);
+static void enterNode(graph *g, node *n, int *depth);
+static void printCycle(graph *g, int depth, node *n);
+static void runWorkers(struct nodeWork *work, int threads, void *(*worker)(void *));
+static void *hashWorker(void *arg);
+static void *statWorker(void *arg);
+static bool checkPrereqs(graph *g, node *n);
+static void addDependent(node *prereq, node *dependent);
+static void removeDependent(node *prereq, node *dependent);
+static void insertNode(graph *g, node *n);
+
+/*  Function: graph_create
+*  Input:
+*			makefile *m			:Parsed makefile.
+*			depslog *deps		:Header dependencies, or NULL.
+*
+*  Output: A graph without nodes.
+*/
+graph *graph_create(makefile *m, depslog *deps) {
+	graph *g = calloc(1, sizeof(graph));
+	if(g == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	g->m = m;
+	g->deps = deps;
+	g->tableCap = 64;
+	g->table = calloc(g->tableCap, sizeof(node *));
+	if(g->table == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	return g;
+}
+
+/*  Function: graph_add
+*  Input:
+*			graph *g			:Graph to add to.
+*			const char *target	:Target to add.
+*
+*  Output: The node of the target, or NULL. Walks depth first with an explicit stack,
+*		   so long chains of rules can't overflow the call stack. A node already in
+*		   the graph is reused, and a prerequisite that is still in progress closes
+*		   a cycle. Nothing is stat'ed, that is left to graph_stat_all.
+*/
+node *graph_add(graph *g, const char *target) {
+	node *n = graph_find(g, target);
+	if(n == NULL) {
+		n = newNode(g, target);
+	}
+	if(n->state == NODE_DONE) {
+		return n;
+	}
+	int depth = 0;
+	enterNode(g, n, &depth);
+
+	while(depth > 0) {
+		struct frame *top = &g->stack[depth - 1];
+		if(top->next == top->total) {
+			top->n->state = NODE_DONE;
+			depth--;
+			continue;
+		}
+		const char *name = top->next >= top->n->ruleAmt ? top->deps[top->next - top->n->ruleAmt]
+														: rule_prereq(top->n->rule)[top->next];
+		top->next++;
+		node *prereq = graph_find(g, name);
+		if(prereq == NULL) {
+			prereq = newNode(g, name);
+		}
+		top->n->prereqs[top->n->prereqAmt++] = prereq;
+		addDependent(prereq, top->n);
+
+		if(prereq->state == NODE_IN_PROGRESS) {
+			printCycle(g, depth, prereq);
+			return NULL;
+		}
+		if(prereq->state == NODE_UNVISITED) {
+			enterNode(g, prereq, &depth);
+		}
+	}
+	return n;
+}
+
+/*  Function: graph_find
+*  Input:
+*			graph *g			:Graph to search.
+*			const char *name	:Name to find.
+*
+*  Output: The node of the name, or NULL.
+*/
+node *graph_find(graph *g, const char *name) {
+	size_t mask = g->tableCap - 1;
+	for(size_t i = hash_bytes(name, strlen(name)) & mask; g->table[i] != NULL; i = (i + 1) & mask) {
+		if(strcmp(g->table[i]->name, name) == 0) {
+			return g->table[i];
+		}
+	}
+	return NULL;
+}
+
+/*  Function: graph_mtime
+*  Input:
+*			node *n				:Node to stat.
+*			struct timespec *mtime	:Set to the modification time.
+*
+*  Output: true if the file of the node exists. Stats it only the first time.
+*/
+bool graph_mtime(node *n, struct timespec *mtime) {
+	if(!n->statted) {
+		struct stat info;
+		n->exists = stat(n->name, &info) == 0;
+		n->mtime = info.st_mtim;
+		n->statted = true;
+	}
+	*mtime = n->mtime;
+	return n->exists;
+}
+
+/*  Function: graph_hash
+*  Input:
+*			node *n				:Node to hash.
+*			uint64_t *hash		:Set to the content hash.
+*
+*  Output: true if the file of the node can be read. Hashes it only the first time.
+*/
+bool graph_hash(node *n, uint64_t *hash) {
+	if(!n->hashed) {
+		n->hashOk = db_hash_file(n->name, &n->hash);
+		n->hashed = true;
+	}
+	*hash = n->hash;
+	return n->hashOk;
+}
+
+/*  Function: graph_hash_all
+*  Input:
+*			graph *g			:Graph whose files to hash.
+*			int threads			:Threads to use.
+*
+*  Output: Every existing prerequisite is hashed. The threads take the next node
+*		   from a shared index, so big and small files even out.
+*/
+void graph_hash_all(graph *g, int threads) {
+	struct timespec mtime;
+	struct nodeWork work = {malloc((g->nodeAmt + 1) * sizeof(node *)), 0, 0};
+	if(work.nodes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < g->nodeAmt; i++) {
+		node *n = g->nodes[i];
+		if(n->dependentAmt > 0 && !n->hashed && graph_mtime(n, &mtime)) {
+			work.nodes[work.nodeAmt++] = n;
+		}
+	}
+
+	runWorkers(&work, threads, hashWorker);
+	free(work.nodes);
+}
+
+/*  Function: graph_stat_all
+*  Input:
+*			graph *g			:Graph whose files to stat.
+*			int threads			:Threads to use at most.
+*
+*  Output: false if a file without a rule doesn't exist. Every node is stat'ed, spread
+*		   over threads that each take STAT_BATCH nodes at least, and then the
+*		   prerequisites of every rule are checked.
+*/
+bool graph_stat_all(graph *g, int threads) {
+	struct nodeWork work = {malloc((g->nodeAmt + 1) * sizeof(node *)), 0, 0};
+	if(work.nodes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < g->nodeAmt; i++) {
+		if(!g->nodes[i]->statted) {
+			work.nodes[work.nodeAmt++] = g->nodes[i];
+		}
+	}
+	if(threads > work.nodeAmt / STAT_BATCH) {
+		threads = work.nodeAmt / STAT_BATCH;
+	}
+	runWorkers(&work, threads, statWorker);
+	free(work.nodes);
+
+	for(int i = 0; i < g->nodeAmt; i++) {
+		if(g->nodes[i]->rule != NULL && !checkPrereqs(g, g->nodes[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*  Function: graph_invalidate
+*  Input:
+*			node *n				:Node whose file has changed.
+*
+*  Output: The next graph_mtime and graph_hash look at the file again.
+*/
+void graph_invalidate(node *n) {
+	n->statted = false;
+	n->hashed = false;
+}
+
+/*  Function: graph_set_deps
+*  Input:
+*			graph *g			:Graph of the node.
+*			node *n				:Node whose depfile was just read into the deps log.
+*
+*  Output: Replaces the headers of the node with the ones now recorded for it. A header
+*		   that isn't in the graph yet is added as a file. Like in checkPrereqs, a header
+*		   that is gone is left out and makes the node stale, and so does a target that
+*		   isn't in the graph or isn't finished in the current build, which would need
+*		   a walk or would make the node ready a second time.
+*/
+void graph_set_deps(graph *g, node *n) {
+	const char **deps;
+	int depAmt;
+	struct timespec recorded;
+	struct timespec mtime;
+	if(g->deps == NULL || !depslog_find(g->deps, n->name, &deps, &depAmt, &recorded)) {
+		return;
+	}
+	for(int i = n->ruleAmt; i < n->prereqAmt; i++) {
+		removeDependent(n->prereqs[i], n);
+	}
+	n->prereqAmt = n->ruleAmt;
+	n->prereqs = realloc(n->prereqs, (n->ruleAmt + depAmt + 1) * sizeof(node *));
+	if(n->prereqs == NULL) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < depAmt; i++) {
+		node *h = graph_find(g, deps[i]);
+		if(h == NULL && makefile_rule(g->m, deps[i]) == NULL) {
+			h = newNode(g, deps[i]);
+			h->state = NODE_DONE;
+		}
+		if(h == NULL || h == n || (h->inBuild && !h->done) || !graph_mtime(h, &mtime)) {
+			n->staleDeps = true;
+			continue;
+		}
+		n->prereqs[n->prereqAmt++] = h;
+		addDependent(h, n);
+	}
+}
+
+/*  Function: graph_del
+*  Input:
+*			graph *g			:Graph to free.
+*
+*  Output: Frees the graph and its nodes.
+*/
+void graph_del(graph *g) {
+	for(int i = 0; i < g->nodeAmt; i++) {
+		free(g->nodes[i]->prereqs);
+		free(g->nodes[i]->dependents);
+		free(g->nodes[i]);
+	}
+	free(g->nodes);
+	free(g->table);
+	free(g->stack);
+	free(g);
+}
+
+/*  Function: newNode
+*  Input:
+*			graph *g			:Graph to add to.
+*			const char *name	:Name of the node.
+*
+*  Output: A node without edges, added to the node list and the hash table.
+*/
+static node *newNode(graph *g, const char *name) {
+	node *n = calloc(1, sizeof(node));
+	if(n == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	n->name = name;
+	n->rule = makefile_rule(g->m, name);
+
+	if(g->nodeAmt == g->nodeCap) {
+		g->nodeCap = g->nodeCap == 0 ? 64 : g->nodeCap * 2;
+		g->nodes = realloc(g->nodes, g->nodeCap * sizeof(node *));
+		if(g->nodes == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	g->nodes[g->nodeAmt++] = n;
+
+	// Keep the table at most half full.
+	if((size_t)g->nodeAmt * 2 > g->tableCap) {
+		node **old = g->table;
+		size_t oldCap = g->tableCap;
+		g->tableCap *= 2;
+		g->table = calloc(g->tableCap, sizeof(node *));
+		if(g->table == NULL) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for(size_t i = 0; i < oldCap; i++) {
+			if(old[i] != NULL) {
+				insertNode(g, old[i]);
+			}
+		}
+		free(old);
+	}
+	insertNode(g, n);
+	return n;
+}
+
+/*  Function: enterNode
+*  Input:
+*			graph *g			:Graph being walked.
+*			node *n				:Unvisited node.
+*			int *depth			:Depth of the walk stack.
+*
+*  Output: A file is done at once, a rule is pushed on the walk stack to walk its
+*		   prerequisites and then its headers in the deps log.
+*/
+static void enterNode(graph *g, node *n, int *depth) {
+	if(n->rule == NULL) {
+		n->state = NODE_DONE;
+		return;
+	}
+
+	const char **prereqList = rule_prereq(n->rule);
+	while(prereqList[n->ruleAmt] != NULL) {
+		n->ruleAmt++;
+	}
+	const char **deps = NULL;
+	int depAmt = 0;
+	struct timespec recorded;
+	if(g->deps != NULL && !depslog_find(g->deps, n->name, &deps, &depAmt, &recorded)
+	   && depslog_depfile(rule_cmd(n->rule), n->name, NULL, 0)) {
+		n->staleDeps = true;
+	}
+	n->prereqs = malloc((n->ruleAmt + depAmt + 1) * sizeof(node *));
+	if(n->prereqs == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	if(*depth == g->stackCap) {
+		g->stackCap = g->stackCap == 0 ? 64 : g->stackCap * 2;
+		g->stack = realloc(g->stack, g->stackCap * sizeof(struct frame));
+		if(g->stack == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	g->stack[(*depth)++] = (struct frame){n, 0, n->ruleAmt + depAmt, deps};
+	n->state = NODE_IN_PROGRESS;
+}
+
+/*  Function: printCycle
+*  Input:
+*			graph *g			:Graph being walked.
+*			int depth			:Depth of the walk stack.
+*			node *n				:Node in progress that was reached again.
+*
+*  Output: Prints the rules of the cycle, from the node back to itself.
+*/
+static void printCycle(graph *g, int depth, node *n) {
+	int i = depth - 1;
+	while(g->stack[i].n != n) {
+		i--;
+	}
+	fprintf(stderr, "mmake: circular dependency");
+	for(; i < depth; i++) {
+		fprintf(stderr, " %s ->", g->stack[i].n->name);
+	}
+	fprintf(stderr, " %s\n", n->name);
+}
+
+/*  Function: runWorkers
+*  Input:
+*			struct nodeWork *work	:Nodes to work on.
+*			int threads			:Threads to use.
+*			void *(*worker)(void *)	:Function taking nodes from the work until none are left.
+*
+*  Output: Runs the worker on the threads and waits for them. This thread works too,
+*		   so one thread less is started.
+*/
+static void runWorkers(struct nodeWork *work, int threads, void *(*worker)(void *)) {
+	if(threads > work->nodeAmt) {
+		threads = work->nodeAmt;
+	}
+	pthread_t tids[threads > 0 ? threads : 1];
+	int started = 0;
+	while(started < threads - 1 && pthread_create(&tids[started], NULL, worker, work) == 0) {
+		started++;
+	}
+	worker(work);
+	for(int i = 0; i < started; i++) {
+		pthread_join(tids[i], NULL);
+	}
+}
+
+/*  Function: hashWorker
+*  Input:
+*			void *arg			:Shared struct nodeWork.
+*
+*  Output: Hashes nodes until there are none left. Returns NULL.
+*/
+static void *hashWorker(void *arg) {
+	struct nodeWork *work = arg;
+	uint64_t hash;
+	int i;
+	while((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->nodeAmt) {
+		graph_hash(work->nodes[i], &hash);
+	}
+	return NULL;
+}
+
+/*  Function: statWorker
+*  Input:
+*			void *arg			:Shared struct nodeWork.
+*
+*  Output: Stats nodes until there are none left. Returns NULL.
+*/
+static void *statWorker(void *arg) {
+	struct nodeWork *work = arg;
+	struct timespec mtime;
+	int i;
+	while((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->nodeAmt) {
+		graph_mtime(work->nodes[i], &mtime);
+	}
+	return NULL;
+}
+
+/*  Function: checkPrereqs
+*  Input:
+*			graph *g			:Graph that has been stat'ed.
+*			node *n				:Node with a rule.
+*
+*  Output: false if a prerequisite of the rule is a file without a rule that doesn't
+*		   exist. A missing header is dropped instead, and makes the node stale, as
+*		   do headers recorded for another version of the target than the one there.
+*/
+static bool checkPrereqs(graph *g, node *n) {
+	int kept = 0;
+	for(int i = 0; i < n->prereqAmt; i++) {
+		node *p = n->prereqs[i];
+		if(p->rule == NULL && !p->exists) {
+			if(i < n->ruleAmt) {
+				fprintf(stderr, "mmake: %s: No such file or directory\n", p->name);
+				return false;
+			}
+			removeDependent(p, n);
+			n->staleDeps = true;
+			continue;
+		}
+		n->prereqs[kept++] = p;
+	}
+	n->prereqAmt = kept;
+
+	const char **deps;
+	int depAmt;
+	struct timespec recorded;
+	if(g->deps != NULL && n->exists && depslog_find(g->deps, n->name, &deps, &depAmt, &recorded)
+	   && (n->mtime.tv_sec != recorded.tv_sec || n->mtime.tv_nsec != recorded.tv_nsec)) {
+		n->staleDeps = true;
+	}
+	return true;
+}
+
+/*  Function: insertNode
+*  Input:
+*			graph *g			:Graph with room in its table.
+*			node *n				:Node to insert.
+*
+*  Output: Puts the node in the first free slot from its hash.
+*/
+static void insertNode(graph *g, node *n) {
+	size_t mask = g->tableCap - 1;
+	size_t i = hash_bytes(n->name, strlen(n->name)) & mask;
+	while(g->table[i] != NULL) {
+		i = (i + 1) & mask;
+	}
+	g->table[i] = n;
+}
+
+/*  Function: addDependent
+*  Input:
+*			node *prereq		:Prerequisite.
+*			node *dependent		:Node depending on it.
+*
+*  Output: Adds the reverse edge from the prerequisite to its dependent.
+*/
+static void addDependent(node *prereq, node *dependent) {
+	if(prereq->dependentAmt == prereq->dependentCap) {
+		prereq->dependentCap = prereq->dependentCap == 0 ? 4 : prereq->dependentCap * 2;
+		prereq->dependents = realloc(prereq->dependents, prereq->dependentCap * sizeof(node *));
+		if(prereq->dependents == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	prereq->dependents[prereq->dependentAmt++] = dependent;
+}
+
+/*  Function: removeDependent
+*  Input:
+*			node *prereq		:Prerequisite.
+*			node *dependent		:Node no longer depending on it.
+*
+*  Output: Removes the reverse edge, the last dependent takes its place.
+*/
+static void removeDependent(node *prereq, node *dependent) {
+	for(int i = 0; i < prereq->dependentAmt; i++) {
+		if(prereq->dependents[i] == dependent) {
+			prereq->dependents[i] = prereq->dependents[--prereq->dependentAmt];
+			return;
+		}
+	}
+}
@@ -0,0 +1,196 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Dependency graph of the targets to build. Every target and file
+*				 reachable from the goals is one node, shared by all rules that
+*				 depend on it. Edges go both ways, to the prerequisites and to the
+*				 dependents, so the build can count down how many prerequisites
+*				 each node still waits for.
+*
+*				 Headers found by the compiler in earlier builds are added from the
+*				 deps log as prerequisites after the ones of the rule.
+*
+*				 The graph doubles as the stat cache of the run: every node is
+*				 stat'ed once the graph is walked, on many threads at once since
+*				 stat mostly waits for the disk or the network on a cold cache,
+*				 and again only after its command has run.
+*/
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "parser.h"
+#include "depslog.h"
+
+typedef struct node node;
+
+// How far graph_add has walked a node.
+typedef enum node_state {
+	NODE_UNVISITED,
+	// Its prerequisites are being walked, reaching it again is a cycle.
+	NODE_IN_PROGRESS,
+	NODE_DONE
+} node_state;
+
+struct node {
+	// Target or file name, owned by the makefile or the caller of graph_add.
+	const char *name;
+	// Rule building the node, NULL for a file without one.
+	rule *rule;
+	node **prereqs;
+	int prereqAmt;
+	// The first ruleAmt prerequisites are the rule's, the rest are headers.
+	int ruleAmt;
+	// Nodes with this node as a prerequisite.
+	node **dependents;
+	int dependentAmt;
+	int dependentCap;
+	node_state state;
+	// The header dependencies recorded for it can't be trusted, because a
+	// header is gone, its target was built by something else, or its command
+	// writes a depfile that was never read. Its command has to run.
+	bool staleDeps;
+	// Cached stat of the name. exists is only valid when statted is set.
+	bool statted;
+	bool exists;
+	struct timespec mtime;
+	// Cached content hash, valid when hashed is set.
+	bool hashed;
+	bool hashOk;
+	uint64_t hash;
+	// Part of the current build, which is the whole graph or what depends on
+	// changed files.
+	bool inBuild;
+	// Prerequisites not yet finished in the current build.
+	int waiting;
+	// Finished in the current build.
+	bool done;
+	// Its command ran in the current build.
+	bool rebuilt;
+	// When it was found out of date, and how long its command ran.
+	struct timespec queued;
+	double runTime;
+	// Longest chain of command run times ending with this node, and the
+	// prerequisite it goes through.
+	double pathTime;
+	node *pathPrev;
+	// Estimated run time of the longest chain of commands from this node to a
+	// goal, which decides the order out of date nodes are started in, and the
+	// order the node became out of date, which breaks ties.
+	double priority;
+	int order;
+};
+
+typedef struct graph {
+	makefile *m;
+	// Header dependencies of earlier builds, NULL if not used.
+	depslog *deps;
+	// All nodes, in the order they were added.
+	node **nodes;
+	int nodeAmt;
+	int nodeCap;
+	// Open addressing hash table of the nodes by name.
+	node **table;
+	size_t tableCap;
+	// Walk stack of graph_add, kept between calls.
+	struct frame *stack;
+	int stackCap;
+} graph;
+
+/**
+ * Creates an empty graph for a makefile.
+ *
+ * @param m			Parsed makefile.
+ * @param deps		Header dependencies to add to the rules, may be NULL.
+ * @return			Pointer to the graph.
+ */
+graph *graph_create(makefile *m, depslog *deps);
+
+/**
+ * Adds a target and everything it depends on to a graph. Every node is walked
+ * once, however many rules depend on it. Prints an error if the target depends
+ * on itself. Files are not stat'ed, call graph_stat_all once every goal is in.
+ *
+ * @param g			Pointer to the graph.
+ * @param target	Name of the target, must outlive the graph.
+ * @return			Node of the target, or NULL if something can't be built.
+ */
+node *graph_add(graph *g, const char *target);
+
+/**
+ * Finds the node of a name.
+ *
+ * @param g			Pointer to the graph.
+ * @param name		Target or file name.
+ * @return			The node, or NULL if the name isn't in the graph.
+ */
+node *graph_find(graph *g, const char *name);
+
+/**
+ * Stats every node of a graph, spread over a number of threads, and checks
+ * that the files without a rule exist. A header from the deps log that doesn't
+ * exist only makes its dependent stale.
+ *
+ * @param g			Pointer to the graph.
+ * @param threads	Threads to stat with at most.
+ * @return			false with an error printed if a file without a rule doesn't exist.
+ */
+bool graph_stat_all(graph *g, int threads);
+
+/**
+ * Gets the modification time of a node, from the cache if it has been stat'ed.
+ *
+ * @param n			The node.
+ * @param mtime		Set to the modification time if the file exists.
+ * @return			true if the file exists.
+ */
+bool graph_mtime(node *n, struct timespec *mtime);
+
+/**
+ * Gets the content hash of a node, from the cache if it has been hashed.
+ *
+ * @param n			The node.
+ * @param hash		Set to the hash if the file can be read.
+ * @return			true if the file can be read.
+ */
+bool graph_hash(node *n, uint64_t *hash);
+
+/**
+ * Hashes every existing file that is a prerequisite of some rule, spread over
+ * a number of threads, so graph_hash finds them cached.
+ *
+ * @param g			Pointer to the graph.
+ * @param threads	Threads to hash with.
+ */
+void graph_hash_all(graph *g, int threads);
+
+/**
+ * Drops the cached stat and hash of a node, after its command has run.
+ *
+ * @param n			The node.
+ */
+void graph_invalidate(node *n);
+
+/**
+ * Replaces the headers of a node with the ones recorded for it in the deps
+ * log, after its depfile was read. Headers not in the graph yet are added as
+ * files at the end of the node list, so a graph that outlives a build, like
+ * in --watch, sees them.
+ *
+ * @param g			Pointer to the graph.
+ * @param n			Node that was just built.
+ */
+void graph_set_deps(graph *g, node *n);
+
+/**
+ * Frees a graph. The makefile is not freed.
+ *
+ * @param g			Pointer to the graph.
+ */
+void graph_del(graph *g);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Run time history of the commands, see history.h.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "history.h"
+#include "parser.h"
+
+struct entry {
+	char *target;
+	double seconds;
+	long peakKb;
+	// The command left the target unchanged, with these modification times.
+	bool unchanged;
+	struct timespec output;
+	struct timespec inputs;
+};
+
+struct history {
+	char *path;
+	// Open addressing hash table of the entries by target.
+	struct entry *table;
+	size_t tableCap;
+	size_t entryAmt;
+	bool changed;
+	// The file is read on first use.
+	bool loaded;
+};
+
+
+// Function declaration.
+static void load(history *h);
+static struct entry *slot(history *h, const char *target);
+
+/*  Function: history_open
+*  Input:
+*			const char *path	:Path of the history file.
+*
+*  Output: The history of the file, empty if there is none. The file isn't read until
+*		   a run time is needed.
+*/
+history *history_open(const char *path) {
+	history *h = calloc(1, sizeof(history));
+	if(h == NULL || (h->path = strdup(path)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	h->tableCap = 64;
+	h->table = calloc(h->tableCap, sizeof(struct entry));
+	if(h->table == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	return h;
+}
+
+/*  Function: history_get
+*  Input:
+*			history *h			:History.
+*			const char *target	:Target to find.
+*			double *seconds		:Set to its run time, unless NULL.
+*			long *peakKb		:Set to its peak memory, unless NULL.
+*
+*  Output: true if the target has a run time.
+*/
+bool history_get(history *h, const char *target, double *seconds, long *peakKb) {
+	load(h);
+	struct entry *e = slot(h, target);
+	if(e->target == NULL) {
+		return false;
+	}
+	if(seconds != NULL) {
+		*seconds = e->seconds;
+	}
+	if(peakKb != NULL) {
+		*peakKb = e->peakKb;
+	}
+	return true;
+}
+
+/*  Function: history_put
+*  Input:
+*			history *h			:History.
+*			const char *target	:Target of the command.
+*			double seconds		:Its run time.
+*			long peakKb			:Its peak memory.
+*
+*  Output: Replaces the run time and peak memory of the target, or adds them.
+*/
+void history_put(history *h, const char *target, double seconds, long peakKb) {
+	load(h);
+	struct entry *e = slot(h, target);
+	h->changed = true;
+	if(e->target != NULL) {
+		e->seconds = seconds;
+		e->peakKb = peakKb;
+		e->unchanged = false;
+		return;
+	}
+
+	// Keep the table at most half full.
+	if((h->entryAmt + 1) * 2 > h->tableCap) {
+		struct entry *old = h->table;
+		size_t oldCap = h->tableCap;
+		h->tableCap *= 2;
+		h->table = calloc(h->tableCap, sizeof(struct entry));
+		if(h->table == NULL) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for(size_t i = 0; i < oldCap; i++) {
+			if(old[i].target != NULL) {
+				*slot(h, old[i].target) = old[i];
+			}
+		}
+		free(old);
+		e = slot(h, target);
+	}
+	if((e->target = strdup(target)) == NULL) {
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	e->seconds = seconds;
+	e->peakKb = peakKb;
+	e->unchanged = false;
+	h->entryAmt++;
+}
+
+/*  Function: history_get_restat
+*  Input:
+*			history *h			:History.
+*			const char *target	:Target to find.
+*			struct timespec *output	:Set to the modification time it kept.
+*			struct timespec *inputs	:Set to the newest one of its prerequisites.
+*
+*  Output: true if the target's command left it unchanged the last time.
+*/
+bool history_get_restat(history *h, const char *target, struct timespec *output,
+						struct timespec *inputs) {
+	load(h);
+	struct entry *e = slot(h, target);
+	if(e->target == NULL || !e->unchanged) {
+		return false;
+	}
+	*output = e->output;
+	*inputs = e->inputs;
+	return true;
+}
+
+/*  Function: history_put_restat
+*  Input:
+*			history *h			:History.
+*			const char *target	:Target with a run time.
+*			struct timespec output	:Modification time it kept.
+*			struct timespec inputs	:Newest one of its prerequisites.
+*
+*  Output: Records the times, if the target has a run time.
+*/
+void history_put_restat(history *h, const char *target, struct timespec output,
+						struct timespec inputs) {
+	load(h);
+	struct entry *e = slot(h, target);
+	if(e->target == NULL) {
+		return;
+	}
+	e->unchanged = true;
+	e->output = output;
+	e->inputs = inputs;
+	h->changed = true;
+}
+
+/*  Function: history_save
+*  Input:
+*			history *h			:History.
+*
+*  Output: 0 if the file was written or nothing had changed, otherwise -1. Writes a
+*		   temporary file next to it and renames it into place.
+*/
+int history_save(history *h) {
+	if(!h->changed) {
+		return 0;
+	}
+	char tmpPath[strlen(h->path) + 32];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%d", h->path, (int)getpid());
+	FILE *fp = fopen(tmpPath, "w");
+	if(fp == NULL) {
+		perror(tmpPath);
+		return -1;
+	}
+	struct timespec none = {0, 0};
+	for(size_t i = 0; i < h->tableCap; i++) {
+		struct entry *e = &h->table[i];
+		if(e->target != NULL) {
+			struct timespec output = e->unchanged ? e->output : none;
+			struct timespec inputs = e->unchanged ? e->inputs : none;
+			fprintf(fp, "%.6f %ld %lld.%09ld %lld.%09ld %s\n", e->seconds, e->peakKb,
+					(long long)output.tv_sec, output.tv_nsec, (long long)inputs.tv_sec,
+					inputs.tv_nsec, e->target);
+		}
+	}
+	if(fclose(fp) == EOF || rename(tmpPath, h->path) == -1) {
+		perror(h->path);
+		unlink(tmpPath);
+		return -1;
+	}
+	h->changed = false;
+	return 0;
+}
+
+/*  Function: history_close
+*  Input:
+*			history *h			:History to free.
+*
+*  Output: Frees the history and its entries.
+*/
+void history_close(history *h) {
+	for(size_t i = 0; i < h->tableCap; i++) {
+		free(h->table[i].target);
+	}
+	free(h->table);
+	free(h->path);
+	free(h);
+}
+
+/*  Function: load
+*  Input:
+*			history *h			:History.
+*
+*  Output: Adds the run times of the file the first time it is called. On a line that
+*		   doesn't parse, the run times read so far are dropped. Lines of older files
+*		   without the modification times are read as targets that changed.
+*/
+static void load(history *h) {
+	if(h->loaded) {
+		return;
+	}
+	h->loaded = true;
+	FILE *fp = fopen(h->path, "r");
+	if(fp == NULL) {
+		return;
+	}
+	char *line = NULL;
+	size_t lineCap = 0;
+	double seconds;
+	long peakKb;
+	long long outputSec;
+	long long inputsSec;
+	struct timespec output;
+	struct timespec inputs;
+	int nameStart = 0;
+	bool corrupt = false;
+
+	while(getline(&line, &lineCap, fp) != -1) {
+		line[strcspn(line, "\n")] = '\0';
+		bool times = sscanf(line, "%lf %ld %lld.%ld %lld.%ld %n", &seconds, &peakKb, &outputSec,
+							&output.tv_nsec, &inputsSec, &inputs.tv_nsec, &nameStart) == 6
+					 && line[nameStart] != '\0';
+		if(times) {
+			output.tv_sec = outputSec;
+			inputs.tv_sec = inputsSec;
+		}
+		else if(sscanf(line, "%lf %ld %n", &seconds, &peakKb, &nameStart) != 2) {
+			corrupt = true;
+			break;
+		}
+		if(!(seconds >= 0) || peakKb < 0 || line[nameStart] == '\0'
+		   || (times && (output.tv_nsec < 0 || output.tv_nsec >= 1000000000
+						 || inputs.tv_nsec < 0 || inputs.tv_nsec >= 1000000000))) {
+			corrupt = true;
+			break;
+		}
+		history_put(h, line + nameStart, seconds, peakKb);
+		if(times && (output.tv_sec != 0 || output.tv_nsec != 0 || inputs.tv_sec != 0
+					 || inputs.tv_nsec != 0)) {
+			history_put_restat(h, line + nameStart, output, inputs);
+		}
+	}
+	free(line);
+	fclose(fp);
+
+	if(corrupt) {
+		fprintf(stderr, "mmake: %s: corrupt, ignored\n", h->path);
+		for(size_t i = 0; i < h->tableCap; i++) {
+			free(h->table[i].target);
+			h->table[i].target = NULL;
+		}
+		h->entryAmt = 0;
+	}
+	// Nothing new to write yet, unless the file has to be replaced.
+	h->changed = corrupt;
+}
+
+/*  Function: slot
+*  Input:
+*			history *h			:History.
+*			const char *target	:Target to find.
+*
+*  Output: The entry of the target in the table, or the free entry where it belongs.
+*/
+static struct entry *slot(history *h, const char *target) {
+	size_t mask = h->tableCap - 1;
+	size_t i = hash_bytes(target, strlen(target)) & mask;
+	while(h->table[i].target != NULL && strcmp(h->table[i].target, target) != 0) {
+		i = (i + 1) & mask;
+	}
+	return &h->table[i];
+}
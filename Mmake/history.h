@@ -0,0 +1,101 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Run time history of the commands, kept in .mmake_log between
+*				 runs. It holds how long the command of each target took the last
+*				 time it ran, which the parallel build uses to start the targets
+*				 on the longest remaining chain first, and the most memory it used,
+*				 which --mem-reserve goes by. When the command of a restat rule
+*				 left its target unchanged, it also holds the modification time
+*				 the target kept and the newest one of its prerequisites, as the
+*				 target is up to date with those although it is older.
+*
+*				 The file is text, one line per target:
+*					<seconds> <peak RSS in KiB> <target mtime> <prerequisite mtime> <target>
+*				 with the modification times as seconds.nanoseconds, 0.000000000
+*				 if the target changed. Lines without them are read as well.
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#define HISTORY_FILE ".mmake_log"
+
+typedef struct history history;
+
+/**
+ * Loads a history. A missing file gives an empty history, a corrupt one is
+ * ignored with a warning.
+ *
+ * @param path		Path of the history file.
+ * @return			Pointer to the history.
+ */
+history *history_open(const char *path);
+
+/**
+ * Gets the last run time and peak memory of a target's command.
+ *
+ * @param h			Pointer to the history.
+ * @param target	Name of the target.
+ * @param seconds	Set to the run time if there is one, may be NULL.
+ * @param peakKb	Set to the peak resident memory in KiB if there is one, may be NULL.
+ * @return			true if the target has a run time.
+ */
+bool history_get(history *h, const char *target, double *seconds, long *peakKb);
+
+/**
+ * Sets the run time and peak memory of a target's command, replacing any
+ * earlier ones. Drops what history_put_restat recorded.
+ *
+ * @param h			Pointer to the history.
+ * @param target	Name of the target.
+ * @param seconds	Run time of the command.
+ * @param peakKb	Peak resident memory of the command in KiB.
+ */
+void history_put(history *h, const char *target, double seconds, long peakKb);
+
+/**
+ * Gets the modification times recorded for a target whose command left it
+ * unchanged the last time it ran.
+ *
+ * @param h			Pointer to the history.
+ * @param target	Name of the target.
+ * @param output	Set to the modification time the target kept.
+ * @param inputs	Set to the newest modification time of its prerequisites then.
+ * @return			true if the times are recorded.
+ */
+bool history_get_restat(history *h, const char *target, struct timespec *output,
+						struct timespec *inputs);
+
+/**
+ * Records that a target's command left it unchanged, after history_put has set
+ * the run time of the command.
+ *
+ * @param h			Pointer to the history.
+ * @param target	Name of the target, which has a run time.
+ * @param output	Modification time the target kept.
+ * @param inputs	Newest modification time of its prerequisites.
+ */
+void history_put_restat(history *h, const char *target, struct timespec output,
+						struct timespec inputs);
+
+/**
+ * Writes a history back to its file if it has changed. The file is replaced
+ * atomically.
+ *
+ * @param h			Pointer to the history.
+ * @return			0 on success, -1 with an error printed otherwise.
+ */
+int history_save(history *h);
+
+/**
+ * Frees a history without saving it.
+ *
+ * @param h			Pointer to the history.
+ */
+void history_close(history *h);
+
+#endif
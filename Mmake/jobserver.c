@@ -0,0 +1,276 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: GNU make's jobserver, see jobserver.h.
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "jobserver.h"
+
+struct jobserver {
+	// Descriptors of this make's own, reading without blocking.
+	int readFd;
+	int writeFd;
+	// Value of --jobserver-auth for the commands.
+	char *auth;
+	// FIFO this make created, NULL if it didn't create one.
+	char *fifoPath;
+};
+
+
+// Function declaration.
+static int reopen(int fd);
+static bool isPipe(int fd);
+static jobserver *newJobserver(int readFd, int writeFd, const char *auth);
+
+/*  Function: jobserver_create
+*  Input:
+*			int jobs			:Commands to run at once.
+*			bool fifo			:Use a named FIFO.
+*
+*  Output: A pool of jobs - 1 tokens, the last job slot being the one every make has
+*		   without a token. A pipe is created without close-on-exec so the commands
+*		   inherit it. A FIFO is created in $TMPDIR and opened by path by the makes
+*		   that join.
+*/
+jobserver *jobserver_create(int jobs, bool fifo) {
+	jobserver *js;
+	char auth[4096];
+	if(fifo) {
+		const char *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+		for(unsigned i = 0; ; i++) {
+			snprintf(auth, sizeof(auth), "fifo:%s/mmake-fifo-%d-%u", tmp, (int)getpid(), i);
+			if(mkfifo(auth + 5, 0600) == 0) {
+				break;
+			}
+			if(errno != EEXIST) {
+				perror(auth + 5);
+				return NULL;
+			}
+		}
+		int fd = open(auth + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if(fd == -1) {
+			perror(auth + 5);
+			unlink(auth + 5);
+			return NULL;
+		}
+		js = newJobserver(fd, fd, auth);
+		if((js->fifoPath = strdup(auth + 5)) == NULL) {
+			perror("strdup");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else {
+		int fds[2];
+		int readFd;
+		if(pipe(fds) == -1) {
+			perror("pipe");
+			return NULL;
+		}
+		if((readFd = reopen(fds[0])) == -1) {
+			perror("jobserver");
+			close(fds[0]);
+			close(fds[1]);
+			return NULL;
+		}
+		snprintf(auth, sizeof(auth), "%d,%d", fds[0], fds[1]);
+		js = newJobserver(readFd, fds[1], auth);
+	}
+	for(int i = 1; i < jobs; i++) {
+		jobserver_release(js, '+');
+	}
+	return js;
+}
+
+/*  Function: jobserver_join
+*  Input:
+*			const char *makeflags	:Value of MAKEFLAGS, or NULL.
+*			int *jobs			:Set to the -j of MAKEFLAGS.
+*
+*  Output: The pool of the last --jobserver-auth, or the older --jobserver-fds, in
+*		   MAKEFLAGS. If the descriptors weren't passed on or the FIFO can't be
+*		   opened, a warning is printed and NULL returned.
+*/
+jobserver *jobserver_join(const char *makeflags, int *jobs) {
+	const char *auth = NULL;
+	int authLen = 0;
+	int poolJobs = 0;
+	for(const char *p = makeflags; p != NULL && *p != '\0'; ) {
+		int len = strcspn(p, " \t");
+		if(strncmp(p, "--jobserver-auth=", 17) == 0 || strncmp(p, "--jobserver-fds=", 16) == 0) {
+			auth = strchr(p, '=') + 1;
+			authLen = len - (auth - p);
+		}
+		else if(strncmp(p, "-j", 2) == 0 && len > 2) {
+			poolJobs = atoi(p + 2);
+		}
+		p += len;
+		p += strspn(p, " \t");
+	}
+	if(auth == NULL) {
+		return NULL;
+	}
+
+	char value[authLen + 1];
+	memcpy(value, auth, authLen);
+	value[authLen] = '\0';
+	jobserver *js = NULL;
+	int readFd;
+	int writeFd;
+	int end = 0;
+	if(strncmp(value, "fifo:", 5) == 0) {
+		if((readFd = open(value + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC)) != -1) {
+			js = newJobserver(readFd, readFd, value);
+		}
+	}
+	else if(sscanf(value, "%d,%d%n", &readFd, &writeFd, &end) == 2 && value[end] == '\0'
+			&& isPipe(readFd) && isPipe(writeFd)) {
+		int fd = reopen(readFd);
+		if(fd != -1) {
+			js = newJobserver(fd, writeFd, value);
+		}
+	}
+	if(js == NULL) {
+		fprintf(stderr, "mmake: warning: jobserver %s unavailable, using -j1\n", value);
+		return NULL;
+	}
+	if(poolJobs > 0) {
+		*jobs = poolJobs;
+	}
+	return js;
+}
+
+/*  Function: jobserver_export
+*  Input:
+*			jobserver *js		:Jobserver, or NULL.
+*			int jobs			:Commands to run at once.
+*			const char *letters	:Single letter flags.
+*
+*  Output: Sets MAKEFLAGS the way GNU make writes it, the letters first and then
+*		   -j and --jobserver-auth. Without any of them MAKEFLAGS is removed.
+*/
+void jobserver_export(jobserver *js, int jobs, const char *letters) {
+	char flags[4096 + 64];
+	int len = snprintf(flags, sizeof(flags), "%s", letters);
+	if(js != NULL) {
+		snprintf(flags + len, sizeof(flags) - len, "%s-j%d --jobserver-auth=%s", len > 0 ? " " : "",
+				 jobs, js->auth);
+	}
+	if(flags[0] == '\0') {
+		unsetenv("MAKEFLAGS");
+	}
+	else if(setenv("MAKEFLAGS", flags, 1) == -1) {
+		perror("setenv");
+	}
+}
+
+/*  Function: jobserver_fd
+*  Input:
+*			jobserver *js		:Jobserver.
+*
+*  Output: The descriptor tokens are read from.
+*/
+int jobserver_fd(jobserver *js) {
+	return js->readFd;
+}
+
+/*  Function: jobserver_acquire
+*  Input:
+*			jobserver *js		:Jobserver.
+*			char *token			:Set to the token.
+*
+*  Output: true if a token was read. The descriptor doesn't block, so another make
+*		   taking the token first just means trying again later.
+*/
+bool jobserver_acquire(jobserver *js, char *token) {
+	ssize_t n = read(js->readFd, token, 1);
+	if(n == -1 && errno != EAGAIN && errno != EINTR) {
+		perror("jobserver");
+	}
+	return n == 1;
+}
+
+/*  Function: jobserver_release
+*  Input:
+*			jobserver *js		:Jobserver.
+*			char token			:Token to give back.
+*
+*  Output: Writes the token back to the pool.
+*/
+void jobserver_release(jobserver *js, char token) {
+	ssize_t n;
+	do {
+		n = write(js->writeFd, &token, 1);
+	} while(n == -1 && errno == EINTR);
+	if(n != 1) {
+		perror("jobserver");
+	}
+}
+
+/*  Function: jobserver_close
+*  Input:
+*			jobserver *js		:Jobserver to free.
+*
+*  Output: Closes the descriptors of this make's own and removes a FIFO it created.
+*		   Inherited descriptors stay open.
+*/
+void jobserver_close(jobserver *js) {
+	close(js->readFd);
+	if(js->fifoPath != NULL) {
+		unlink(js->fifoPath);
+		free(js->fifoPath);
+	}
+	free(js->auth);
+	free(js);
+}
+
+/*  Function: reopen
+*  Input:
+*			int fd				:Read end of a pipe.
+*
+*  Output: A new open file description of the pipe, which can be made non-blocking
+*		   without changing the descriptor the other makes share, or -1.
+*/
+static int reopen(int fd) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+/*  Function: isPipe
+*  Input:
+*			int fd				:File descriptor.
+*
+*  Output: true if the descriptor is open and a pipe or FIFO.
+*/
+static bool isPipe(int fd) {
+	struct stat info;
+	return fd >= 0 && fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+/*  Function: newJobserver
+*  Input:
+*			int readFd			:Non-blocking descriptor to read tokens from.
+*			int writeFd			:Descriptor to write tokens to.
+*			const char *auth	:Value of --jobserver-auth.
+*
+*  Output: The jobserver.
+*/
+static jobserver *newJobserver(int readFd, int writeFd, const char *auth) {
+	jobserver *js = calloc(1, sizeof(jobserver));
+	if(js == NULL || (js->auth = strdup(auth)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	js->readFd = readFd;
+	js->writeFd = writeFd;
+	return js;
+}
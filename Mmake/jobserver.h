@@ -0,0 +1,83 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: GNU make's jobserver, a pool of job tokens shared by every make
+*				 of a recursive build so that together they run no more commands
+*				 than the top one was given with -j. A token is one byte in a pipe
+*				 or named FIFO. Every make may run one command without a token, and
+*				 reads a token for each command beyond that and writes it back when
+*				 the command is done.
+*
+*				 The top make creates the pool with -j minus one tokens and tells
+*				 its children about it in MAKEFLAGS, as --jobserver-auth=R,W with
+*				 the file descriptors of an inherited pipe or as
+*				 --jobserver-auth=fifo:PATH. Both are understood when joining.
+*/
+
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+#include <stdbool.h>
+
+typedef struct jobserver jobserver;
+
+/**
+ * Creates a token pool for a top-level build.
+ *
+ * @param jobs		Commands to run at once in the whole build, more than one.
+ * @param fifo		Use a named FIFO instead of a pipe.
+ * @return			Pointer to the jobserver, or NULL with an error printed.
+ */
+jobserver *jobserver_create(int jobs, bool fifo);
+
+/**
+ * Joins the token pool named in MAKEFLAGS, if there is one.
+ *
+ * @param makeflags	Value of MAKEFLAGS, or NULL.
+ * @param jobs		Set to the -j of the pool, if MAKEFLAGS has one.
+ * @return			Pointer to the jobserver, or NULL if there is no usable pool.
+ */
+jobserver *jobserver_join(const char *makeflags, int *jobs);
+
+/**
+ * Sets MAKEFLAGS for the commands, so makes they run share the pool.
+ *
+ * @param js		Pointer to the jobserver, or NULL if there is none.
+ * @param jobs		Commands to run at once.
+ * @param letters	Single letter flags to pass on, like "s", may be empty.
+ */
+void jobserver_export(jobserver *js, int jobs, const char *letters);
+
+/**
+ * Gets the file descriptor to poll for POLLIN while waiting for a token.
+ *
+ * @param js		Pointer to the jobserver.
+ * @return			The file descriptor.
+ */
+int jobserver_fd(jobserver *js);
+
+/**
+ * Takes a token from the pool without blocking.
+ *
+ * @param js		Pointer to the jobserver.
+ * @param token		Set to the token, which has to be given back.
+ * @return			true if a token was taken.
+ */
+bool jobserver_acquire(jobserver *js, char *token);
+
+/**
+ * Gives a token back to the pool.
+ *
+ * @param js		Pointer to the jobserver.
+ * @param token		Token from jobserver_acquire.
+ */
+void jobserver_release(jobserver *js, char token);
+
+/**
+ * Leaves the pool. The FIFO of a pool this make created is removed.
+ *
+ * @param js		Pointer to the jobserver.
+ */
+void jobserver_close(jobserver *js);
+
+#endif
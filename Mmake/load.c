@@ -0,0 +1,232 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Admission control of -l and --mem-reserve, see load.h.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "load.h"
+
+// How long a sample is used before the files are read again.
+#define SAMPLE_NS 10000000
+// Share of the last ten seconds some task stalled on memory at which no more jobs start.
+#define STALL_LIMIT 10.0
+
+struct running {
+	pid_t pid;
+	long peakKb;
+};
+
+struct load {
+	double maxLoad;
+	long long reserveKb;
+	// -1 if not needed or not available.
+	int loadFd;
+	int memFd;
+	int psiFd;
+	struct timespec sampled;
+	bool haveSample;
+	// Runnable tasks besides mmake, available memory and memory stall percentage.
+	int runnable;
+	long long availKb;
+	double stall;
+	// Jobs started after the sample.
+	int startedSince;
+	struct running *jobs;
+	int jobAmt;
+	int jobCap;
+};
+
+
+// Function declaration.
+static void sample(load *l);
+static bool readFile(int fd, char *buf, size_t size);
+static long long growth(load *l);
+
+/*  Function: load_open
+*  Input:
+*			double maxLoad		:Load limit, 0 for none.
+*			long long reserveKb	:Memory to leave available, 0 for none.
+*
+*  Output: The sampler, with the files it needs opened. A file that can't be opened,
+*		   like /proc/pressure without PSI, is left out of the checks.
+*/
+load *load_open(double maxLoad, long long reserveKb) {
+	load *l = calloc(1, sizeof(load));
+	if(l == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	l->maxLoad = maxLoad;
+	l->reserveKb = reserveKb;
+	l->loadFd = maxLoad > 0 ? open("/proc/loadavg", O_RDONLY | O_CLOEXEC) : -1;
+	l->memFd = reserveKb > 0 ? open("/proc/meminfo", O_RDONLY | O_CLOEXEC) : -1;
+	l->psiFd = reserveKb > 0 ? open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC) : -1;
+	if((maxLoad > 0 && l->loadFd == -1) || (reserveKb > 0 && l->memFd == -1)) {
+		perror("mmake: /proc");
+	}
+	return l;
+}
+
+/*  Function: load_admit
+*  Input:
+*			load *l				:Sampler.
+*			long peakKb			:Expected peak memory of the new job.
+*
+*  Output: true if the runnable tasks, counting the jobs started since the sample, are
+*		   below the load limit, and the available memory less the new job's peak and
+*		   the growth left in the running jobs stays above the reserve without memory
+*		   stalls.
+*/
+bool load_admit(load *l, long peakKb) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(!l->haveSample || (now.tv_sec - l->sampled.tv_sec) * 1000000000LL
+						 + now.tv_nsec - l->sampled.tv_nsec >= SAMPLE_NS) {
+		sample(l);
+		l->sampled = now;
+		l->haveSample = true;
+	}
+	if(l->loadFd != -1 && l->runnable + l->startedSince >= l->maxLoad) {
+		return false;
+	}
+	if(l->memFd != -1 && (l->availKb - peakKb - growth(l) < l->reserveKb || l->stall >= STALL_LIMIT)) {
+		return false;
+	}
+	return true;
+}
+
+/*  Function: load_started
+*  Input:
+*			load *l				:Sampler.
+*			pid_t pid			:Process of the job.
+*			long peakKb			:Expected peak memory of the job.
+*
+*  Output: Adds the job to the running jobs and to the jobs the sample doesn't show.
+*/
+void load_started(load *l, pid_t pid, long peakKb) {
+	if(l->jobAmt == l->jobCap) {
+		l->jobCap = l->jobCap == 0 ? 16 : l->jobCap * 2;
+		if((l->jobs = realloc(l->jobs, l->jobCap * sizeof(struct running))) == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	l->jobs[l->jobAmt++] = (struct running){pid, peakKb};
+	l->startedSince++;
+}
+
+/*  Function: load_finished
+*  Input:
+*			load *l				:Sampler.
+*			pid_t pid			:Process of the job.
+*
+*  Output: Removes the job from the running jobs.
+*/
+void load_finished(load *l, pid_t pid) {
+	for(int i = 0; i < l->jobAmt; i++) {
+		if(l->jobs[i].pid == pid) {
+			l->jobs[i] = l->jobs[--l->jobAmt];
+			return;
+		}
+	}
+}
+
+/*  Function: load_close
+*  Input:
+*			load *l				:Sampler to free.
+*
+*  Output: Closes the files and frees the sampler.
+*/
+void load_close(load *l) {
+	if(l->loadFd != -1) {
+		close(l->loadFd);
+	}
+	if(l->memFd != -1) {
+		close(l->memFd);
+	}
+	if(l->psiFd != -1) {
+		close(l->psiFd);
+	}
+	free(l->jobs);
+	free(l);
+}
+
+/*  Function: sample
+*  Input:
+*			load *l				:Sampler.
+*
+*  Output: Reads the runnable tasks, MemAvailable and the memory stall percentage of
+*		   the last ten seconds from the open files.
+*/
+static void sample(load *l) {
+	char buf[4096];
+	char *p;
+	l->startedSince = 0;
+	// "0.13 0.22 0.29 1/72 11913", the runnable tasks include mmake itself.
+	if(l->loadFd != -1 && readFile(l->loadFd, buf, sizeof(buf))
+	   && sscanf(buf, "%*f %*f %*f %d", &l->runnable) == 1) {
+		l->runnable--;
+	}
+	if(l->memFd != -1 && readFile(l->memFd, buf, sizeof(buf))
+	   && (p = strstr(buf, "MemAvailable:")) != NULL) {
+		l->availKb = strtoll(p + 13, NULL, 10);
+	}
+	// "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+	if(l->psiFd != -1 && readFile(l->psiFd, buf, sizeof(buf)) && strncmp(buf, "some avg10=", 11) == 0) {
+		l->stall = strtod(buf + 11, NULL);
+	}
+}
+
+/*  Function: readFile
+*  Input:
+*			int fd				:Open file of /proc.
+*			char *buf			:Buffer.
+*			size_t size			:Size of the buffer.
+*
+*  Output: true if the start of the file was read into the buffer, NUL terminated.
+*/
+static bool readFile(int fd, char *buf, size_t size) {
+	ssize_t n = pread(fd, buf, size - 1, 0);
+	if(n <= 0) {
+		return false;
+	}
+	buf[n] = '\0';
+	return true;
+}
+
+/*  Function: growth
+*  Input:
+*			load *l				:Sampler.
+*
+*  Output: KiB the running jobs are expected to use beyond their current resident
+*		   memory, from /proc/PID/statm. A job whose memory is in a process of its
+*		   own, like a compiler driver's, is expected to grow by all of its peak.
+*/
+static long long growth(load *l) {
+	long long total = 0;
+	long pageKb = sysconf(_SC_PAGESIZE) / 1024;
+	for(int i = 0; i < l->jobAmt; i++) {
+		char path[64];
+		char buf[128];
+		long pages = 0;
+		snprintf(path, sizeof(path), "/proc/%d/statm", (int)l->jobs[i].pid);
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd != -1) {
+			if(readFile(fd, buf, sizeof(buf))) {
+				sscanf(buf, "%*s %ld", &pages);
+			}
+			close(fd);
+		}
+		if(l->jobs[i].peakKb > pages * pageKb) {
+			total += l->jobs[i].peakKb - pages * pageKb;
+		}
+	}
+	return total;
+}
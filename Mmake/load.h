@@ -0,0 +1,67 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Admission control of -l and --mem-reserve. Before a job beyond
+*				 the first is started, the load and free memory of the machine are
+*				 checked. The runnable task count of /proc/loadavg is used as load,
+*				 since the averages lag by a minute, and MemAvailable of
+*				 /proc/meminfo and the stall time of /proc/pressure/memory are used
+*				 for memory. The files are kept open and read at most once per
+*				 sample period, jobs started since the last sample are added to it.
+*
+*				 A running job is expected to still grow by the difference between
+*				 its peak memory in earlier builds and what it uses now, and that
+*				 is kept in reserve as well.
+*/
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+typedef struct load load;
+
+/**
+ * Opens the files to sample.
+ *
+ * @param maxLoad		Load at which no more jobs start, 0 for no limit.
+ * @param reserveKb		Memory in KiB to leave available, 0 for no limit.
+ * @return				Pointer to the load sampler.
+ */
+load *load_open(double maxLoad, long long reserveKb);
+
+/**
+ * Checks if one more job may start.
+ *
+ * @param l				Pointer to the load sampler.
+ * @param peakKb		Peak memory in KiB of the job in earlier builds, 0 if unknown.
+ * @return				true if the load is below the limit and enough memory is left.
+ */
+bool load_admit(load *l, long peakKb);
+
+/**
+ * Counts a started job.
+ *
+ * @param l				Pointer to the load sampler.
+ * @param pid			Process of the job.
+ * @param peakKb		Peak memory in KiB of the job in earlier builds, 0 if unknown.
+ */
+void load_started(load *l, pid_t pid, long peakKb);
+
+/**
+ * Forgets a job that has finished.
+ *
+ * @param l				Pointer to the load sampler.
+ * @param pid			Process of the job.
+ */
+void load_finished(load *l, pid_t pid);
+
+/**
+ * Closes the files and frees the sampler.
+ *
+ * @param l				Pointer to the load sampler.
+ */
+void load_close(load *l);
+
+#endif
@@ -7,8 +7,56 @@
 *				 -f flag: Use other makefile than "mmakefile".
 *				 -B flag: Force rebuild.
 *				 -s flag: Mute output.
+*				 -j flag: Run up to the given amount of commands at once. Their output is
+*						  buffered and printed when each command is done.
+*				 --hash flag: Decide rebuilds by the content of the prerequisites and the
+*						  command, recorded in ".mmake_db" by earlier runs. Targets without
+*						  a record fall back to comparing modification times.
+*				 --cache flag: Restore targets from the given artifact cache directory when
+*						  their command and prerequisite contents match an earlier build,
+*						  and store every target built. --cache-size limits the directory
+*						  (default 1G).
+*				 --trace flag: Write a Chrome trace_event JSON file of the build, for
+*						  Perfetto, and print the critical path and mmake's own overhead.
+*				 --fifo flag: Start out of date targets in the order they are found, instead
+*						  of the longest chain of commands first.
+*				 --watch flag: After building, keep watching the files without rules and
+*						  rebuild what depends on the ones that change. A change to the
+*						  makefile restarts mmake.
+*				 --jobserver-style flag: "pipe" (default) or "fifo", how a -j build shares
+*						  its job tokens with makes run by its commands.
+*				 -l flag: Don't start more jobs while the given amount of tasks or more
+*						  are runnable on the machine, besides the first job.
+*				 --mem-reserve flag: Don't start more jobs while less memory than the
+*						  given size, like 2G, would be available after them. A job is
+*						  expected to use as much memory as its command did last time.
 *				 Targets: mmake can take targets as input, and will build the input targets.
 *
+*				 A rule's command is every line starting with a tab after it, run one
+*				 line at a time until one fails. A line is split into words and run
+*				 directly with posix_spawn, unless it has characters the shell treats
+*				 specially or starts with a shell builtin, then /bin/sh -c runs it.
+*
+*				 The parsed form of makefiles with many rules is saved in ".mmake_image",
+*				 which later runs map instead of parsing as long as the makefile is unchanged.
+*				 How long each command ran and its peak memory is kept in ".mmake_log",
+*				 for ordering the commands of -j builds and for --mem-reserve.
+*
+*				 Commands with -MD or -MMD write depfiles listing the headers they read.
+*				 The headers are recorded in ".mmake_deps" when the command is done, and
+*				 later runs rebuild the target when one of them changes.
+*
+*				 A comment "# mmake: weight=N" before a rule makes its command take N
+*				 of the -j job slots, for commands that are themselves parallel.
+*				 "# mmake: restat" marks a command that may leave its target as it
+*				 was. When the target comes out with the same content, it keeps its
+*				 old modification time and the targets depending on it alone are not
+*				 rebuilt. ".mmake_log" remembers that it is up to date.
+*
+*				 mmake takes part in GNU make's jobserver. With -j above one it creates
+*				 the token pool, and commands get it in MAKEFLAGS. Without -j it joins a
+*				 pool named in MAKEFLAGS, and the s and B flags there apply as well.
+*
 */
 
 #include <sys/types.h>
@@ -18,17 +66,51 @@
 #include <getopt.h>
 #include <unistd.h>
 #include "parser.h"
+#include "graph.h"
+#include "build.h"
+#include "db.h"
+#include "cache.h"
+#include "trace.h"
+#include "history.h"
+#include "watch.h"
+#include "jobserver.h"
+#include "load.h"
+#include "depslog.h"
 #include <sys/wait.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <stdbool.h>
 
+// Binary image of the parsed makefile, kept between runs.
+#define IMAGE_FILE ".mmake_image"
+// Threads to stat the files with. Stat mostly waits on a cold cache, so more
+// threads than cores keep the disk or the file server busy.
+#define STAT_THREADS 16
 
 typedef struct {
 	// Values for flags
 	bool Bflag;
 	bool sflag;
+	// Commands to run at once, 0 if -j wasn't given.
+	int jobs;
+	// Share job tokens through a named FIFO instead of a pipe.
+	bool jobserverFifo;
+	// Use the build database.
+	bool hash;
+	// Artifact cache directory, NULL if not caching.
+	const char *cacheDir;
+	long long cacheSize;
+	// Trace file, NULL if not tracing.
+	const char *tracePath;
+	// Ignore the priorities of the targets.
+	bool fifo;
+	// Rebuild when files change.
+	bool watch;
+	// Load limit of -l and memory to leave of --mem-reserve in bytes, 0 for none.
+	double maxLoad;
+	long long memReserve;
+	const char *makefilePath;
 	// Index of targets.
 	int targetIndex;
 
@@ -37,20 +119,21 @@ typedef struct {
 
 // Function declaration.
 char** getArgs(FILE **file, int argc, char **argv, optVariable *varp);
-void recurseBuild(makefile *m, const char *target, optVariable var);
-void build(rule *target_rule, optVariable var);
+void readMakeflags(const char *makeflags, optVariable *varp);
+long long parseSize(const char *s);
 
 int main(int argc, char **argv) {
 
 	FILE *fp = NULL;
 	// Defualt option values.
-	optVariable var = {false, false, 0};
+	optVariable var = {false, false, 0, false, false, NULL, 1LL << 30, NULL, false, false, 0, 0, "mmakefile", 0};
 	optVariable *varp = &var;
 
 	char **targetList = NULL;
 
 	// Get list of targets and update flag status.
 	targetList = getArgs(&fp, argc, argv, varp);
+	readMakeflags(getenv("MAKEFLAGS"), varp);
 
 	// If no flag or argument were input, default value to open is "mmakefile".
 	if(fp == NULL) {
@@ -61,8 +144,17 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	// Parse makefile.
-	makefile *m = parse_makefile(fp);
+	trace *t = NULL;
+	if(var.tracePath != NULL && (t = trace_open(var.tracePath)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	// Parse makefile, or map the image of it saved by an earlier run.
+	struct timespec start = trace_now();
+	makefile *m = parse_makefile_image(fp, IMAGE_FILE);
+	if(t != NULL) {
+		trace_phase(t, "parse", start, trace_now());
+	}
 	if (m == NULL) {
 		fprintf(stderr, "mmakefile: Could not parse makefile\n");
 		exit(EXIT_FAILURE);
@@ -74,25 +166,119 @@ int main(int argc, char **argv) {
 	// Get makefiles default target.
 	const char *defTarget = makefile_default_target(m);
 
-	// If there wasn't any individual targets, we want to build using a makefile.
-	if(targetList == NULL){
-		recurseBuild(m, defTarget, var);
+	// Add the goals and everything they depend on to the dependency graph. If there wasn't
+	// any individual targets, the goal is the makefile's default target.
+	start = trace_now();
+	depslog *deps = depslog_open(DEPS_FILE);
+	graph *g = graph_create(m, deps);
+	int goalAmt = targetList == NULL ? 1 : argc - var.targetIndex;
+	for(int i = 0; i < goalAmt; ++i) {
+		const char *target = targetList == NULL ? defTarget : targetList[i];
+		if(makefile_rule(m, target) == NULL) {
+			printf("%s: Rule not found\n", target);
+			continue;
+		}
+		if(graph_add(g, target) == NULL) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(t != NULL) {
+		trace_phase(t, "graph", start, trace_now());
 	}
-	// Else, build using the targets.
-	else {
-		for(int i = 0; i < (argc-var.targetIndex); ++i) {
-			rule *rule = makefile_rule(m, targetList[i]);
-			if (rule == NULL) {
-				printf("%s: Rule not found\n", targetList[i]);
-				continue;
-			}
-			build(rule, var);
+	start = trace_now();
+	if(!graph_stat_all(g, STAT_THREADS)) {
+		exit(EXIT_FAILURE);
+	}
+	if(t != NULL) {
+		trace_phase(t, "stat", start, trace_now());
+	}
+
+	// With -j this make runs the token pool, otherwise it joins the one of the make
+	// running it, if any. Commands learn about the pool from MAKEFLAGS.
+	jobserver *js = NULL;
+	if(var.jobs == 0) {
+		var.jobs = 1;
+		js = jobserver_join(getenv("MAKEFLAGS"), &var.jobs);
+	}
+	else if(var.jobs > 1) {
+		js = jobserver_create(var.jobs, var.jobserverFifo);
+	}
+	char letters[3] = "";
+	strcat(letters, var.sflag ? "s" : "");
+	strcat(letters, var.Bflag ? "B" : "");
+	jobserver_export(js, var.jobs, letters);
+
+	build_options opts = {var.jobs, var.Bflag, var.sflag, NULL, NULL, t, history_open(HISTORY_FILE),
+						  var.fifo, js, NULL, deps};
+	if(var.maxLoad > 0 || var.memReserve > 0) {
+		opts.load = load_open(var.maxLoad, var.memReserve >> 10);
+	}
+	if(var.hash) {
+		opts.db = db_open(DB_FILE);
+	}
+	// Without a usable cache directory everything still builds, just uncached.
+	if(var.cacheDir != NULL) {
+		opts.cache = cache_open(var.cacheDir, var.cacheSize);
+	}
+	if(opts.db != NULL || opts.cache != NULL) {
+		start = trace_now();
+		graph_hash_all(g, (int) sysconf(_SC_NPROCESSORS_ONLN));
+		if(t != NULL) {
+			trace_phase(t, "hashing", start, trace_now());
+		}
+	}
+	int status = build_run(g, opts);
+	// Keep the graph and rebuild from it until the makefile changes.
+	bool restart = false;
+	if(var.watch) {
+		restart = watch_run(g, opts, var.makefilePath) == 0;
+		status = restart ? 0 : EXIT_FAILURE;
+	}
+	if(opts.db != NULL) {
+		if(db_save(opts.db) == -1) {
+			status = EXIT_FAILURE;
+		}
+		db_close(opts.db);
+	}
+	if(history_save(opts.history) == -1) {
+		status = EXIT_FAILURE;
+	}
+	history_close(opts.history);
+	if(js != NULL) {
+		jobserver_close(js);
+	}
+	if(opts.load != NULL) {
+		load_close(opts.load);
+	}
+	if(opts.cache != NULL) {
+		if(var.sflag != true) {
+			fflush(stdout);
+			cache_print_stats(opts.cache, stderr);
+		}
+		cache_close(opts.cache);
+	}
+	if(t != NULL) {
+		trace_print_overhead(t, stderr);
+		if(trace_close(t) == -1) {
+			status = EXIT_FAILURE;
 		}
 	}
+
 	// Free memory.
+	graph_del(g);
+	if(depslog_close(deps) == -1) {
+		status = EXIT_FAILURE;
+	}
 	makefile_del(m);
 	free(targetList);
-	return 0;
+	if(restart) {
+		fprintf(stderr, "mmake: %s changed, restarting\n", var.makefilePath);
+		execv("/proc/self/exe", argv);
+		perror(argv[0]);
+		return EXIT_FAILURE;
+	}
+	return status;
 }
 
 /*  Function: getArgs
@@ -109,13 +295,26 @@ char** getArgs(FILE **file, int argc, char **argv, optVariable *varp) {
 	char **targetList = NULL;
 	int option;
 	// Get options and accompanying arguments.
-	while((option = getopt(argc, argv, "f:Bs")) != -1) {
+	char *endp;
+	static struct option longOptions[] = {
+		{"hash", no_argument, NULL, 'H'},
+		{"cache", required_argument, NULL, 'C'},
+		{"cache-size", required_argument, NULL, 'S'},
+		{"trace", required_argument, NULL, 'T'},
+		{"fifo", no_argument, NULL, 'F'},
+		{"watch", no_argument, NULL, 'W'},
+		{"jobserver-style", required_argument, NULL, 'J'},
+		{"mem-reserve", required_argument, NULL, 'M'},
+		{NULL, 0, NULL, 0}
+	};
+	while((option = getopt_long(argc, argv, "f:Bsj:l:", longOptions, NULL)) != -1) {
 		switch (option) {
 			// F flag is used to use other targets instead of makefile.
 			case 'f':
 			// optarg to get arguments.
+			varp->makefilePath = optarg;
 			*file = fopen(optarg, "r");
-			if(file == NULL) {
+			if(*file == NULL) {
 				perror(optarg);
 				exit(EXIT_FAILURE);
 			}
@@ -128,6 +327,64 @@ char** getArgs(FILE **file, int argc, char **argv, optVariable *varp) {
 			case 's':
 			varp->sflag = true;
 			break;
+			// j flag: Amount of commands to run at once.
+			case 'j':
+			varp->jobs = (int) strtol(optarg, &endp, 10);
+			if(*endp != '\0' || varp->jobs < 1) {
+				fprintf(stderr, "%s: -j needs a positive number\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+			// l flag: Load at which no more jobs start.
+			case 'l':
+			varp->maxLoad = strtod(optarg, &endp);
+			if(*endp != '\0' || varp->maxLoad <= 0) {
+				fprintf(stderr, "%s: -l needs a positive number\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+			// hash flag: Use the build database.
+			case 'H':
+			varp->hash = true;
+			break;
+			// cache flag: Artifact cache directory.
+			case 'C':
+			varp->cacheDir = optarg;
+			break;
+			// trace flag: Trace file.
+			case 'T':
+			varp->tracePath = optarg;
+			break;
+			// fifo flag: Ignore priorities.
+			case 'F':
+			varp->fifo = true;
+			break;
+			// watch flag: Rebuild when files change.
+			case 'W':
+			varp->watch = true;
+			break;
+			// jobserver-style flag: How to share job tokens.
+			case 'J':
+			if(strcmp(optarg, "fifo") != 0 && strcmp(optarg, "pipe") != 0) {
+				fprintf(stderr, "%s: --jobserver-style needs fifo or pipe\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			varp->jobserverFifo = strcmp(optarg, "fifo") == 0;
+			break;
+			// cache-size flag: Size limit of the cache, with an optional K, M or G suffix.
+			case 'S':
+			if((varp->cacheSize = parseSize(optarg)) <= 0) {
+				fprintf(stderr, "%s: --cache-size needs a size like 512M or 2G\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+			// mem-reserve flag: Memory to leave available, with an optional K, M or G suffix.
+			case 'M':
+			if((varp->memReserve = parseSize(optarg)) <= 0) {
+				fprintf(stderr, "%s: --mem-reserve needs a size like 512M or 2G\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
 			// Wrong option, print error.
 			default:
 			printf("opt: %c\n", option);
@@ -155,117 +412,47 @@ char** getArgs(FILE **file, int argc, char **argv, optVariable *varp) {
 	return targetList;
 }
 
-
-/*  Function: recurseBuild
+/*  Function: readMakeflags
 *  Input:
-makefile m    			:Parsed makefile
-const char *target      :Target to check prerequisites of and eventually build.
-optVariable var			:Current flag statuses.
+*            const char *makeflags	:Value of MAKEFLAGS, or NULL.
+*			  optVaribale varp 			:Variable struct storing options to update.
 *
-*  Output: Recrusively builds the rules in the makefile
+*  Output: Sets the s and B flags if they are among the single letter flags that GNU
+*  		make writes first in MAKEFLAGS, without a dash.
 */
-void recurseBuild(makefile *m, const char *target, optVariable var) {
-
-	int index = 0;
-	struct stat prereqInfo;
-	struct stat targetInfo;
-
-	rule *target_rule = makefile_rule(m, target);
-	// No rule exists, so we continue.
-	if(target_rule == NULL) {
-		// Check that target exists.
-		if(stat(target, &targetInfo) == -1) {
-			perror(target);
-			exit(EXIT_FAILURE);
-		}
+void readMakeflags(const char *makeflags, optVariable *varp) {
+	if(makeflags == NULL) {
 		return;
 	}
-	// Get list of prerequisites.
-	const char **prereqList = rule_prereq(target_rule);
-
-	// Iterate down the list of prerequisites, to build from the bottom and up.
-	while(prereqList[index] != NULL) {
-		recurseBuild(m, prereqList[index], var);
-		++index;
-	}
-	// If the target doesn't exist, we want to build.
-	if(stat(target,&targetInfo) == -1) {
-		build(target_rule, var);
+	makeflags += strspn(makeflags, " ");
+	if(*makeflags == '-') {
 		return;
 	}
-
-	index = 0;
-
-	//Loop prerequisites and recursively build file.
-	while(prereqList[index] != NULL) {
-
-		// Get info about the time of last modification. Prerequiste has to exist at this point.
-		if (stat(prereqList[index], &prereqInfo) == -1) {
-			perror(prereqList[index]);
-			exit(EXIT_FAILURE);
+	for(const char *p = makeflags; *p != '\0' && *p != ' '; p++) {
+		if(*p == 's') {
+			varp->sflag = true;
 		}
-
-		// If B-flag is true, we want to force rebuild, if the time of last modiciation of the prerequiste is sooner than
-		// targets last modification, and that time is more than one second we also want to build.
-		if(var.Bflag == true || (difftime(prereqInfo.st_mtime, targetInfo.st_mtime) > 1)) {
-			build(target_rule, var);
-			break;
+		else if(*p == 'B') {
+			varp->Bflag = true;
 		}
-		++index;
 	}
-	return;
 }
 
-/*  Function: Build
+/*  Function: parseSize
 *  Input:
-*          rule *target_rule      :Rule to build,
-*			optVariable var		   :Current flag statuses.
+*            const char *s			:Size in bytes, with an optional K, M or G suffix.
 *
-*  Output: Builds target rule, outputs command built.
+*  Output: The size in bytes, or -1 if it isn't one.
 */
-void build(rule *target_rule, optVariable var) {
-
-	pid_t pid;
-	int status;
-	int i = 0;
-
-	// Get commandline to execute.
-	char** cmd = rule_cmd(target_rule);
-	// Make child
-	if((pid = fork()) == -1) {
-		perror("fork");
-		exit(EXIT_FAILURE);
+long long parseSize(const char *s) {
+	char *endp;
+	long long size = strtoll(s, &endp, 10);
+	if(endp == s) {
+		return -1;
 	}
-	// Child executes commands.
-	if(pid == 0) {
-		execvp(cmd[0], cmd);
-		// Child shouldn't reach these lines.
-		perror(cmd[0]);
-		exit(EXIT_FAILURE);
-	}
-	else {
-		// If s-flag is true we don't want to write.
-		if(var.sflag != true) {
-			// Otherwise write command and arguments, add spaces between arguments and newline when command is done.
-			while(cmd[i] != NULL) {
-				printf("%s", cmd[i]);
-				++i;
-				if(cmd[i] != NULL) {
-					printf(" ");
-				}
-				else{
-					printf("\n");
-				}
-			}
-		}
-		// Wait for children.
-		if (wait(&status) == -1) {
-			perror("wait");
-			exit(EXIT_FAILURE);
-		}
-		else if(WEXITSTATUS(status) != 0) {
-			exit(EXIT_FAILURE);
-		}
+	if(*endp != '\0' && strchr("KMG", *endp) != NULL) {
+		size <<= 10 * (strchr("KMG", *endp) - "KMG" + 1);
+		endp++;
 	}
-
+	return *endp == '\0' ? size : -1;
 }
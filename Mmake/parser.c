@@ -3,6 +3,24 @@
  * with its header-file parser.h to solve the mmake laboration in the course C
  * Programming and Unix (5DV088).
  *
+ * The makefile is mapped into memory and parsed in place, without limits on
+ * the length of lines or the number of prerequisites and arguments.  Every
+ * word is interned, so a name shared by many rules is stored once, and the
+ * rules are kept in an open addressing hash table keyed by their target.
+ *
+ * A rule may have several command lines.  They are kept in one array, each
+ * line ending with NULL and the last one followed by another NULL.  A line
+ * with characters the shell treats specially, or starting with a shell
+ * builtin, is kept as RULE_SHELL -c and the text of the line, so running it
+ * is the same as running any other line.
+ *
+ * A parsed makefile can be saved as an image: a string table, the rule array,
+ * the NULL-terminated prerequisite and command arrays and the hash table, with
+ * file offsets where the makefile has pointers.  Loading an image maps it
+ * privately and turns the offsets into pointers in place, checking that each
+ * one points into its section, so no parsing or allocation is needed.  A
+ * checksum over the image catches corruption the offset checks would miss.
+ *
  * @file parse.h
  * @author Elias Åström, Fredrik Peteri
  * @date 2020-09-04
@@ -10,207 +28,954 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "parser.h"
 
-#define MAX_RULES 256
-#define MAX_LINE 1024
-#define MAX_PREREQ 32
-#define MAX_CMD 32
+#define CHUNK_SIZE (64 * 1024)
+// Characters that make a command line need the shell.
+#define SHELL_CHARS "#;\"'\\*?[]&|<>(){}$`^~!"
+
+#define IMAGE_MAGIC "MMAKEIMG"
+#define IMAGE_VERSION 4
+// Smaller makefiles parse about as fast as an image loads.
+#define IMAGE_MIN_RULES 1024
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/**
+ * Start of an image file.  All offsets are from the start of the file, and the
+ * sections follow the header in this order.
+ */
+struct image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t ptr_size;
+	// identity of the makefile the image was made from
+	uint64_t src_size;
+	int64_t src_sec;
+	int64_t src_nsec;
+	uint64_t src_hash;
+	uint64_t size;
+	// NUL-terminated strings
+	uint64_t strings_off;
+	uint64_t strings_len;
+	// struct rule records
+	uint64_t rules_off;
+	uint64_t n_rules;
+	// NULL-terminated arrays of string offsets, the command lines of a rule
+	// are followed by another 0
+	uint64_t arrays_off;
+	uint64_t arrays_len;
+	// hash table of rule offsets, 0 for a free slot
+	uint64_t table_off;
+	uint64_t table_cap;
+	uint64_t first_off;
+	// hash_source of everything after the header
+	uint64_t checksum;
+};
+
+/**
+ * Block of memory that words, rules and their arrays are allocated from.
+ * Everything is freed at once by makefile_del.
+ */
+struct chunk {
+	struct chunk *next;
+	size_t used;
+	size_t size;
+	max_align_t data[];
+};
+
+/**
+ * Slot of the table of interned words.
+ */
+struct word {
+	const char *s;
+	size_t len;
+	uint64_t hash;
+	// offset in the string table of an image being written
+	uint64_t off;
+};
+
+/**
+ * Growing array of words, used while a line is parsed.
+ */
+struct words {
+	char **a;
+	size_t n;
+	size_t cap;
+};
 
 struct makefile {
-	struct rule *rules;
+	struct chunk *chunks;
+	struct word *words;
+	size_t n_words;
+	size_t words_cap;
+	struct rule **rules;
+	size_t n_rules;
+	size_t rules_cap;
+	struct rule *first;
+	// mapped image holding everything else, or NULL
+	void *image;
+	size_t image_size;
 };
 
 struct rule {
 	char *target;
+	uint64_t hash;
 	char **prereq;
 	char **cmd;
-	rule *next;
+	// job slots the command takes, from a weight annotation
+	uint64_t weight;
+	// 1 if a restat annotation says the command may leave the target as it was
+	uint64_t restat;
 };
 
 /**
- * Check if line is blank.
+ * Allocate memory, exiting if there is none.
+ */
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+	if (p == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/**
+ * Allocate size bytes from the chunks of a makefile, aligned for any type.
+ */
+static void *alloc(makefile *m, size_t size)
+{
+	size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+
+	struct chunk *c = m->chunks;
+	if (c == NULL || c->size - c->used < size) {
+		size_t n = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+		c = xmalloc(sizeof *c + n);
+		c->next = m->chunks;
+		c->used = 0;
+		c->size = n;
+		m->chunks = c;
+	}
+
+	void *p = (char *)c->data + c->used;
+	c->used += size;
+	return p;
+}
+
+uint64_t hash_bytes(const char *s, size_t n)
+{
+	uint64_t hash = FNV_OFFSET;
+	for (size_t i = 0; i < n; i++)
+		hash = (hash ^ (unsigned char)s[i]) * FNV_PRIME;
+	return hash;
+}
+
+/**
+ * Hash of a whole makefile.  Like FNV-1a but eight bytes at a time, mixed
+ * with a rotation, which is several times faster on big files.
+ */
+static uint64_t hash_source(const char *s, size_t n)
+{
+	uint64_t hash = FNV_OFFSET;
+	uint64_t v;
+	size_t i = 0;
+	for (; i + sizeof v <= n; i += sizeof v) {
+		memcpy(&v, s + i, sizeof v);
+		hash = (hash ^ v) * FNV_PRIME;
+		hash ^= hash >> 29;
+	}
+	return hash_bytes(s + i, n - i) ^ hash;
+}
+
+/**
+ * Put a word in the first free slot from its hash.  The table must have room.
+ */
+static void put_word(struct word *table, size_t cap, struct word w)
+{
+	size_t i = w.hash & (cap - 1);
+	while (table[i].s != NULL)
+		i = (i + 1) & (cap - 1);
+	table[i] = w;
+}
+
+/**
+ * Get the interned copy of the n bytes at s, adding it if it is new.
+ */
+static char *intern(makefile *m, const char *s, size_t n)
+{
+	uint64_t hash = hash_bytes(s, n);
+	size_t mask = m->words_cap - 1;
+	for (size_t i = hash & mask; m->words[i].s != NULL; i = (i + 1) & mask) {
+		struct word *w = &m->words[i];
+		if (w->hash == hash && w->len == n && memcmp(w->s, s, n) == 0)
+			return (char *)w->s;
+	}
+
+	// keep the table at most half full
+	if ((m->n_words + 1) * 2 > m->words_cap) {
+		size_t cap = m->words_cap * 2;
+		struct word *table = calloc(cap, sizeof *table);
+		if (table == NULL) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < m->words_cap; i++)
+			if (m->words[i].s != NULL)
+				put_word(table, cap, m->words[i]);
+		free(m->words);
+		m->words = table;
+		m->words_cap = cap;
+	}
+
+	char *copy = alloc(m, n + 1);
+	memcpy(copy, s, n);
+	copy[n] = '\0';
+	put_word(m->words, m->words_cap, (struct word){copy, n, hash, 0});
+	m->n_words++;
+	return copy;
+}
+
+/**
+ * Put a rule in the first free slot from the hash of its target.  The table
+ * must have room.
+ */
+static void put_rule(struct rule **table, size_t cap, struct rule *r)
+{
+	size_t i = r->hash & (cap - 1);
+	while (table[i] != NULL)
+		i = (i + 1) & (cap - 1);
+	table[i] = r;
+}
+
+/**
+ * Add a rule to the table.  If the target already has a rule, the first one
+ * is kept.  Targets are interned, so they are compared by address.
+ */
+static void add_rule(makefile *m, struct rule *r)
+{
+	size_t mask = m->rules_cap - 1;
+	for (size_t i = r->hash & mask; m->rules[i] != NULL; i = (i + 1) & mask)
+		if (m->rules[i]->target == r->target)
+			return;
+
+	if ((m->n_rules + 1) * 2 > m->rules_cap) {
+		size_t cap = m->rules_cap * 2;
+		struct rule **table = calloc(cap, sizeof *table);
+		if (table == NULL) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < m->rules_cap; i++)
+			if (m->rules[i] != NULL)
+				put_rule(table, cap, m->rules[i]);
+		free(m->rules);
+		m->rules = table;
+		m->rules_cap = cap;
+	}
+
+	put_rule(m->rules, m->rules_cap, r);
+	m->n_rules++;
+	if (m->first == NULL)
+		m->first = r;
+}
+
+/**
+ * Check if the line starting at p is blank.
  */
-static bool is_blank_line(const char *s)
+static bool is_blank_line(const char *p, const char *end)
 {
-	for (size_t i = 0; s[i] != '\0'; i++) {
-		if (!isspace(s[i]))
+	for (; p < end && *p != '\n'; p++) {
+		if (!isspace((unsigned char)*p))
 			return false;
 	}
 	return true;
 }
 
+/**
+ * Advance p to the start of the next line which is not blank.  Returns false
+ * at the end of the file.
+ */
+static bool next_line(const char **p, const char *end)
+{
+	while (*p < end && is_blank_line(*p, end)) {
+		const char *nl = memchr(*p, '\n', end - *p);
+		*p = nl == NULL ? end : nl + 1;
+	}
+	return *p < end;
+}
+
+/**
+ * Advance pointer to the next character which is not a space, stops at
+ * newline.
+ */
+static void skipwhite(const char **p, const char *end)
+{
+	while (*p < end && isspace((unsigned char)**p) && **p != '\n')
+		(*p)++;
+}
+
+/**
+ * Skip comment lines, starting with # after any whitespace, and blank lines.
+ * A comment of the form "# mmake: weight=N" sets *weight, and one holding the
+ * word restat sets *restat, other words after "mmake:" are ignored.  Returns
+ * false at the end of the file.
+ */
+static bool skip_comments(const char **p, const char *end, uint64_t *weight,
+		uint64_t *restat)
+{
+	while (next_line(p, end)) {
+		const char *q = *p;
+		skipwhite(&q, end);
+		if (*q != '#')
+			return true;
+
+		const char *nl = memchr(q, '\n', end - q);
+		const char *eol = nl == NULL ? end : nl;
+		q++;
+		skipwhite(&q, eol);
+		if (eol - q > 6 && memcmp(q, "mmake:", 6) == 0) {
+			for (q += 6; q < eol; ) {
+				skipwhite(&q, eol);
+				const char *word = q;
+				while (q < eol && !isspace((unsigned char)*q))
+					q++;
+				if (q - word > 7 && memcmp(word, "weight=", 7) == 0) {
+					uint64_t n = 0;
+					const char *d = word + 7;
+					while (d < q && isdigit((unsigned char)*d) && n < 1000000)
+						n = n * 10 + (*d++ - '0');
+					if (d == q && n > 0)
+						*weight = n;
+				}
+				if (q - word == 6 && memcmp(word, "restat", 6) == 0)
+					*restat = 1;
+			}
+		}
+		*p = nl == NULL ? end : nl + 1;
+	}
+	return false;
+}
+
+/**
+ * Check that the character pointed to by p is c, and increment p if it is.
+ * The end of the file counts as a newline.
+ */
+static bool expect(const char **p, const char *end, char c)
+{
+	if (*p == end)
+		return c == '\n';
+	if (**p != c)
+		return false;
+
+	(*p)++;
+	return true;
+}
+
 /**
  * Parse a word and update p to point to the first character after the word.
  * The word is delimited by whitespace and any character in delim.  The
- * returned string should be freed using free.
+ * returned string is interned in the makefile.
  */
-static char *parse_word(char **p, char *delim)
+static char *parse_word(makefile *m, const char **p, const char *end,
+		const char *delim)
 {
 	size_t n = 0;
-	while (!isspace((*p)[n]) && strchr(delim, (*p)[n]) == NULL)
+	while (*p + n < end && !isspace((unsigned char)(*p)[n])
+			&& strchr(delim, (*p)[n]) == NULL)
 		n++;
 
 	if (n == 0)
 		return NULL;
 
-	char *path = strndup(*p, n);
+	char *word = intern(m, *p, n);
 	*p += n;
-	return path;
+	return word;
 }
 
 /**
- * Fills buf with the next line from fp.  Returns buf if a line was read and
- * NULL otherwise.
+ * Add a word, or NULL, last in w.
  */
-static char *next_line(char buf[MAX_LINE], FILE *fp)
+static void push_word(struct words *w, char *word)
 {
-	do {
-		if (fgets(buf, MAX_LINE, fp) == NULL)
-			return NULL;
-	} while (is_blank_line(buf));
+	if (w->n == w->cap) {
+		w->cap = w->cap == 0 ? 16 : w->cap * 2;
+		w->a = realloc(w->a, w->cap * sizeof *w->a);
+		if (w->a == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	w->a[w->n++] = word;
+}
 
-	return buf;
+/**
+ * Parse the words up to the end of the line, adding them after the ones
+ * already in w.
+ */
+static void parse_words(makefile *m, const char **p, const char *end,
+		struct words *w)
+{
+	char *word;
+	while ((word = parse_word(m, p, end, "")) != NULL) {
+		push_word(w, word);
+		skipwhite(p, end);
+	}
 }
 
 /**
- * Duplicate an array of strings.
+ * Check if a command line needs the shell: it has a character the shell
+ * treats specially, its first word is a shell builtin or keyword, or it
+ * starts by setting a variable.
  *
- * @param n     Size of array to duplicate.
- * @param a     Array to duplicate.
- * @return      NULL-terminated array which should be freed using free.
+ * @param s     Text of the line.
+ * @param end   End of the text.
+ * @param first First word of the line.
  */
-static char **dupe_str_array(size_t n, char **a)
+static bool needs_shell(const char *s, const char *end, const char *first)
 {
-	char **ret = malloc((n + 1) * sizeof *ret);
-
-	for (size_t i = 0; i < n; i++)
-		ret[i] = a[i];
-	ret[n] = NULL;
+	static const char *const builtins[] = {
+		".", ":", "alias", "bg", "break", "case", "cd", "command",
+		"continue", "eval", "exec", "exit", "export", "fc", "fg", "for",
+		"getopts", "hash", "if", "jobs", "read", "readonly", "return",
+		"set", "shift", "source", "test", "trap", "type", "ulimit", "umask",
+		"unalias", "unset", "until", "wait", "while", NULL
+	};
 
-	return ret;
+	for (; s < end; s++)
+		if (memchr(SHELL_CHARS, *s, sizeof SHELL_CHARS - 1) != NULL)
+			return true;
+	if (strchr(first, '=') != NULL)
+		return true;
+	for (size_t i = 0; builtins[i] != NULL; i++)
+		if (strcmp(first, builtins[i]) == 0)
+			return true;
+	return false;
 }
 
 /**
- * Advance pointer to the next character which is not a space, stops at
- * newline.
+ * Parse a command line, the part after the tab, adding its words to w
+ * followed by a NULL.  A line that needs the shell is added as RULE_SHELL,
+ * "-c" and the text of the line instead.  A blank line adds nothing.
  */
-static void skipwhite(char **p)
+static void parse_cmd_line(makefile *m, const char **p, const char *end,
+		struct words *w)
 {
-	while (isspace(**p) && **p != '\n')
-		(*p)++;
+	skipwhite(p, end);
+	const char *start = *p;
+	size_t first = w->n;
+	parse_words(m, p, end, w);
+	if (w->n == first)
+		return;
+
+	// the words were only needed to tell, trailing whitespace isn't part of
+	// the text
+	if (needs_shell(start, *p, w->a[first])) {
+		const char *stop = *p;
+		while (stop > start && isspace((unsigned char)stop[-1]))
+			stop--;
+		w->n = first;
+		push_word(w, intern(m, RULE_SHELL, strlen(RULE_SHELL)));
+		push_word(w, intern(m, "-c", 2));
+		push_word(w, intern(m, start, stop - start));
+	}
+	push_word(w, NULL);
 }
 
 /**
- * Check that the character pointed to by p is c, and increment p if it is.
+ * Copy an array of words into the makefile.
+ *
+ * @return      NULL-terminated copy of the array.
  */
-static bool expect(char **p, char c)
+static char **dupe_str_array(makefile *m, struct words *w)
 {
-	if (**p != c)
-		return false;
+	char **ret = alloc(m, (w->n + 1) * sizeof *ret);
 
-	(*p)++;
-	return true;
+	memcpy(ret, w->a, w->n * sizeof *ret);
+	ret[w->n] = NULL;
+
+	return ret;
 }
 
 /**
  * Parse a rule.
  *
- * @param fp    File to read from.
+ * @param m     Makefile to add the rule to.
+ * @param p     Position in the makefile, updated past the rule.
+ * @param end   End of the makefile.
+ * @param w     Scratch array for the words of a line.
  * @param err   Pointer to flag which gets set to true on error.
- * @return      A parsed rule or NULL.
+ * @return      true if a rule was parsed.
  */
-static rule *parse_rule(FILE *fp, bool *err)
+static bool parse_rule(makefile *m, const char **p, const char *end,
+		struct words *w, bool *err)
 {
-	char buf[MAX_LINE];
-	char *p;
-
-	// read line with target and prerequisites
-	if ((p = next_line(buf, fp)) == NULL)
-		return NULL;
+	// find line with target and prerequisites, after any annotations
+	uint64_t weight = 1;
+	uint64_t restat = 0;
+	if (!skip_comments(p, end, &weight, &restat))
+		return false;
 
 	// line cannot begin with whitespace
-	if (isspace(*p))
-		goto err0;
+	if (isspace((unsigned char)**p))
+		goto err;
 
-	char *target = parse_word(&p, ":");
+	char *target = parse_word(m, p, end, ":");
 
-	skipwhite(&p);
+	skipwhite(p, end);
 
-	if (!expect(&p, ':'))
-		goto err1;
+	if (target == NULL || !expect(p, end, ':'))
+		goto err;
 
-	skipwhite(&p);
+	skipwhite(p, end);
 
 	// parse prerequisites
-	char *prereq[MAX_PREREQ];
-	size_t n_prereq = 0;
-	while (n_prereq < MAX_PREREQ
-			&& (prereq[n_prereq] = parse_word(&p, "")) != NULL) {
-		n_prereq++;
-		skipwhite(&p);
+	w->n = 0;
+	parse_words(m, p, end, w);
+	if (!expect(p, end, '\n'))
+		goto err;
+
+	struct rule *r = alloc(m, sizeof *r);
+	r->target = target;
+	r->hash = hash_bytes(target, strlen(target));
+	r->prereq = dupe_str_array(m, w);
+	r->weight = weight;
+	r->restat = restat;
+
+	// parse command lines, every line that begins with a tab up to the next
+	// rule, and there has to be one
+	size_t lines = 0;
+	const char *q = *p;
+	w->n = 0;
+	while (next_line(&q, end) && *q == '\t') {
+		*p = q + 1;
+		parse_cmd_line(m, p, end, w);
+		if (!expect(p, end, '\n'))
+			goto err;
+		q = *p;
+		lines++;
 	}
-	if (!expect(&p, '\n'))
-		goto err2;
+	if (lines == 0)
+		goto err;
 
-	// read line with command
-	if ((p = next_line(buf, fp)) == NULL)
-		goto err2;
+	// the NULL after the last line ends the lines
+	r->cmd = dupe_str_array(m, w);
 
-	// command has to begin with tab
-	if (!expect(&p, '\t'))
-		goto err2;
+	add_rule(m, r);
+	return true;
 
-	skipwhite(&p);
+err:
+	*err = true;
+	return false;
+}
 
-	// parse command
-	char *cmd[MAX_CMD];
-	size_t n_cmd = 0;
-	while (n_cmd < MAX_CMD && (cmd[n_cmd] = parse_word(&p, "")) != NULL) {
-		n_cmd++;
-		skipwhite(&p);
+/**
+ * Map the file of fp into memory.  Files that can't be mapped, like pipes, are
+ * read into a buffer instead.
+ *
+ * @param fp        File to map.
+ * @param size      Set to the size of the file.
+ * @param mapped    Set to true if the file was mapped, false if it was read.
+ * @return          The contents of the file, or NULL on error.
+ */
+static char *map_file(FILE *fp, size_t *size, bool *mapped)
+{
+	struct stat info;
+	if (fstat(fileno(fp), &info) == 0 && S_ISREG(info.st_mode)
+			&& info.st_size > 0) {
+		char *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+				fileno(fp), 0);
+		if (data != MAP_FAILED) {
+			madvise(data, info.st_size, MADV_SEQUENTIAL);
+			*size = info.st_size;
+			*mapped = true;
+			return data;
+		}
 	}
 
-	// create rule
-	rule *r = malloc(sizeof *r);
-	r->target = target;
-	r->prereq = dupe_str_array(n_prereq, prereq);
-	r->cmd = dupe_str_array(n_cmd, cmd);
+	size_t cap = CHUNK_SIZE;
+	size_t n = 0;
+	char *data = xmalloc(cap);
+	while (!feof(fp)) {
+		if (n == cap) {
+			cap *= 2;
+			data = realloc(data, cap);
+			if (data == NULL) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		n += fread(data + n, 1, cap - n, fp);
+		if (ferror(fp)) {
+			free(data);
+			return NULL;
+		}
+	}
+	*size = n;
+	*mapped = false;
+	return data;
+}
+
+/**
+ * Parse a makefile from memory.
+ *
+ * @param data  Contents of the makefile.
+ * @param size  Size of the contents.
+ * @return      The makefile, or NULL if it could not be parsed.
+ */
+static makefile *parse_buffer(const char *data, size_t size)
+{
+	makefile *m = xmalloc(sizeof *m);
+	m->chunks = NULL;
+	m->n_words = 0;
+	m->words_cap = 64;
+	m->words = calloc(m->words_cap, sizeof *m->words);
+	m->n_rules = 0;
+	m->rules_cap = 64;
+	m->rules = calloc(m->rules_cap, sizeof *m->rules);
+	m->first = NULL;
+	m->image = NULL;
+	if (m->words == NULL || m->rules == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
 
-	return r;
+	const char *p = data;
+	struct words w = {NULL, 0, 0};
+	bool err = false;
+	while (parse_rule(m, &p, data + size, &w, &err))
+		;
+	free(w.a);
 
-err2:
-	for (size_t i = 0; i < n_prereq; i++)
-		free(prereq[i]);
-err1:
-	free(target);
-err0:
-	*err = true;
-	return NULL;
+	if (m->first == NULL || err) {
+		makefile_del(m);
+		return NULL;
+	}
+
+	return m;
 }
 
 /**
  * Parse a makefile.
  *
- * @param path  Path to makefile to parse.
+ * @param fp    File to read the makefile from.
  * @return      The makefile.
  */
 makefile *parse_makefile(FILE *fp)
 {
-	makefile *m = malloc(sizeof *m);
-	rule **tailp = &m->rules;
+	size_t size;
+	bool mapped;
+	char *data = map_file(fp, &size, &mapped);
+	if (data == NULL)
+		return NULL;
 
-	bool err = false;
-	while ((*tailp = parse_rule(fp, &err)) != NULL)
-		tailp = &(*tailp)->next;
-	*tailp = NULL;
+	makefile *m = parse_buffer(data, size);
 
-	if (m->rules == NULL || err) {
-		makefile_del(m);
+	if (mapped)
+		munmap(data, size);
+	else
+		free(data);
+
+	return m;
+}
+
+/**
+ * Find the interned word s.
+ */
+static struct word *find_word(makefile *m, const char *s)
+{
+	size_t n = strlen(s);
+	uint64_t hash = hash_bytes(s, n);
+	size_t mask = m->words_cap - 1;
+	size_t i = hash & mask;
+	while (m->words[i].s != s)
+		i = (i + 1) & mask;
+	return &m->words[i];
+}
+
+/**
+ * Write the string offsets of a NULL-terminated array of words to a.
+ *
+ * @return      Slots written, including the terminating 0.
+ */
+static size_t put_array(makefile *m, uint64_t *a, char **words)
+{
+	size_t n = 0;
+	for (; words[n] != NULL; n++)
+		a[n] = find_word(m, words[n])->off;
+	a[n] = 0;
+	return n + 1;
+}
+
+/**
+ * Count the slots of the command lines of a rule, with the NULL ending each
+ * line and the one after the last.
+ */
+static size_t cmd_slots(char **cmd)
+{
+	size_t n = 0;
+	while (cmd[n] != NULL || cmd[n + 1] != NULL)
+		n++;
+	return n + 2;
+}
+
+/**
+ * Write the string offsets of the command lines of a rule to a.
+ *
+ * @return      Slots written, see cmd_slots.
+ */
+static size_t put_cmd(makefile *m, uint64_t *a, char **cmd)
+{
+	size_t n = cmd_slots(cmd);
+	for (size_t i = 0; i < n; i++)
+		a[i] = cmd[i] != NULL ? find_word(m, cmd[i])->off : 0;
+	return n;
+}
+
+/**
+ * Save a parsed makefile as an image.  The image is written to a temporary
+ * file that is renamed to path, so a reader never maps a partial image.
+ *
+ * @param m     Parsed makefile.
+ * @param path  Path of the image.
+ * @param src   Identity of the makefile, copied into the header.
+ */
+static void write_image(makefile *m, const char *path,
+		const struct image_header *src)
+{
+	struct image_header h = *src;
+	memcpy(h.magic, IMAGE_MAGIC, sizeof h.magic);
+	h.version = IMAGE_VERSION;
+	h.ptr_size = sizeof(void *);
+
+	// size every section, giving each word its offset on the way
+	h.strings_off = sizeof h;
+	h.strings_len = 0;
+	for (size_t i = 0; i < m->words_cap; i++) {
+		struct word *w = &m->words[i];
+		if (w->s != NULL) {
+			w->off = h.strings_off + h.strings_len;
+			h.strings_len += w->len + 1;
+		}
+	}
+	h.rules_off = (h.strings_off + h.strings_len + 7) & ~(uint64_t)7;
+	h.n_rules = m->n_rules;
+	h.arrays_off = h.rules_off + h.n_rules * sizeof(struct rule);
+	h.arrays_len = 0;
+	for (size_t i = 0; i < m->rules_cap; i++) {
+		struct rule *r = m->rules[i];
+		if (r == NULL)
+			continue;
+		for (size_t j = 0; r->prereq[j] != NULL; j++)
+			h.arrays_len++;
+		h.arrays_len += 1 + cmd_slots(r->cmd);
+	}
+	h.table_off = h.arrays_off + h.arrays_len * sizeof(uint64_t);
+	h.table_cap = m->rules_cap;
+	h.size = h.table_off + h.table_cap * sizeof(uint64_t);
+
+	char *buf = calloc(1, h.size);
+	if (buf == NULL)
+		return;
+	for (size_t i = 0; i < m->words_cap; i++) {
+		struct word *w = &m->words[i];
+		if (w->s != NULL)
+			memcpy(buf + w->off, w->s, w->len + 1);
+	}
+
+	// rules in table order, so slot i of the table holds rule number k
+	uint64_t *arrays = (uint64_t *)(buf + h.arrays_off);
+	uint64_t *table = (uint64_t *)(buf + h.table_off);
+	size_t k = 0;
+	size_t slot = 0;
+	for (size_t i = 0; i < m->rules_cap; i++) {
+		struct rule *r = m->rules[i];
+		if (r == NULL)
+			continue;
+		uint64_t off = h.rules_off + k++ * sizeof(struct rule);
+		uint64_t rec[6] = {
+			find_word(m, r->target)->off,
+			r->hash,
+			h.arrays_off + slot * sizeof(uint64_t),
+			0,
+			r->weight,
+			r->restat
+		};
+		slot += put_array(m, arrays + slot, r->prereq);
+		rec[3] = h.arrays_off + slot * sizeof(uint64_t);
+		slot += put_cmd(m, arrays + slot, r->cmd);
+		memcpy(buf + off, rec, sizeof rec);
+		table[i] = off;
+		if (r == m->first)
+			h.first_off = off;
+	}
+	h.checksum = hash_source(buf + sizeof h, h.size - sizeof h);
+	memcpy(buf, &h, sizeof h);
+
+	char tmp[strlen(path) + 32];
+	snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid());
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd != -1) {
+		bool ok = write(fd, buf, h.size) == (ssize_t)h.size;
+		if (close(fd) == -1 || !ok || rename(tmp, path) == -1)
+			unlink(tmp);
+	}
+	free(buf);
+}
+
+/**
+ * Turn the offset stored in *slot into a pointer into the image, checking
+ * that it lies in [lo, hi).
+ */
+static bool relocate(void *slot, char *base, uint64_t lo, uint64_t hi)
+{
+	uint64_t off;
+	memcpy(&off, slot, sizeof off);
+	if (off < lo || off >= hi)
+		return false;
+
+	char *p = base + off;
+	memcpy(slot, &p, sizeof p);
+	return true;
+}
+
+/**
+ * Map an image and turn it into a makefile.
+ *
+ * @param path  Path of the image.
+ * @param src   Identity of the makefile the image must have been made from.
+ * @return      The makefile, or NULL if the image is missing, stale or
+ *              corrupt.
+ */
+static makefile *load_image(const char *path, const struct image_header *src)
+{
+	struct image_header h;
+	struct stat info;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof h
+			|| pread(fd, &h, sizeof h, 0) != sizeof h
+			|| memcmp(h.magic, IMAGE_MAGIC, sizeof h.magic) != 0
+			|| h.version != IMAGE_VERSION || h.ptr_size != sizeof(void *)
+			|| h.src_size != src->src_size || h.src_sec != src->src_sec
+			|| h.src_nsec != src->src_nsec || h.src_hash != src->src_hash
+			|| h.size != (uint64_t)info.st_size) {
+		close(fd);
 		return NULL;
 	}
+	char *base = mmap(NULL, h.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE,
+			fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	// the sections must be in order and fit, and strings and arrays must end
+	// with a terminator so no walk can leave them, two for the walk over the
+	// command lines of the last rule
+	uint64_t strings_end = h.strings_off + h.strings_len;
+	uint64_t rules_end = h.rules_off + h.n_rules * sizeof(struct rule);
+	uint64_t arrays_end = h.arrays_off + h.arrays_len * sizeof(uint64_t);
+	uint64_t *arrays = (uint64_t *)(base + h.arrays_off);
+	uint64_t *table = (uint64_t *)(base + h.table_off);
+	bool ok = h.checksum == hash_source(base + sizeof h, h.size - sizeof h)
+		&& h.strings_off == sizeof h && h.strings_len > 0
+		&& base[strings_end - 1] == '\0'
+		&& h.rules_off >= strings_end && h.rules_off % 8 == 0
+		&& h.arrays_off == rules_end && h.arrays_len > 1
+		&& h.table_off == arrays_end
+		&& h.table_cap > 0 && (h.table_cap & (h.table_cap - 1)) == 0
+		&& h.size == h.table_off + h.table_cap * sizeof(uint64_t)
+		&& h.n_rules < h.table_cap && arrays[h.arrays_len - 1] == 0
+		&& arrays[h.arrays_len - 2] == 0
+		&& h.first_off >= h.rules_off && h.first_off < rules_end
+		&& (h.first_off - h.rules_off) % sizeof(struct rule) == 0;
+
+	for (uint64_t i = 0; ok && i < h.arrays_len; i++)
+		if (arrays[i] != 0)
+			ok = relocate(&arrays[i], base, h.strings_off, strings_end);
+	struct rule *rules = (struct rule *)(base + h.rules_off);
+	for (uint64_t i = 0; ok && i < h.n_rules; i++) {
+		uint64_t prereq, cmd;
+		memcpy(&prereq, &rules[i].prereq, sizeof prereq);
+		memcpy(&cmd, &rules[i].cmd, sizeof cmd);
+		ok = (prereq - h.arrays_off) % 8 == 0 && (cmd - h.arrays_off) % 8 == 0
+			&& rules[i].weight > 0 && rules[i].restat <= 1
+			&& relocate(&rules[i].target, base, h.strings_off, strings_end)
+			&& relocate(&rules[i].prereq, base, h.arrays_off, arrays_end)
+			&& relocate(&rules[i].cmd, base, h.arrays_off, arrays_end);
+	}
+	for (uint64_t i = 0; ok && i < h.table_cap; i++)
+		if (table[i] != 0)
+			ok = (table[i] - h.rules_off) % sizeof(struct rule) == 0
+				&& relocate(&table[i], base, h.rules_off, rules_end);
+	if (!ok) {
+		munmap(base, h.size);
+		return NULL;
+	}
+
+	makefile *m = xmalloc(sizeof *m);
+	m->chunks = NULL;
+	m->words = NULL;
+	m->n_words = 0;
+	m->words_cap = 0;
+	m->rules = (struct rule **)table;
+	m->n_rules = h.n_rules;
+	m->rules_cap = h.table_cap;
+	m->first = (struct rule *)(base + h.first_off);
+	m->image = base;
+	m->image_size = h.size;
+	return m;
+}
+
+/**
+ * Parse a makefile, using an image saved by an earlier call if it was made
+ * from the same makefile.
+ *
+ * @param fp    File to read the makefile from.
+ * @param image Path of the image.
+ * @return      The makefile, or NULL if it could not be parsed.
+ */
+makefile *parse_makefile_image(FILE *fp, const char *image)
+{
+	struct stat info;
+	if (sizeof(void *) != sizeof(uint64_t) || fstat(fileno(fp), &info) == -1
+			|| !S_ISREG(info.st_mode))
+		return parse_makefile(fp);
+
+	size_t size;
+	bool mapped;
+	char *data = map_file(fp, &size, &mapped);
+	if (data == NULL)
+		return NULL;
+
+	struct image_header src = {0};
+	src.src_size = size;
+	src.src_sec = info.st_mtim.tv_sec;
+	src.src_nsec = info.st_mtim.tv_nsec;
+	src.src_hash = hash_source(data, size);
+
+	makefile *m = load_image(image, &src);
+	if (m == NULL) {
+		m = parse_buffer(data, size);
+		if (m != NULL && m->n_rules >= IMAGE_MIN_RULES)
+			write_image(m, image, &src);
+	}
+
+	if (mapped)
+		munmap(data, size);
+	else
+		free(data);
 
 	return m;
 }
@@ -224,7 +989,7 @@ makefile *parse_makefile(FILE *fp)
  */
 const char *makefile_default_target(makefile *m)
 {
-	return m->rules->target;
+	return m->first->target;
 }
 
 /**
@@ -236,9 +1001,13 @@ const char *makefile_default_target(makefile *m)
  */
 rule *makefile_rule(makefile *m, const char *target)
 {
-	for (rule *i = m->rules; i != NULL; i = i->next)
-		if (strcmp(i->target, target) == 0)
-			return i;
+	uint64_t hash = hash_bytes(target, strlen(target));
+	size_t mask = m->rules_cap - 1;
+	for (size_t i = hash & mask; m->rules[i] != NULL; i = (i + 1) & mask) {
+		rule *r = m->rules[i];
+		if (r->hash == hash && strcmp(r->target, target) == 0)
+			return r;
+	}
 
 	return NULL;
 }
@@ -259,9 +1028,10 @@ const char **rule_prereq(rule *rule)
  * Get the command for a rule.
  *
  * @param rule  The rule.
- * @return      Array containing the arguments for the command used to build
- *              the rule.  The first argument is the name of the command.  The
- *              array is terminated with NULL.
+ * @return      Array containing the arguments for the first command line
+ *              used to build the rule.  The first argument is the name of the
+ *              command.  The array is terminated with NULL, and the next
+ *              line follows, see rule_next_cmd.
  */
 char **rule_cmd(rule *rule)
 {
@@ -269,26 +1039,54 @@ char **rule_cmd(rule *rule)
 }
 
 /**
- * Recursively delete a list of rules.
+ * Get the command line after another one of a rule.
+ *
+ * @param cmd   A command line from rule_cmd or rule_next_cmd.
+ * @return      The next command line, or NULL after the last.
  */
-static void del_rules(struct rule *rules)
+char **rule_next_cmd(char **cmd)
 {
-	if (rules == NULL)
-		return;
-
-	free(rules->target);
-
-	for (size_t i = 0; rules->prereq[i] != NULL; i++)
-		free(rules->prereq[i]);
-	free(rules->prereq);
+	while (*cmd != NULL)
+		cmd++;
+	return cmd[1] != NULL ? cmd + 1 : NULL;
+}
 
-	for (size_t i = 0; rules->cmd[i] != NULL; i++)
-		free(rules->cmd[i]);
-	free(rules->cmd);
+/**
+ * Check if a command line is run by the shell.
+ *
+ * @param cmd   A command line of a rule.
+ * @return      true if the line is RULE_SHELL -c and a text, then the text
+ *              is cmd[2].
+ */
+bool rule_cmd_shell(char **cmd)
+{
+	return cmd[0] != NULL && strcmp(cmd[0], RULE_SHELL) == 0
+		&& cmd[1] != NULL && strcmp(cmd[1], "-c") == 0
+		&& cmd[2] != NULL && cmd[3] == NULL;
+}
 
-	del_rules(rules->next);
+/**
+ * Get the weight of a rule.
+ *
+ * @param rule  The rule.
+ * @return      Job slots the command of the rule takes, 1 unless the rule
+ *              has a weight annotation.
+ */
+int rule_weight(rule *rule)
+{
+	return (int)rule->weight;
+}
 
-	free(rules);
+/**
+ * Get whether a rule has a restat annotation.
+ *
+ * @param rule  The rule.
+ * @return      true if the command of the rule may leave the target as it
+ *              was, so what depends on it is built only if it changed.
+ */
+bool rule_restat(rule *rule)
+{
+	return rule->restat != 0;
 }
 
 /**
@@ -299,6 +1097,18 @@ static void del_rules(struct rule *rules)
  */
 void makefile_del(makefile *make)
 {
-	del_rules(make->rules);
+	if (make->image != NULL) {
+		munmap(make->image, make->image_size);
+		free(make);
+		return;
+	}
+
+	struct chunk *next;
+	for (struct chunk *c = make->chunks; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(make->words);
+	free(make->rules);
 	free(make);
 }
@@ -0,0 +1,151 @@
+/**
+ * Parser to parse a minimal makefile.  This file is provided to students along
+ * with its implementation parser.c to solve the mmake laboration in the course
+ * C Programming and Unix (5DV088).
+ *
+ * A makefile consists of rules.  Each rule is a line with a target, a colon
+ * and the prerequisites of the target separated by whitespace, followed by
+ * one or more lines starting with a tab holding the commands that build the
+ * target, run one after the other.  A command line is split into words at
+ * whitespace and run directly, unless it needs the shell, see rule_cmd_shell.
+ *
+ * Lines starting with # are comments.  A comment "# mmake: weight=N" before
+ * a rule gives its command a weight of N job slots, and "# mmake: restat"
+ * marks a command that may leave its target unchanged, like a code generator
+ * that only writes its output when the content differs.
+ *
+ * @file parser.h
+ * @author Elias Åström, Fredrik Peteri
+ * @date 2020-09-04
+ */
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Shell running the command lines that need one.
+#define RULE_SHELL "/bin/sh"
+
+typedef struct makefile makefile;
+typedef struct rule rule;
+
+/**
+ * Parse a makefile.  A regular file is mapped into memory, anything else is
+ * read to its end.  Lines, prerequisites and commands have no length limits.
+ *
+ * @param fp    File to read the makefile from.
+ * @return      The makefile, or NULL if it could not be parsed.
+ */
+makefile *parse_makefile(FILE *fp);
+
+/**
+ * Parse a makefile like parse_makefile, but through a binary image of the
+ * parsed makefile.  If the image was made from a makefile with the same size,
+ * modification time and content hash it is mapped instead of parsing.
+ * Otherwise the makefile is parsed, and the image is written if the makefile
+ * is big enough to gain from one.  A stale or corrupt image is never used.
+ *
+ * @param fp    File to read the makefile from.
+ * @param image Path of the image.
+ * @return      The makefile, or NULL if it could not be parsed.
+ */
+makefile *parse_makefile_image(FILE *fp, const char *image);
+
+/**
+ * Get the default target for a makefile.  The default target is the target
+ * from the first rule.
+ *
+ * @param make  The makefile.
+ * @return      Name of the default target for the makefile.
+ */
+const char *makefile_default_target(makefile *make);
+
+/**
+ * Get the rule for building a specific target in a makefile.
+ *
+ * @param make      The makefile.
+ * @param target    Name of a target.
+ * @return          The rule for building the target, or NULL if there is none.
+ */
+rule *makefile_rule(makefile *make, const char *target);
+
+/**
+ * Get the prerequisites for a rule.
+ *
+ * @param rule  The rule.
+ * @return      Array containing the prerequisites for the rule.  The array is
+ *              terminated with NULL.
+ */
+const char **rule_prereq(rule *rule);
+
+/**
+ * Get the command for a rule.
+ *
+ * @param rule  The rule.
+ * @return      Array containing the arguments for the first command line
+ *              used to build the rule.  The first argument is the name of the
+ *              command.  The array is terminated with NULL, and the next
+ *              line follows, see rule_next_cmd.
+ */
+char **rule_cmd(rule *rule);
+
+/**
+ * Get the command line after another one of a rule.
+ *
+ * @param cmd   A command line from rule_cmd or rule_next_cmd.
+ * @return      The next command line, or NULL after the last.
+ */
+char **rule_next_cmd(char **cmd);
+
+/**
+ * Check if a command line is run by the shell.  A line with any of the
+ * characters #;"'\*?[]&|<>(){}$`^~! , or whose first word is a shell builtin
+ * or keyword like cd or for, or sets a variable, is kept as RULE_SHELL, -c
+ * and the text of the line.
+ *
+ * @param cmd   A command line of a rule.
+ * @return      true if the line is RULE_SHELL -c and a text, then the text
+ *              is cmd[2].
+ */
+bool rule_cmd_shell(char **cmd);
+
+/**
+ * Get the weight of a rule.
+ *
+ * @param rule  The rule.
+ * @return      Job slots the command of the rule takes, 1 unless the rule
+ *              has a weight annotation.
+ */
+int rule_weight(rule *rule);
+
+/**
+ * Get whether a rule has a restat annotation.
+ *
+ * @param rule  The rule.
+ * @return      true if the command of the rule may leave the target as it
+ *              was, so what depends on it is built only if it changed.
+ */
+bool rule_restat(rule *rule);
+
+/**
+ * Free the memory of a makefile.  This will also delete the rules from the
+ * makefile returned by makefile_rule.
+ *
+ * @param make  Makefile to delete.
+ */
+void makefile_del(makefile *make);
+
+/**
+ * FNV-1a hash of n bytes.  The tables of targets and paths in mmake are all
+ * keyed by it.
+ *
+ * @param s     Bytes to hash.
+ * @param n     Amount of bytes.
+ * @return      The hash.
+ */
+uint64_t hash_bytes(const char *s, size_t n);
+
+#endif
@@ -0,0 +1,257 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Build trace of --trace, see trace.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+struct trace {
+	char *path;
+	FILE *fp;
+	struct timespec origin;
+	// No comma before the first event.
+	int events;
+	// Job slot tracks that have been named.
+	int lanes;
+	// Time spent in each kind of overhead, in the order first seen.
+	const char *overheadNames[TRACE_OVERHEADS];
+	double overheadSeconds[TRACE_OVERHEADS];
+	int overheadAmt;
+};
+
+
+// Function declaration.
+static void beginEvent(trace *t);
+static void writeString(FILE *fp, const char *s);
+static void writeChars(FILE *fp, const char *s);
+static long long micros(trace *t, struct timespec time);
+
+/*  Function: trace_open
+*  Input:
+*			const char *path	:Path of the trace file.
+*
+*  Output: The trace, with the JSON opened and the tracks named.
+*/
+trace *trace_open(const char *path) {
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+	trace *t = calloc(1, sizeof(trace));
+	if(t == NULL || (t->path = strdup(path)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	t->fp = fp;
+	t->origin = trace_now();
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	beginEvent(t);
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"mmake\"}}");
+	beginEvent(t);
+	fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"mmake\"}}");
+	return t;
+}
+
+/*  Function: trace_now
+*  Input:	-
+*
+*  Output: The monotonic clock.
+*/
+struct timespec trace_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now;
+}
+
+/*  Function: trace_seconds
+*  Input:
+*			struct timespec start	:Start time.
+*			struct timespec end		:End time.
+*
+*  Output: Seconds from start to end.
+*/
+double trace_seconds(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*  Function: trace_phase
+*  Input:
+*			trace *t			:Trace.
+*			const char *name	:Name of the phase.
+*			struct timespec start	:Start time.
+*			struct timespec end		:End time.
+*
+*  Output: A complete event on mmake's own track. Its time is added to the overhead.
+*/
+void trace_phase(trace *t, const char *name, struct timespec start, struct timespec end) {
+	trace_overhead(t, name, trace_seconds(start, end));
+	beginEvent(t);
+	fprintf(t->fp, "{\"name\":");
+	writeString(t->fp, name);
+	fprintf(t->fp, ",\"cat\":\"mmake\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%lld,\"dur\":%lld}",
+			micros(t, start), micros(t, end) - micros(t, start));
+}
+
+/*  Function: trace_overhead
+*  Input:
+*			trace *t			:Trace.
+*			const char *name	:Kind of overhead, a string that outlives the trace.
+*			double seconds		:Time to add.
+*
+*  Output: Adds the time to the total of its kind.
+*/
+void trace_overhead(trace *t, const char *name, double seconds) {
+	int i = 0;
+	while(i < t->overheadAmt && strcmp(t->overheadNames[i], name) != 0) {
+		i++;
+	}
+	if(i == t->overheadAmt) {
+		if(i == TRACE_OVERHEADS) {
+			return;
+		}
+		t->overheadNames[t->overheadAmt++] = name;
+	}
+	t->overheadSeconds[i] += seconds;
+}
+
+/*  Function: trace_print_overhead
+*  Input:
+*			trace *t			:Trace.
+*			FILE *fp			:Where to print.
+*
+*  Output: One line with the total of each kind of overhead.
+*/
+void trace_print_overhead(trace *t, FILE *fp) {
+	double total = 0;
+	fprintf(fp, "mmake: overhead");
+	for(int i = 0; i < t->overheadAmt; i++) {
+		fprintf(fp, "%s %s %.3f ms", i == 0 ? ":" : ",", t->overheadNames[i], t->overheadSeconds[i] * 1e3);
+		total += t->overheadSeconds[i];
+	}
+	fprintf(fp, ", total %.3f ms\n", total * 1e3);
+}
+
+/*  Function: trace_job
+*  Input:
+*			trace *t			:Trace.
+*			const char *target	:Target built.
+*			char **cmd			:Command line run.
+*			int lane			:Job slot.
+*			struct timespec queued	:When the target was found out of date.
+*			struct timespec start	:When the command started.
+*			struct timespec end		:When it was reaped.
+*			int status			:Exit status.
+*			const struct rusage *usage	:Resource usage.
+*
+*  Output: A complete event on the track of the job slot, named by the target, with
+*		   the command, the time it waited for a slot, the status and the rusage as
+*		   arguments. The first event of a slot also names its track.
+*/
+void trace_job(trace *t, const char *target, char **cmd, int lane, struct timespec queued,
+			   struct timespec start, struct timespec end, int status, const struct rusage *usage) {
+	for(; t->lanes <= lane; t->lanes++) {
+		beginEvent(t);
+		fprintf(t->fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				"\"args\":{\"name\":\"job %d\"}}", t->lanes + 1, t->lanes + 1);
+	}
+	beginEvent(t);
+	fprintf(t->fp, "{\"name\":");
+	writeString(t->fp, target);
+	fprintf(t->fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,\"args\":{\"cmd\":",
+			status == 0 ? "rule" : "failed", lane + 1, micros(t, start), micros(t, end) - micros(t, start));
+	fputc('"', t->fp);
+	for(int i = 0; cmd[i] != NULL; i++) {
+		if(i > 0) {
+			fputc(' ', t->fp);
+		}
+		writeChars(t->fp, cmd[i]);
+	}
+	fputc('"', t->fp);
+	fprintf(t->fp, ",\"status\":%d,\"queued_us\":%lld,\"user_ms\":%.3f,\"sys_ms\":%.3f,\"maxrss_kb\":%ld,"
+			"\"majflt\":%ld,\"inblock\":%ld,\"oublock\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}}",
+			status, micros(t, start) - micros(t, queued),
+			usage->ru_utime.tv_sec * 1e3 + usage->ru_utime.tv_usec / 1e3,
+			usage->ru_stime.tv_sec * 1e3 + usage->ru_stime.tv_usec / 1e3,
+			usage->ru_maxrss, usage->ru_majflt, usage->ru_inblock, usage->ru_oublock,
+			usage->ru_nvcsw, usage->ru_nivcsw);
+}
+
+/*  Function: trace_close
+*  Input:
+*			trace *t			:Trace to close.
+*
+*  Output: 0 if the whole file was written. Frees the trace.
+*/
+int trace_close(trace *t) {
+	fprintf(t->fp, "\n]}\n");
+	int status = 0;
+	if(ferror(t->fp) || fclose(t->fp) == EOF) {
+		perror(t->path);
+		status = -1;
+	}
+	free(t->path);
+	free(t);
+	return status;
+}
+
+/*  Function: beginEvent
+*  Input:
+*			trace *t			:Trace.
+*
+*  Output: Separates the event about to be written from the one before.
+*/
+static void beginEvent(trace *t) {
+	if(t->events++ > 0) {
+		fprintf(t->fp, ",\n");
+	}
+}
+
+/*  Function: writeString
+*  Input:
+*			FILE *fp			:File to write to.
+*			const char *s		:String to write.
+*
+*  Output: The string as a quoted JSON string.
+*/
+static void writeString(FILE *fp, const char *s) {
+	fputc('"', fp);
+	writeChars(fp, s);
+	fputc('"', fp);
+}
+
+/*  Function: writeChars
+*  Input:
+*			FILE *fp			:File to write to.
+*			const char *s		:String to write.
+*
+*  Output: The string escaped for the inside of a JSON string.
+*/
+static void writeChars(FILE *fp, const char *s) {
+	for(const unsigned char *p = (const unsigned char *)s; *p != '\0'; p++) {
+		if(*p == '"' || *p == '\\') {
+			fprintf(fp, "\\%c", *p);
+		}
+		else if(*p < 0x20) {
+			fprintf(fp, "\\u%04x", *p);
+		}
+		else {
+			fputc(*p, fp);
+		}
+	}
+}
+
+/*  Function: micros
+*  Input:
+*			trace *t			:Trace.
+*			struct timespec time	:A time.
+*
+*  Output: Microseconds from the start of the trace.
+*/
+static long long micros(trace *t, struct timespec time) {
+	return (long long)(trace_seconds(t->origin, time) * 1e6);
+}
@@ -0,0 +1,100 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Build trace of --trace, written as Chrome trace_event JSON that
+*				 Perfetto and chrome://tracing can show. mmake's own phases, like
+*				 parsing and up-to-date checking, are on one track and every job
+*				 slot has a track of its own with the commands that ran in it.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <time.h>
+
+// Kinds of overhead that are kept apart.
+#define TRACE_OVERHEADS 8
+
+typedef struct trace trace;
+
+/**
+ * Creates a trace file. Times in the trace are from this call.
+ *
+ * @param path		Path of the trace file.
+ * @return			Pointer to the trace, or NULL with an error printed.
+ */
+trace *trace_open(const char *path);
+
+/**
+ * Gets the current time, for the start and end of events.
+ *
+ * @return			Current monotonic time.
+ */
+struct timespec trace_now(void);
+
+/**
+ * Seconds between two times.
+ *
+ * @param start		Start time.
+ * @param end		End time.
+ * @return			end - start in seconds.
+ */
+double trace_seconds(struct timespec start, struct timespec end);
+
+/**
+ * Records a phase of mmake itself.
+ *
+ * @param t			Pointer to the trace.
+ * @param name		Name of the phase.
+ * @param start		When it started.
+ * @param end		When it ended.
+ */
+void trace_phase(trace *t, const char *name, struct timespec start, struct timespec end);
+
+/**
+ * Adds time to one kind of overhead without recording an event, for work that
+ * is done in many small pieces.
+ *
+ * @param t			Pointer to the trace.
+ * @param name		Kind of overhead, must outlive the trace.
+ * @param seconds	Time to add.
+ */
+void trace_overhead(trace *t, const char *name, double seconds);
+
+/**
+ * Prints the total time of each kind of overhead, phases included.
+ *
+ * @param t			Pointer to the trace.
+ * @param fp		Where to print.
+ */
+void trace_print_overhead(trace *t, FILE *fp);
+
+/**
+ * Records a command line that has run. Every line of a command is an event of
+ * its own.
+ *
+ * @param t			Pointer to the trace.
+ * @param target	Target the command built.
+ * @param cmd		NULL terminated command line.
+ * @param lane		Job slot it ran in, from 0.
+ * @param queued	When the target was found out of date, or the line started
+ *					for all lines but the first.
+ * @param start		When the command started.
+ * @param end		When it was reaped.
+ * @param status	Exit status, or 128 + signal number.
+ * @param usage		Resource usage of the command.
+ */
+void trace_job(trace *t, const char *target, char **cmd, int lane, struct timespec queued,
+			   struct timespec start, struct timespec end, int status, const struct rusage *usage);
+
+/**
+ * Finishes and closes a trace file.
+ *
+ * @param t			Pointer to the trace.
+ * @return			0 on success, -1 with an error printed otherwise.
+ */
+int trace_close(trace *t);
+
+#endif
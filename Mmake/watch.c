@@ -0,0 +1,421 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Watch mode of --watch, see watch.h.
+*/
+
+#define _GNU_SOURCE
+#include <sys/inotify.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include "watch.h"
+
+// A burst of changes has settled when nothing more happens for this long.
+#define QUIET_MS 3
+#define EVENTS (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+				| IN_ONLYDIR)
+
+// A watched directory, by the prefix its files have in the graph. Spellings
+// like "src" and "./src" share a watch descriptor.
+struct dir {
+	int wd;
+	char *prefix;
+	size_t prefixLen;
+};
+
+struct watch {
+	graph *g;
+	const char *makefile;
+	int fd;
+	// Sorted by watch descriptor.
+	struct dir *dirs;
+	int dirAmt;
+	// Nodes of the graph whose directories are watched, the ones after them
+	// are headers found by the builds since.
+	int nodeAmt;
+	// Changed files not yet built.
+	node **changed;
+	int changedAmt;
+	int changedCap;
+	// Every file may have changed, after the event queue overflowed.
+	bool overflow;
+	// The makefile has changed.
+	bool restart;
+	// Longest name an event can have, for the path buffer.
+	size_t prefixMax;
+};
+
+
+// Function declaration.
+static int addDirs(struct watch *w);
+static bool addDir(struct watch *w, char *prefix);
+static void addNewDirs(struct watch *w);
+static char *prefixOf(const char *path);
+static int compareStrings(const void *a, const void *b);
+static int compareWd(const void *a, const void *b);
+static bool readEvents(struct watch *w);
+static void handleEvent(struct watch *w, const struct inotify_event *ev, char *path);
+static void addChanged(struct watch *w, node *n);
+static bool changesExist(struct watch *w);
+static int rebuild(struct watch *w, build_options opts);
+
+/*  Function: watch_run
+*  Input:
+*			graph *g			:Graph that has been built.
+*			build_options opts	:Build options.
+*			const char *makefile	:Path of the makefile.
+*
+*  Output: Watches the directories of the files without rules and of the makefile.
+*		   Waits for an event, reads the events of the burst until the queue has been
+*		   quiet for QUIET_MS, then rebuilds what depends on the changed files. Returns
+*		   when the makefile changes.
+*/
+int watch_run(graph *g, build_options opts, const char *makefile) {
+	struct watch w = {0};
+	w.g = g;
+	w.makefile = makefile;
+	if((w.fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) == -1) {
+		perror("inotify_init1");
+		return -1;
+	}
+	int files = addDirs(&w);
+	if(files == -1) {
+		close(w.fd);
+		return -1;
+	}
+	if(opts.silent != true) {
+		int dirs = 0;
+		for(int i = 0; i < w.dirAmt; i++) {
+			dirs += i == 0 || w.dirs[i].wd != w.dirs[i - 1].wd;
+		}
+		printf("mmake: watching %d files in %d directories\n", files, dirs);
+		fflush(stdout);
+	}
+
+	struct pollfd pfd = {w.fd, POLLIN, 0};
+	bool failed = false;
+	while(!w.restart && !failed) {
+		if(poll(&pfd, 1, -1) == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+		// Read the whole burst, so a save that touches a file several times builds once.
+		do {
+			failed = !readEvents(&w);
+		} while(!failed && !w.restart && poll(&pfd, 1, QUIET_MS) > 0);
+		if(failed || w.restart) {
+			break;
+		}
+		if(w.overflow || (w.changedAmt > 0 && changesExist(&w))) {
+			rebuild(&w, opts);
+		}
+	}
+
+	for(int i = 0; i < w.dirAmt; i++) {
+		free(w.dirs[i].prefix);
+	}
+	free(w.dirs);
+	free(w.changed);
+	close(w.fd);
+	return w.restart ? 0 : -1;
+}
+
+/*  Function: addDirs
+*  Input:
+*			struct watch *w		:Watch without directories.
+*
+*  Output: Watches the directory of every file without a rule and of the makefile,
+*		   once per spelling of the directory. A directory that can't be watched is
+*		   warned about and skipped. Returns the amount of files, or -1 if nothing
+*		   could be watched.
+*/
+static int addDirs(struct watch *w) {
+	char **prefixes = malloc((w->g->nodeAmt + 1) * sizeof(char *));
+	if(prefixes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int amount = 0;
+	prefixes[amount++] = prefixOf(w->makefile);
+	for(int i = 0; i < w->g->nodeAmt; i++) {
+		if(w->g->nodes[i]->rule == NULL) {
+			prefixes[amount++] = prefixOf(w->g->nodes[i]->name);
+		}
+	}
+	int files = amount - 1;
+	qsort(prefixes, amount, sizeof(char *), compareStrings);
+	int unique = 0;
+	for(int i = 0; i < amount; i++) {
+		if(unique > 0 && strcmp(prefixes[i], prefixes[unique - 1]) == 0) {
+			free(prefixes[i]);
+		}
+		else {
+			prefixes[unique++] = prefixes[i];
+		}
+	}
+
+	if((w->dirs = malloc(unique * sizeof(struct dir))) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < unique; i++) {
+		addDir(w, prefixes[i]);
+	}
+	free(prefixes);
+	qsort(w->dirs, w->dirAmt, sizeof(struct dir), compareWd);
+	w->nodeAmt = w->g->nodeAmt;
+	return w->dirAmt > 0 ? files : -1;
+}
+
+/*  Function: addDir
+*  Input:
+*			struct watch *w		:Watch with room for one more directory.
+*			char *prefix		:Prefix of the files in the directory, owned by the watch
+*								 from now on.
+*
+*  Output: Watches the directory and appends it, unsorted. A directory that can't be
+*		   watched is warned about and false is returned.
+*/
+static bool addDir(struct watch *w, char *prefix) {
+	// The directory is the prefix without its last slash, "/" for the root.
+	size_t len = strlen(prefix);
+	char dir[len + 2];
+	strcpy(dir, len == 0 ? "." : prefix);
+	if(len > 1) {
+		dir[len - 1] = '\0';
+	}
+	int wd = inotify_add_watch(w->fd, dir, EVENTS);
+	if(wd == -1) {
+		fprintf(stderr, "mmake: %s: can't watch: %s\n", dir, strerror(errno));
+		free(prefix);
+		return false;
+	}
+	w->dirs[w->dirAmt++] = (struct dir){wd, prefix, len};
+	if(len > w->prefixMax) {
+		w->prefixMax = len;
+	}
+	return true;
+}
+
+/*  Function: addNewDirs
+*  Input:
+*			struct watch *w		:Watch after a build.
+*
+*  Output: Watches the directories of the headers that builds added to the graph, the
+*		   ones not watched already under the same spelling.
+*/
+static void addNewDirs(struct watch *w) {
+	bool added = false;
+	for(; w->nodeAmt < w->g->nodeAmt; w->nodeAmt++) {
+		node *n = w->g->nodes[w->nodeAmt];
+		if(n->rule != NULL) {
+			continue;
+		}
+		char *prefix = prefixOf(n->name);
+		bool watched = false;
+		for(int i = 0; i < w->dirAmt && !watched; i++) {
+			watched = strcmp(w->dirs[i].prefix, prefix) == 0;
+		}
+		if(watched) {
+			free(prefix);
+			continue;
+		}
+		if((w->dirs = realloc(w->dirs, (w->dirAmt + 1) * sizeof(struct dir))) == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		added = addDir(w, prefix) || added;
+	}
+	if(added) {
+		qsort(w->dirs, w->dirAmt, sizeof(struct dir), compareWd);
+	}
+}
+
+/*  Function: prefixOf
+*  Input:
+*			const char *path	:Path of a file.
+*
+*  Output: A copy of the path up to and including its last slash, empty for a path
+*		   without one.
+*/
+static char *prefixOf(const char *path) {
+	const char *slash = strrchr(path, '/');
+	char *prefix = strndup(path, slash == NULL ? 0 : (size_t)(slash - path + 1));
+	if(prefix == NULL) {
+		perror("strndup");
+		exit(EXIT_FAILURE);
+	}
+	return prefix;
+}
+
+/*  Function: compareStrings
+*  Input:
+*			const void *a		:Pointer to a string.
+*			const void *b		:Pointer to a string.
+*
+*  Output: qsort comparison of the strings.
+*/
+static int compareStrings(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*  Function: compareWd
+*  Input:
+*			const void *a		:Directory.
+*			const void *b		:Directory.
+*
+*  Output: qsort comparison by watch descriptor.
+*/
+static int compareWd(const void *a, const void *b) {
+	int x = ((const struct dir *)a)->wd;
+	int y = ((const struct dir *)b)->wd;
+	return x < y ? -1 : x > y;
+}
+
+/*  Function: readEvents
+*  Input:
+*			struct watch *w		:Watch.
+*
+*  Output: Handles every queued event. false if the queue can't be read.
+*/
+static bool readEvents(struct watch *w) {
+	char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char path[w->prefixMax + NAME_MAX + 2];
+	ssize_t len;
+	while((len = read(w->fd, buf, sizeof(buf))) > 0) {
+		for(char *p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			handleEvent(w, ev, path);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if(len == -1 && errno != EAGAIN && errno != EINTR) {
+		perror("inotify");
+		return false;
+	}
+	return true;
+}
+
+/*  Function: handleEvent
+*  Input:
+*			struct watch *w		:Watch.
+*			const struct inotify_event *ev	:Event.
+*			char *path			:Room for the longest path of an event.
+*
+*  Output: Finds the node of every spelling of the file's path. A file without a rule
+*		   is invalidated and added to the changed files. Changes to targets, which
+*		   commands make, are ignored.
+*/
+static void handleEvent(struct watch *w, const struct inotify_event *ev, char *path) {
+	if(ev->mask & IN_Q_OVERFLOW) {
+		w->overflow = true;
+		return;
+	}
+	if(ev->len == 0) {
+		return;
+	}
+	// Find the first directory with the descriptor, the spellings follow it.
+	int low = 0;
+	int high = w->dirAmt;
+	while(low < high) {
+		int mid = (low + high) / 2;
+		if(w->dirs[mid].wd < ev->wd) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	for(int i = low; i < w->dirAmt && w->dirs[i].wd == ev->wd; i++) {
+		memcpy(path, w->dirs[i].prefix, w->dirs[i].prefixLen);
+		strcpy(path + w->dirs[i].prefixLen, ev->name);
+		if(strcmp(path, w->makefile) == 0) {
+			w->restart = true;
+			return;
+		}
+		node *n = graph_find(w->g, path);
+		if(n != NULL && n->rule == NULL) {
+			graph_invalidate(n);
+			addChanged(w, n);
+		}
+	}
+}
+
+/*  Function: addChanged
+*  Input:
+*			struct watch *w		:Watch.
+*			node *n				:Changed file.
+*
+*  Output: Adds the file to the changed files. It may already be there.
+*/
+static void addChanged(struct watch *w, node *n) {
+	if(w->changedAmt == w->changedCap) {
+		w->changedCap = w->changedCap == 0 ? 16 : w->changedCap * 2;
+		if((w->changed = realloc(w->changed, w->changedCap * sizeof(node *))) == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	w->changed[w->changedAmt++] = n;
+}
+
+/*  Function: changesExist
+*  Input:
+*			struct watch *w		:Watch with changed files.
+*
+*  Output: true if every changed file exists. A file that was removed can't be built
+*		   from, so the build waits until it comes back.
+*/
+static bool changesExist(struct watch *w) {
+	struct timespec mtime;
+	for(int i = 0; i < w->changedAmt; i++) {
+		if(!graph_mtime(w->changed[i], &mtime)) {
+			fprintf(stderr, "mmake: %s: No such file or directory, waiting for it\n", w->changed[i]->name);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*  Function: rebuild
+*  Input:
+*			struct watch *w		:Watch with changes.
+*			build_options opts	:Build options.
+*
+*  Output: Builds what depends on the changed files, or the whole graph if events were
+*		   lost, and saves the build database and history. Headers the build found in
+*		   depfiles are watched from then on.
+*/
+static int rebuild(struct watch *w, build_options opts) {
+	int status;
+	if(w->overflow) {
+		for(int i = 0; i < w->g->nodeAmt; i++) {
+			if(w->g->nodes[i]->rule == NULL) {
+				graph_invalidate(w->g->nodes[i]);
+			}
+		}
+		status = build_run(w->g, opts);
+	}
+	else {
+		status = build_downstream(w->g, opts, w->changed, w->changedAmt);
+	}
+	w->overflow = false;
+	w->changedAmt = 0;
+	addNewDirs(w);
+	if(opts.db != NULL && db_save(opts.db) == -1) {
+		status = EXIT_FAILURE;
+	}
+	if(opts.history != NULL && history_save(opts.history) == -1) {
+		status = EXIT_FAILURE;
+	}
+	fflush(stdout);
+	return status;
+}
@@ -0,0 +1,30 @@
+/*
+*   Author: Edvin Lindholm (c19elm)
+*
+*   Description: Watch mode of --watch. After the first build the parsed makefile
+*				 and the graph stay in memory, and inotify reports changes to the
+*				 files without rules. Every directory holding one is watched, which
+*				 also catches editors that save by renaming a new file over the old
+*				 one. When a burst of changes has settled, only what depends on the
+*				 changed files is checked and rebuilt.
+*/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "graph.h"
+#include "build.h"
+
+/**
+ * Rebuilds what depends on changed files until the makefile itself changes.
+ * The build database and history in the options are saved after every build.
+ *
+ * @param g			Graph that has been built.
+ * @param opts		Build options.
+ * @param makefile	Path of the makefile.
+ * @return			0 when the makefile has changed and has to be parsed again,
+ *					-1 with an error printed if watching isn't possible.
+ */
+int watch_run(graph *g, build_options opts, const char *makefile);
+
+#endif